@@ -0,0 +1,925 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
+#include "aot.h"
+
+//// Defines
+
+#define AOT_PATH_MAX 4096
+#define AOT_DEF_CC "cc"
+
+// Instructions in one block function before it goes on in the next
+#define AOT_BLOCK_MAX 256
+
+// What the walk marks at an address
+#define AOT_SEEN 1 // An instruction starts here
+#define AOT_LEADER 2 // A block starts here
+#define AOT_CODE 4 // Part of an instruction walked
+
+// Lets the module declare AOT_MACHINE from the same fields
+#define AOT_STRING(x) #x
+#define AOT_EXPAND(x) AOT_STRING(x)
+
+// What translating does with an instruction
+#define AOT_KIND_PLAIN 0 // Runs in the block, which goes on after it
+#define AOT_KIND_JUMP 1
+#define AOT_KIND_CALL 2
+#define AOT_KIND_RET 3
+#define AOT_KIND_HALT 4
+#define AOT_KIND_SLOW 5 // For state_resume, the code goes on after it
+#define AOT_KIND_END 6 // Invalid or past the end, for state_resume, the walk stops here
+
+//// Type declarations
+
+typedef struct _AOT_INSTRUCTION
+{
+    int kind;
+    int size;
+    unsigned char ins;
+    unsigned char fn;
+    unsigned char rA;
+    unsigned char rB;
+    unsigned int val; // Immediate, displacement or destination
+} AOT_INSTRUCTION;
+
+//// Definitions
+
+#ifndef _WIN32
+extern char **environ;
+#endif
+
+// Helpers and exits of every module, after its code range and bytes
+static const char aot_prelude[] =
+    "static inline unsigned int ld(const AOT_MACHINE *m, unsigned int a)\n"
+    "{\n"
+    "    const unsigned char *p = m->memory + a;\n"
+    "    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);\n"
+    "}\n"
+    "\n"
+    "// Stores a word, 1 if it went over translated code\n"
+    "static inline int st(AOT_MACHINE *m, unsigned int a, unsigned int v)\n"
+    "{\n"
+    "    unsigned char *p = m->memory + a;\n"
+    "    p[0] = (unsigned char) v;\n"
+    "    p[1] = (unsigned char) (v >> 8);\n"
+    "    p[2] = (unsigned char) (v >> 16);\n"
+    "    p[3] = (unsigned char) (v >> 24);\n"
+    "    for (unsigned int i = 0; 4 > i; i++)\n"
+    "        if ((CODE_LO <= a + i) && (CODE_HI > a + i) && (0 != aot_in_code[a + i - CODE_LO]))\n"
+    "        {\n"
+    "            m->modified = 1;\n"
+    "            return 1;\n"
+    "        }\n"
+    "    return 0;\n"
+    "}\n"
+    "\n"
+    "// The bytes of a block as translated?\n"
+    "static inline int changed(const AOT_MACHINE *m, unsigned int from, unsigned int to)\n"
+    "{\n"
+    "    return 0 != memcmp(m->memory + from, aot_original + from - CODE_LO, to - from);\n"
+    "}\n"
+    "\n"
+    "// OPl and iOPl as state_word.h has them, b = b op a\n"
+    "static inline int op(AOT_MACHINE *m, int fn, unsigned int a, unsigned int *b)\n"
+    "{\n"
+    "    unsigned int value = *b;\n"
+    "    unsigned int temp = 0;\n"
+    "    long long product = 0;\n"
+    "    int overflow = 0;\n"
+    "    switch (fn)\n"
+    "    {\n"
+    "        case 0: temp = value + a; overflow = (1 == (value >> 31)) && (0 == (temp >> 31)); break;\n"
+    "        case 1: temp = value - a; overflow = (0 == (value >> 31)) && (1 == (temp >> 31)); break;\n"
+    "        case 2: temp = value & a; break;\n"
+    "        case 3: temp = value ^ a; break;\n"
+    "        case 4:\n"
+    "            product = (long long) (int) value * (int) a;\n"
+    "            temp = (unsigned int) product;\n"
+    "            overflow = (-2147483647LL - 1 > product) || (2147483647LL < product);\n"
+    "            break;\n"
+    "        case 5:\n"
+    "        case 6:\n"
+    "            if (0 == a)\n"
+    "                return 0;\n"
+    "            if ((0x80000000u == value) && (0xFFFFFFFFu == a))\n"
+    "            {\n"
+    "                temp = (5 == fn) ? value : 0;\n"
+    "                overflow = (5 == fn);\n"
+    "            }\n"
+    "            else\n"
+    "                temp = (unsigned int) ((5 == fn) ? (int) value / (int) a : (int) value % (int) a);\n"
+    "            break;\n"
+    "        case 7: temp = value << (a & 31); break;\n"
+    "        case 8: temp = (unsigned int) ((int) value >> (a & 31)); break;\n"
+    "        case 9: temp = value >> (a & 31); break;\n"
+    "        case 10: temp = value | a; break;\n"
+    "        default: return 0;\n"
+    "    }\n"
+    "    m->zf = (0 == temp);\n"
+    "    m->sf = (int) (temp >> 31);\n"
+    "    m->of = overflow;\n"
+    "    *b = temp;\n"
+    "    return 1;\n"
+    "}\n"
+    "\n"
+    "// Leaving a block at p after k instructions\n"
+    "#define SLOW(p, k) do { m->pc = (p); m->step += (k); return AOT_SLOW; } while (0)\n"
+    "#define NEXT(p, k) do { m->pc = (p); m->step += (k); return AOT_NEXT; } while (0)\n"
+    "#define HALT(p, k) do { m->pc = (p); m->step += (k); return AOT_HALT; } while (0)\n"
+    "#define TAKEN(p, k) do { m->pc = (int) (p); m->step += (k); \\\n"
+    "                         return (m->check_at <= m->step) ? AOT_CHECK : AOT_NEXT; } while (0)\n";
+
+// Conditions of jXX and cmovXX on the module's flags
+static const char* aot_conditions[] =
+{
+    "1",
+    "(m->zf || (m->sf != m->of))",
+    "(m->sf != m->of)",
+    "m->zf",
+    "!m->zf",
+    "(m->zf || (m->sf == m->of))",
+    "(!m->zf && (m->sf == m->of))",
+};
+
+// FNV-1a, 64 bits, over the code the walk marked and what the module was
+// built for.  Data is never read, it may be a file mapped in and not touched
+unsigned long long aot_hash(const STATE *state, const unsigned char *marks)
+{
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+
+    // Nothing passed?
+    if ((NULL == state) || (NULL == marks))
+        return hash;
+
+    unsigned int tail[4] = { (unsigned int) state->memory_size, (unsigned int) state->pc, AOT_VERSION,
+                             (unsigned int) sizeof(AOT_MACHINE) };
+    for (int i = 0; state->memory_size > i; i++)
+    {
+        hash ^= (0 != (marks[i] & AOT_CODE)) ? state->memory[i] : 0x100;
+        hash *= 0x100000001b3ULL;
+    }
+    for (int i = 0; 4 > i; i++)
+    {
+        hash ^= tail[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// What the instruction at pc is to the translation, invalid ones end the walk
+static void aot_decode(const STATE *state, int pc, AOT_INSTRUCTION *i)
+{
+    memset(i, 0, sizeof(AOT_INSTRUCTION));
+    i->kind = AOT_KIND_END;
+    i->size = 1;
+
+    // Invalid PC address?  The reference has the fault
+    if ((0 > pc) || (state->memory_size - 6 <= pc))
+        return;
+
+    const unsigned char *at = state->memory + pc;
+    i->ins = at[0] >> 4;
+    i->fn = at[0] & 0xF;
+    i->rA = at[1] >> 4;
+    i->rB = at[1] & 0xF;
+    BOOL registers = (REGISTER_COUNT > i->rA) && (REGISTER_COUNT > i->rB);
+    an_bytes_int(at + ((7 == i->ins) || (8 == i->ins) ? 1 : 2), &i->val);
+
+    switch (i->ins)
+    {
+        case 0: // halt
+            if (0 == i->fn)
+                i->kind = AOT_KIND_HALT;
+            break;
+
+        case 1: // nop
+            if (0 == i->fn)
+                i->kind = AOT_KIND_PLAIN;
+            break;
+
+        case 2: // rrmovl or cmovXX
+        case 6: // OPl
+            if ((((2 == i->ins) && (6 >= i->fn)) || ((6 == i->ins) && (OPERATION_COUNT > i->fn))) && registers)
+            {
+                i->kind = AOT_KIND_PLAIN;
+                i->size = 2;
+            }
+            break;
+
+        case 3: // irmovl
+        case 12: // iOPl
+            if ((((3 == i->ins) && (0 == i->fn)) || ((12 == i->ins) && (OPERATION_COUNT > i->fn)))
+                && (REGISTER_NONE == i->rA) && (REGISTER_COUNT > i->rB))
+            {
+                i->kind = AOT_KIND_PLAIN;
+                i->size = 6;
+            }
+            break;
+
+        case 4: // rmmovl
+        case 5: // mrmovl
+            if ((0 == i->fn) && registers)
+            {
+                i->kind = AOT_KIND_PLAIN;
+                i->size = 6;
+            }
+            break;
+
+        case 7: // jXX
+        case 8: // call
+            if ((((7 == i->ins) && (6 >= i->fn)) || ((8 == i->ins) && (0 == i->fn)))
+                && ((unsigned int) (state->memory_size - 6) > i->val))
+            {
+                i->kind = (7 == i->ins) ? AOT_KIND_JUMP : AOT_KIND_CALL;
+                i->size = 5;
+            }
+            break;
+
+        case 9: // ret
+            if (0 == i->fn)
+                i->kind = AOT_KIND_RET;
+            break;
+
+        case 10: // pushl
+        case 11: // popl
+            if ((0 == i->fn) && (REGISTER_COUNT > i->rA) && (REGISTER_NONE == i->rB))
+            {
+                i->kind = AOT_KIND_PLAIN;
+                i->size = 2;
+            }
+            break;
+
+        case 13: // block
+        case 14: // trap, or a breakpoint hiding its instruction's length, the walk goes on at the next byte
+        case 15: // atomic
+            i->kind = AOT_KIND_SLOW;
+            i->size = (13 == i->ins) ? 3 : ((14 == i->ins) ? 1 : 6);
+            break;
+    }
+}
+
+// Marks a block start, 1 if it was not one yet
+static BOOL aot_lead(unsigned char *marks, int size, int pc)
+{
+    if ((0 > pc) || (size <= pc) || (0 != (marks[pc] & AOT_LEADER)))
+        return 0;
+
+    marks[pc] |= AOT_LEADER;
+    return 1;
+}
+
+// Every instruction reachable from the PC, where blocks start and which
+// bytes are code, 0 if out of memory
+static BOOL aot_walk(const STATE *state, unsigned char *marks, const ENGINE_ALLOCATOR *allocator)
+{
+    int size = state->memory_size;
+    int *work = allocator->alloc(allocator->context, (size_t) size * sizeof(int));
+    if (NULL == work)
+        return 0;
+
+    int count = 0;
+    if (0 != aot_lead(marks, size, state->pc))
+        work[count++] = state->pc;
+
+    while (0 < count)
+    {
+        int pc = work[--count];
+        while ((0 <= pc) && (size > pc) && (0 == (marks[pc] & AOT_SEEN)))
+        {
+            AOT_INSTRUCTION i;
+            marks[pc] |= AOT_SEEN;
+            aot_decode(state, pc, &i);
+
+            if (AOT_KIND_PLAIN == i.kind)
+            {
+                pc += i.size;
+                continue;
+            }
+
+            // Jumped to, called or returned to?  Walked from there later
+            if (((AOT_KIND_JUMP == i.kind) || (AOT_KIND_CALL == i.kind)) && (0 != aot_lead(marks, size, (int) i.val)))
+                work[count++] = (int) i.val;
+            if ((AOT_KIND_CALL == i.kind) || (AOT_KIND_SLOW == i.kind) || ((AOT_KIND_JUMP == i.kind) && (0 != i.fn)))
+                if (0 != aot_lead(marks, size, pc + i.size))
+                    work[count++] = pc + i.size;
+            break;
+        }
+    }
+    allocator->free(allocator->context, work);
+
+    for (int pc = 0; size > pc; pc++)
+        if (0 != (marks[pc] & AOT_SEEN))
+        {
+            AOT_INSTRUCTION i;
+            aot_decode(state, pc, &i);
+            for (int j = 0; (i.size > j) && (size > pc + j); j++)
+                marks[pc + j] |= AOT_CODE;
+        }
+    return 1;
+}
+
+// Writes the block function at start, returns the address it ends at.  A
+// block too long to be one function goes on in another, marked here
+static int aot_block(const STATE *state, FILE *out, unsigned char *marks, int start)
+{
+    static const char* names[] = INSTRUCTION_NAME_ARRAY;
+
+    fprintf(out, "\nstatic int b_%x(AOT_MACHINE *m)\n{\n", start);
+    fprintf(out, "    unsigned int *R = m->reg;\n    unsigned int a;\n    unsigned int e;\n\n");
+    fprintf(out, "    (void) R;\n    (void) a;\n    (void) e;\n");
+
+    int pos = start;
+    for (int k = 0; ; k++)
+    {
+        // Into the next block?
+        if ((start != pos) && ((0 != (marks[pos] & AOT_LEADER)) || (AOT_BLOCK_MAX <= k)))
+        {
+            marks[pos] |= AOT_LEADER;
+            fprintf(out, "    NEXT(0x%x, %d);\n}\n", pos, k);
+            return pos;
+        }
+
+        AOT_INSTRUCTION i;
+        aot_decode(state, pos, &i);
+        int next = pos + i.size;
+        fprintf(out, "    // 0x%x %s\n", pos, (AOT_KIND_END == i.kind) ? "(for the reference)" : names[i.ins]);
+
+        switch (i.kind)
+        {
+            case AOT_KIND_PLAIN:
+                switch (i.ins)
+                {
+                    case 2: // rrmovl or cmovXX
+                        if (0 == i.fn)
+                            fprintf(out, "    R[%d] = R[%d];\n", i.rB, i.rA);
+                        else
+                            fprintf(out, "    if (%s)\n        R[%d] = R[%d];\n", aot_conditions[i.fn], i.rB, i.rA);
+                        break;
+
+                    case 3: // irmovl
+                        fprintf(out, "    R[%d] = 0x%xu;\n", i.rB, i.val);
+                        break;
+
+                    case 4: // rmmovl, devices are past the end of memory
+                        fprintf(out, "    a = R[%d] + 0x%xu;\n", i.rB, i.val);
+                        fprintf(out, "    if (m->memory_size - 4 <= a)\n        SLOW(0x%x, %d);\n", pos, k);
+                        fprintf(out, "    if (0 != st(m, a, R[%d]))\n        NEXT(0x%x, %d);\n", i.rA, next, k + 1);
+                        break;
+
+                    case 5: // mrmovl
+                        fprintf(out, "    a = R[%d] + 0x%xu;\n", i.rB, i.val);
+                        fprintf(out, "    if (m->memory_size - 4 <= a)\n        SLOW(0x%x, %d);\n", pos, k);
+                        fprintf(out, "    R[%d] = ld(m, a);\n", i.rA);
+                        break;
+
+                    case 6: // OPl
+                    case 12: // iOPl
+                        if (6 == i.ins)
+                            fprintf(out, "    e = R[%d];\n", i.rA);
+                        else
+                            fprintf(out, "    e = 0x%xu;\n", i.val);
+                        if ((5 == i.fn) || (6 == i.fn))
+                            fprintf(out, "    if (0 == op(m, %d, e, R + %d))\n        SLOW(0x%x, %d);\n", i.fn, i.rB,
+                                    pos, k);
+                        else
+                            fprintf(out, "    op(m, %d, e, R + %d);\n", i.fn, i.rB);
+                        break;
+
+                    case 10: // pushl, of esp as it was
+                        fprintf(out, "    a = R[4];\n");
+                        fprintf(out, "    if ((4 > (int) a) || ((int) m->memory_size <= (int) a))\n"
+                                     "        SLOW(0x%x, %d);\n", pos, k);
+                        fprintf(out, "    e = R[%d];\n    R[4] = a - 4;\n", i.rA);
+                        fprintf(out, "    if (0 != st(m, a - 4, e))\n        NEXT(0x%x, %d);\n", next, k + 1);
+                        break;
+
+                    case 11: // popl, into esp too, which then moves on
+                        fprintf(out, "    a = R[4];\n");
+                        fprintf(out, "    if ((0 > (int) a) || ((int) m->memory_size - 4 <= (int) a))\n"
+                                     "        SLOW(0x%x, %d);\n", pos, k);
+                        fprintf(out, "    R[%d] = ld(m, a);\n    R[4] += 4;\n", i.rA);
+                        break;
+                }
+                break;
+
+            case AOT_KIND_JUMP:
+                if (0 == i.fn)
+                {
+                    fprintf(out, "    TAKEN(0x%x, %d);\n}\n", i.val, k + 1);
+                    return next;
+                }
+                fprintf(out, "    if (%s)\n        TAKEN(0x%x, %d);\n", aot_conditions[i.fn], i.val, k + 1);
+                break;
+
+            case AOT_KIND_CALL:
+                fprintf(out, "    a = R[4];\n");
+                fprintf(out, "    if ((4 > (int) a) || ((int) m->memory_size <= (int) a))\n        SLOW(0x%x, %d);\n",
+                        pos, k);
+                fprintf(out, "    R[4] = a - 4;\n    st(m, a - 4, 0x%xu);\n", next);
+                fprintf(out, "    TAKEN(0x%x, %d);\n}\n", i.val, k + 1);
+                return next;
+
+            case AOT_KIND_RET:
+                fprintf(out, "    a = R[4];\n");
+                fprintf(out, "    if ((0 > (int) a) || ((int) m->memory_size - 4 <= (int) a))\n        SLOW(0x%x, %d);\n",
+                        pos, k);
+                fprintf(out, "    e = ld(m, a);\n");
+                fprintf(out, "    if (m->memory_size - 6 <= e)\n        SLOW(0x%x, %d);\n", pos, k);
+                fprintf(out, "    R[4] = a + 4;\n    TAKEN(e, %d);\n}\n", k + 1);
+                return next;
+
+            case AOT_KIND_HALT:
+                fprintf(out, "    HALT(0x%x, %d);\n}\n", pos, k + 1);
+                return next;
+
+            default:
+                fprintf(out, "    SLOW(0x%x, %d);\n}\n", pos, k);
+                return next;
+        }
+
+        pos = next;
+    }
+}
+
+// Writes the module for the image as C, returns the number of blocks or -1
+int aot_translate(const STATE *state, FILE *out, const ENGINE_ALLOCATOR *allocator)
+{
+    // Nothing passed?
+    if ((NULL == state) || (NULL == out) || (NULL == allocator) || (0 >= state->memory_size))
+        return -1;
+
+    int size = state->memory_size;
+    unsigned char *marks = allocator->alloc(allocator->context, (size_t) size);
+    int *ends = allocator->alloc(allocator->context, (size_t) size * sizeof(int));
+    if ((NULL != marks) && (NULL != ends))
+    {
+        memset(marks, 0, (size_t) size);
+        memset(ends, 0, (size_t) size * sizeof(int));
+    }
+    if ((NULL == marks) || (NULL == ends) || (0 == aot_walk(state, marks, allocator)))
+    {
+        if (NULL != marks)
+            allocator->free(allocator->context, marks);
+        if (NULL != ends)
+            allocator->free(allocator->context, ends);
+        return -1;
+    }
+
+    // Code range of the module, the bytes in it are kept to check against
+    int lo = size;
+    int hi = 0;
+    for (int pc = 0; size > pc; pc++)
+        if (0 != (marks[pc] & AOT_CODE))
+        {
+            lo = (lo > pc) ? pc : lo;
+            hi = pc + 1;
+        }
+    if (lo >= hi)
+        lo = hi = 0;
+
+    fprintf(out, "// Y86-32 image %016llx from 0x%x, translated by aot.c\n\n", aot_hash(state, marks), state->pc);
+    fprintf(out, "#include <string.h>\n\n");
+    fprintf(out, "typedef struct _AOT_MACHINE\n{\n    %s\n} AOT_MACHINE;\n\n", AOT_EXPAND(AOT_MACHINE_FIELDS));
+    fprintf(out, "#define AOT_NEXT %d\n#define AOT_SLOW %d\n#define AOT_CHECK %d\n#define AOT_HALT %d\n", AOT_NEXT,
+            AOT_SLOW, AOT_CHECK, AOT_HALT);
+    fprintf(out, "#define CODE_LO %du\n#define CODE_HI %du\n\n", lo, hi);
+
+    // The code as translated, and which bytes of the range are code, exported
+    // so a cached module is checked against the image before it is used
+    fprintf(out, "const unsigned int aot_code_range[2] = { CODE_LO, CODE_HI };\n\n");
+    fprintf(out, "const unsigned char aot_original[%d] =\n{", (hi > lo) ? hi - lo : 1);
+    for (int pc = lo; hi > pc; pc++)
+        fprintf(out, "%s%d,", (0 == (pc - lo) % 16) ? "\n    " : " ",
+                (0 != (marks[pc] & AOT_CODE)) ? state->memory[pc] : 0);
+    fprintf(out, "%s};\n\n", (hi > lo) ? "\n" : " 0 ");
+    fprintf(out, "const unsigned char aot_in_code[%d] =\n{", (hi > lo) ? hi - lo : 1);
+    for (int pc = lo; hi > pc; pc++)
+        fprintf(out, "%s%d,", (0 == (pc - lo) % 16) ? "\n    " : " ", (0 != (marks[pc] & AOT_CODE)) ? 1 : 0);
+    fprintf(out, "%s};\n\n%s", (hi > lo) ? "\n" : " 0 ", aot_prelude);
+
+    // Blocks found going long are emitted further on, they start higher
+    int blocks = 0;
+    for (int pc = 0; size > pc; pc++)
+        if (0 != (marks[pc] & AOT_LEADER))
+        {
+            ends[pc] = aot_block(state, out, marks, pc);
+            blocks++;
+        }
+
+    // Back here until a block needs the engine, checking the bytes once
+    // anything may have stored over them
+    fprintf(out, "\nint aot_abi(void)\n{\n    return %d;\n}\n", (AOT_VERSION << 16) | (int) sizeof(AOT_MACHINE));
+    fprintf(out, "\nint aot_run(AOT_MACHINE *m)\n{\n    int exit = AOT_NEXT;\n    while (AOT_NEXT == exit)\n    {\n");
+    fprintf(out, "        switch (m->pc)\n        {\n");
+    for (int pc = 0; size > pc; pc++)
+        if (0 != (marks[pc] & AOT_LEADER))
+            fprintf(out, "            case 0x%x: exit = (m->modified && changed(m, 0x%x, 0x%x)) ? AOT_SLOW : b_%x(m); "
+                         "break;\n", pc, pc, (size < ends[pc]) ? size : ends[pc], pc);
+    fprintf(out, "            default: return AOT_SLOW;\n        }\n    }\n    return exit;\n}\n");
+
+    allocator->free(allocator->context, marks);
+    allocator->free(allocator->context, ends);
+    return ferror(out) ? -1 : blocks;
+}
+
+#ifndef _WIN32
+
+// Makes every directory on the way, 0 if one cannot be
+static BOOL aot_directory(char *path)
+{
+    // Nothing passed?
+    if ('\0' == path[0])
+        return 0;
+
+    for (char *at = path + 1; ; at++)
+    {
+        if (('/' != *at) && ('\0' != *at))
+            continue;
+
+        char end = *at;
+        *at = '\0';
+        BOOL made = (0 == mkdir(path, 0700)) || (EEXIST == errno);
+        *at = end;
+        if (0 == made)
+            return 0;
+        if ('\0' == end)
+            return 1;
+    }
+}
+
+// Is dir a real directory of this user that nobody else can write to?
+// Modules are loaded from it, and loading one runs its code
+static BOOL aot_private(const char *dir)
+{
+    struct stat info;
+    return (0 == lstat(dir, &info)) && S_ISDIR(info.st_mode) && (getuid() == info.st_uid)
+           && (0 == (info.st_mode & (S_IRWXG | S_IRWXO)));
+}
+
+// Cached module of an image, 0 if there is nowhere safe to keep it.  The
+// directories are only made when make is set
+static BOOL aot_cache_path(unsigned long long hash, char *path, size_t size, BOOL make)
+{
+    char dir[AOT_PATH_MAX];
+    const char *env = getenv(AOT_CACHE_ENV);
+    const char *home = getenv("HOME");
+    int written;
+    if ((NULL != env) && ('\0' != env[0]))
+        written = snprintf(dir, sizeof(dir), "%s", env);
+    else if ((NULL != home) && ('\0' != home[0]))
+        written = snprintf(dir, sizeof(dir), "%s/%s", home, AOT_DEF_CACHE);
+    else
+        written = snprintf(dir, sizeof(dir), "/tmp/y86-aot-%ld", (long) getuid());
+    if ((0 > written) || (sizeof(dir) <= (size_t) written) || ((0 != make) && (0 == aot_directory(dir)))
+        || (0 == aot_private(dir)))
+        return 0;
+
+    written = snprintf(path, size, "%s/y86-%016llx.so", dir, hash);
+    return (0 <= written) && (size > (size_t) written);
+}
+
+// Writes and compiles the module, renamed into place so others never load
+// half of one
+static BOOL aot_build(const AOT *aot, const STATE *state, const char *path)
+{
+    char source[AOT_PATH_MAX + 64];
+    char temp[AOT_PATH_MAX + 64];
+    snprintf(source, sizeof(source), "%s.%ld.%p.c", path, (long) getpid(), (const void*) aot);
+    snprintf(temp, sizeof(temp), "%s.%ld.%p.tmp", path, (long) getpid(), (const void*) aot);
+
+    FILE *out = fopen(source, "w");
+    if (NULL == out)
+        return 0;
+    int blocks = aot_translate(state, out, &aot->allocator);
+    if ((0 != fclose(out)) || (0 > blocks))
+    {
+        unlink(source);
+        return 0;
+    }
+
+    const char *cc = getenv("CC");
+    if ((NULL == cc) || ('\0' == cc[0]))
+        cc = AOT_DEF_CC;
+    char *argv[] = { (char*) cc, "-O2", "-shared", "-fPIC", "-o", temp, source, NULL };
+    pid_t pid;
+    int status = 0;
+    BOOL built = (0 == posix_spawnp(&pid, cc, NULL, NULL, argv, environ)) && (pid == waitpid(pid, &status, 0))
+                 && WIFEXITED(status) && (0 == WEXITSTATUS(status)) && (0 == rename(temp, path));
+    unlink(source);
+    if (0 == built)
+        unlink(temp);
+    return built;
+}
+
+// Was the module translated from the code bytes in aot->image?  The hash in
+// its name is only 64 bits
+static BOOL aot_matches(const AOT *aot, void *module)
+{
+    const unsigned int *range = dlsym(module, "aot_code_range");
+    const unsigned char *original = dlsym(module, "aot_original");
+    const unsigned char *in_code = dlsym(module, "aot_in_code");
+    if ((NULL == range) || (NULL == original) || (NULL == in_code) || (range[0] > range[1])
+        || ((unsigned int) aot->memory_size < range[1]))
+        return 0;
+
+    for (int i = 0; aot->memory_size > i; i++)
+    {
+        BOOL code = (0 != (aot->marks[i] & AOT_CODE));
+        BOOL translated = (range[0] <= (unsigned int) i) && (range[1] > (unsigned int) i) && (0 != in_code[i - range[0]]);
+        if ((code != translated) || ((0 != code) && (aot->image[i] != original[i - range[0]])))
+            return 0;
+    }
+    return 1;
+}
+
+// Loads a module built for this version from the same code, 0 if there is
+// none
+static BOOL aot_load(AOT *aot, const char *path)
+{
+    void *module = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (NULL == module)
+        return 0;
+
+    int (*abi)(void) = (int (*)(void)) dlsym(module, "aot_abi");
+    AOT_RUN run = (AOT_RUN) dlsym(module, "aot_run");
+    if ((NULL == abi) || (NULL == run) || (((AOT_VERSION << 16) | (int) sizeof(AOT_MACHINE)) != abi())
+        || (0 == aot_matches(aot, module)))
+    {
+        dlclose(module);
+        return 0;
+    }
+
+    aot->module = module;
+    aot->run = run;
+    return 1;
+}
+
+#endif
+
+// Module for memory as it is now, from the cache or built if allowed.
+// Without one every run goes to state_resume
+static BOOL aot_prepare(AOT *aot, const STATE *state)
+{
+#ifndef _WIN32
+    if (NULL != aot->module)
+        dlclose(aot->module);
+#endif
+    aot->module = NULL;
+    aot->run = NULL;
+    aot->modified = 0;
+    aot->flushed = 0;
+
+    memset(aot->marks, 0, (size_t) aot->memory_size);
+    if (0 == aot_walk(state, aot->marks, &aot->allocator))
+        return 0;
+    for (int i = 0; aot->memory_size > i; i++)
+        if (0 != (aot->marks[i] & AOT_CODE))
+            aot->image[i] = state->memory[i];
+
+#ifdef _WIN32
+    return 0;
+#else
+    char path[AOT_PATH_MAX];
+    aot->hash = aot_hash(state, aot->marks);
+    BOOL placed = aot_cache_path(aot->hash, path, sizeof(path), aot->compile);
+    BOOL cached = (0 != placed) && (0 != aot_load(aot, path));
+
+    // Not cached and not to be built?  Tried again once memory changes
+    if ((0 != cached) || (0 == aot->compile))
+        return 1;
+
+    if ((0 == placed) || (0 == aot_build(aot, state, path)) || (0 == aot_load(aot, path)))
+    {
+        aot->failed = 1;
+        return 0;
+    }
+    return 1;
+#endif
+}
+
+// Memory changed outside a run.  The module stays if the code it was
+// translated from is as it was, else memory is translated again
+static void aot_refresh(AOT *aot, const STATE *state)
+{
+    aot->flushed = 0;
+
+    // Nothing it could translate?
+    if ((0 != aot->failed) || (aot->memory_size != state->memory_size) || (WORD_SIZE_64 == state->word_size)
+        || (7 > state->memory_size))
+        return;
+
+    if (NULL != aot->module)
+    {
+        BOOL same = 1;
+        for (int i = 0; (0 != same) && (aot->memory_size > i); i++)
+            same = (0 == (aot->marks[i] & AOT_CODE)) || (aot->image[i] == state->memory[i]);
+        if (0 != same)
+        {
+            aot->modified = 0;
+            return;
+        }
+    }
+
+    aot_prepare(aot, state);
+}
+
+BOOL aot_open(void **context, const STATE *state, const ENGINE_OPTIONS *options)
+{
+    // Nothing passed?
+    if ((NULL == context) || (NULL == state) || (NULL == options))
+        return 0;
+
+    const ENGINE_ALLOCATOR *allocator = &options->allocator;
+    AOT *aot = allocator->alloc(allocator->context, sizeof(AOT));
+    if (NULL == aot)
+        return 0;
+    memset(aot, 0, sizeof(AOT));
+    aot->allocator = *allocator;
+    aot->compile = options->compile;
+    aot->memory_size = state->memory_size;
+    if (0 < aot->memory_size)
+    {
+        aot->image = allocator->alloc(allocator->context, (size_t) aot->memory_size);
+        aot->marks = allocator->alloc(allocator->context, (size_t) aot->memory_size);
+        if ((NULL == aot->image) || (NULL == aot->marks))
+        {
+            aot_close(aot);
+            return 0;
+        }
+    }
+
+    // Nothing to translate yet?  Runs go to the reference until there is
+    if ((WORD_SIZE_64 == state->word_size) || (7 > state->memory_size))
+    {
+        *context = aot;
+        return 1;
+    }
+
+    if (0 == aot_prepare(aot, state))
+    {
+        aot_close(aot);
+        return 0;
+    }
+
+    *context = aot;
+    return 1;
+}
+
+void aot_close(void *context)
+{
+    AOT *aot = context;
+
+    // Nothing passed?
+    if (NULL == aot)
+        return;
+
+#ifndef _WIN32
+    if (NULL != aot->module)
+        dlclose(aot->module);
+#endif
+    ENGINE_ALLOCATOR allocator = aot->allocator;
+    if (NULL != aot->image)
+        allocator.free(allocator.context, aot->image);
+    if (NULL != aot->marks)
+        allocator.free(allocator.context, aot->marks);
+    allocator.free(allocator.context, aot);
+}
+
+void aot_flush(void *context)
+{
+    AOT *aot = context;
+
+    // Nothing passed?
+    if (NULL == aot)
+        return;
+
+    aot->flushed = 1;
+}
+
+// Would the instruction at the PC end a block on the reference?
+static BOOL aot_ends_block(const STATE *state)
+{
+    int pc = state->pc;
+    if ((0 > pc) || (state->memory_size <= pc))
+        return 0;
+
+    const CONDITION_CODES *codes = &state->codes;
+    unsigned char insfn = state->memory[pc];
+    switch (insfn >> 4)
+    {
+        case 7: // jXX, when taken
+            switch (insfn & 0xF)
+            {
+                case 0: return 1;
+                case 1: return codes->ZF || (codes->SF != codes->OF);
+                case 2: return codes->SF != codes->OF;
+                case 3: return codes->ZF;
+                case 4: return !codes->ZF;
+                case 5: return codes->ZF || (codes->SF == codes->OF);
+                case 6: return !codes->ZF && (codes->SF == codes->OF);
+            }
+            return 0;
+
+        case 8: // call
+        case 9: // ret
+            return 1;
+    }
+    return 0;
+}
+
+PROGRAM_STATUS aot_resume(void *context, STATE *state, const BUDGET *budget, PROBES *probes)
+{
+    AOT *aot = context;
+
+    // Nothing passed?
+    if ((NULL == aot) || (NULL == state))
+        return INS;
+
+    if (0 != aot->flushed)
+        aot_refresh(aot, state);
+
+    // Not covered by the module?  The reference may store anywhere
+    if ((NULL == aot->module) || (WORD_SIZE_64 == state->word_size) || (aot->memory_size != state->memory_size)
+        || (NULL != state->hle) || ((NULL != probes) && (0 < probes->count)) || ((NULL != budget) && (0 != budget->exact)))
+    {
+        PROGRAM_STATUS status = state_resume(state, budget, probes);
+        aot->modified = 1;
+        aot->flushed = 1;
+        return status;
+    }
+
+    // Stopped for good?
+    if (LIM == state->status)
+        state->status = AOK;
+    if (AOK != state->status)
+        return state->status;
+
+    LIMIT limit;
+    limit_start(&limit, state, budget);
+
+    AOT_MACHINE machine;
+    machine.memory = state->memory;
+    machine.memory_size = (unsigned int) state->memory_size;
+    while (AOK == state->status)
+    {
+        for (int i = 0; REGISTER_COUNT > i; i++)
+            machine.reg[i] = (unsigned int) state->registers.ids[i];
+        machine.zf = state->codes.ZF;
+        machine.sf = state->codes.SF;
+        machine.of = state->codes.OF;
+        machine.pc = state->pc;
+        machine.modified = aot->modified;
+        machine.step = state->step;
+        machine.check_at = limit.check_at;
+
+        int exit = aot->run(&machine);
+
+        for (int i = 0; REGISTER_COUNT > i; i++)
+            state->registers.ids[i] = (REGISTER_ID) machine.reg[i];
+        state->codes.ZF = (BOOL) machine.zf;
+        state->codes.SF = (BOOL) machine.sf;
+        state->codes.OF = (BOOL) machine.of;
+        state->pc = machine.pc;
+        state->step = machine.step;
+        aot->modified = (BOOL) machine.modified;
+
+        if (AOT_HALT == exit)
+            state->status = HLT;
+        else if (AOT_CHECK == exit)
+        {
+            if (0 != limit_reached(&limit, state))
+                state->status = LIM;
+        }
+        else if (AOT_SLOW == exit)
+        {
+            // Outside the module, or changed, a store may go over translated code
+            int pc = state->pc;
+            int ins = ((0 <= pc) && (state->memory_size > pc)) ? state->memory[pc] >> 4 : 0;
+            BOOL stores = (4 == ins) || (8 == ins) || (10 == ins) || (13 <= ins);
+            BOOL ends = aot_ends_block(state);
+
+            // One instruction on the reference, it knows every fault and device
+            BUDGET one = { 1, 0, 1 };
+            state_resume(state, &one, NULL);
+            if (LIM == state->status)
+                state->status = AOK;
+            if (0 != stores)
+                aot->modified = 1;
+            aot->slow++;
+
+            if ((AOK == state->status) && (0 != ends) && (limit.check_at <= state->step)
+                && (0 != limit_reached(&limit, state)))
+                state->status = LIM;
+        }
+    }
+
+    return state->status;
+}
@@ -0,0 +1,87 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdio.h>
+
+#include "engine.h"
+
+// The "aot" backend.  Opening it walks the loaded Y86-32 image from the PC,
+// finds the code reachable from there, and writes it out as C with one
+// function per basic block.  The system compiler ($CC, or cc) builds that
+// into a shared object, which is kept in a cache by the hash of the image
+// (Y86_AOT_CACHE, or ~/.cache/y86-aot, only if private to the user) and
+// loaded with dlopen.  Running the
+// same image again just loads it.  The compiler only runs, and the cache is
+// only written, when the engine is opened with compile set; otherwise an
+// image with no module cached runs on state_resume.
+//
+// Faults, devices, block, trap and atomic instructions, and any PC the walk
+// did not reach, run on state_resume one instruction at a time.  Once
+// anything stores into translated code, every block checks its bytes
+// against the image before it runs and goes to state_resume if they
+// changed.  When memory is changed outside a run, as loading another image
+// does, the next run translates it again unless the code is as it was.
+// Probed, exact, Y86-64 and high level emulated runs go to state_resume
+// whole.
+
+//// Defines
+
+#define AOT_CACHE_ENV "Y86_AOT_CACHE"
+#define AOT_DEF_CACHE ".cache/y86-aot" // Under $HOME
+#define AOT_VERSION 2
+
+// Why the translated code returned
+#define AOT_NEXT 0 // Keep going, only inside the module
+#define AOT_SLOW 1 // The instruction at pc is for state_resume
+#define AOT_CHECK 2 // A block ended past check_at
+#define AOT_HALT 3
+
+// The machine as the translated code sees it.  The fields are kept in a
+// macro so the module is written with the very same declaration
+#define AOT_MACHINE_FIELDS \
+    unsigned int reg[8]; \
+    int zf; \
+    int sf; \
+    int of; \
+    int pc; \
+    int modified; \
+    unsigned long long step; \
+    unsigned long long check_at; \
+    unsigned char *memory; \
+    unsigned int memory_size;
+
+//// Type declarations
+
+typedef struct _AOT_MACHINE
+{
+    AOT_MACHINE_FIELDS
+} AOT_MACHINE;
+
+typedef int (*AOT_RUN)(AOT_MACHINE *machine);
+
+typedef struct _AOT
+{
+    ENGINE_ALLOCATOR allocator; // Of the context and scratch memory
+    BOOL compile; // May build modules, else only loads cached ones
+    void *module; // From dlopen, NULL to run everything on state_resume
+    AOT_RUN run;
+    int memory_size;
+    unsigned char *image; // Code as it was translated, data is not kept
+    unsigned char *marks; // What the walk found at each address of it
+    BOOL modified; // Translated code may have been stored over
+    BOOL flushed; // Memory changed outside a run, checked before the next
+    BOOL failed; // Building failed, not tried again
+    unsigned long long hash; // Of the image it was translated from
+    unsigned long long slow; // Instructions run by state_resume
+} AOT;
+
+//// Forward declarations
+
+unsigned long long aot_hash(const STATE *state, const unsigned char *marks);
+int aot_translate(const STATE *state, FILE *out, const ENGINE_ALLOCATOR *allocator);
+BOOL aot_open(void **context, const STATE *state, const ENGINE_OPTIONS *options);
+void aot_close(void *context);
+PROGRAM_STATUS aot_resume(void *context, STATE *state, const BUDGET *budget, PROBES *probes);
+void aot_flush(void *context);
+
+#endif
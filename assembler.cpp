@@ -0,0 +1,601 @@
+#include "assembler.hpp"
+#include "optimizer.hpp"
+
+// Register numbers as encoded in instructions
+const char* REGISTER_CODES[REGISTER_COUNT] = REGISTER_NAME_ARRAY;
+// From AOK on
+const char* STATUS_NAMES[STATUS_COUNT] = STATUS_NAME_ARRAY;
+// OPl and iOPl mnemonics by function code
+const char* OPERATION_NAMES[OPERATION_COUNT] = OPERATION_NAME_ARRAY;
+// jXX and rrmovl / cmovXX mnemonics by function code
+const char* JUMP_NAMES[CONDITION_COUNT] = { "jmp", "jle", "jl", "je", "jne",
+                                            "jge", "jg" };
+const char* MOVE_NAMES[CONDITION_COUNT] = { "rrmovl", "cmovle", "cmovl",
+                                            "cmove", "cmovne", "cmovge",
+                                            "cmovg" };
+
+// Two hex digits for every byte value
+static const char HEX_PAIRS[] =
+  "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+  "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+  "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+  "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+  "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+  "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+  "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+  "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+// Bytes of value lowest first, from the table so the stream state is untouched
+static char* hex_bytes(char* out, int value, int count, bool prefix) {
+  if (prefix) {
+    *out++ = '0';
+    *out++ = 'x';
+  }
+  for (int i = 0; i < count; i++) {
+    const char* pair = HEX_PAIRS + 2 * ((value >> (i << 3)) & 0xFF);
+    *out++ = pair[0];
+    *out++ = pair[1];
+  }
+  return out;
+}
+
+std::ostream& operator<<(std::ostream& os, const to_hex o) {
+  char text[2 + 2 * sizeof(int)];
+  int count = std::min(std::max(o.count, 0), (int) sizeof(int));
+  os.write(text, hex_bytes(text, o.value, count, o.prefix) - text);
+  return os;
+}
+
+void Result::set(std::string _problem, std::string _value) {
+  this->problem.assign(_problem);
+  this->value.assign(_value);
+}
+
+template <typename T> void Result::set(std::string _problem, T _value) {
+  this->set(_problem, std::to_string(_value));
+}
+
+void Result::warn() {
+  std::cout << "Warning: ";
+  this->info();
+}
+
+void Result::error() {
+  std::cout << "Error: ";
+  this->info();
+}
+
+void Result::info() {
+  std::cout << "Line " << this->line << ": " << this->problem << " ("
+            << this->value << ")" << std::endl;
+}
+
+State::State(int memory_size) {
+  memset(&this->machine, 0, sizeof(this->machine));
+  state_init(&this->machine);
+  if (!state_allocate(&this->machine, memory_size))
+    throw std::bad_alloc();
+  this->memory = this->machine.memory;
+  memset(&this->started, 0, sizeof(this->started));
+  state_init(&this->started);
+}
+
+State::~State() {
+  state_free(&this->machine);
+  state_free(&this->started);
+}
+
+void State::print() {
+  std::cout << "Registers:" << std::endl;
+  for (int i = 0; i < REGISTER_COUNT / 4; i++) {
+    for (int j = i * 4; j < (i + 1) * 4 && j < REGISTER_COUNT; j++)
+      std::cout << "  " << REGISTER_CODES[j] << ": "
+                << to_hex(this->machine.registers.ids[j]);
+    std::cout << std::endl;
+  }
+  
+  std::cout << "Condition Codes:" << std::endl
+            << "  ZF:  " << std::setw(10) << bool_str(this->machine.codes.ZF)
+            << "  SF:  " << std::setw(10) << bool_str(this->machine.codes.SF)
+            << "  OF:  " << std::setw(10) << bool_str(this->machine.codes.OF)
+            << std::endl;
+
+  std::cout << "Program Counter:" << std::endl
+            << "  PC:  " << to_hex(this->machine.pc)
+            << "  Mem:";
+  for (int i = 0; i < 6; i++) {
+    int index = this->machine.pc + i;
+    bool valid = index >= 0 && index < this->machine.memory_size;
+    std::cout << " " << to_hex(valid ? this->memory[index] : 0, 1, false);
+  }
+  std::cout << std::endl;
+
+  std::cout << "Program Status:" << std::endl;
+  {
+    int status = this->machine.status;
+    bool invalid = status < _FIRST || status > _LAST;
+    std::cout << "  STR: " << std::setw(10)
+              << (invalid ? "???" : STATUS_NAMES[status - _FIRST])
+              << "  VAL: " << std::setw(10) << status
+              << "  Steps: " << this->machine.step
+              << std::endl;
+  }
+}
+
+PROGRAM_STATUS State::run(const char* backend, const BUDGET* budget) {
+  // Compiling backends may run the compiler for an image run from here
+  ENGINE engine;
+  ENGINE_OPTIONS options = { { NULL, NULL, NULL }, 1 };
+  if (!engine_open(&engine, backend, &this->machine, &options))
+    throw std::invalid_argument(backend ? backend : ENGINE_DEF_BACKEND);
+
+  state_restart(&this->machine);
+  state_free(&this->started);
+  state_init(&this->started);
+  if (!state_clone(&this->machine, &this->started))
+    throw std::bad_alloc();
+
+  PROGRAM_STATUS status = engine_resume(&engine, &this->machine, budget, NULL);
+  engine_close(&engine);
+  return status;
+}
+
+void State::print_changes() {
+  // Written straight to the descriptor, after what is buffered here
+  std::cout.flush();
+  state_changes(&this->started, &this->machine);
+}
+
+void State::print_memory(int lines) {
+  // Whole lines of 32 bytes only, written at once
+  lines = std::max(0, std::min(lines, this->machine.memory_size / 32));
+  std::string text("Memory\n");
+  text.resize(text.size() + lines * (8 * 10 + 1));
+  char* out = &text[7];
+  for (int i = 0; i < lines; i++) {
+    for (int j = 0; j < 8; j++) {
+      *out++ = ' ';
+      *out++ = ' ';
+      for (int k = 0; k < 4; k++)
+        out = hex_bytes(out, this->memory[i * 32 + j * 4 + k], 1, false);
+    }
+    *out++ = '\n';
+  }
+  std::cout.write(text.data(), text.size());
+}
+
+Result State::compile(std::vector<std::string> source, bool as_errors,
+                      bool optimize) {
+  Result result;
+  result.was_error = true;
+
+  // Rewrite the source before anything is encoded
+  this->optimizations.clear();
+  std::vector<int> origin;
+  if (optimize) {
+    for (size_t i = 0; i < source.size(); i++)
+      origin.push_back(i);
+    inline_functions(source, origin, this->optimizations);
+    peephole(source, origin, this->optimizations);
+  }
+
+  int pos = 0;
+  std::map<std::string, int> labels;
+  std::string last_label("");
+  std::map<int, std::pair<int, std::string> > put_labels;
+
+  // Operand of irmovl, jXX and call written at `at`: $value or a number, or
+  // a label, filled in once every line is read
+  auto put_address = [&](std::string text, int& at) {
+    size_t first = text.find_first_not_of(" \t");
+    text = first == std::string::npos
+           ? "" : text.substr(first, text.find_last_not_of(" \t") - first + 1);
+    if (!text.empty() && text.at(0) == '$')
+      text.erase(0, 1);
+
+    unsigned int value = 0;
+    if (!text.empty() && (isdigit(text.at(0)) || text.at(0) == '-'
+                          || text.at(0) == '+')) {
+      try {
+        size_t end = 0;
+        long long number = std::stoll(text, &end, 0);
+        if (end != text.size()
+            || number < -0x80000000LL || number > 0xFFFFFFFFLL)
+          throw std::invalid_argument(text);
+        value = (unsigned int) number;
+      } catch (const std::out_of_range& e) {
+        throw std::invalid_argument(text);
+      }
+    } else {
+      bool local = !text.empty() && text.at(0) == '@';
+      if (!valid_label(local ? text.substr(1) : text))
+        throw std::invalid_argument(text);
+      put_labels[at] = std::make_pair(result.line,
+                                      local ? last_label + text : text);
+    }
+
+    for (int i = 0; i < 4; i++) {
+      this->memory[at++] = value & 0xFF;
+      value >>= 8;
+    }
+  };
+
+  for (size_t i = 0; i < source.size(); i++) {
+    std::string line = source[i];
+    size_t index = 0;
+    result.line = origin.empty() ? i : origin[i];
+
+    // Trim left
+    index = line.find_first_not_of(" \t\n\r");
+    line.erase(0, index);
+
+    // Trim right
+    index = line.find_last_not_of(" \t\n\r");
+    line.erase(index + 1);
+
+    // Remove comments
+    index = line.find_first_of(";#");
+    if (index != std::string::npos)
+      line.erase(index);
+    
+    // Ignore blank lines
+    if (line.size() == 0)
+      continue;
+    
+    // Macro?
+    if (line.at(0) == '.') {
+      // Remove '.'
+      line.erase(0, 1);
+
+      // Split into command and arguments
+      std::string args("");
+      std::string arg_type("number");
+      index = line.find(' ');
+      if (index != std::string::npos) {
+        args.assign(line.substr(index + 1));
+        line.erase(index);
+      }
+
+      try {
+        if (line == "pos") {
+          pos = std::stoi(args, nullptr, 0);
+        } else if (line == "align") {
+          int alignment = std::stoi(args, nullptr, 0);
+
+          // Valid alignment?
+          if (alignment > 1) {
+            // Round up to nearest block
+            if (pos % alignment != 0)
+              pos = pos - (pos % alignment) + alignment;
+          } else {
+            result.set("Invalid alignment", alignment);
+            return result;
+          }
+        } else if (line == "inline") {
+          // Only marks the next function for the optimizer
+        } else if (line == "long") {
+          unsigned int value = std::stoi(args, nullptr, 0);
+
+          // Overflow?
+          if (pos + 4 >= this->machine.memory_size) {
+            result.set("Not enough memory for long value", pos);
+            return result;
+          }
+
+          // Set in memory
+          for (int i = 0; i < 4; i++) {
+            this->memory[pos++] = value & 0xFF;
+            value >>= 8;
+          }
+        } else if (line == "quad") {
+          unsigned long long value = std::stoull(args, nullptr, 0);
+
+          // Overflow?
+          if (pos + 8 >= this->machine.memory_size) {
+            result.set("Not enough memory for quad value", pos);
+            return result;
+          }
+
+          // Set in memory, Y86-64 data
+          for (int i = 0; i < 8; i++) {
+            this->memory[pos++] = value & 0xFF;
+            value >>= 8;
+          }
+        } else if (line == "incbin") {
+          // Host file, mapped copy on write when pos is on a page
+          std::string path(args);
+          if (path.size() >= 2 && path.front() == '"' && path.back() == '"')
+            path = path.substr(1, path.size() - 2);
+          int size = state_map_file(&this->machine, pos, path.c_str());
+
+          // Unreadable or does not fit?
+          if (size < 0) {
+            result.set("Cannot include file here", args);
+            return result;
+          }
+          pos += size;
+        } else {
+          result.set("Unknown macro", line);
+          if (as_errors)
+            return result;
+          result.warn();
+        }
+      } catch (const std::invalid_argument& e) {
+        result.set("Macro '" + line + "' requires a " + arg_type, args);
+        return result;
+      }
+
+      continue;
+    }
+
+    // Label?
+    if (line.at(line.size() - 1) == ':') {
+      // Remove colon
+      line.erase(line.size() - 1);
+
+      // Valid label
+      bool valid = false;
+
+      // Local label?
+      std::string full_label = line;
+      if (line.at(0) == '@') {
+        full_label.assign(last_label + line);
+        valid = valid_label(line.substr(1));
+      } else {
+        last_label = line;
+        valid = valid_label(line);
+      }
+
+      // Invalid characters?
+      if (!valid) {
+        result.set("Label contains invalid characters", full_label);
+        return result;
+      }
+
+      // Already declared?
+      if (labels.find(full_label) != labels.end()) {
+        result.set("Label already defined", full_label);
+        return result;
+      }
+
+      // Store in map
+      labels.insert(std::pair<std::string, int>(full_label, pos));
+
+      continue;
+    }
+
+    // Split into command and optional args
+    index = line.find_first_of(" \t");
+    std::string command = to_lower(line.substr(0, index));
+    if (index != std::string::npos)
+      index = line.find_first_not_of(" \t", index + 1);
+    bool had_args = index != std::string::npos;
+    std::string args = had_args ? line.substr(index) : "";
+
+    // Valid command?
+    if (!valid_command(command)) {
+      result.set("Invalid command name", command);
+      return result;
+    }
+
+    // Compile command
+    int command_size = 6;
+    try {
+      if (command == "halt") {
+        command_size = 1; INDEX(pos + command_size);
+        this->memory[pos++] = 0x00;
+      } else if (command == "nop") {
+        command_size = 1; INDEX(pos + command_size);
+        this->memory[pos++] = 0x10;
+      } else if (condition_code(MOVE_NAMES, command) >= 0) {
+        command_size = 2; INDEX(pos + command_size);
+        std::vector<int> regs = parse_registers(args, 2);
+        this->memory[pos++] = 0x20 | condition_code(MOVE_NAMES, command);
+        this->memory[pos++] = (regs[0] << 4) | regs[1];
+      } else if (command == "irmovl") {
+        command_size = 6; INDEX(pos + command_size);
+        size_t comma = args.rfind(',');
+        if (comma == std::string::npos)
+          throw std::invalid_argument(args);
+        std::vector<int> regs = parse_registers(args.substr(comma + 1), 1);
+        this->memory[pos++] = 0x30;
+        this->memory[pos++] = (NO_REGISTER << 4) | regs[0];
+        put_address(args.substr(0, comma), pos);
+      } else if (command == "rmmovl" || command == "mrmovl") {
+        command_size = 6; INDEX(pos + command_size);
+        unsigned int displacement = parse_displacement(args);
+        std::vector<int> regs = parse_registers(args, 2);
+
+        // mrmovl D(rB), rA is written with rA first as well
+        bool load = command == "mrmovl";
+        this->memory[pos++] = load ? 0x50 : 0x40;
+        this->memory[pos++] = load ? (regs[1] << 4) | regs[0]
+                                   : (regs[0] << 4) | regs[1];
+        for (int i = 0; i < 4; i++) {
+          this->memory[pos++] = displacement & 0xFF;
+          displacement >>= 8;
+        }
+      } else if (operation_code(command) >= 0) {
+        command_size = 2; INDEX(pos + command_size);
+        std::vector<int> regs = parse_registers(args, 2);
+        this->memory[pos++] = 0x60 | operation_code(command);
+        this->memory[pos++] = (regs[0] << 4) | regs[1];
+      } else if (command.at(0) == 'i'
+                 && operation_code(command.substr(1)) >= 0) {
+        command_size = 6; INDEX(pos + command_size);
+        unsigned int value = parse_immediate(args);
+        std::vector<int> regs = parse_registers(args, 1);
+        this->memory[pos++] = 0xC0 | operation_code(command.substr(1));
+        this->memory[pos++] = (NO_REGISTER << 4) | regs[0];
+        for (int i = 0; i < 4; i++) {
+          this->memory[pos++] = value & 0xFF;
+          value >>= 8;
+        }
+      } else if (condition_code(JUMP_NAMES, command) >= 0) {
+        command_size = 5; INDEX(pos + command_size);
+        this->memory[pos++] = 0x70 | condition_code(JUMP_NAMES, command);
+        put_address(args, pos);
+      } else if (command == "call") {
+        command_size = 5; INDEX(pos + command_size);
+        this->memory[pos++] = 0x80;
+        put_address(args, pos);
+      } else if (command == "ret") {
+        command_size = 1; INDEX(pos + command_size);
+        this->memory[pos++] = 0x90;
+      } else if (command == "trap") {
+        command_size = 1; INDEX(pos + command_size);
+        this->memory[pos++] = 0xE0;
+      } else if (command == "pushl" || command == "popl") {
+        command_size = 2; INDEX(pos + command_size);
+        std::vector<int> regs = parse_registers(args, 1);
+        this->memory[pos++] = command == "pushl" ? 0xA0 : 0xB0;
+        this->memory[pos++] = (regs[0] << 4) | NO_REGISTER;
+      } else if (command == "cas" || command == "xadd") {
+        command_size = 6; INDEX(pos + command_size);
+        unsigned int displacement = parse_displacement(args);
+        std::vector<int> regs = parse_registers(args, 2);
+        this->memory[pos++] = 0xF0 | (command == "cas" ? 0 : 1);
+        this->memory[pos++] = (regs[0] << 4) | regs[1];
+        for (int i = 0; i < 4; i++) {
+          this->memory[pos++] = displacement & 0xFF;
+          displacement >>= 8;
+        }
+      } else if (command == "bcopy" || command == "bfill"
+                 || command == "bcmp") {
+        command_size = 3; INDEX(pos + command_size);
+        std::vector<int> regs = parse_registers(args, 3);
+        int fn = command == "bcopy" ? 0 : command == "bfill" ? 1 : 2;
+        this->memory[pos++] = 0xD0 | fn;
+        this->memory[pos++] = (regs[0] << 4) | regs[1];
+        this->memory[pos++] = (regs[2] << 4) | NO_REGISTER;
+      } else {
+        result.set("Invalid or unimplemented command", command);
+        return result;
+      }
+    } catch(const char* e) {
+      result.set("Not enough memory for " + command + ", space left: "
+                 + std::to_string(this->machine.memory_size - pos), command_size);
+      return result;
+    } catch(const std::invalid_argument& e) {
+      result.set("Invalid operands for " + command, args);
+      return result;
+    }
+  }
+
+  // Every label is known now
+  std::map<int, std::pair<int, std::string> >::iterator put;
+  for (put = put_labels.begin(); put != put_labels.end(); put++) {
+    std::map<std::string, int>::iterator label = labels.find(put->second.second);
+    if (label == labels.end()) {
+      result.line = put->second.first;
+      result.set("Undefined label", put->second.second);
+      return result;
+    }
+    unsigned int value = label->second;
+    for (int i = 0; i < 4; i++) {
+      this->memory[put->first + i] = value & 0xFF;
+      value >>= 8;
+    }
+  }
+
+  result.was_error = false;
+  return result;
+}
+
+bool valid_label(std::string label) {
+  static const std::regex pattern("^[a-zA-Z][a-zA-Z0-9_]*$");
+  return std::regex_match(label, pattern);
+}
+
+std::string to_lower(std::string s) {
+  std::string result = s;
+  std::transform(result.begin(), result.end(), result.begin(), ::tolower);
+  return result;
+}
+
+bool valid_command(std::string command) {
+  static const std::regex pattern("^[a-zA-Z]+$");
+  return std::regex_match(command, pattern);
+}
+
+// Function code of a jXX or cmovXX mnemonic in names, or -1
+int condition_code(const char* const names[CONDITION_COUNT],
+                   std::string command) {
+  for (int fn = 0; fn < CONDITION_COUNT; fn++)
+    if (command == names[fn])
+      return fn;
+  return -1;
+}
+
+// Function code of an OPl mnemonic, or -1
+int operation_code(std::string command) {
+  for (int fn = 0; fn < OPERATION_COUNT; fn++)
+    if (command == OPERATION_NAMES[fn])
+      return fn;
+  return -1;
+}
+
+// Leading "$value," operand, removed from args
+unsigned int parse_immediate(std::string& args) {
+  static const std::regex pattern("^\\s*\\$([-+]?\\w+)\\s*,");
+  std::smatch match;
+  if (!std::regex_search(args, match, pattern))
+    throw std::invalid_argument(args);
+  try {
+    size_t end = 0;
+    long long value = std::stoll(match[1].str(), &end, 0);
+    if (end != match[1].str().size()
+        || value < -0x80000000LL || value > 0xFFFFFFFFLL)
+      throw std::invalid_argument(args);
+    args = match.suffix().str();
+    return (unsigned int) value;
+  } catch (const std::out_of_range& e) {
+    throw std::invalid_argument(args);
+  }
+}
+
+// Memory operand "D(%reg)" in args, returns D and leaves "%reg" in its place
+unsigned int parse_displacement(std::string& args) {
+  static const std::regex pattern("([-+]?\\w*)\\(\\s*(%\\w+)\\s*\\)");
+  std::smatch match;
+  if (!std::regex_search(args, match, pattern))
+    throw std::invalid_argument(args);
+  long long value = 0;
+  try {
+    size_t end = 0;
+    if (!match[1].str().empty())
+      value = std::stoll(match[1].str(), &end, 0);
+    if (end != match[1].str().size()
+        || value < -0x80000000LL || value > 0xFFFFFFFFLL)
+      throw std::invalid_argument(args);
+  } catch (const std::out_of_range& e) {
+    throw std::invalid_argument(args);
+  }
+  args = match.prefix().str() + match[2].str() + match.suffix().str();
+  return (unsigned int) value;
+}
+
+// Comma separated registers such as "%eax, %ecx", as encoded numbers
+std::vector<int> parse_registers(std::string args, int count) {
+  std::vector<int> regs;
+  static const std::regex pattern("^\\s*%([a-zA-Z]+)\\s*(,|$)");
+  std::smatch match;
+  while (std::regex_search(args, match, pattern)) {
+    std::string name = to_lower(match[1].str());
+    int id = 0;
+    while (id < REGISTER_COUNT && name != REGISTER_CODES[id])
+      id++;
+    if (id == REGISTER_COUNT)
+      throw std::invalid_argument(name);
+    regs.push_back(id);
+    args = match.suffix().str();
+    if (match[2].str().empty())
+      break;
+  }
+
+  // Wrong count or something left over?
+  if ((int) regs.size() != count
+      || args.find_first_not_of(" \t") != std::string::npos)
+    throw std::invalid_argument(args);
+  return regs;
+}
@@ -0,0 +1,100 @@
+#ifndef ASSEMBLER_HPP
+#define ASSEMBLER_HPP
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <map>
+#include <regex>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+// The machine is the simulator's own, so what compiles here runs there
+extern "C" {
+#include "engine.h"
+}
+
+#define NO_REGISTER REGISTER_NONE
+
+#define INDEX(v) if((v) >= this->machine.memory_size) throw ""
+
+extern const char* REGISTER_CODES[REGISTER_COUNT];
+extern const char* STATUS_NAMES[STATUS_COUNT];
+extern const char* OPERATION_NAMES[OPERATION_COUNT];
+
+// jXX and cmovXX conditions, 0 is jmp and rrmovl
+#define CONDITION_COUNT 7
+extern const char* JUMP_NAMES[CONDITION_COUNT];
+extern const char* MOVE_NAMES[CONDITION_COUNT];
+
+class to_hex {
+  public:
+    to_hex(int _value, int _count = 4, bool _prefix = true) :
+      value(_value), count(_count), prefix(_prefix) {}
+    friend std::ostream& operator<<(std::ostream& os, const to_hex o);
+  private:
+    int value;  
+    int count;
+    bool prefix;
+};
+
+class Result {
+  public:
+    Result() : was_error(false), line(0), problem(""), value("") {}
+    void set(std::string _problem, std::string _value);
+    template <typename T> void set(std::string _problem, T _value);
+    void warn();
+    void error();
+  protected:
+    void info();
+
+  public:
+    bool was_error;
+    int line;
+    std::string problem;
+    std::string value;
+};
+
+class State {
+  public:
+    State(int memory_size = DEF_MEMORY_SIZE);
+    ~State();
+    State(const State&) = delete;
+    State& operator=(const State&) = delete;
+    void print();
+    void print_memory(int lines);
+    Result compile(std::vector<std::string> source, bool as_errors = false,
+                   bool optimize = false);
+    // Runs from address 0 on a backend, NULL for the reference
+    PROGRAM_STATUS run(const char* backend = NULL,
+                       const BUDGET* budget = NULL);
+    // What the last run changed, the same report as the simulator's
+    void print_changes();
+    unsigned long long steps() const { return this->machine.step; }
+
+    // What the optimizer changed in the last compile
+    std::vector<std::string> optimizations;
+  protected:
+    STATE machine;
+    unsigned char* memory; // The machine's
+    STATE started; // The machine before the last run
+};
+
+inline const char* bool_str(bool v) {
+  return v ? "true" : "false";
+}
+
+bool valid_label(std::string label);
+std::string to_lower(std::string s);
+bool valid_command(std::string command);
+int condition_code(const char* const names[CONDITION_COUNT],
+                   std::string command);
+int operation_code(std::string command);
+unsigned int parse_immediate(std::string& args);
+unsigned int parse_displacement(std::string& args);
+std::vector<int> parse_registers(std::string args, int count);
+
+#endif
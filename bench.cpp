@@ -0,0 +1,137 @@
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+#include "assembler.hpp"
+#include "generator.hpp"
+
+// Allocation counter, every operator new goes through here
+static unsigned long long allocations = 0;
+
+void* operator new(std::size_t size) {
+  allocations++;
+  void* p = std::malloc(size ? size : 1);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  std::free(p);
+}
+
+int usage(std::string prog) {
+  std::cout << "Usage: " << prog << " [--seed N] [--labels M] [--block K]"
+            << " [--repeat R] [--emit LINES | LINES...]" << std::endl;
+  return 0;
+}
+
+bool run(const GeneratorOptions& options, long long lines, int repeat) {
+  GeneratorOptions sized = options;
+  generator_fit_lines(sized, lines);
+
+  std::vector<std::string> source;
+  generate_source(sized, source);
+
+  unsigned long long bytes = 0;
+  for (size_t i = 0; i < source.size(); i++)
+    bytes += source[i].size() + 1;
+
+  double best = 0;
+  unsigned long long allocated = 0;
+  Result res;
+  for (int r = 0; r < repeat; r++) {
+    State state;
+    unsigned long long before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    res = state.compile(source);
+    auto stop = std::chrono::steady_clock::now();
+    allocated = allocations - before;
+
+    double seconds = std::chrono::duration<double>(stop - start).count();
+    if (r == 0 || seconds < best)
+      best = seconds;
+    if (res.was_error)
+      break;
+  }
+
+  // Generated source should always compile
+  if (res.was_error) {
+    std::cout << "Error Compiling:" << std::endl;
+    res.error();
+    return false;
+  }
+
+  double count = (double) source.size();
+  std::cout << std::setw(10) << source.size()
+            << std::setw(12) << bytes
+            << std::setw(10) << std::fixed << std::setprecision(3) << best
+            << std::setw(14) << std::setprecision(0) << count / best
+            << std::setw(10) << std::setprecision(2)
+            << bytes / best / (1024 * 1024)
+            << std::setw(12) << allocated / count
+            << std::endl;
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  std::vector<std::string> args(argv, argv + argc);
+  GeneratorOptions options;
+  std::vector<long long> sizes;
+  long long emit = 0;
+  int repeat = 1;
+
+  for (size_t i = 1; i < args.size(); i++) {
+    std::string arg = args[i];
+    bool has_value = i + 1 < args.size();
+    try {
+      if (arg == "--seed" && has_value)
+        options.seed = std::stoul(args[++i], nullptr, 0);
+      else if (arg == "--labels" && has_value)
+        options.labels = std::stoi(args[++i], nullptr, 0);
+      else if (arg == "--block" && has_value)
+        options.block = std::stoi(args[++i], nullptr, 0);
+      else if (arg == "--repeat" && has_value)
+        repeat = std::stoi(args[++i], nullptr, 0);
+      else if (arg == "--emit" && has_value)
+        emit = std::stoll(args[++i], nullptr, 0);
+      else
+        sizes.push_back(std::stoll(arg, nullptr, 0));
+    } catch (const std::logic_error& e) {
+      return usage(args[0]);
+    }
+  }
+
+  try {
+    // Only print the source?
+    if (emit > 0) {
+      generator_fit_lines(options, emit);
+      std::vector<std::string> source;
+      generate_source(options, source);
+      for (size_t i = 0; i < source.size(); i++)
+        std::cout << source[i] << '\n';
+      return 0;
+    }
+
+    if (sizes.empty()) {
+      sizes.push_back(10000);
+      sizes.push_back(1000000);
+      sizes.push_back(10000000);
+    }
+
+    std::cout << "     lines       bytes   seconds        lines/s      MB/s"
+              << "  allocs/line" << std::endl;
+    for (size_t i = 0; i < sizes.size(); i++)
+      if (!run(options, sizes[i], repeat < 1 ? 1 : repeat))
+        return 1;
+  } catch (const std::invalid_argument& e) {
+    std::cout << "Invalid generator options: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bpred.h"
+
+//// Definitions
+
+BOOL bpred_parse(BPRED *bpred, const char* spec)
+{
+    // Nothing passed?
+    if (NULL == bpred)
+        return 0;
+
+    // No jXX models, only the return stack?
+    if (NULL == spec)
+        return 1;
+
+    // kind[:bits][,kind[:bits]...]
+    const char* kind_names[BPRED_KIND_COUNT] = BPRED_KIND_NAME_ARRAY;
+    const char* start = spec;
+    while ('\0' != *start)
+    {
+        // No room?
+        if (BPRED_MODEL_MAX <= bpred->count)
+            return 0;
+
+        char part[32];
+        const char* end = strchr(start, ',');
+        size_t len = (NULL == end) ? strlen(start) : (size_t) (end - start);
+        if (sizeof(part) <= len)
+            return 0;
+        memcpy(part, start, len);
+        part[len] = '\0';
+
+        // Table size?
+        BPRED_MODEL *model = bpred->models + bpred->count;
+        model->bits = BPRED_DEF_BITS;
+        char* bits = strchr(part, ':');
+        if (NULL != bits)
+        {
+            *bits++ = '\0';
+            if ((0 == an_parse_int(bits, &model->bits)) || (1 > model->bits) || (24 < model->bits))
+                return 0;
+        }
+
+        int kind = 0;
+        while ((BPRED_KIND_COUNT > kind) && (0 != strcmp(part, kind_names[kind])))
+            kind++;
+        if (BPRED_KIND_COUNT <= kind)
+            return 0;
+        model->kind = (BPRED_KIND) kind;
+        bpred->count++;
+
+        if (NULL == end)
+            break;
+        start = end + 1;
+    }
+
+    return 1;
+}
+
+BOOL bpred_init(BPRED *bpred, int memory_size, int ras_size)
+{
+    // Nothing passed?
+    if (NULL == bpred)
+        return 0;
+
+    // Invalid sizes?
+    if ((1 > memory_size) || (0 > ras_size))
+        return 0;
+
+    // Keep parsed models, reset everything else
+    BPRED_MODEL models[BPRED_MODEL_MAX];
+    int count = bpred->count;
+    memcpy(models, bpred->models, sizeof(models));
+    memset(bpred, 0, sizeof(BPRED));
+    memcpy(bpred->models, models, sizeof(models));
+    bpred->count = count;
+    bpred->memory_size = memory_size;
+    bpred->jump_penalty = BPRED_DEF_JUMP_PENALTY;
+    bpred->ret_penalty = BPRED_DEF_RET_PENALTY;
+
+    for (int i = 0; bpred->count > i; i++)
+    {
+        BPRED_MODEL *model = bpred->models + i;
+        model->pc_misses = calloc(memory_size, sizeof(unsigned long long));
+        if (NULL == model->pc_misses)
+            return 0;
+
+        // Weakly taken to start with
+        if ((BPRED_BIMODAL == model->kind) || (BPRED_GSHARE == model->kind))
+        {
+            model->counters = malloc((size_t) 1 << model->bits);
+            if (NULL == model->counters)
+                return 0;
+            memset(model->counters, 2, (size_t) 1 << model->bits);
+        }
+    }
+
+    bpred->pc_branches = calloc(memory_size, sizeof(unsigned long long));
+    bpred->pc_taken = calloc(memory_size, sizeof(unsigned long long));
+    bpred->pc_returns = calloc(memory_size, sizeof(unsigned long long));
+    bpred->pc_ras_misses = calloc(memory_size, sizeof(unsigned long long));
+    if ((NULL == bpred->pc_branches) || (NULL == bpred->pc_taken) || (NULL == bpred->pc_returns) || (NULL == bpred->pc_ras_misses))
+        return 0;
+
+    if (0 < ras_size)
+    {
+        bpred->ras = calloc(ras_size, sizeof(int));
+        if (NULL == bpred->ras)
+            return 0;
+        bpred->ras_size = ras_size;
+    }
+
+    return 1;
+}
+
+void bpred_free(BPRED *bpred)
+{
+    // Nothing passed?
+    if (NULL == bpred)
+        return;
+
+    for (int i = 0; bpred->count > i; i++)
+    {
+        free(bpred->models[i].counters);
+        free(bpred->models[i].pc_misses);
+    }
+    free(bpred->pc_branches);
+    free(bpred->pc_taken);
+    free(bpred->pc_returns);
+    free(bpred->pc_ras_misses);
+    free(bpred->ras);
+    memset(bpred, 0, sizeof(BPRED));
+}
+
+// Predict one conditional jump, then train on the outcome
+static BOOL bpred_model_predict(BPRED_MODEL *model, int pc, int target, BOOL taken)
+{
+    unsigned int mask = (1u << model->bits) - 1;
+    unsigned int index = 0;
+    BOOL predicted = 1;
+
+    switch (model->kind)
+    {
+        case BPRED_ALWAYS:
+            break;
+
+        case BPRED_BTFNT:
+            predicted = (target <= pc);
+            break;
+
+        case BPRED_BIMODAL:
+        case BPRED_GSHARE:
+            index = (unsigned int) pc;
+            if (BPRED_GSHARE == model->kind)
+                index ^= model->history;
+            index &= mask;
+            predicted = (2 <= model->counters[index]);
+
+            // Saturating counter
+            if ((0 != taken) && (3 > model->counters[index]))
+                model->counters[index]++;
+            else if ((0 == taken) && (0 < model->counters[index]))
+                model->counters[index]--;
+            model->history = ((model->history << 1) | (0 != taken)) & mask;
+            break;
+    }
+
+    return (predicted == (0 != taken));
+}
+
+void bpred_retire(void *context, const STATE *state, const RETIRED *retired)
+{
+    BPRED *bpred = context;
+    unsigned char ins = (retired->insfn >> 4) & 0xF;
+    unsigned char fn = retired->insfn & 0xF;
+    int pc = retired->pc;
+    BOOL counted = (0 <= pc) && (bpred->memory_size > pc);
+
+    switch (ins)
+    {
+        case 7: // jXX
+            // Unconditional jumps are never mispredicted
+            if (0 == fn)
+                return;
+
+            // Target comes from the instruction itself, memory is small enough
+            // that the low 4 bytes hold a Y86-64 one as well
+            unsigned int target = 0;
+            an_bytes_int(state->memory + pc + 1, &target);
+
+            bpred->branches++;
+            if (0 != counted)
+            {
+                bpred->pc_branches[pc]++;
+                bpred->pc_taken[pc] += (0 != retired->condition);
+            }
+
+            for (int i = 0; bpred->count > i; i++)
+            {
+                BPRED_MODEL *model = bpred->models + i;
+                if (0 == bpred_model_predict(model, pc, (int) target, retired->condition))
+                {
+                    model->misses++;
+                    if (0 != counted)
+                        model->pc_misses[pc]++;
+                }
+            }
+            break;
+
+        case 8: // call
+            if (0 < bpred->ras_size)
+            {
+                bpred->ras[bpred->ras_top] = pc + retired->size;
+                bpred->ras_top = (bpred->ras_top + 1) % bpred->ras_size;
+                if (bpred->ras_size > bpred->ras_depth)
+                    bpred->ras_depth++;
+            }
+            break;
+
+        case 9: // ret
+            bpred->returns++;
+            if (0 != counted)
+                bpred->pc_returns[pc]++;
+
+            // Pop the predicted return address
+            BOOL hit = 0;
+            if (0 < bpred->ras_depth)
+            {
+                bpred->ras_top = (bpred->ras_top + bpred->ras_size - 1) % bpred->ras_size;
+                bpred->ras_depth--;
+                hit = (bpred->ras[bpred->ras_top] == retired->next_pc);
+            }
+
+            if (0 == hit)
+            {
+                bpred->ras_misses++;
+                if (0 != counted)
+                    bpred->pc_ras_misses[pc]++;
+            }
+            break;
+    }
+}
+
+static double bpred_percent(unsigned long long part, unsigned long long whole)
+{
+    return (0 == whole) ? 0 : 100.0 * part / whole;
+}
+
+void bpred_report(BPRED *bpred, int top)
+{
+    // Nothing passed?
+    if (NULL == bpred)
+        return;
+
+    const char* kind_names[BPRED_KIND_COUNT] = BPRED_KIND_NAME_ARRAY;
+    printf("Branch prediction:\n");
+    for (int i = 0; bpred->count > i; i++)
+    {
+        BPRED_MODEL *model = bpred->models + i;
+        unsigned long long correct = bpred->branches - model->misses;
+        char name[16];
+        if ((BPRED_BIMODAL == model->kind) || (BPRED_GSHARE == model->kind))
+            snprintf(name, sizeof(name), "%s:%d", kind_names[model->kind], model->bits);
+        else
+            snprintf(name, sizeof(name), "%s", kind_names[model->kind]);
+        printf("%-10s  %llu jumps, %llu correct (%.2f%%), %llu mispredicted, penalty %llu cycles\n",
+               name, bpred->branches, correct, bpred_percent(correct, bpred->branches), model->misses,
+               model->misses * bpred->jump_penalty);
+    }
+    unsigned long long ret_correct = bpred->returns - bpred->ras_misses;
+    printf("ras:%-6d  %llu returns, %llu correct (%.2f%%), %llu mispredicted, penalty %llu cycles\n",
+           bpred->ras_size, bpred->returns, ret_correct, bpred_percent(ret_correct, bpred->returns),
+           bpred->ras_misses, bpred->ras_misses * bpred->ret_penalty);
+
+    // Busiest sites first, reported ones are cleared from the search
+    printf("By site:\n");
+    BOOL *shown = calloc(bpred->memory_size, sizeof(BOOL));
+    if (NULL == shown)
+        return;
+    for (int n = 0; top > n; n++)
+    {
+        int busiest = -1;
+        unsigned long long busiest_count = 0;
+        for (int pc = 0; bpred->memory_size > pc; pc++)
+        {
+            unsigned long long count = bpred->pc_branches[pc] + bpred->pc_returns[pc];
+            if ((0 == shown[pc]) && (busiest_count < count))
+            {
+                busiest = pc;
+                busiest_count = count;
+            }
+        }
+
+        // Nothing left?
+        if (0 > busiest)
+            break;
+
+        shown[busiest] = 1;
+        if (0 != bpred->pc_returns[busiest])
+        {
+            unsigned long long count = bpred->pc_returns[busiest];
+            unsigned long long misses = bpred->pc_ras_misses[busiest];
+            printf("0x%04x ret:  %llu executed  ras %.2f%%\n", busiest, count, bpred_percent(count - misses, count));
+            continue;
+        }
+
+        unsigned long long count = bpred->pc_branches[busiest];
+        printf("0x%04x jXX:  %llu executed, %llu taken", busiest, count, bpred->pc_taken[busiest]);
+        for (int i = 0; bpred->count > i; i++)
+            printf("  %s %.2f%%", kind_names[bpred->models[i].kind],
+                   bpred_percent(count - bpred->models[i].pc_misses[busiest], count));
+        printf("\n");
+    }
+    free(shown);
+}
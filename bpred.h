@@ -0,0 +1,74 @@
+#ifndef BPRED_H
+#define BPRED_H
+
+#include "state.h"
+
+//// Defines
+
+// Most predictors compared in one run
+#define BPRED_MODEL_MAX 8
+
+// Predictor kinds, spelled as on the command line
+#define BPRED_KIND_COUNT 4
+#define BPRED_KIND_NAME_ARRAY { "always", "btfnt", "bimodal", "gshare" }
+
+// Table size when none is given, in index bits
+#define BPRED_DEF_BITS 10
+
+// Cycles lost on a mispredicted jXX and ret in PIPE
+#define BPRED_DEF_JUMP_PENALTY 2
+#define BPRED_DEF_RET_PENALTY 3
+
+//// Type declarations
+
+typedef enum _BPRED_KIND
+{
+    BPRED_ALWAYS, // Static, always taken
+    BPRED_BTFNT, // Static, backward taken and forward not taken
+    BPRED_BIMODAL, // 2-bit counters indexed by PC
+    BPRED_GSHARE // 2-bit counters indexed by PC xor global history
+} BPRED_KIND;
+
+typedef struct _BPRED_MODEL
+{
+    BPRED_KIND kind;
+    int bits;
+    unsigned char *counters;
+    unsigned int history;
+    unsigned long long misses;
+    unsigned long long *pc_misses;
+} BPRED_MODEL;
+
+// Conditional jXX predictors, all fed the same outcomes, plus a return
+// address stack for ret.  Without a stack every ret is mispredicted.
+typedef struct _BPRED
+{
+    BPRED_MODEL models[BPRED_MODEL_MAX];
+    int count;
+    unsigned long long branches;
+    unsigned long long *pc_branches;
+    unsigned long long *pc_taken;
+
+    int *ras;
+    int ras_size;
+    int ras_top; // Pushes minus pops, wraps around the stack
+    int ras_depth; // Valid entries
+    unsigned long long returns;
+    unsigned long long ras_misses;
+    unsigned long long *pc_returns;
+    unsigned long long *pc_ras_misses;
+
+    int jump_penalty;
+    int ret_penalty;
+    int memory_size;
+} BPRED;
+
+//// Forward declarations
+
+BOOL bpred_parse(BPRED *bpred, const char* spec);
+BOOL bpred_init(BPRED *bpred, int memory_size, int ras_size);
+void bpred_free(BPRED *bpred);
+void bpred_retire(void *context, const STATE *state, const RETIRED *retired);
+void bpred_report(BPRED *bpred, int top);
+
+#endif
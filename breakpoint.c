@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "breakpoint.h"
+
+//// Definitions
+
+void breakpoint_init(BREAKPOINTS *points)
+{
+    // Nothing passed?
+    if (NULL == points)
+        return;
+
+    memset(points, 0, sizeof(BREAKPOINTS));
+}
+
+// Puts the original bytes back in state, the breakpoints are still listed
+void breakpoint_unpatch(BREAKPOINTS *points, STATE *state)
+{
+    // Nothing passed?
+    if ((NULL == points) || (NULL == state))
+        return;
+
+    for (int i = 0; points->count > i; i++)
+        if ((points->points[i].address < state->memory_size)
+            && (BREAKPOINT_OPCODE == state->memory[points->points[i].address]))
+            state->memory[points->points[i].address] = points->points[i].original;
+}
+
+// Unpatched first, NULL state if its memory is gone
+void breakpoint_free(BREAKPOINTS *points, STATE *state)
+{
+    // Nothing passed?
+    if (NULL == points)
+        return;
+
+    breakpoint_unpatch(points, state);
+    free(points->points);
+    memset(points, 0, sizeof(BREAKPOINTS));
+}
+
+// Index of address, or where it would go
+static int breakpoint_index(const BREAKPOINTS *points, int address)
+{
+    int low = 0;
+    int high = points->count;
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+        if (points->points[mid].address < address)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+BREAKPOINT* breakpoint_find(BREAKPOINTS *points, int address)
+{
+    // Nothing passed?
+    if (NULL == points)
+        return NULL;
+
+    int i = breakpoint_index(points, address);
+    return ((points->count > i) && (address == points->points[i].address)) ? points->points + i : NULL;
+}
+
+// Patches the instruction at address, set already is fine
+BOOL breakpoint_add(BREAKPOINTS *points, STATE *state, int address)
+{
+    // Nothing passed?
+    if ((NULL == points) || (NULL == state))
+        return 0;
+
+    // Outside memory, or the opcode itself, which could never be stepped over?
+    if ((0 > address) || (state->memory_size <= address) || (BREAKPOINT_OPCODE == state->memory[address]))
+        return (NULL != breakpoint_find(points, address));
+
+    // Room for one more?
+    if (points->capacity == points->count)
+    {
+        int capacity = (0 == points->capacity) ? 16 : points->capacity * 2;
+        BREAKPOINT *grown = realloc(points->points, (size_t) capacity * sizeof(BREAKPOINT));
+        if (NULL == grown)
+            return 0;
+        points->points = grown;
+        points->capacity = capacity;
+    }
+
+    int i = breakpoint_index(points, address);
+    memmove(points->points + i + 1, points->points + i, (size_t) (points->count - i) * sizeof(BREAKPOINT));
+    points->count++;
+    points->points[i].address = address;
+    points->points[i].original = state->memory[address];
+    points->points[i].hits = 0;
+    state->memory[address] = BREAKPOINT_OPCODE;
+
+    return 1;
+}
+
+BOOL breakpoint_remove(BREAKPOINTS *points, STATE *state, int address)
+{
+    // Nothing passed?
+    if ((NULL == points) || (NULL == state))
+        return 0;
+
+    BREAKPOINT *point = breakpoint_find(points, address);
+    if (NULL == point)
+        return 0;
+
+    if ((address < state->memory_size) && (BREAKPOINT_OPCODE == state->memory[address]))
+        state->memory[address] = point->original;
+    int i = (int) (point - points->points);
+    memmove(points->points + i, points->points + i + 1, (size_t) (points->count - i - 1) * sizeof(BREAKPOINT));
+    points->count--;
+
+    return 1;
+}
+
+// Runs the instruction state stopped on with BRK and patches it back in.
+// AOK to resume, or where that instruction stopped.  A BRK that is not one of
+// these breakpoints is left as it is.  NULL resume for state_resume
+PROGRAM_STATUS breakpoint_step(BREAKPOINTS *points, STATE *state, BREAKPOINT_RESUME resume, void *context,
+                               PROBES *probes)
+{
+    // Nothing passed?
+    if ((NULL == points) || (NULL == state))
+        return INS;
+
+    BREAKPOINT *point = (BRK == state->status) ? breakpoint_find(points, state->pc) : NULL;
+    if (NULL == point)
+        return state->status;
+    point->hits++;
+
+    // Exactly one instruction
+    BUDGET one = { 1, 0, 1 };
+    state->memory[point->address] = point->original;
+    state->status = AOK;
+    if (NULL == resume)
+        state_resume(state, &one, probes);
+    else
+        resume(context, state, &one, probes);
+    if (LIM == state->status)
+        state->status = AOK;
+
+    // Stored over itself?  That is the original now
+    if (BREAKPOINT_OPCODE != state->memory[point->address])
+        point->original = state->memory[point->address];
+    state->memory[point->address] = BREAKPOINT_OPCODE;
+
+    return state->status;
+}
+
+// One line for a stop, before the instruction runs
+void breakpoint_print_hit(const STATE *state)
+{
+    // Nothing passed?
+    if (NULL == state)
+        return;
+
+    const char* reg_names[REGISTER_COUNT] = REGISTER_NAME_ARRAY;
+    printf("[-] Breakpoint at PC = 0x%x after %llu steps, CC Z=%d S=%d O=%d\n   ", state->pc, state->step,
+           state->codes.ZF, state->codes.SF, state->codes.OF);
+    if (WORD_SIZE_64 == state->word_size)
+    {
+        const char* reg64_names[REGISTER64_COUNT] = REGISTER64_NAME_ARRAY;
+        for (int i = 0; REGISTER64_COUNT > i; i++)
+            printf(" %%%s=0x%llx", reg64_names[i], (unsigned long long) state->registers64.ids[i]);
+    }
+    else
+    {
+        for (int i = 0; REGISTER_COUNT > i; i++)
+            printf(" %%%s=0x%x", reg_names[i], state->registers.ids[i]);
+    }
+    printf("\n");
+}
+
+void breakpoint_report(BREAKPOINTS *points)
+{
+    // Nothing passed?
+    if (NULL == points)
+        return;
+
+    printf("Breakpoints:\n");
+    for (int i = 0; points->count > i; i++)
+        printf("0x%04x: %llu hits\n", points->points[i].address, points->points[i].hits);
+}
@@ -0,0 +1,46 @@
+#ifndef BREAKPOINT_H
+#define BREAKPOINT_H
+
+#include "state.h"
+
+// Breakpoints by patching code.  Setting one swaps the first byte of the
+// instruction at its address for BREAKPOINT_OPCODE and keeps the original
+// here, sorted by address.  The executors only see a trap they already
+// decode, so runs pay nothing per step however many breakpoints there are.
+// A run stops on one with BRK, and breakpoint_step runs the original
+// instruction and patches it back in before the run is resumed.  The guest
+// reads the patch if it loads its own code, and a store over it drops it.
+
+//// Type declarations
+
+// Runs the stepped over instruction, like BACKEND resume
+typedef PROGRAM_STATUS (*BREAKPOINT_RESUME)(void *context, STATE *state, const BUDGET *budget, PROBES *probes);
+
+typedef struct _BREAKPOINT
+{
+    int address;
+    unsigned char original; // Byte the patch replaced
+    unsigned long long hits;
+} BREAKPOINT;
+
+typedef struct _BREAKPOINTS
+{
+    BREAKPOINT *points; // Sorted by address
+    int count;
+    int capacity;
+} BREAKPOINTS;
+
+//// Forward declarations
+
+void breakpoint_init(BREAKPOINTS *points);
+void breakpoint_unpatch(BREAKPOINTS *points, STATE *state);
+void breakpoint_free(BREAKPOINTS *points, STATE *state);
+BOOL breakpoint_add(BREAKPOINTS *points, STATE *state, int address);
+BOOL breakpoint_remove(BREAKPOINTS *points, STATE *state, int address);
+BREAKPOINT* breakpoint_find(BREAKPOINTS *points, int address);
+PROGRAM_STATUS breakpoint_step(BREAKPOINTS *points, STATE *state, BREAKPOINT_RESUME resume, void *context,
+                               PROBES *probes);
+void breakpoint_print_hit(const STATE *state);
+void breakpoint_report(BREAKPOINTS *points);
+
+#endif
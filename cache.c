@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+
+//// Definitions
+
+static BOOL cache_power_of_two(int value)
+{
+    return (0 < value) && (0 == (value & (value - 1)));
+}
+
+BOOL cache_parse(const char* spec, CACHE_CONFIG *config)
+{
+    // Nothing passed?
+    if ((NULL == spec) || (NULL == config))
+        return 0;
+
+    // size:ways:line[:policy]
+    char part[32];
+    int values[3];
+    int count = 0;
+    const char* start = spec;
+    config->policy = CACHE_LRU;
+    while (1)
+    {
+        const char* end = strchr(start, ':');
+        size_t len = (NULL == end) ? strlen(start) : (size_t) (end - start);
+        if (sizeof(part) <= len)
+            return 0;
+        memcpy(part, start, len);
+        part[len] = '\0';
+
+        if (3 > count)
+        {
+            if (0 == an_parse_int(part, values + count))
+                return 0;
+        }
+        else if (3 == count)
+        {
+            const char* policy_names[CACHE_POLICY_COUNT] = CACHE_POLICY_NAME_ARRAY;
+            int policy = 0;
+            while ((CACHE_POLICY_COUNT > policy) && (0 != strcmp(part, policy_names[policy])))
+                policy++;
+            if (CACHE_POLICY_COUNT <= policy)
+                return 0;
+            config->policy = (CACHE_POLICY) policy;
+        }
+        else
+            return 0;
+        count++;
+
+        if (NULL == end)
+            break;
+        start = end + 1;
+    }
+
+    // Missing a size?
+    if (3 > count)
+        return 0;
+
+    config->size = values[0];
+    config->ways = values[1];
+    config->line = values[2];
+
+    // Sets must come out as a power of two too
+    return cache_power_of_two(config->size) && cache_power_of_two(config->ways)
+           && cache_power_of_two(config->line) && (config->size >= config->ways * config->line);
+}
+
+static BOOL cache_level_init(CACHE *cache, const CACHE_CONFIG *config, const char* name)
+{
+    // No room?
+    if (CACHE_LEVEL_MAX <= cache->count)
+        return 0;
+
+    CACHE_LEVEL *level = cache->levels + cache->count;
+    int lines = config->size / config->line;
+    int sets = lines / config->ways;
+
+    level->config = *config;
+    snprintf(level->name, sizeof(level->name), "%s", name);
+    level->index = cache->count;
+    level->line_bits = 0;
+    while ((1 << level->line_bits) < config->line)
+        level->line_bits++;
+    level->set_mask = sets - 1;
+    level->tags = calloc(lines, sizeof(unsigned int));
+    level->stamps = calloc(lines, sizeof(unsigned long long));
+    cache->count++;
+
+    return (NULL != level->tags) && (NULL != level->stamps);
+}
+
+BOOL cache_init(CACHE *cache, int memory_size, const CACHE_CONFIG *icache, const CACHE_CONFIG *dcache, const CACHE_CONFIG *shared, int shared_count)
+{
+    // Nothing passed?
+    if (NULL == cache)
+        return 0;
+
+    // Invalid memory size?
+    if (1 > memory_size)
+        return 0;
+
+    memset(cache, 0, sizeof(CACHE));
+    cache->random = 0x2545f491;
+
+    // Too many levels?
+    int split = (NULL != icache) + (NULL != dcache);
+    if ((0 == split + shared_count) || (CACHE_LEVEL_MAX < split + shared_count))
+        return 0;
+
+    // Split first level
+    char name[8];
+    if ((NULL != icache) && (0 == cache_level_init(cache, icache, "L1I")))
+        return 0;
+    if ((NULL != dcache) && (0 == cache_level_init(cache, dcache, "L1D")))
+        return 0;
+
+    // Shared levels, the first is a unified L1 if there is no split
+    int first_shared = cache->count;
+    for (int i = 0; shared_count > i; i++)
+    {
+        snprintf(name, sizeof(name), "L%d", i + ((0 < split) ? 2 : 1));
+        if (0 == cache_level_init(cache, shared + i, name))
+            return 0;
+        if (first_shared < cache->count - 1)
+            cache->levels[cache->count - 2].next = cache->levels + cache->count - 1;
+    }
+
+    // Connect the split level to the shared ones
+    CACHE_LEVEL *below = (first_shared < cache->count) ? cache->levels + first_shared : NULL;
+    int next = 0;
+    if (NULL != icache)
+    {
+        cache->instruction = cache->levels + next++;
+        cache->instruction->next = below;
+    }
+    else
+        cache->instruction = below;
+    if (NULL != dcache)
+    {
+        cache->data = cache->levels + next++;
+        cache->data->next = below;
+    }
+    else
+        cache->data = below;
+
+    // Per address counters
+    cache->pc_accesses = calloc((size_t) memory_size * cache->count, sizeof(unsigned long long));
+    cache->pc_misses = calloc((size_t) memory_size * cache->count, sizeof(unsigned long long));
+    if ((NULL == cache->pc_accesses) || (NULL == cache->pc_misses))
+        return 0;
+    cache->memory_size = memory_size;
+
+    return 1;
+}
+
+void cache_free(CACHE *cache)
+{
+    // Nothing passed?
+    if (NULL == cache)
+        return;
+
+    for (int i = 0; cache->count > i; i++)
+    {
+        free(cache->levels[i].tags);
+        free(cache->levels[i].stamps);
+    }
+    free(cache->pc_accesses);
+    free(cache->pc_misses);
+    memset(cache, 0, sizeof(CACHE));
+}
+
+// Look up one line, filling it on a miss and walking down the hierarchy
+static void cache_access_line(CACHE *cache, CACHE_LEVEL *level, unsigned int pos, int pc)
+{
+    for (; NULL != level; level = level->next)
+    {
+        unsigned int line = pos >> level->line_bits;
+        int ways = level->config.ways;
+        unsigned int set = line & level->set_mask;
+        unsigned int *tags = level->tags + set * ways;
+        unsigned long long *stamps = level->stamps + set * ways;
+        BOOL counted = (0 <= pc) && (cache->memory_size > pc);
+
+        cache->clock++;
+        level->accesses++;
+        if (0 != counted)
+            cache->pc_accesses[pc * cache->count + level->index]++;
+
+        // Hit?
+        int way = 0;
+        while ((ways > way) && (line + 1 != tags[way]))
+            way++;
+        if (ways > way)
+        {
+            if (CACHE_LRU == level->config.policy)
+                stamps[way] = cache->clock;
+            return;
+        }
+
+        level->misses++;
+        if (0 != counted)
+            cache->pc_misses[pc * cache->count + level->index]++;
+
+        // Pick a victim, empty ways first
+        int victim = 0;
+        if (CACHE_RANDOM == level->config.policy)
+        {
+            cache->random ^= cache->random << 13;
+            cache->random ^= cache->random >> 17;
+            cache->random ^= cache->random << 5;
+            victim = cache->random & (ways - 1);
+        }
+        for (int i = 0; ways > i; i++)
+        {
+            if (0 == tags[i])
+            {
+                victim = i;
+                break;
+            }
+            if ((CACHE_RANDOM != level->config.policy) && (stamps[i] < stamps[victim]))
+                victim = i;
+        }
+
+        tags[victim] = line + 1;
+        stamps[victim] = cache->clock;
+    }
+}
+
+// An access may straddle two lines
+static void cache_access(CACHE *cache, CACHE_LEVEL *level, int pos, int size, int pc)
+{
+    // Unmodelled?
+    if ((NULL == level) || (0 > pos) || (0 >= size))
+        return;
+
+    unsigned int first = (unsigned int) pos >> level->line_bits;
+    unsigned int last = (unsigned int) (pos + size - 1) >> level->line_bits;
+    for (unsigned int line = first; last >= line; line++)
+        cache_access_line(cache, level, line << level->line_bits, pc);
+}
+
+void cache_retire(void *context, const STATE *state, const RETIRED *retired)
+{
+    CACHE *cache = context;
+
+    cache_access(cache, cache->instruction, retired->pc, retired->size, retired->pc);
+    if (0 <= retired->read_pos)
+        cache_access(cache, cache->data, retired->read_pos, retired->mem_size, retired->pc);
+    if (0 <= retired->mem_pos)
+        cache_access(cache, cache->data, retired->mem_pos, retired->mem_size, retired->pc);
+}
+
+void cache_report(CACHE *cache, int top)
+{
+    // Nothing passed?
+    if (NULL == cache)
+        return;
+
+    const char* policy_names[CACHE_POLICY_COUNT] = CACHE_POLICY_NAME_ARRAY;
+    printf("Cache:\n");
+    for (int i = 0; cache->count > i; i++)
+    {
+        CACHE_LEVEL *level = cache->levels + i;
+        unsigned long long hits = level->accesses - level->misses;
+        double rate = (0 == level->accesses) ? 0 : 100.0 * hits / level->accesses;
+        printf("%-4s %6dB %2d-way %3dB %-6s  %llu accesses, %llu hits (%.2f%%), %llu misses (%.2f%%)\n",
+               level->name, level->config.size, level->config.ways, level->config.line,
+               policy_names[level->config.policy], level->accesses, hits, rate, level->misses,
+               (0 == level->accesses) ? 0 : 100.0 - rate);
+    }
+
+    // Worst addresses first, reported ones are cleared from the search
+    printf("Misses by PC:\n");
+    BOOL *shown = calloc(cache->memory_size, sizeof(BOOL));
+    if (NULL == shown)
+        return;
+    for (int n = 0; top > n; n++)
+    {
+        int worst = -1;
+        unsigned long long worst_total = 0;
+        for (int pc = 0; cache->memory_size > pc; pc++)
+        {
+            unsigned long long sum = 0;
+            for (int i = 0; cache->count > i; i++)
+                sum += cache->pc_misses[pc * cache->count + i];
+            if ((0 == shown[pc]) && (worst_total < sum))
+            {
+                worst = pc;
+                worst_total = sum;
+            }
+        }
+
+        // Nothing left?
+        if (0 > worst)
+            break;
+
+        shown[worst] = 1;
+        printf("0x%04x:", worst);
+        for (int i = 0; cache->count > i; i++)
+            printf("  %s %llu/%llu", cache->levels[i].name, cache->pc_misses[worst * cache->count + i],
+                   cache->pc_accesses[worst * cache->count + i]);
+        printf("\n");
+    }
+    free(shown);
+}
@@ -0,0 +1,70 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "state.h"
+
+//// Defines
+
+// Most levels in one hierarchy, split L1 counts as two
+#define CACHE_LEVEL_MAX 6
+
+// Replacement policies
+#define CACHE_POLICY_COUNT 3
+#define CACHE_POLICY_NAME_ARRAY { "lru", "fifo", "random" }
+
+//// Type declarations
+
+typedef enum _CACHE_POLICY
+{
+    CACHE_LRU,
+    CACHE_FIFO,
+    CACHE_RANDOM
+} CACHE_POLICY;
+
+// Sizes in bytes, all powers of two
+typedef struct _CACHE_CONFIG
+{
+    int size;
+    int ways;
+    int line;
+    CACHE_POLICY policy;
+} CACHE_CONFIG;
+
+typedef struct _CACHE_LEVEL
+{
+    CACHE_CONFIG config;
+    char name[8];
+    int index; // Position in CACHE.levels
+    int line_bits;
+    unsigned int set_mask;
+    unsigned int *tags; // Line number + 1 per way, 0 when empty
+    unsigned long long *stamps; // Last use for LRU, fill time for FIFO
+    unsigned long long accesses;
+    unsigned long long misses;
+    struct _CACHE_LEVEL *next; // Where misses go, NULL for memory
+} CACHE_LEVEL;
+
+// Write-allocate hierarchy, either unified or with split L1 instruction
+// and data caches in front of shared levels
+typedef struct _CACHE
+{
+    CACHE_LEVEL levels[CACHE_LEVEL_MAX];
+    int count;
+    CACHE_LEVEL *instruction; // First level for fetches, NULL if unmodelled
+    CACHE_LEVEL *data; // First level for loads and stores, NULL if unmodelled
+    unsigned long long clock;
+    unsigned int random;
+    unsigned long long *pc_accesses; // count counters per address
+    unsigned long long *pc_misses;
+    int memory_size;
+} CACHE;
+
+//// Forward declarations
+
+BOOL cache_parse(const char* spec, CACHE_CONFIG *config);
+BOOL cache_init(CACHE *cache, int memory_size, const CACHE_CONFIG *icache, const CACHE_CONFIG *dcache, const CACHE_CONFIG *shared, int shared_count);
+void cache_free(CACHE *cache);
+void cache_retire(void *context, const STATE *state, const RETIRED *retired);
+void cache_report(CACHE *cache, int top);
+
+#endif
@@ -0,0 +1,538 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "engine.h"
+#include "hle.h"
+
+// Conformance harness.  Runs every backend on the same random images, from
+// the same start, and checks each ends in the same state as the reference:
+// registers, condition codes, status, PC, step count and every byte of memory.
+// Images are mostly valid instructions with backward jumps, calls and stores
+// into their own code, so runs get past the first few instructions, loop
+// until the budget and fault in every way there is.  With --hle images also
+// link the library routines hle.c knows and call them with random arguments,
+// and every backend runs them natively against the reference interpreting
+// them.
+
+//// Defines
+
+#define DEF_IMAGES 2000
+#define DEF_SEED 1
+#define DEF_STEPS 100000
+
+// Longest instruction, the generator leaves this much room at the end of code
+#define CONFORM_LONGEST 6
+
+// Two irmovl and a rmmovl that patch code already run
+#define CONFORM_PATCH 18
+
+// Where the Y86-64 program keeps its stack and stores its result
+#define CONFORM_STACK64 0x200
+#define CONFORM_RESULT64 0x100
+
+// An irmovl and pushl per argument, and the call
+#define CONFORM_CALL (8 * HLE_MAX_ARGS + 5)
+
+//// Type declarations
+
+typedef struct _OPTIONS
+{
+    int images;
+    unsigned int seed;
+    int steps;
+    int memory_size;
+    BOOL hle;
+    const char *backend; // Only this one against the reference, NULL for all that do not compile
+} OPTIONS;
+
+//// Forward declarations
+
+BOOL options_parse(OPTIONS *options, int argc, char** argv);
+void options_usage(const char* prog);
+unsigned int conform_random(unsigned int *seed);
+void conform_image(STATE *state, unsigned int *seed, BOOL hle);
+const char* conform_compare(const STATE *reference, const STATE *state);
+BOOL conform_checks(const OPTIONS *options, int backend);
+BOOL conform_known64(STATE *start, STATE *end);
+
+//// Main function
+
+int main(int argc, char** argv)
+{
+    OPTIONS options = { DEF_IMAGES, DEF_SEED, DEF_STEPS, DEF_MEMORY_SIZE, 0, NULL };
+    if (0 == options_parse(&options, argc, argv))
+    {
+        options_usage((0 == argc) ? "conform" : argv[0]);
+        return 0;
+    }
+
+    // With --hle the reference interprets first, then every backend runs natively
+    int backends = engine_count();
+    int count = backends + ((0 != options.hle) ? 1 : 0);
+    STATE boot = { 0 };
+    STATE *runs = calloc(count, sizeof(STATE));
+    double *seconds = calloc(count, sizeof(double));
+    unsigned long long *steps = calloc(count, sizeof(unsigned long long));
+    state_init(&boot);
+    if ((NULL == runs) || (NULL == seconds) || (NULL == steps) || (0 == state_allocate(&boot, options.memory_size)))
+    {
+        printf("[!] Failed to allocate memory\n");
+        return 1;
+    }
+
+    // Y86-64 against an end worked out by hand, the random images compare
+    // backends with the reference and every backend runs Y86-64 there
+    int mismatches = 0;
+    STATE known_start = { 0 };
+    STATE known_end = { 0 };
+    if (0 == conform_known64(&known_start, &known_end))
+    {
+        printf("[!] Failed to allocate memory\n");
+        return 1;
+    }
+    for (int b = 0; backends > b; b++)
+    {
+        if (0 == conform_checks(&options, b))
+            continue;
+
+        STATE state = { 0 };
+        ENGINE engine;
+        ENGINE_OPTIONS engine_options = { { NULL, NULL, NULL }, 1 };
+        if ((0 == state_clone(&known_start, &state))
+            || (0 == engine_open(&engine, engine_backend(b)->name, &state, &engine_options)))
+        {
+            printf("[!] Could not set up backend '%s'\n", engine_backend(b)->name);
+            return 1;
+        }
+        engine_resume(&engine, &state, NULL, NULL);
+        engine_close(&engine);
+
+        const char* part = conform_compare(&known_end, &state);
+        if (NULL != part)
+        {
+            printf("[!] Y86-64 program: %s differs from the known end in %s\n", engine_backend(b)->name, part);
+            mismatches++;
+        }
+        state_free(&state);
+    }
+    state_free(&known_start);
+    state_free(&known_end);
+
+    unsigned long long native = 0;
+    unsigned long long interpreted = 0;
+    unsigned int seed = options.seed;
+    HLE hle;
+    for (int image = 0; options.images > image; image++)
+    {
+        unsigned int image_seed = seed;
+        conform_image(&boot, &seed, options.hle);
+        if (0 != options.hle)
+            hle_scan(&hle, &boot);
+
+        for (int r = 0; count > r; r++)
+        {
+            int b = (0 != options.hle) ? ((0 < r) ? r - 1 : 0) : r;
+            if ((0 < r) && (0 == conform_checks(&options, b)))
+                continue;
+
+            // Same start for every backend
+            STATE *state = runs + r;
+            state_free(state);
+            memset(state, 0, sizeof(STATE));
+            if (0 == state_clone(&boot, state))
+            {
+                printf("[!] Failed to allocate memory\n");
+                return 1;
+            }
+            state->hle = ((0 != options.hle) && (0 < r)) ? &hle : NULL;
+
+            ENGINE engine;
+            ENGINE_OPTIONS engine_options = { { NULL, NULL, NULL }, 1 };
+            if (0 == engine_open(&engine, engine_backend(b)->name, state, &engine_options))
+            {
+                printf("[!] Could not set up backend '%s'\n", engine_backend(b)->name);
+                return 1;
+            }
+
+            // Twice, so a run is also resumed after its budget
+            struct timespec start;
+            struct timespec end;
+            BUDGET budget = { (unsigned long long) options.steps, 0, 0 };
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            engine_resume(&engine, state, &budget, NULL);
+            engine_resume(&engine, state, &budget, NULL);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            engine_close(&engine);
+            seconds[r] += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+            steps[r] += state->step;
+
+            const char* part = (0 == r) ? NULL : conform_compare(runs, state);
+            if (NULL != part)
+            {
+                printf("[!] Image %d (--seed %u --images 1%s): %s%s differs from %s in %s\n", image, image_seed,
+                       (0 != options.hle) ? " --hle" : "", engine_backend(b)->name, (NULL != state->hle) ? "+hle" : "",
+                       engine_backend(0)->name, part);
+                mismatches++;
+            }
+        }
+
+        for (int i = 0; (0 != options.hle) && (hle.count > i); i++)
+        {
+            native += hle.found[i].calls;
+            interpreted += hle.found[i].interpreted;
+        }
+    }
+
+    int checked = 0;
+    for (int b = 0; backends > b; b++)
+        checked += conform_checks(&options, b);
+    printf("[-] %d images of %d bytes, %d backends, %d mismatches\n", options.images, options.memory_size, checked,
+           mismatches);
+    if (0 != options.hle)
+        printf("[-] %llu routine calls run natively, %llu interpreted\n", native, interpreted);
+    for (int r = 0; count > r; r++)
+    {
+        int b = (0 != options.hle) ? ((0 < r) ? r - 1 : 0) : r;
+        if ((0 < r) && (0 == conform_checks(&options, b)))
+            continue;
+
+        char name[32];
+        snprintf(name, sizeof(name), "%s%s", engine_backend(b)->name, ((0 != options.hle) && (0 < r)) ? "+hle" : "");
+        printf("    %-14s %12llu steps  %8.3f s  %7.1fM steps/s\n", name, steps[r], seconds[r],
+               (0 < seconds[r]) ? steps[r] / seconds[r] / 1e6 : 0.0);
+    }
+
+    for (int r = 0; count > r; r++)
+        state_free(runs + r);
+    state_free(&boot);
+    free(runs);
+    free(seconds);
+    free(steps);
+
+    return (0 == mismatches) ? 0 : 1;
+}
+
+//// Definitions
+
+BOOL options_parse(OPTIONS *options, int argc, char** argv)
+{
+    for (int i = 1; argc > i; i++)
+    {
+        char* arg = argv[i];
+        BOOL has_value = (argc > i + 1);
+        int value = 0;
+
+        if ((0 == strcmp(arg, "--images")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &options->images)) || (1 > options->images))
+                return 0;
+        }
+        else if ((0 == strcmp(arg, "--seed")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &value)) || (0 > value))
+                return 0;
+            options->seed = (unsigned int) value;
+        }
+        else if ((0 == strcmp(arg, "--steps")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &options->steps)) || (1 > options->steps))
+                return 0;
+        }
+        else if ((0 == strcmp(arg, "--memory")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &options->memory_size)) || (64 > options->memory_size)
+                || (0 != options->memory_size % 4))
+                return 0;
+        }
+        else if (0 == strcmp(arg, "--hle"))
+            options->hle = 1;
+        else if ((0 == strcmp(arg, "--backend")) && has_value)
+        {
+            options->backend = argv[++i];
+            if (NULL == engine_find(options->backend))
+            {
+                printf("[!] Unknown backend: '%s'\n", options->backend);
+                return 0;
+            }
+        }
+        else
+        {
+            printf("[!] Unknown option: '%s'\n", arg);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void options_usage(const char* prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("Options:\n");
+    printf("  --images N     Random images to run, default %d\n", DEF_IMAGES);
+    printf("  --seed N       First seed, each image says the seed to repeat it, default %d\n", DEF_SEED);
+    printf("  --steps N      Budget of each of the two runs, default %d\n", DEF_STEPS);
+    printf("  --memory N     Bytes of memory, a multiple of 4, default %d\n", DEF_MEMORY_SIZE);
+    printf("  --hle          Call library routines, run natively against the reference\n");
+    printf("  --backend NAME Only this backend, also one that compiles, default all others\n");
+}
+
+// Is the backend run on every image?  The reference always is
+BOOL conform_checks(const OPTIONS *options, int backend)
+{
+    const BACKEND *checked = engine_backend(backend);
+    if (0 == backend)
+        return 1;
+
+    if (NULL != options->backend)
+        return 0 == strcmp(options->backend, checked->name);
+
+    return 0 == checked->compiles;
+}
+
+// xorshift, the same images everywhere
+unsigned int conform_random(unsigned int *seed)
+{
+    unsigned int x = (0 != *seed) ? *seed : 0x9E3779B9U;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+// Code in the first half of memory, registers mostly pointing into it.  With
+// hle the library routines go at the end of the code
+void conform_image(STATE *state, unsigned int *seed, BOOL hle)
+{
+    int size = state->memory_size;
+    int code = size / 2;
+    int entries[HLE_MAX];
+    int routines = (0 != hle) ? hle_routine_count() : 0;
+    int starts[DEF_MEMORY_SIZE];
+    int start_count = 0;
+    unsigned char *m = state->memory;
+
+    memset(m, 0, size);
+    memset(&state->registers, 0, sizeof(REGISTERS));
+    memset(&state->registers64, 0, sizeof(REGISTERS64));
+    memset(&state->codes, 0, sizeof(CONDITION_CODES));
+    state->word_size = (0 == conform_random(seed) % 8) ? WORD_SIZE_64 : WORD_SIZE_32;
+    state->step = 0;
+    state_restart(state);
+
+    for (int i = 0; routines > i; i++)
+    {
+        code -= hle_routine(i)->size;
+        entries[i] = code;
+        hle_place(i, m, size, code);
+    }
+
+    // Where instructions start, for jumps and calls to land on
+    for (int pos = 0; code - CONFORM_LONGEST > pos; )
+    {
+        if (DEF_MEMORY_SIZE > start_count)
+            starts[start_count++] = pos;
+        unsigned int r = conform_random(seed);
+        unsigned char regs = (unsigned char) (((r >> 8) & 0x77));
+        unsigned int value = conform_random(seed);
+        if (0 != (r & 0x10000))
+            value %= (unsigned int) size;
+        switch ((r & 0xFF) % 20)
+        {
+            case 0: // halt, now and then
+                m[pos++] = (0 == (r >> 24) % 4) ? 0x00 : 0x10;
+                break;
+            case 1: // Any byte at all
+                m[pos++] = (unsigned char) (r >> 24);
+                break;
+            case 2:
+            case 3: // irmovl
+                m[pos++] = 0x30;
+                m[pos++] = 0xF0 | (regs & 0x7);
+                an_int_bytes(value, m + pos);
+                pos += 4;
+                break;
+            case 4: // rrmovl or cmovXX
+                m[pos++] = 0x20 | ((r >> 24) % 7);
+                m[pos++] = regs;
+                break;
+            case 5: // rmmovl
+            case 6: // mrmovl
+                m[pos++] = (5 == (r & 0xFF) % 20) ? 0x40 : 0x50;
+                m[pos++] = regs;
+                an_int_bytes((0 != (r & 0x20000)) ? value % 64 : value % (unsigned int) size, m + pos);
+                pos += 4;
+                break;
+            case 7:
+            case 8: // OPl
+                m[pos++] = 0x60 | ((r >> 24) % OPERATION_COUNT);
+                m[pos++] = regs;
+                break;
+            case 9: // iOPl
+                m[pos++] = 0xC0 | ((r >> 24) % OPERATION_COUNT);
+                m[pos++] = 0xF0 | (regs & 0x7);
+                an_int_bytes(value, m + pos);
+                pos += 4;
+                break;
+            case 10:
+            case 11: // jXX, mostly back
+            case 12: // call
+                m[pos++] = ((12 == (r & 0xFF) % 20) ? 0x80 : 0x70 | ((r >> 24) % 7));
+                an_int_bytes((unsigned int) starts[value % start_count], m + pos);
+                pos += 4;
+                break;
+            case 13: // ret
+                m[pos++] = 0x90;
+                break;
+            case 14: // pushl
+            case 15: // popl
+                m[pos++] = (14 == (r & 0xFF) % 20) ? 0xA0 : 0xB0;
+                m[pos++] = (regs & 0x70) | REGISTER_NONE;
+                break;
+            case 16: // bcopy, bfill or bcmp
+                m[pos++] = 0xD0 | ((r >> 24) % BLOCK_COUNT);
+                m[pos++] = regs;
+                m[pos++] = ((r >> 28) & 0x70) | REGISTER_NONE;
+                break;
+            case 17: // cas or xadd
+                m[pos++] = 0xF0 | ((r >> 24) % ATOMIC_COUNT);
+                m[pos++] = regs;
+                an_int_bytes(value & ~3U, m + pos);
+                pos += 4;
+                break;
+            case 18: // Store over the immediate of an earlier instruction, loops run it again
+                if ((code - CONFORM_LONGEST - CONFORM_PATCH > pos) && (1 < start_count))
+                {
+                    m[pos++] = 0x30;
+                    m[pos++] = 0xF0 | ((regs >> 4) & 0x7);
+                    an_int_bytes(value, m + pos);
+                    pos += 4;
+                    m[pos++] = 0x30;
+                    m[pos++] = 0xF0 | (regs & 0x7);
+                    an_int_bytes((unsigned int) starts[(r >> 24) % (start_count - 1)] + 2, m + pos);
+                    pos += 4;
+                    m[pos++] = 0x40;
+                    m[pos++] = regs;
+                    an_int_bytes(0, m + pos);
+                    pos += 4;
+                    break;
+                }
+                m[pos++] = 0x10;
+                break;
+            default: // trap, nothing serves it, or a library call
+                if ((0 < routines) && (0 != (r & 0x100000)) && (code - CONFORM_LONGEST - CONFORM_CALL > pos))
+                {
+                    int routine = (int) ((r >> 24) % (unsigned int) routines);
+                    for (int i = 0; hle_routine(routine)->args > i; i++)
+                    {
+                        // Counts and pointers, now and then anything at all
+                        unsigned int arg = conform_random(seed);
+                        m[pos++] = 0x30;
+                        m[pos++] = 0xF0;
+                        an_int_bytes((0 == arg % 8) ? arg : (0 != (arg & 8)) ? arg % 24 : arg % (unsigned int) size,
+                                     m + pos);
+                        pos += 4;
+                        m[pos++] = 0xA0;
+                        m[pos++] = 0x0F;
+                    }
+                    m[pos++] = 0x80;
+                    an_int_bytes((unsigned int) entries[routine], m + pos);
+                    pos += 4;
+                    break;
+                }
+                m[pos++] = 0xE0;
+                break;
+        }
+    }
+
+    // Registers point into memory, half into the code so it gets stored over,
+    // the stack is at the top
+    for (int i = 0; REGISTER_COUNT > i; i++)
+        state->registers.ids[i] = (int) (conform_random(seed) % (unsigned int) ((0 == i % 2) ? code : size));
+    for (int i = 0; REGISTER64_COUNT > i; i++)
+        state->registers64.ids[i] = conform_random(seed) % (unsigned int) size;
+    state->registers.ids[REGISTER_ESP] = size - 4 * (int) (conform_random(seed) % 8);
+    state->registers64.ids[REGISTER_ESP] = state->registers.ids[REGISTER_ESP];
+}
+
+// Name of the first part that differs, NULL if none
+// Y86-64 program, hand encoded like main.c's Y86-32 one: a call to a loop
+// that doubles a 64 bit value, a push and pop, a shift, and a store and load
+// back.  end is how it must finish
+BOOL conform_known64(STATE *start, STATE *end)
+{
+    static const unsigned char program[] =
+    {
+        0x30, 0xF4, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x00 irmovq $0x200, %rsp
+        0x30, 0xF0, 0x89, 0x67, 0x45, 0x23, 0x01, 0x00, 0x00, 0x00, // 0x0a irmovq $0x123456789, %rax
+        0x30, 0xF1, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x14 irmovq $3, %rcx
+        0x80, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,       // 0x1e call Double
+        0x40, 0x02, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x27 rmmovq %rax, 0x100(%rdx)
+        0x50, 0x32, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x31 mrmovq 0x100(%rdx), %rbx
+        0x00,                                                       // 0x3b halt
+        0x10, 0x10, 0x10, 0x10,                                     // 0x3c nop
+        0x60, 0x00,                                                 // 0x40 Double: addq %rax, %rax
+        0x30, 0xF8, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, // 0x42 irmovq $-1, %r8
+        0x60, 0x81,                                                 // 0x4c addq %r8, %rcx
+        0x74, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,       // 0x4e jne Double
+        0xA0, 0x0F,                                                 // 0x57 pushq %rax
+        0xB0, 0xDF,                                                 // 0x59 popq %r13
+        0x30, 0xF9, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x5b irmovq $4, %r9
+        0x67, 0x9D,                                                 // 0x65 shlq %r9, %r13
+        0x90                                                        // 0x67 ret
+    };
+    unsigned long long doubled = 0x123456789ULL * 8;
+
+    state_init(start);
+    state_init(end);
+    if ((0 == state_allocate(start, DEF_MEMORY_SIZE)) || (0 == state_allocate(end, DEF_MEMORY_SIZE)))
+        return 0;
+    memcpy(start->memory, program, sizeof(program));
+    start->word_size = WORD_SIZE_64;
+    state_restart(start);
+    if (0 == state_clone(start, end))
+        return 0;
+
+    // The stores: the return address, the pushed value and the result
+    for (int i = 0; 8 > i; i++)
+    {
+        end->memory[CONFORM_STACK64 - 8 + i] = (unsigned char) (0x27ULL >> (i * 8));
+        end->memory[CONFORM_STACK64 - 16 + i] = (unsigned char) (doubled >> (i * 8));
+        end->memory[CONFORM_RESULT64 + i] = (unsigned char) (doubled >> (i * 8));
+    }
+
+    REGISTER64_ID *r = end->registers64.ids;
+    r[0] = (REGISTER64_ID) doubled; // rax
+    r[3] = (REGISTER64_ID) doubled; // rbx
+    r[4] = CONFORM_STACK64; // rsp
+    r[8] = -1; // r8
+    r[9] = 4; // r9
+    r[13] = (REGISTER64_ID) (doubled << 4); // r13
+    end->status = HLT;
+    end->step = 24;
+    end->pc = 0x3b;
+    return 1;
+}
+
+const char* conform_compare(const STATE *reference, const STATE *state)
+{
+    if (reference->status != state->status)
+        return "status";
+    if (reference->step != state->step)
+        return "step count";
+    if (reference->pc != state->pc)
+        return "PC";
+    if ((reference->codes.ZF != state->codes.ZF) || (reference->codes.SF != state->codes.SF)
+        || (reference->codes.OF != state->codes.OF))
+        return "condition codes";
+    if (0 != memcmp(&reference->registers, &state->registers, sizeof(REGISTERS)))
+        return "registers";
+    if (0 != memcmp(&reference->registers64, &state->registers64, sizeof(REGISTERS64)))
+        return "Y86-64 registers";
+    if (0 != memcmp(reference->memory, state->memory, reference->memory_size))
+        return "memory";
+    return NULL;
+}
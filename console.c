@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "console.h"
+
+//// Definitions
+
+static BOOL console_store(void *context, unsigned int offset, unsigned int value)
+{
+    CONSOLE *console = context;
+
+    // Only the data register takes stores
+    if (CONSOLE_DATA != offset)
+        return 0;
+
+    // Full?  Wait for the host thread rather than lose output
+    unsigned int head = atomic_load_explicit(&console->head, memory_order_relaxed);
+    if (console->capacity == head - console->cached_tail)
+    {
+        console->stalls++;
+        while (console->capacity == head - (console->cached_tail = atomic_load_explicit(&console->tail, memory_order_acquire)))
+            sched_yield();
+    }
+
+    console->ring[head & (console->capacity - 1)] = (unsigned char) value;
+    atomic_store_explicit(&console->head, head + 1, memory_order_release);
+    return 1;
+}
+
+static BOOL console_load(void *context, unsigned int offset, unsigned int *value)
+{
+    CONSOLE *console = context;
+    switch (offset)
+    {
+        case CONSOLE_DATA:
+            *value = 0;
+            return 1;
+        case CONSOLE_STATUS:
+            *value = console->capacity - (atomic_load_explicit(&console->head, memory_order_relaxed)
+                                          - atomic_load_explicit(&console->tail, memory_order_acquire));
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// All of it, unless the descriptor fails
+static BOOL console_write(CONSOLE *console, const unsigned char *data, size_t size)
+{
+    while (0 < size)
+    {
+        ssize_t done = write(console->fd, data, size);
+        console->writes++;
+        if (0 > done)
+        {
+            if (EINTR == errno)
+                continue;
+            return 0;
+        }
+        data += done;
+        size -= (size_t) done;
+    }
+
+    return 1;
+}
+
+static void* console_drain(void *context)
+{
+    CONSOLE *console = context;
+    struct timespec nap = { 0, 50000 };
+
+    while (1)
+    {
+        unsigned int tail = atomic_load_explicit(&console->tail, memory_order_relaxed);
+        unsigned int head = atomic_load_explicit(&console->head, memory_order_acquire);
+
+        // Nothing stored?
+        if (tail == head)
+        {
+            // Run finished and everything is written?
+            if ((0 != atomic_load_explicit(&console->done, memory_order_acquire))
+                && (tail == atomic_load_explicit(&console->head, memory_order_acquire)))
+                break;
+            nanosleep(&nap, NULL);
+            continue;
+        }
+
+        // Up to the end of the ring, the rest on the next turn
+        unsigned int start = tail & (console->capacity - 1);
+        unsigned int count = head - tail;
+        if (console->capacity - start < count)
+            count = console->capacity - start;
+        if (0 == console_write(console, console->ring + start, count))
+            atomic_store(&console->failed, 1);
+        atomic_store_explicit(&console->tail, tail + count, memory_order_release);
+    }
+
+    return NULL;
+}
+
+BOOL console_open(CONSOLE *console, int fd, int capacity)
+{
+    // Nothing passed?
+    if (NULL == console)
+        return 0;
+
+    memset(console, 0, sizeof(CONSOLE));
+    atomic_init(&console->head, 0);
+    atomic_init(&console->tail, 0);
+    atomic_init(&console->done, 0);
+    atomic_init(&console->failed, 0);
+    console->fd = fd;
+    console->device.base = CONSOLE_BASE;
+    console->device.size = CONSOLE_SIZE;
+    console->device.store = console_store;
+    console->device.load = console_load;
+    console->device.context = console;
+
+    // Round up to a power of two, so positions can wrap freely
+    console->capacity = 1;
+    while (((0 < capacity) ? (unsigned int) capacity : CONSOLE_DEF_CAPACITY) > console->capacity)
+        console->capacity <<= 1;
+    console->ring = malloc(console->capacity);
+    if (NULL == console->ring)
+        return 0;
+
+    if (0 != pthread_create(&console->thread, NULL, console_drain, console))
+    {
+        free(console->ring);
+        console->ring = NULL;
+        return 0;
+    }
+    console->started = 1;
+
+    return 1;
+}
+
+// Waits for everything stored to be written
+BOOL console_close(CONSOLE *console)
+{
+    // Nothing passed?
+    if (NULL == console)
+        return 0;
+
+    if (0 != console->started)
+    {
+        atomic_store_explicit(&console->done, 1, memory_order_release);
+        pthread_join(console->thread, NULL);
+        console->started = 0;
+    }
+
+    free(console->ring);
+    console->ring = NULL;
+
+    return (0 == atomic_load(&console->failed));
+}
@@ -0,0 +1,57 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "state.h"
+
+// Memory mapped console.  A guest stores bytes to the data register with
+// rmmovl, they go into a single producer, single consumer ring and a host
+// thread writes them out in blocks, so printing never leaves the run.
+//
+//   CONSOLE_BASE + 0  data    store: the low byte is printed, waits while the ring is full
+//   CONSOLE_BASE + 4  status  load: bytes free in the ring
+
+//// Defines
+
+#define CONSOLE_BASE 0xFFFF0000U
+#define CONSOLE_DATA 0
+#define CONSOLE_STATUS 4
+#define CONSOLE_SIZE 8
+
+// Ring size in bytes, a power of two
+#define CONSOLE_DEF_CAPACITY 65536
+
+// Keeps the two sides of the ring off each other's cache line
+#define CONSOLE_LINE 64
+
+//// Type declarations
+
+typedef struct _CONSOLE
+{
+    DEVICE device;
+    unsigned char *ring;
+    unsigned int capacity;
+    int fd;
+    pthread_t thread;
+    BOOL started;
+
+    // Guest side
+    _Alignas(CONSOLE_LINE) atomic_uint head; // Bytes stored
+    unsigned int cached_tail; // Last tail seen, reloaded only when the ring looks full
+    unsigned long long stalls; // Stores that waited for room
+
+    // Host side
+    _Alignas(CONSOLE_LINE) atomic_uint tail; // Bytes written out
+    atomic_int done;
+    atomic_int failed;
+    unsigned long long writes;
+} CONSOLE;
+
+//// Forward declarations
+
+BOOL console_open(CONSOLE *console, int fd, int capacity);
+BOOL console_close(CONSOLE *console);
+
+#endif
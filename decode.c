@@ -0,0 +1,422 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "decode.h"
+#include "hle.h"
+
+//// Definitions
+
+BOOL decode_open(void **context, const STATE *state, const ENGINE_OPTIONS *options)
+{
+    // Nothing passed?
+    if ((NULL == context) || (NULL == state) || (NULL == options))
+        return 0;
+
+    const ENGINE_ALLOCATOR *allocator = &options->allocator;
+    DECODE_CACHE *cache = allocator->alloc(allocator->context, sizeof(DECODE_CACHE));
+    if (NULL == cache)
+        return 0;
+    memset(cache, 0, sizeof(DECODE_CACHE));
+    cache->allocator = *allocator;
+    cache->generation = 1;
+
+    // No memory yet?  Every run goes to the reference
+    if (0 < state->memory_size)
+    {
+        int count = (state->memory_size + DECODE_PAGE_MASK) >> DECODE_PAGE_BITS;
+        size_t size = (size_t) count * sizeof(DECODED*);
+        cache->pages = allocator->alloc(allocator->context, size);
+        if (NULL == cache->pages)
+        {
+            allocator->free(allocator->context, cache);
+            return 0;
+        }
+        memset(cache->pages, 0, size);
+        cache->page_count = count;
+        cache->memory_size = state->memory_size;
+    }
+
+    *context = cache;
+    return 1;
+}
+
+void decode_close(void *context)
+{
+    DECODE_CACHE *cache = context;
+
+    // Nothing passed?
+    if (NULL == cache)
+        return;
+
+    ENGINE_ALLOCATOR allocator = cache->allocator;
+    for (int i = 0; cache->page_count > i; i++)
+        if (NULL != cache->pages[i])
+            allocator.free(allocator.context, cache->pages[i]);
+    if (NULL != cache->pages)
+        allocator.free(allocator.context, cache->pages);
+    allocator.free(allocator.context, cache);
+}
+
+void decode_flush(void *context)
+{
+    DECODE_CACHE *cache = context;
+
+    // Nothing passed?
+    if (NULL == cache)
+        return;
+
+    // Wrapped?  Old entries could look valid again
+    if (0 == ++cache->generation)
+    {
+        for (int i = 0; cache->page_count > i; i++)
+            if (NULL != cache->pages[i])
+                memset(cache->pages[i], 0, DECODE_PAGE_SIZE * sizeof(DECODED));
+        cache->generation = 1;
+    }
+}
+
+// Allocates the page of the table that pc is on, NULL if there is no memory
+static DECODED* decode_page(DECODE_CACHE *cache, int pc)
+{
+    size_t size = DECODE_PAGE_SIZE * sizeof(DECODED);
+    DECODED *page = cache->allocator.alloc(cache->allocator.context, size);
+    if (NULL == page)
+        return NULL;
+
+    memset(page, 0, size);
+    cache->pages[pc >> DECODE_PAGE_BITS] = page;
+    return page;
+}
+
+// Fills the entry for pc, which is at least 6 bytes from the end of memory.
+// Anything state_resume would fault on is left to it
+static void decode_entry(DECODE_CACHE *cache, const STATE *state, DECODED *entry, int pc)
+{
+    const unsigned char *at = state->memory + pc;
+    unsigned char fn = at[0] & 0xF;
+    unsigned char rA = (at[1] >> 4) & 0xF;
+    unsigned char rB = at[1] & 0xF;
+    BOOL registers = (REGISTER_COUNT > rA) && (REGISTER_COUNT > rB);
+    unsigned int dest = 0;
+    BOOL ok = 0;
+
+    entry->ins = (at[0] >> 4) & 0xF;
+    entry->fn = fn;
+    entry->rA = rA;
+    entry->rB = rB;
+    entry->val = 0;
+
+    switch (entry->ins)
+    {
+        case 0: // halt
+        case 1: // nop
+        case 9: // ret
+            ok = (0 == fn);
+            break;
+        case 2: // rrmovl or cmovXX
+            ok = (6 >= fn) && registers;
+            break;
+        case 3: // irmovl
+            ok = (0 == fn) && (REGISTER_NONE == rA) && (REGISTER_COUNT > rB);
+            an_bytes_int(at + 2, &entry->val);
+            break;
+        case 4: // rmmovl
+        case 5: // mrmovl
+            ok = (0 == fn) && registers;
+            an_bytes_int(at + 2, &entry->val);
+            break;
+        case 6: // OPl
+            ok = (OPERATION_COUNT > fn) && registers;
+            break;
+        case 7: // jXX
+        case 8: // call
+            an_bytes_int(at + 1, &dest);
+            ok = ((7 == entry->ins) ? (6 >= fn) : (0 == fn)) && ((unsigned int) (state->memory_size - 6) > dest);
+            entry->val = dest;
+            break;
+        case 10: // pushl
+        case 11: // popl
+            ok = (0 == fn) && (REGISTER_COUNT > rA) && (REGISTER_NONE == rB);
+            break;
+        case 12: // iOPl
+            ok = (OPERATION_COUNT > fn) && (REGISTER_NONE == rA) && (REGISTER_COUNT > rB);
+            an_bytes_int(at + 2, &entry->val);
+            break;
+    }
+
+    if (0 == ok)
+        entry->ins = DECODE_SLOW;
+    entry->generation = cache->generation;
+    cache->decodes++;
+}
+
+// Drops the entries of instructions size bytes stored at address overlap,
+// pages never run from have none
+static inline void decode_drop_range(DECODE_CACHE *cache, int address, int size)
+{
+    int from = (address < 5) ? 0 : address - 5;
+    for (int i = from; address + size > i; i++)
+    {
+        DECODED *page = cache->pages[i >> DECODE_PAGE_BITS];
+        if (NULL != page)
+            page[i & DECODE_PAGE_MASK].generation = 0;
+    }
+}
+
+// The same for a 4 byte store
+static inline void decode_drop(DECODE_CACHE *cache, unsigned int address)
+{
+    decode_drop_range(cache, (int) address, 4);
+}
+
+static inline BOOL decode_condition(const CONDITION_CODES *codes, unsigned char fn)
+{
+    switch (fn)
+    {
+        case 1: // le
+            return (0 != codes->ZF) || (codes->SF != codes->OF);
+        case 2: // l
+            return (codes->SF != codes->OF);
+        case 3: // e
+            return (0 != codes->ZF);
+        case 4: // ne
+            return (0 == codes->ZF);
+        case 5: // ge
+            return (0 != codes->ZF) || (codes->SF == codes->OF);
+        case 6: // g
+            return (0 == codes->ZF) && (codes->SF == codes->OF);
+        default: // Unconditional
+            return 1;
+    }
+}
+
+// The same operation and flags as state_operate, addl to xorl inline
+static inline BOOL decode_operate(STATE *state, unsigned char fn, unsigned int a, REGISTER_ID *b)
+{
+    unsigned int value = (unsigned int) *b;
+    unsigned int temp;
+    BOOL overflow = 0;
+    switch (fn)
+    {
+        case 0: // addl
+            temp = value + a;
+            overflow = ((1 == an_sign(value)) && (0 == an_sign(temp)));
+            break;
+        case 1: // subl
+            temp = value - a;
+            overflow = ((0 == an_sign(value)) && (1 == an_sign(temp)));
+            break;
+        case 2: // andl
+            temp = value & a;
+            break;
+        case 3: // xorl
+            temp = value ^ a;
+            break;
+        default:
+            return state_operate(state, fn, a, (unsigned int*) b);
+    }
+
+    state->codes.ZF = (0 == temp);
+    state->codes.SF = (temp >> 31) & 1;
+    state->codes.OF = overflow;
+    *b = (REGISTER_ID) temp;
+    return 1;
+}
+
+PROGRAM_STATUS decode_resume(void *context, STATE *state, const BUDGET *budget, PROBES *probes)
+{
+    DECODE_CACHE *cache = context;
+
+    // Nothing passed?
+    if ((NULL == cache) || (NULL == state))
+        return INS;
+
+    // Not covered by the table?  The reference may store anywhere
+    if ((WORD_SIZE_64 == state->word_size) || (0 >= cache->memory_size) || (cache->memory_size != state->memory_size)
+        || ((NULL != probes) && (0 < probes->count)) || ((NULL != budget) && (0 != budget->exact)))
+    {
+        PROGRAM_STATUS status = state_resume(state, budget, probes);
+        decode_flush(cache);
+        return status;
+    }
+
+    // Stopped for good?
+    if (LIM == state->status)
+        state->status = AOK;
+    if (AOK != state->status)
+        return state->status;
+
+    LIMIT limit;
+    limit_start(&limit, state, budget);
+
+    REGISTER_ID *reg = state->registers.ids;
+    unsigned char *memory = state->memory;
+    int size = state->memory_size;
+    unsigned int address;
+    int esp;
+    HOST_STORE store;
+
+    while (AOK == state->status)
+    {
+        int pc = state->pc;
+
+        // Invalid PC address?  The reference has the fault
+        if ((0 > pc) || (size - 6 <= pc))
+            goto slow;
+
+        // First run from this page?  No memory for it, the reference runs it
+        DECODED *page = cache->pages[pc >> DECODE_PAGE_BITS];
+        if ((NULL == page) && (NULL == (page = decode_page(cache, pc))))
+            goto slow;
+
+        DECODED *entry = page + (pc & DECODE_PAGE_MASK);
+        if (cache->generation != entry->generation)
+            decode_entry(cache, state, entry, pc);
+
+        // Each case bails out to the reference before anything changes
+        switch (entry->ins)
+        {
+            case 0: // halt
+                state->step++;
+                state->status = HLT;
+                return HLT;
+
+            case 1: // nop
+                state->pc = pc + 1;
+                break;
+
+            case 2: // rrmovl or cmovXX
+                if (0 != decode_condition(&state->codes, entry->fn))
+                    reg[entry->rB] = reg[entry->rA];
+                state->pc = pc + 2;
+                break;
+
+            case 3: // irmovl
+                reg[entry->rB] = (REGISTER_ID) entry->val;
+                state->pc = pc + 6;
+                break;
+
+            case 4: // rmmovl
+                address = (unsigned int) reg[entry->rB] + entry->val;
+                if ((unsigned int) (size - 4) <= address)
+                    goto slow;
+                an_int_bytes((unsigned int) reg[entry->rA], memory + address);
+                decode_drop(cache, address);
+                state->pc = pc + 6;
+                break;
+
+            case 5: // mrmovl
+                address = (unsigned int) reg[entry->rB] + entry->val;
+                if ((unsigned int) (size - 4) <= address)
+                    goto slow;
+                an_bytes_int(memory + address, (unsigned int*) (reg + entry->rA));
+                state->pc = pc + 6;
+                break;
+
+            case 6: // OPl
+                if (0 == decode_operate(state, entry->fn, (unsigned int) reg[entry->rA], reg + entry->rB))
+                    goto slow;
+                state->pc = pc + 2;
+                break;
+
+            case 7: // jXX
+                if (0 == decode_condition(&state->codes, entry->fn))
+                {
+                    state->pc = pc + 5;
+                    break;
+                }
+                state->pc = (int) entry->val;
+                state->step++;
+                if ((limit.check_at <= state->step) && (0 != limit_reached(&limit, state)))
+                    state->status = LIM;
+                continue;
+
+            case 8: // call
+                esp = reg[REGISTER_ESP];
+                if ((4 > esp) || (size <= esp))
+                    goto slow;
+                reg[REGISTER_ESP] = esp - 4;
+                an_int_bytes((unsigned int) (pc + 5), memory + esp - 4);
+                decode_drop(cache, (unsigned int) (esp - 4));
+                state->pc = (int) entry->val;
+                state->step++;
+
+                // Recognised routine?  It ran natively, drop what it stored
+                if ((NULL != state->hle)
+                    && (0 != hle_run(state->hle, state, (limit.steps > state->step) ? limit.steps - state->step : 0,
+                                     &store)))
+                {
+                    decode_drop(cache, (unsigned int) (esp - 8));
+                    if (0 < store.size)
+                        decode_drop_range(cache, store.pos, store.size);
+                }
+                if ((limit.check_at <= state->step) && (0 != limit_reached(&limit, state)))
+                    state->status = LIM;
+                continue;
+
+            case 9: // ret
+                esp = reg[REGISTER_ESP];
+                if ((0 > esp) || (size - 4 <= esp))
+                    goto slow;
+                an_bytes_int(memory + esp, &address);
+                if ((unsigned int) (size - 6) <= address)
+                    goto slow;
+                reg[REGISTER_ESP] = esp + 4;
+                state->pc = (int) address;
+                state->step++;
+                if ((limit.check_at <= state->step) && (0 != limit_reached(&limit, state)))
+                    state->status = LIM;
+                continue;
+
+            case 10: // pushl
+                esp = reg[REGISTER_ESP];
+                if ((4 > esp) || (size <= esp))
+                    goto slow;
+                address = (unsigned int) reg[entry->rA];
+                reg[REGISTER_ESP] = esp - 4;
+                an_int_bytes(address, memory + esp - 4);
+                decode_drop(cache, (unsigned int) (esp - 4));
+                state->pc = pc + 2;
+                break;
+
+            case 11: // popl, into esp too, which then moves on
+                esp = reg[REGISTER_ESP];
+                if ((0 > esp) || (size - 4 <= esp))
+                    goto slow;
+                an_bytes_int(memory + esp, (unsigned int*) (reg + entry->rA));
+                reg[REGISTER_ESP] += 4;
+                state->pc = pc + 2;
+                break;
+
+            case 12: // iOPl
+                if (0 == decode_operate(state, entry->fn, entry->val, reg + entry->rB))
+                    goto slow;
+                state->pc = pc + 6;
+                break;
+
+            default:
+                goto slow;
+        }
+
+        state->step++;
+        continue;
+
+    slow:
+        {
+            // Block, trap and atomic instructions may store anywhere
+            pc = state->pc;
+            BOOL stores = (0 <= pc) && (size > pc) && (13 <= (memory[pc] >> 4));
+
+            // One instruction on the reference, it knows every fault and device
+            BUDGET one = { 1, 0, 1 };
+            state_resume(state, &one, NULL);
+            if (LIM == state->status)
+                state->status = AOK;
+            if (0 != stores)
+                decode_flush(cache);
+            cache->slow++;
+        }
+    }
+
+    return state->status;
+}
@@ -0,0 +1,56 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include "engine.h"
+
+// The "decoded" backend.  Each Y86-32 instruction is decoded once into a
+// table with an entry per address and run from there after, so the hot loop
+// no longer reassembles immediates byte by byte.  The table is allocated a
+// page at a time, for the pages code runs from.  A store drops the entries
+// it overlaps, so code that writes itself still runs right.  Block, trap and
+// atomic instructions, device accesses and faults run on state_resume one
+// instruction at a time, and probed, exact and Y86-64 runs go to it whole.
+// Only stores made by the machine being run are seen, harts sharing memory
+// with self modifying code need the reference.
+
+//// Defines
+
+// Entry that state_resume has to run
+#define DECODE_SLOW 0xFF
+
+// Addresses per page of the table, pages are allocated when first run from
+#define DECODE_PAGE_BITS 8
+#define DECODE_PAGE_SIZE (1 << DECODE_PAGE_BITS)
+#define DECODE_PAGE_MASK (DECODE_PAGE_SIZE - 1)
+
+//// Type declarations
+
+typedef struct _DECODED
+{
+    unsigned int generation; // Valid while it is the cache's, never 0
+    unsigned int val; // Immediate, displacement or destination
+    unsigned char ins; // icode, or DECODE_SLOW
+    unsigned char fn;
+    unsigned char rA;
+    unsigned char rB;
+} DECODED;
+
+typedef struct _DECODE_CACHE
+{
+    ENGINE_ALLOCATOR allocator; // Of the cache and its pages
+    DECODED **pages; // DECODE_PAGE_SIZE entries each, NULL until code runs there
+    int page_count;
+    int memory_size;
+    unsigned int generation; // Bumped to drop every entry at once
+    unsigned long long decodes; // Entries filled
+    unsigned long long slow; // Instructions run by state_resume
+} DECODE_CACHE;
+
+//// Forward declarations
+
+BOOL decode_open(void **context, const STATE *state, const ENGINE_OPTIONS *options);
+void decode_close(void *context);
+PROGRAM_STATUS decode_resume(void *context, STATE *state, const BUDGET *budget, PROBES *probes);
+void decode_flush(void *context);
+
+#endif
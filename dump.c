@@ -0,0 +1,412 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "dump.h"
+
+//// Defines
+
+// Equal memory is skipped this many bytes at a time
+#define DUMP_SKIP 64
+
+//// Definitions
+
+// Two hex digits for every byte value
+static const char dump_pairs[] =
+    "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+// Index of a format name, -1 if there is none
+int dump_format(const char *name)
+{
+    // Nothing passed?
+    if (NULL == name)
+        return -1;
+
+    const char* names[DUMP_FORMAT_COUNT] = DUMP_FORMAT_NAME_ARRAY;
+    for (int i = 0; DUMP_FORMAT_COUNT > i; i++)
+        if (0 == strcmp(name, names[i]))
+            return i;
+
+    return -1;
+}
+
+// 0 capacity for the default
+BOOL dump_open(DUMP *dump, int fd, int format, size_t capacity)
+{
+    // Nothing passed?
+    if ((NULL == dump) || (0 > fd) || (0 > format) || (DUMP_FORMAT_COUNT <= format))
+        return 0;
+
+    memset(dump, 0, sizeof(DUMP));
+    if (0 == capacity)
+        capacity = DUMP_DEF_BUFFER;
+    if (DUMP_MIN_BUFFER > capacity)
+        capacity = DUMP_MIN_BUFFER;
+    dump->buffer = malloc(capacity);
+    if (NULL == dump->buffer)
+        return 0;
+
+    dump->fd = fd;
+    dump->format = format;
+    dump->capacity = capacity;
+    return 1;
+}
+
+// All of the buffer, unless the descriptor fails
+BOOL dump_flush(DUMP *dump)
+{
+    // Nothing passed?
+    if (NULL == dump)
+        return 0;
+
+    const unsigned char *data = dump->buffer;
+    size_t size = dump->used;
+    dump->used = 0;
+    while ((0 == dump->failed) && (0 < size))
+    {
+        ssize_t done = write(dump->fd, data, size);
+        dump->writes++;
+        if (0 > done)
+        {
+            if (EINTR == errno)
+                continue;
+            dump->failed = 1;
+            break;
+        }
+        data += done;
+        size -= (size_t) done;
+    }
+
+    return (0 == dump->failed);
+}
+
+// Flushes and frees, 0 if anything failed to write.  The descriptor stays open
+BOOL dump_close(DUMP *dump)
+{
+    // Nothing passed?
+    if ((NULL == dump) || (NULL == dump->buffer))
+        return 0;
+
+    BOOL ok = dump_flush(dump);
+    free(dump->buffer);
+    dump->buffer = NULL;
+    dump->capacity = 0;
+    return ok;
+}
+
+// Room for size bytes, at most DUMP_MIN_BUFFER, then dump_commit the end
+static inline char* dump_space(DUMP *dump, size_t size)
+{
+    if (dump->capacity - dump->used < size)
+        dump_flush(dump);
+    return (char*) dump->buffer + dump->used;
+}
+
+static inline void dump_commit(DUMP *dump, char *end)
+{
+    dump->used = (size_t) ((unsigned char*) end - dump->buffer);
+}
+
+// Any number of bytes
+static void dump_bytes(DUMP *dump, const unsigned char *data, size_t size)
+{
+    while (0 < size)
+    {
+        if (dump->capacity == dump->used)
+            dump_flush(dump);
+        size_t part = dump->capacity - dump->used;
+        if (part > size)
+            part = size;
+        memcpy(dump->buffer + dump->used, data, part);
+        dump->used += part;
+        data += part;
+        size -= part;
+    }
+}
+
+static inline char* dump_string(char *out, const char *s)
+{
+    while ('\0' != *s)
+        *out++ = *s++;
+    return out;
+}
+
+// Lower case hex, at least digits long, like %0*llx
+static char* dump_hex(char *out, unsigned long long value, int digits)
+{
+    int count = 1;
+    while ((16 > count) && (0 != (value >> (count * 4))))
+        count++;
+    if (digits > count)
+        count = digits;
+
+    // Byte pairs from the end, then the odd digit
+    char *end = out + count;
+    char *at = end;
+    while (2 <= at - out)
+    {
+        at -= 2;
+        memcpy(at, dump_pairs + 2 * (value & 0xFF), 2);
+        value >>= 8;
+    }
+    if (at != out)
+        *out = dump_pairs[2 * (value & 0xF) + 1];
+    return end;
+}
+
+static char* dump_decimal(char *out, unsigned long long value)
+{
+    char digits[20];
+    int count = 0;
+    do
+    {
+        digits[count++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (0 != value);
+
+    while (0 < count)
+        *out++ = digits[--count];
+    return out;
+}
+
+// Bytes as one hex number, the highest address first
+static char* dump_word_hex(char *out, const unsigned char *bytes, int count)
+{
+    for (int i = count - 1; 0 <= i; i--)
+    {
+        memcpy(out, dump_pairs + 2 * bytes[i], 2);
+        out += 2;
+    }
+    return out;
+}
+
+static char* dump_le(char *out, unsigned long long value, int bytes)
+{
+    for (int i = 0; bytes > i; i++)
+        *out++ = (char) ((value >> (i * 8)) & 0xFF);
+    return out;
+}
+
+static void dump_state(DUMP *dump, const STATE *state)
+{
+    const char* st_names[STATUS_COUNT] = STATUS_NAME_ARRAY;
+    BOOL st_invalid = (_FIRST > state->status) || (_LAST < state->status);
+    const char* st_str = st_invalid ? "???" : st_names[state->status - _FIRST];
+    BOOL zf = (0 != state->codes.ZF);
+    BOOL sf = (0 != state->codes.SF);
+    BOOL of = (0 != state->codes.OF);
+    char *out = dump_space(dump, DUMP_MIN_BUFFER);
+
+    switch (dump->format)
+    {
+        case DUMP_TEXT:
+            out = dump_string(out, "Stopped in ");
+            out = dump_decimal(out, state->step);
+            out = dump_string(out, " steps at PC = 0x");
+            out = dump_hex(out, (unsigned int) state->pc, 1);
+            out = dump_string(out, ".  Status '");
+            out = dump_string(out, st_str);
+            out = dump_string(out, "', CC Z=");
+            *out++ = (char) ('0' + zf);
+            out = dump_string(out, " S=");
+            *out++ = (char) ('0' + sf);
+            out = dump_string(out, " O=");
+            *out++ = (char) ('0' + of);
+            out = dump_string(out, "\nChanges to registers:\n");
+            break;
+
+        case DUMP_JSON:
+            out = dump_string(out, "{\"kind\":\"state\",\"steps\":");
+            out = dump_decimal(out, state->step);
+            out = dump_string(out, ",\"pc\":");
+            out = dump_decimal(out, (unsigned int) state->pc);
+            out = dump_string(out, ",\"status\":\"");
+            out = dump_string(out, st_str);
+            out = dump_string(out, "\",\"ZF\":");
+            *out++ = (char) ('0' + zf);
+            out = dump_string(out, ",\"SF\":");
+            *out++ = (char) ('0' + sf);
+            out = dump_string(out, ",\"OF\":");
+            *out++ = (char) ('0' + of);
+            out = dump_string(out, ",\"word_size\":");
+            out = dump_decimal(out, (WORD_SIZE_64 == state->word_size) ? WORD_SIZE_64 : WORD_SIZE_32);
+            out = dump_string(out, ",\"memory_size\":");
+            out = dump_decimal(out, (unsigned int) state->memory_size);
+            out = dump_string(out, "}\n");
+            break;
+
+        case DUMP_BINARY:
+            out = dump_le(out, DUMP_MAGIC, 4);
+            *out++ = DUMP_VERSION;
+            *out++ = (char) ((WORD_SIZE_64 == state->word_size) ? WORD_SIZE_64 : WORD_SIZE_32);
+            *out++ = (char) state->status;
+            *out++ = (char) (zf | (sf << 1) | (of << 2));
+            out = dump_le(out, state->step, 8);
+            out = dump_le(out, (unsigned int) state->pc, 4);
+            out = dump_le(out, (unsigned int) state->memory_size, 4);
+            break;
+    }
+
+    dump_commit(dump, out);
+}
+
+static void dump_register(DUMP *dump, const char *name, int id, unsigned long long old, unsigned long long now, int bytes)
+{
+    char *out = dump_space(dump, DUMP_MIN_BUFFER);
+
+    switch (dump->format)
+    {
+        case DUMP_TEXT:
+            *out++ = '%';
+            for (int pad = (int) strlen(name); 3 > pad; pad++)
+                *out++ = ' ';
+            out = dump_string(out, name);
+            out = dump_string(out, ":   0x");
+            out = dump_hex(out, old, bytes * 2);
+            out = dump_string(out, "      0x");
+            out = dump_hex(out, now, bytes * 2);
+            *out++ = '\n';
+            break;
+
+        case DUMP_JSON:
+            out = dump_string(out, "{\"kind\":\"register\",\"name\":\"");
+            out = dump_string(out, name);
+            out = dump_string(out, "\",\"old\":");
+            out = dump_decimal(out, old);
+            out = dump_string(out, ",\"new\":");
+            out = dump_decimal(out, now);
+            out = dump_string(out, "}\n");
+            break;
+
+        case DUMP_BINARY:
+            *out++ = DUMP_REGISTER;
+            *out++ = (char) id;
+            out = dump_le(out, old, bytes);
+            out = dump_le(out, now, bytes);
+            break;
+    }
+
+    dump_commit(dump, out);
+}
+
+// A run of changed words, a line each in text and JSON, one record in binary
+static void dump_memory(DUMP *dump, const unsigned char *old, const unsigned char *now, int address, int size)
+{
+    if (DUMP_BINARY == dump->format)
+    {
+        char *out = dump_space(dump, 9);
+        *out++ = DUMP_MEMORY;
+        out = dump_le(out, (unsigned int) address, 4);
+        out = dump_le(out, (unsigned int) size, 4);
+        dump_commit(dump, out);
+        dump_bytes(dump, old + address, (size_t) size);
+        dump_bytes(dump, now + address, (size_t) size);
+        return;
+    }
+
+    for (int a = address; address + size > a; a += 4)
+    {
+        char *out = dump_space(dump, DUMP_MIN_BUFFER);
+        unsigned int old_word = 0;
+        unsigned int now_word = 0;
+        if (DUMP_TEXT == dump->format)
+        {
+            out = dump_string(out, "0x");
+            out = dump_hex(out, (unsigned int) a, 4);
+            out = dump_string(out, ": 0x");
+            out = dump_word_hex(out, old + a, 4);
+            out = dump_string(out, "      0x");
+            out = dump_word_hex(out, now + a, 4);
+            *out++ = '\n';
+        }
+        else
+        {
+            an_bytes_int(old + a, &old_word);
+            an_bytes_int(now + a, &now_word);
+            out = dump_string(out, "{\"kind\":\"memory\",\"address\":");
+            out = dump_decimal(out, (unsigned int) a);
+            out = dump_string(out, ",\"old\":");
+            out = dump_decimal(out, old_word);
+            out = dump_string(out, ",\"new\":");
+            out = dump_decimal(out, now_word);
+            out = dump_string(out, "}\n");
+        }
+        dump_commit(dump, out);
+    }
+}
+
+// Where state_now ended and what differs from state_old, left in the buffer
+void dump_changes(DUMP *dump, const STATE *state_old, const STATE *state_now)
+{
+    // Nothing passed?
+    if ((NULL == dump) || (NULL == dump->buffer) || (NULL == state_old) || (NULL == state_now))
+        return;
+
+    dump_state(dump, state_now);
+
+    const char* reg_names[REGISTER_COUNT] = REGISTER_NAME_ARRAY;
+    const char* reg64_names[REGISTER64_COUNT] = REGISTER64_NAME_ARRAY;
+    if (WORD_SIZE_64 == state_now->word_size)
+    {
+        for (int i = 0; REGISTER64_COUNT > i; i++)
+            if (state_old->registers64.ids[i] != state_now->registers64.ids[i])
+                dump_register(dump, reg64_names[i], i, (unsigned long long) state_old->registers64.ids[i],
+                              (unsigned long long) state_now->registers64.ids[i], WORD_SIZE_64);
+    }
+    else
+    {
+        for (int i = 0; REGISTER_COUNT > i; i++)
+            if (state_old->registers.ids[i] != state_now->registers.ids[i])
+                dump_register(dump, reg_names[i], i, (unsigned int) state_old->registers.ids[i],
+                              (unsigned int) state_now->registers.ids[i], WORD_SIZE_32);
+    }
+
+    if (DUMP_TEXT == dump->format)
+    {
+        char *out = dump_space(dump, 32);
+        out = dump_string(out, "\nChanges to memory:\n");
+        dump_commit(dump, out);
+    }
+
+    // Runs of changed words, equal stretches skipped a block at a time
+    const unsigned char *old = state_old->memory;
+    const unsigned char *now = state_now->memory;
+    int size = (state_old->memory_size < state_now->memory_size) ? state_old->memory_size : state_now->memory_size;
+    size -= size % 4;
+    int run = -1;
+    for (int a = 0; size > a; )
+    {
+        if ((-1 == run) && (0 == a % DUMP_SKIP) && (size - a >= DUMP_SKIP) && (0 == memcmp(old + a, now + a, DUMP_SKIP)))
+        {
+            a += DUMP_SKIP;
+            continue;
+        }
+
+        BOOL changed = (0 != memcmp(old + a, now + a, 4));
+        if ((0 != changed) && (-1 == run))
+            run = a;
+        else if ((0 == changed) && (-1 != run))
+        {
+            dump_memory(dump, old, now, run, a - run);
+            run = -1;
+        }
+        a += 4;
+    }
+    if (-1 != run)
+        dump_memory(dump, old, now, run, size - run);
+
+    if (DUMP_BINARY == dump->format)
+    {
+        char *out = dump_space(dump, 1);
+        *out++ = DUMP_END;
+        dump_commit(dump, out);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+#include "state.h"
+
+// Reports of what a run changed, formatted into one large buffer that goes
+// out with a single write when it fills or is closed.  Hex comes from a table
+// of byte pairs, so no printf per byte.  Three formats:
+//
+//   text    the lines state_changes has always printed
+//   json    JSON lines, one object per line, "kind" is state, register or memory
+//   binary  the header below, then records, all integers little endian
+//
+// Binary header: "Y86D", version, word size, status, condition codes
+// (ZF | SF << 1 | OF << 2), steps (8 bytes), PC, memory size
+
+//// Defines
+
+#define DUMP_TEXT 0
+#define DUMP_JSON 1
+#define DUMP_BINARY 2
+#define DUMP_FORMAT_COUNT 3
+#define DUMP_FORMAT_NAME_ARRAY { "text", "json", "binary" }
+
+#define DUMP_MAGIC 0x44363859
+#define DUMP_VERSION 1
+#define DUMP_HEADER_SIZE 24
+
+// Binary records, a kind byte then
+#define DUMP_END 0x00 // Nothing, last record
+#define DUMP_REGISTER 0x01 // Register id byte, old and new value of word size each
+#define DUMP_MEMORY 0x02 // Address, byte count, the old bytes, then the new bytes
+
+// Buffer size when none is given, and the least taken
+#define DUMP_DEF_BUFFER 65536
+#define DUMP_MIN_BUFFER 256
+
+//// Type declarations
+
+typedef struct _DUMP
+{
+    int fd;
+    int format;
+    unsigned char *buffer;
+    size_t capacity;
+    size_t used;
+    BOOL failed; // A write failed, the rest is dropped
+    unsigned long long writes;
+} DUMP;
+
+//// Forward declarations
+
+int dump_format(const char *name);
+BOOL dump_open(DUMP *dump, int fd, int format, size_t capacity);
+BOOL dump_flush(DUMP *dump);
+BOOL dump_close(DUMP *dump);
+void dump_changes(DUMP *dump, const STATE *state_old, const STATE *state_now);
+
+#endif
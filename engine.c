@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "decode.h"
+#include "aot.h"
+
+//// Definitions
+
+static void* engine_default_alloc(void *context, size_t size)
+{
+    return malloc(size);
+}
+
+static void engine_default_free(void *context, void *pointer)
+{
+    free(pointer);
+}
+
+static PROGRAM_STATUS reference_resume(void *context, STATE *state, const BUDGET *budget, PROBES *probes)
+{
+    return state_resume(state, budget, probes);
+}
+
+static const BACKEND backends[] =
+{
+    { "reference", "state_resume, decodes every instruction as it runs", NULL, NULL, reference_resume, NULL, 0 },
+    { "decoded", "Y86-32 from a table of decoded instructions", decode_open, decode_close, decode_resume, decode_flush, 0 },
+    { "aot", "Y86-32 translated ahead of time to C and compiled, cached by image", aot_open, aot_close, aot_resume,
+      aot_flush, 1 },
+};
+
+int engine_count(void)
+{
+    return (int) (sizeof(backends) / sizeof(backends[0]));
+}
+
+const BACKEND* engine_backend(int index)
+{
+    // No such backend?
+    if ((0 > index) || (engine_count() <= index))
+        return NULL;
+
+    return backends + index;
+}
+
+const BACKEND* engine_find(const char *name)
+{
+    // Nothing passed?
+    if (NULL == name)
+        return NULL;
+
+    for (int i = 0; engine_count() > i; i++)
+        if (0 == strcmp(name, backends[i].name))
+            return backends + i;
+
+    return NULL;
+}
+
+// NULL name for the reference
+BOOL engine_open(ENGINE *engine, const char *name, const STATE *state, const ENGINE_OPTIONS *options)
+{
+    // Nothing passed?
+    if ((NULL == engine) || (NULL == state))
+        return 0;
+
+    // Half an allocator?
+    ENGINE_OPTIONS use = { { engine_default_alloc, engine_default_free, NULL }, 0 };
+    if (NULL != options)
+    {
+        if ((NULL == options->allocator.alloc) != (NULL == options->allocator.free))
+            return 0;
+        use.compile = options->compile;
+        if (NULL != options->allocator.alloc)
+            use.allocator = options->allocator;
+    }
+
+    memset(engine, 0, sizeof(ENGINE));
+    engine->backend = engine_find((NULL != name) ? name : ENGINE_DEF_BACKEND);
+    if (NULL == engine->backend)
+        return 0;
+
+    if ((NULL != engine->backend->open) && (0 == engine->backend->open(&engine->context, state, &use)))
+    {
+        engine->backend = NULL;
+        return 0;
+    }
+
+    return 1;
+}
+
+PROGRAM_STATUS engine_resume(ENGINE *engine, STATE *state, const BUDGET *budget, PROBES *probes)
+{
+    // Nothing passed?
+    if ((NULL == engine) || (NULL == engine->backend))
+        return INS;
+
+    return engine->backend->resume(engine->context, state, budget, probes);
+}
+
+void engine_flush(ENGINE *engine)
+{
+    // Nothing passed?
+    if ((NULL == engine) || (NULL == engine->backend))
+        return;
+
+    if (NULL != engine->backend->flush)
+        engine->backend->flush(engine->context);
+}
+
+void engine_close(ENGINE *engine)
+{
+    // Nothing passed?
+    if ((NULL == engine) || (NULL == engine->backend))
+        return;
+
+    if (NULL != engine->backend->close)
+        engine->backend->close(engine->context);
+    engine->backend = NULL;
+    engine->context = NULL;
+}
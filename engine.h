@@ -0,0 +1,71 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stddef.h>
+
+#include "state.h"
+
+// Interchangeable executors.  Every backend takes the same STATE to the same
+// end, status, step count and all, so one can be swapped for another at run
+// time.  "reference" is state_resume itself, faster backends may hand what
+// they do not cover back to it.  conform.out checks that they all agree.
+
+//// Defines
+
+#define ENGINE_DEF_BACKEND "reference"
+
+//// Type declarations
+
+// Memory for a backend's context, malloc and free when none is given
+typedef struct _ENGINE_ALLOCATOR
+{
+    void* (*alloc)(void *context, size_t size);
+    void (*free)(void *context, void *pointer);
+    void *context;
+} ENGINE_ALLOCATOR;
+
+// How a backend is opened, NULL for malloc and free and no compiler
+typedef struct _ENGINE_OPTIONS
+{
+    ENGINE_ALLOCATOR allocator;
+    BOOL compile; // May run the system compiler, else only cached code is used
+} ENGINE_OPTIONS;
+
+typedef struct _BACKEND
+{
+    const char *name;
+    const char *description;
+
+    // Context for running state, NULL open and close if none is needed.
+    // options always has both allocator functions, close frees with them
+    BOOL (*open)(void **context, const STATE *state, const ENGINE_OPTIONS *options);
+    void (*close)(void *context);
+
+    PROGRAM_STATUS (*resume)(void *context, STATE *state, const BUDGET *budget, PROBES *probes);
+
+    // Memory was changed outside a run, NULL if nothing is kept from it
+    void (*flush)(void *context);
+
+    // Opening builds native code when options allow, conform.out only checks
+    // it when named
+    BOOL compiles;
+} BACKEND;
+
+// A backend opened for one machine
+typedef struct _ENGINE
+{
+    const BACKEND *backend;
+    void *context;
+} ENGINE;
+
+//// Forward declarations
+
+int engine_count(void);
+const BACKEND* engine_backend(int index);
+const BACKEND* engine_find(const char *name);
+BOOL engine_open(ENGINE *engine, const char *name, const STATE *state, const ENGINE_OPTIONS *options);
+PROGRAM_STATUS engine_resume(ENGINE *engine, STATE *state, const BUDGET *budget, PROBES *probes);
+void engine_flush(ENGINE *engine);
+void engine_close(ENGINE *engine);
+
+#endif
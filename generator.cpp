@@ -0,0 +1,216 @@
+#include "generator.hpp"
+
+#include <stdexcept>
+
+#include "state.h"
+
+#define GENERATOR_BASE 0x20
+#define GENERATOR_STACK 0x3f0
+#define GENERATOR_HEADER_LINES 9
+
+namespace {
+
+const char* GENERATOR_REGISTERS[8] = { "%eax", "%ecx", "%edx", "%ebx",
+                                       "%esi", "%edi", "%esp", "%ebp" };
+const char* GENERATOR_OPS[OPERATION_COUNT] = OPERATION_NAME_ARRAY;
+const char* GENERATOR_BLOCKS[BLOCK_COUNT] = BLOCK_NAME_ARRAY;
+const char* GENERATOR_ATOMICS[ATOMIC_COUNT] = ATOMIC_NAME_ARRAY;
+const char* GENERATOR_JUMPS[7] = { "jmp", "jle", "jl", "je", "jne", "jge",
+                                   "jg" };
+const char* GENERATOR_MOVES[6] = { "cmovle", "cmovl", "cmove", "cmovne",
+                                   "cmovge", "cmovg" };
+
+// xorshift32, so the output does not depend on the standard library
+class Random {
+  public:
+    Random(unsigned int seed) : value(seed ? seed : 0x9e3779b9) {}
+    unsigned int next() {
+      value ^= value << 13;
+      value ^= value >> 17;
+      value ^= value << 5;
+      return value;
+    }
+    int below(int n) { return (int) (next() % (unsigned int) n); }
+    const char* reg() { return GENERATOR_REGISTERS[below(8)]; }
+  private:
+    unsigned int value;
+};
+
+// Upper bound on the bytes one function takes, rounded to 16
+int function_bytes(const GeneratorOptions& options) {
+  int bytes = 4 + options.labels * options.block * 6 + 5 + 3 + 8 + 8;
+  return (bytes + 15) & ~15;
+}
+
+std::string hex(int value) {
+  static const char digits[] = "0123456789abcdef";
+  std::string result("0x");
+  bool started = false;
+  for (int shift = 28; shift >= 0; shift -= 4) {
+    int digit = (value >> shift) & 0xF;
+    if (digit != 0 || started || shift == 0) {
+      result.push_back(digits[digit]);
+      started = true;
+    }
+  }
+  return result;
+}
+
+std::string local_label(int index) {
+  return "@L" + std::to_string(index);
+}
+
+std::string function_label(int index) {
+  return "F" + std::to_string(index);
+}
+
+}
+
+int generator_function_lines(const GeneratorOptions& options) {
+  return 12 + options.labels * (options.block + 1);
+}
+
+void generator_fit_lines(GeneratorOptions& options, long long lines) {
+  long long per_function = generator_function_lines(options);
+  long long functions = (lines - GENERATOR_HEADER_LINES + per_function - 1)
+                        / per_function;
+  options.functions = functions < 1 ? 1 : (int) functions;
+}
+
+void generate_source(const GeneratorOptions& options,
+                     std::vector<std::string>& source) {
+  // Invalid shape?
+  if (options.functions < 1 || options.labels < 1 || options.block < 1)
+    throw std::invalid_argument("Generator needs at least one of each");
+
+  // Every function gets a window of memory, reused once all are taken
+  int slot = function_bytes(options);
+  int slots = (GENERATOR_STACK - GENERATOR_BASE) / slot;
+  if (slots < 1)
+    throw std::invalid_argument("Function does not fit in memory");
+
+  Random random(options.seed);
+  source.reserve(source.size() + GENERATOR_HEADER_LINES
+                 + (size_t) options.functions
+                   * generator_function_lines(options));
+
+  // Entry point
+  source.push_back("; Synthetic source, seed " + std::to_string(options.seed));
+  source.push_back("\t.pos 0");
+  source.push_back("init:");
+  source.push_back("\tirmovl Stack, %esp");
+  source.push_back("\tirmovl Stack, %ebp");
+  source.push_back("\tcall " + function_label(0));
+  source.push_back("\thalt");
+
+  for (int i = 0; i < options.functions; i++) {
+    // Forward reference unless this is the last function
+    std::string callee = function_label(i + 1 < options.functions ? i + 1 : 0);
+
+    source.push_back("; Function " + std::to_string(i));
+    source.push_back("\t.pos " + hex(GENERATOR_BASE + (i % slots) * slot));
+    source.push_back("\t.align 4");
+    source.push_back(function_label(i) + ":");
+    source.push_back("\tpushl %ebp");
+    source.push_back("\trrmovl %esp,%ebp");
+
+    for (int j = 0; j < options.labels; j++) {
+      source.push_back(local_label(j) + ":");
+
+      for (int k = 0; k < options.block; k++) {
+        // Jump forward when there is a later label, otherwise loop back
+        int target = j + 1 < options.labels
+                     ? j + 1 + random.below(options.labels - j - 1) : j;
+        std::string line("\t");
+
+        switch (random.below(16)) {
+          case 0:
+            line += random.below(8) ? "nop" : "halt";
+            break;
+          case 1:
+            line += std::string("rrmovl ") + random.reg() + "," + random.reg();
+            break;
+          case 2:
+            line += std::string(GENERATOR_MOVES[random.below(6)]) + " "
+                    + random.reg() + "," + random.reg();
+            break;
+          case 3:
+            line += "irmovl $" + std::to_string(random.below(0x10000))
+                    + ", " + random.reg();
+            break;
+          case 4:
+            line += "irmovl " + function_label(random.below(options.functions))
+                    + ", " + random.reg();
+            break;
+          case 5:
+            line += std::string("rmmovl ") + random.reg() + ","
+                    + std::to_string(random.below(64) * 4) + "("
+                    + random.reg() + ")";
+            break;
+          case 6:
+            line += "mrmovl " + std::to_string(random.below(64) * 4) + "("
+                    + random.reg() + ")," + random.reg();
+            break;
+          case 7:
+            line += std::string(GENERATOR_OPS[random.below(OPERATION_COUNT)])
+                    + " " + random.reg() + "," + random.reg();
+            break;
+          case 8:
+            line += std::string(GENERATOR_JUMPS[random.below(7)]) + " "
+                    + local_label(target);
+            break;
+          case 9:
+            line += "call " + callee;
+            break;
+          case 10:
+            line += std::string("pushl ") + random.reg();
+            break;
+          case 11:
+            line += std::string("i")
+                    + GENERATOR_OPS[random.below(OPERATION_COUNT)] + " $"
+                    + std::to_string(random.below(0x10000)) + ", "
+                    + random.reg();
+            break;
+          case 12:
+            line += std::string(GENERATOR_BLOCKS[random.below(BLOCK_COUNT)])
+                    + " " + random.reg() + "," + random.reg() + ","
+                    + random.reg();
+            break;
+          case 13:
+            line += "trap";
+            break;
+          case 14:
+            line += std::string(GENERATOR_ATOMICS[random.below(ATOMIC_COUNT)])
+                    + " " + random.reg() + ","
+                    + std::to_string(random.below(64) * 4) + "("
+                    + random.reg() + ")";
+            break;
+          default:
+            line += std::string("popl ") + random.reg();
+            break;
+        }
+
+        // Some lines carry a trailing comment
+        if (random.below(4) == 0)
+          line += " ; step " + std::to_string(k);
+
+        source.push_back(line);
+      }
+    }
+
+    source.push_back("\trrmovl %ebp,%esp");
+    source.push_back("\tpopl %ebp");
+    source.push_back("\tret");
+    source.push_back("\t.long " + hex(random.below(0x7fffffff)));
+    source.push_back("\t.long " + hex(i));
+
+    // Y86-64 data, the halves drawn in order
+    unsigned long long quad = (unsigned long long) random.next() << 32;
+    quad |= random.next();
+    source.push_back("\t.quad " + std::to_string(quad));
+  }
+
+  // The stack starts at the end of memory
+  source.push_back("\t.pos " + hex(GENERATOR_STACK));
+  source.push_back("Stack:");
+}
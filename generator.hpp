@@ -0,0 +1,28 @@
+#ifndef GENERATOR_HPP
+#define GENERATOR_HPP
+
+#include <string>
+#include <vector>
+
+// Options for the synthetic source generator
+struct GeneratorOptions {
+  GeneratorOptions() : functions(16), labels(4), block(6), seed(1) {}
+
+  int functions; // Number of global functions
+  int labels; // Local @labels per function
+  int block; // Instructions after each local label
+  unsigned int seed; // Same seed always gives the same source
+};
+
+// Number of source lines one function expands to
+int generator_function_lines(const GeneratorOptions& options);
+
+// Pick the function count so the source is roughly `lines` long
+void generator_fit_lines(GeneratorOptions& options, long long lines);
+
+// Emit a valid source, throws std::invalid_argument if a function can not
+// fit in memory
+void generate_source(const GeneratorOptions& options,
+                     std::vector<std::string>& source);
+
+#endif
@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hart.h"
+#include "scheduler.h"
+
+//// Defines
+
+#define DEF_GUESTS 10000
+#define DEF_COUNT 1000
+
+// Counting loop, the count is patched in at offset 2, eax ends up as it
+#define LOOP_PROGRAM { 0x30, 0xf2, 0, 0, 0, 0, 0x30, 0xf3, 1, 0, 0, 0, 0x60, 0x30, 0x40, 0x01, 0, 1, 0, 0, \
+                       0x61, 0x32, 0x74, 0x0c, 0, 0, 0, 0x00 }
+
+// Harts that each add one to the word at HART_WORD HART_ADDS times with xadd
+#define HART_COUNT 4
+#define HART_ADDS 100000
+#define HART_WORD 0x100
+#define HART_PROGRAM { 0x30, 0xf2, 0xa0, 0x86, 0x01, 0x00, /* irmovl $100000, %edx */ \
+                       0x30, 0xf7, 0xff, 0xff, 0xff, 0xff, /* irmovl $-1, %edi */ \
+                       0x30, 0xf6, 0x01, 0x00, 0x00, 0x00, /* Loop: irmovl $1, %esi */ \
+                       0xf1, 0x63, 0x00, 0x01, 0x00, 0x00, /* xadd %esi, 0x100(%ebx) */ \
+                       0x60, 0x72, /* addl %edi, %edx */ \
+                       0x74, 0x0c, 0, 0, 0, /* jne Loop */ \
+                       0x00 }
+
+//// Type declarations
+
+typedef struct _OPTIONS
+{
+    int guests;
+    int workers;
+    int quantum;
+    int count;
+    SCHED_POLICY policy;
+    BOOL harts;
+} OPTIONS;
+
+// Guests that finished, and those that finished wrong
+typedef struct _TALLY
+{
+    atomic_int done;
+    atomic_int wrong;
+} TALLY;
+
+//// Forward declarations
+
+BOOL options_parse(OPTIONS *options, int argc, char** argv);
+void options_usage(const char* prog);
+void guest_done(void *context, GUEST *guest);
+int harts_check(void);
+BOOL harts_same(const HARTS *a, const HARTS *b);
+
+//// Main function
+
+int main(int argc, char** argv)
+{
+    OPTIONS options = { DEF_GUESTS, (int) sysconf(_SC_NPROCESSORS_ONLN), SCHED_DEF_QUANTUM, DEF_COUNT, SCHED_ROUND_ROBIN, 0 };
+    if (0 == options_parse(&options, argc, argv))
+    {
+        options_usage((0 == argc) ? "guests" : argv[0]);
+        return 0;
+    }
+    if (0 != options.harts)
+        return harts_check();
+    if (1 > options.workers)
+        options.workers = 1;
+    if (SCHED_WORKER_MAX < options.workers)
+        options.workers = SCHED_WORKER_MAX;
+
+    TALLY tally;
+    atomic_init(&tally.done, 0);
+    atomic_init(&tally.wrong, 0);
+    SCHED *sched = malloc(sizeof(SCHED));
+    GUEST *guests = calloc(options.guests, sizeof(GUEST));
+    if ((NULL == sched) || (NULL == guests)
+        || (0 == sched_init(sched, options.workers, options.quantum, options.policy, guest_done, &tally)))
+    {
+        printf("[!] Failed to set up the scheduler\n");
+        return 1;
+    }
+
+    // Loops of different lengths, so guests finish at different times
+    unsigned char program[] = LOOP_PROGRAM;
+    for (int i = 0; options.guests > i; i++)
+    {
+        GUEST *guest = guests + i;
+        int count = options.count + (i % 64) * (options.count / 16);
+        an_int_bytes(count, program + 2);
+        guest->sim = sim_create(DEF_MEMORY_SIZE, NULL);
+        guest->priority = i % SCHED_PRIORITIES;
+        guest->user = (void*) (size_t) count;
+        if ((NULL == guest->sim) || (0 == sim_load(guest->sim, program, sizeof(program))) || (0 == sched_add(sched, guest)))
+        {
+            printf("[!] Failed to create guest %d\n", i);
+            return 1;
+        }
+    }
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    BOOL ok = sched_run(sched);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    unsigned long long steps = 0;
+    unsigned long long quanta = 0;
+    for (int i = 0; sched->worker_count > i; i++)
+    {
+        SCHED_WORKER *worker = sched->workers + i;
+        printf("Worker %2d: %llu quanta, %llu steps, %llu stolen\n", i, worker->quanta, worker->steps, worker->steals);
+        steps += worker->steps;
+        quanta += worker->quanta;
+    }
+    printf("%d guests on %d workers, quantum %d, %s\n", options.guests, sched->worker_count, options.quantum,
+           (SCHED_PRIORITY == options.policy) ? "priority" : "round robin");
+    printf("%.3f s, %.1fM steps/s, %.0f switches/s\n", seconds, steps / seconds / 1e6, quanta / seconds);
+    if ((0 == ok) || (options.guests != atomic_load(&tally.done)) || (0 != atomic_load(&tally.wrong)))
+        printf("[!] %d guests finished, %d wrong\n", atomic_load(&tally.done), atomic_load(&tally.wrong));
+
+    for (int i = 0; options.guests > i; i++)
+        sim_destroy(guests[i].sim);
+    sched_free(sched);
+    free(sched);
+    free(guests);
+    return 0;
+}
+
+//// Definitions
+
+BOOL options_parse(OPTIONS *options, int argc, char** argv)
+{
+    for (int i = 1; argc > i; i++)
+    {
+        char* arg = argv[i];
+        BOOL has_value = (argc > i + 1);
+
+        if ((0 == strcmp(arg, "--guests")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &options->guests)) || (1 > options->guests))
+                return 0;
+        }
+        else if ((0 == strcmp(arg, "--workers")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &options->workers)) || (1 > options->workers))
+                return 0;
+        }
+        else if ((0 == strcmp(arg, "--quantum")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &options->quantum)) || (1 > options->quantum))
+                return 0;
+        }
+        else if ((0 == strcmp(arg, "--count")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &options->count)) || (1 > options->count))
+                return 0;
+        }
+        else if (0 == strcmp(arg, "--priority"))
+            options->policy = SCHED_PRIORITY;
+        else if (0 == strcmp(arg, "--harts"))
+            options->harts = 1;
+        else
+        {
+            printf("[!] Unknown option: '%s'\n", arg);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void options_usage(const char* prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("Options:\n");
+    printf("  --guests N     Guest programs to run, default %d\n", DEF_GUESTS);
+    printf("  --workers N    Worker threads, default one per core\n");
+    printf("  --quantum N    Steps per turn, default %d\n", SCHED_DEF_QUANTUM);
+    printf("  --count N      Shortest guest loop count, default %d\n", DEF_COUNT);
+    printf("  --priority     Run lower priority levels first instead of round robin\n");
+    printf("  --harts        Check a shared counter on harts instead, threaded and deterministic\n");
+}
+
+// Each guest counts to its own number, kept in user
+void guest_done(void *context, GUEST *guest)
+{
+    TALLY *tally = context;
+    const STATE *state = sim_state(guest->sim);
+    if ((HLT != state->status) || ((size_t) (unsigned int) state->registers.names.eax != (size_t) guest->user))
+        atomic_fetch_add(&tally->wrong, 1);
+    atomic_fetch_add(&tally->done, 1);
+}
+
+// Runs the counter threaded and twice deterministic, 0 if all counted right
+// and both deterministic runs took the same turns to the same end
+int harts_check(void)
+{
+    static const char* names[] = { "threaded", "deterministic", "deterministic" };
+    unsigned char program[] = HART_PROGRAM;
+    HARTS *runs = malloc(3 * sizeof(HARTS));
+    STATE boots[3];
+    memset(boots, 0, sizeof(boots));
+    for (int r = 0; 3 > r; r++)
+        state_init(boots + r);
+
+    BOOL ok = (NULL != runs);
+    for (int r = 0; (0 != ok) && (3 > r); r++)
+    {
+        STATE *boot = boots + r;
+        if ((0 == state_allocate(boot, DEF_MEMORY_SIZE)) || (0 == harts_init(runs + r, boot, HART_COUNT)))
+        {
+            printf("[!] Failed to set up the harts\n");
+            ok = 0;
+            break;
+        }
+        memcpy(boot->memory, program, sizeof(program));
+        runs[r].deterministic = (0 < r);
+
+        PROGRAM_STATUS status = harts_run(runs + r, NULL);
+        unsigned int counter = 0;
+        an_bytes_int(boot->memory + HART_WORD, &counter);
+        printf("%d harts %s: counter %u", HART_COUNT, names[r], counter);
+        if (0 != runs[r].deterministic)
+            printf(", %llu turns", runs[r].turns);
+        printf("\n");
+        if ((HLT != status) || (HART_COUNT * HART_ADDS != counter))
+        {
+            printf("[!] Expected %u with every hart halted\n", HART_COUNT * HART_ADDS);
+            ok = 0;
+        }
+    }
+
+    // Same turns, registers and memory both times
+    if ((0 != ok) && ((runs[1].turns != runs[2].turns) || (0 == harts_same(runs + 1, runs + 2))
+        || (0 != memcmp(boots[1].memory, boots[2].memory, boots[1].memory_size))))
+    {
+        printf("[!] Deterministic runs differ\n");
+        ok = 0;
+    }
+
+    for (int r = 0; 3 > r; r++)
+        state_free(boots + r);
+    free(runs);
+    return (0 != ok) ? 0 : 1;
+}
+
+BOOL harts_same(const HARTS *a, const HARTS *b)
+{
+    if (a->count != b->count)
+        return 0;
+
+    for (int i = 0; a->count > i; i++)
+    {
+        const STATE *x = &a->harts[i].state;
+        const STATE *y = &b->harts[i].state;
+        if ((0 != memcmp(&x->registers, &y->registers, sizeof(REGISTERS)))
+            || (0 != memcmp(&x->codes, &y->codes, sizeof(CONDITION_CODES)))
+            || (x->status != y->status) || (x->pc != y->pc) || (x->step != y->step))
+            return 0;
+    }
+
+    return 1;
+}
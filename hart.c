@@ -0,0 +1,148 @@
+#include <string.h>
+#include <time.h>
+
+#include "hart.h"
+
+//// Definitions
+
+static double harts_clock(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static void* hart_thread(void *context)
+{
+    HART *hart = context;
+    state_resume(&hart->state, hart->budget, NULL);
+    return NULL;
+}
+
+BOOL harts_init(HARTS *harts, const STATE *boot, int count)
+{
+    // Nothing passed?
+    if ((NULL == harts) || (NULL == boot))
+        return 0;
+
+    // No memory or invalid count?
+    if ((0 >= boot->memory_size) || (1 > count) || (HART_MAX < count))
+        return 0;
+
+    memset(harts, 0, sizeof(HARTS));
+    harts->count = count;
+
+    for (int i = 0; count > i; i++)
+    {
+        // Same memory, own copy of the rest
+        STATE *state = &harts->harts[i].state;
+        *state = *boot;
+        if (WORD_SIZE_64 == state->word_size)
+        {
+            state->registers64.names.rax = i;
+            state->registers64.names.rcx = count;
+        }
+        else
+        {
+            state->registers.names.eax = i;
+            state->registers.names.ecx = count;
+        }
+    }
+
+    return 1;
+}
+
+// Every hart on its own thread until all have stopped
+static void harts_parallel(HARTS *harts, const BUDGET *budget)
+{
+    for (int i = 0; harts->count > i; i++)
+    {
+        HART *hart = harts->harts + i;
+        hart->budget = budget;
+        hart->state.host = NULL;
+        hart->state.device = NULL;
+        hart->state.hle = NULL;
+        hart->started = (0 == pthread_create(&hart->thread, NULL, hart_thread, hart));
+    }
+
+    // No thread for it?  Run it on this one, the others are already going
+    for (int i = 0; harts->count > i; i++)
+        if (0 == harts->harts[i].started)
+            hart_thread(harts->harts + i);
+
+    for (int i = 0; harts->count > i; i++)
+        if (0 != harts->harts[i].started)
+        {
+            pthread_join(harts->harts[i].thread, NULL);
+            harts->harts[i].started = 0;
+        }
+}
+
+// Round robin on this thread.  Turns end on the block granular step budget,
+// which does not depend on timing, so only a time budget can change a run
+static void harts_round_robin(HARTS *harts, const BUDGET *budget)
+{
+    unsigned long long quantum = (0 != harts->quantum) ? harts->quantum : HART_DEF_QUANTUM;
+    BOOL exact = (NULL != budget) && (0 != budget->exact);
+
+    // Budget as absolute limits, the steps are per hart
+    unsigned long long stop[HART_MAX];
+    for (int i = 0; harts->count > i; i++)
+    {
+        unsigned long long step = harts->harts[i].state.step;
+        stop[i] = ~0ULL;
+        if ((NULL != budget) && (0 != budget->steps) && (~0ULL - step > budget->steps))
+            stop[i] = step + budget->steps;
+    }
+    double deadline = ((NULL != budget) && (0 < budget->seconds)) ? harts_clock() + budget->seconds : 0;
+
+    BOOL running = 1;
+    while (0 != running)
+    {
+        running = 0;
+        for (int i = 0; harts->count > i; i++)
+        {
+            // Stopped for good or out of steps?
+            STATE *state = &harts->harts[i].state;
+            if (((AOK != state->status) && (LIM != state->status)) || (stop[i] <= state->step))
+                continue;
+
+            BUDGET turn = { quantum, 0, exact };
+            if (stop[i] - state->step < quantum)
+                turn.steps = stop[i] - state->step;
+            state_resume(state, &turn, NULL);
+            harts->turns++;
+            running = 1;
+        }
+
+        // Out of time?
+        if ((0 != deadline) && (deadline <= harts_clock()))
+            break;
+    }
+}
+
+// Returns the first fault by hart number, else LIM if a hart was stopped by
+// the budget, else HLT once all have halted.  The budget applies to each hart
+PROGRAM_STATUS harts_run(HARTS *harts, const BUDGET *budget)
+{
+    // Nothing passed?
+    if ((NULL == harts) || (0 >= harts->count))
+        return INS;
+
+    if (0 != harts->deterministic)
+        harts_round_robin(harts, budget);
+    else
+        harts_parallel(harts, budget);
+
+    PROGRAM_STATUS status = HLT;
+    for (int i = 0; harts->count > i; i++)
+    {
+        PROGRAM_STATUS own = harts->harts[i].state.status;
+        if ((ADR == own) || (INS == own))
+            return own;
+        if (HLT != own)
+            status = LIM;
+    }
+
+    return status;
+}
@@ -0,0 +1,56 @@
+#ifndef HART_H
+#define HART_H
+
+#include <pthread.h>
+
+#include "state.h"
+
+// Harts run one program on one shared guest memory, each with its own
+// registers, condition codes and PC, and each on its own host thread.  Every
+// hart starts where the boot state is, with its number in eax and the number
+// of harts in ecx, so the program can give each its own stack and share of
+// the work.
+//
+// Memory model: cas and xadd are host atomics, sequentially consistent with
+// each other.  A plain store before a cas or xadd is seen by any hart whose
+// own cas or xadd on the same word comes after it.  Other than that, plain
+// rmmovl and mrmovl are not ordered between harts and may be seen half done,
+// so shared data has to be handed over through cas or xadd.
+//
+// Host services and devices are not thread safe, so harts on threads have
+// none and trap stops them with INS.  The deterministic mode instead runs the
+// harts round robin on the calling thread, quantum steps at a time, so a run
+// comes out the same every time and keeps the boot state's services.
+
+//// Defines
+
+#define HART_MAX 64
+
+// Steps a hart runs before the next gets a turn in deterministic mode
+#define HART_DEF_QUANTUM 1000
+
+//// Type declarations
+
+typedef struct _HART
+{
+    STATE state; // Memory is the boot state's
+    const BUDGET *budget;
+    pthread_t thread;
+    BOOL started;
+} HART;
+
+typedef struct _HARTS
+{
+    HART harts[HART_MAX];
+    int count;
+    BOOL deterministic;
+    unsigned long long quantum; // Steps per turn, 0 for HART_DEF_QUANTUM
+    unsigned long long turns; // Turns taken in deterministic mode
+} HARTS;
+
+//// Forward declarations
+
+BOOL harts_init(HARTS *harts, const STATE *boot, int count);
+PROGRAM_STATUS harts_run(HARTS *harts, const BUDGET *budget);
+
+#endif
@@ -127,6 +127,22 @@ void an_bytes_int_big(const unsigned char in[4], unsigned int *out)
     *out = (in[0] << 24) | (in[1] << 16) | (in[2] << 8) | in[3];
 }
 
+void an_long_bytes(const unsigned long long in, unsigned char *out)
+{
+    // Unsafe, little endian
+    an_int_bytes((unsigned int) in, out);
+    an_int_bytes((unsigned int) (in >> 32), out + 4);
+}
+
+void an_bytes_long(const unsigned char in[8], unsigned long long *out)
+{
+    unsigned int low = 0;
+    unsigned int high = 0;
+    an_bytes_int(in, &low);
+    an_bytes_int(in + 4, &high);
+    *out = ((unsigned long long) high << 32) | low;
+}
+
 unsigned int an_sign(const unsigned int in)
 {
     return (in >> 31) & 1;
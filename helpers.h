@@ -1,3 +1,6 @@
+#ifndef HELPERS_H
+#define HELPERS_H
+
 //// Type declarations
 
 typedef unsigned char BOOL;
@@ -11,4 +14,8 @@ void an_int_bytes_big(const unsigned int in, unsigned char *out);
 const char* an_bool_str(const BOOL in);
 void an_bytes_int(const unsigned char in[4], unsigned int *out);
 void an_bytes_int_big(const unsigned char in[4], unsigned int *out);
+void an_long_bytes(const unsigned long long in, unsigned char *out);
+void an_bytes_long(const unsigned char in[8], unsigned long long *out);
 unsigned int an_sign(const unsigned int in);
+
+#endif
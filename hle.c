@@ -0,0 +1,594 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "hle.h"
+
+//// Defines
+
+// pushl %ebp and rrmovl %esp,%ebp, then rrmovl, popl %ebp and ret
+#define HLE_FRAME_STEPS 5
+
+//// Type declarations
+
+// One call, with %ebp already pushed
+typedef struct _HLE_CALL
+{
+    STATE *state;
+    unsigned int frame; // esp on entry, where the return address is
+    int entry;
+    int size;
+    unsigned int args[HLE_MAX_ARGS];
+    unsigned long long steps; // Most the body may take inside the frame
+    HOST_STORE store; // What the body wrote
+} HLE_CALL;
+
+// Runs the body inside the frame, returns its steps, 0 to interpret it
+// untouched
+typedef unsigned long long (*HLE_NATIVE)(HLE_CALL *call);
+
+typedef struct _HLE_TEMPLATE
+{
+    HLE_ROUTINE routine;
+    HLE_NATIVE native;
+} HLE_TEMPLATE;
+
+//// Routines
+
+// Sum in test.src, as state_compile has it
+static const unsigned char hle_sum_code[] = {
+    0xa0, 0x5f,                         // Sum:  pushl %ebp
+    0x20, 0x45,                         //       rrmovl %esp,%ebp
+    0x50, 0x15, 0x08, 0x00, 0x00, 0x00, //       mrmovl 8(%ebp),%ecx # ecx = Start
+    0x50, 0x25, 0x0c, 0x00, 0x00, 0x00, //       mrmovl 12(%ebp),%edx # edx = Count
+    0x63, 0x00,                         //       xorl %eax,%eax
+    0x62, 0x22,                         //       andl %edx,%edx
+    0x73, 0x36, 0x00, 0x00, 0x00,       //       je End
+    0x50, 0x61, 0x00, 0x00, 0x00, 0x00, // Loop: mrmovl (%ecx),%esi
+    0x60, 0x60,                         //       addl %esi,%eax
+    0x30, 0xf3, 0x04, 0x00, 0x00, 0x00, //       irmovl $4,%ebx
+    0x60, 0x31,                         //       addl %ebx,%ecx
+    0x30, 0xf3, 0xff, 0xff, 0xff, 0xff, //       irmovl $-1,%ebx
+    0x60, 0x32,                         //       addl %ebx,%edx
+    0x74, 0x19, 0x00, 0x00, 0x00,       //       jne Loop
+    0x20, 0x45,                         // End:  rrmovl %esp,%ebp
+    0xb0, 0x5f,                         //       popl %ebp
+    0x90,                               //       ret
+};
+
+// void Copy(int *Dst, int *Src, int Count)
+static const unsigned char hle_copy_code[] = {
+    0xa0, 0x5f,                         // Copy: pushl %ebp
+    0x20, 0x45,                         //       rrmovl %esp,%ebp
+    0x50, 0x35, 0x08, 0x00, 0x00, 0x00, //       mrmovl 8(%ebp),%ebx # ebx = Dst
+    0x50, 0x15, 0x0c, 0x00, 0x00, 0x00, //       mrmovl 12(%ebp),%ecx # ecx = Src
+    0x50, 0x25, 0x10, 0x00, 0x00, 0x00, //       mrmovl 16(%ebp),%edx # edx = Count
+    0x62, 0x22,                         //       andl %edx,%edx
+    0x73, 0x40, 0x00, 0x00, 0x00,       //       je End
+    0x50, 0x61, 0x00, 0x00, 0x00, 0x00, // Loop: mrmovl (%ecx),%esi
+    0x40, 0x63, 0x00, 0x00, 0x00, 0x00, //       rmmovl %esi,(%ebx)
+    0x30, 0xf0, 0x04, 0x00, 0x00, 0x00, //       irmovl $4,%eax
+    0x60, 0x01,                         //       addl %eax,%ecx
+    0x60, 0x03,                         //       addl %eax,%ebx
+    0x30, 0xf0, 0xff, 0xff, 0xff, 0xff, //       irmovl $-1,%eax
+    0x60, 0x02,                         //       addl %eax,%edx
+    0x74, 0x1d, 0x00, 0x00, 0x00,       //       jne Loop
+    0x20, 0x54,                         // End:  rrmovl %ebp,%esp
+    0xb0, 0x5f,                         //       popl %ebp
+    0x90,                               //       ret
+};
+
+// void Fill(int *Dst, int Value, int Count)
+static const unsigned char hle_fill_code[] = {
+    0xa0, 0x5f,                         // Fill: pushl %ebp
+    0x20, 0x45,                         //       rrmovl %esp,%ebp
+    0x50, 0x35, 0x08, 0x00, 0x00, 0x00, //       mrmovl 8(%ebp),%ebx # ebx = Dst
+    0x50, 0x15, 0x0c, 0x00, 0x00, 0x00, //       mrmovl 12(%ebp),%ecx # ecx = Value
+    0x50, 0x25, 0x10, 0x00, 0x00, 0x00, //       mrmovl 16(%ebp),%edx # edx = Count
+    0x62, 0x22,                         //       andl %edx,%edx
+    0x73, 0x38, 0x00, 0x00, 0x00,       //       je End
+    0x40, 0x13, 0x00, 0x00, 0x00, 0x00, // Loop: rmmovl %ecx,(%ebx)
+    0x30, 0xf0, 0x04, 0x00, 0x00, 0x00, //       irmovl $4,%eax
+    0x60, 0x03,                         //       addl %eax,%ebx
+    0x30, 0xf0, 0xff, 0xff, 0xff, 0xff, //       irmovl $-1,%eax
+    0x60, 0x02,                         //       addl %eax,%edx
+    0x74, 0x1d, 0x00, 0x00, 0x00,       //       jne Loop
+    0x20, 0x54,                         // End:  rrmovl %ebp,%esp
+    0xb0, 0x5f,                         //       popl %ebp
+    0x90,                               //       ret
+};
+
+// int Length(int *Start), words before the first zero one
+static const unsigned char hle_length_code[] = {
+    0xa0, 0x5f,                         // Length: pushl %ebp
+    0x20, 0x45,                         //       rrmovl %esp,%ebp
+    0x50, 0x15, 0x08, 0x00, 0x00, 0x00, //       mrmovl 8(%ebp),%ecx # ecx = Start
+    0x63, 0x00,                         //       xorl %eax,%eax
+    0x50, 0x21, 0x00, 0x00, 0x00, 0x00, // Loop: mrmovl (%ecx),%edx
+    0x62, 0x22,                         //       andl %edx,%edx
+    0x73, 0x2e, 0x00, 0x00, 0x00,       //       je End
+    0x30, 0xf3, 0x04, 0x00, 0x00, 0x00, //       irmovl $4,%ebx
+    0x60, 0x31,                         //       addl %ebx,%ecx
+    0x30, 0xf3, 0x01, 0x00, 0x00, 0x00, //       irmovl $1,%ebx
+    0x60, 0x30,                         //       addl %ebx,%eax
+    0x70, 0x0c, 0x00, 0x00, 0x00,       //       jmp Loop
+    0x20, 0x54,                         // End:  rrmovl %ebp,%esp
+    0xb0, 0x5f,                         //       popl %ebp
+    0x90,                               //       ret
+};
+
+// int Multiply(int A, int B), adds A B times
+static const unsigned char hle_multiply_code[] = {
+    0xa0, 0x5f,                         // Multiply: pushl %ebp
+    0x20, 0x45,                         //       rrmovl %esp,%ebp
+    0x50, 0x15, 0x08, 0x00, 0x00, 0x00, //       mrmovl 8(%ebp),%ecx # ecx = A
+    0x50, 0x25, 0x0c, 0x00, 0x00, 0x00, //       mrmovl 12(%ebp),%edx # edx = B
+    0x63, 0x00,                         //       xorl %eax,%eax
+    0x62, 0x22,                         //       andl %edx,%edx
+    0x73, 0x28, 0x00, 0x00, 0x00,       //       je End
+    0x60, 0x10,                         // Loop: addl %ecx,%eax
+    0x30, 0xf3, 0xff, 0xff, 0xff, 0xff, //       irmovl $-1,%ebx
+    0x60, 0x32,                         //       addl %ebx,%edx
+    0x74, 0x19, 0x00, 0x00, 0x00,       //       jne Loop
+    0x20, 0x54,                         // End:  rrmovl %ebp,%esp
+    0xb0, 0x5f,                         //       popl %ebp
+    0x90,                               //       ret
+};
+
+//// Forward declarations
+
+static unsigned long long hle_sum(HLE_CALL *call);
+static unsigned long long hle_copy(HLE_CALL *call);
+static unsigned long long hle_fill(HLE_CALL *call);
+static unsigned long long hle_length(HLE_CALL *call);
+static unsigned long long hle_multiply(HLE_CALL *call);
+
+//// Definitions
+
+static const HLE_TEMPLATE hle_templates[] = {
+    { { "Sum", hle_sum_code, sizeof(hle_sum_code), 2 }, hle_sum },
+    { { "Copy", hle_copy_code, sizeof(hle_copy_code), 3 }, hle_copy },
+    { { "Fill", hle_fill_code, sizeof(hle_fill_code), 3 }, hle_fill },
+    { { "Length", hle_length_code, sizeof(hle_length_code), 1 }, hle_length },
+    { { "Multiply", hle_multiply_code, sizeof(hle_multiply_code), 2 }, hle_multiply },
+};
+
+#define HLE_TEMPLATE_COUNT ((int) (sizeof(hle_templates) / sizeof(hle_templates[0])))
+
+void hle_init(HLE *hle)
+{
+    // Nothing passed?
+    if (NULL == hle)
+        return;
+
+    memset(hle, 0, sizeof(HLE));
+}
+
+int hle_routine_count(void)
+{
+    return HLE_TEMPLATE_COUNT;
+}
+
+const HLE_ROUTINE* hle_routine(int index)
+{
+    return ((0 <= index) && (HLE_TEMPLATE_COUNT > index)) ? &hle_templates[index].routine : NULL;
+}
+
+// FNV-1a, 64 bits
+static unsigned long long hle_hash(const unsigned char *data, int size)
+{
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; size > i; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Length of an instruction a routine can have, 0 for halt, call and the rest
+static int hle_instruction(unsigned char insfn)
+{
+    switch (insfn >> 4)
+    {
+        case 1: // nop
+        case 9: // ret
+            return 1;
+        case 2: // rrmovl or cmovXX
+        case 6: // OPl
+        case 10: // pushl
+        case 11: // popl
+            return 2;
+        case 7: // jXX
+            return 5;
+        case 3: // irmovl
+        case 4: // rmmovl
+        case 5: // mrmovl
+        case 12: // iOPl
+            return 6;
+    }
+    return 0;
+}
+
+// Adds offset to the destination of every jump in a body
+static void hle_relocate(unsigned char *code, int size, unsigned int offset)
+{
+    for (int pos = 0; size > pos; pos += hle_instruction(code[pos]))
+    {
+        if (0 == hle_instruction(code[pos]))
+            return;
+        if (7 == (code[pos] >> 4) && (size >= pos + 5))
+        {
+            unsigned int dest = 0;
+            an_bytes_int(code + pos + 1, &dest);
+            an_int_bytes(dest + offset, code + pos + 1);
+        }
+    }
+}
+
+// Copies the body at entry up to its first ret, with jumps relative to
+// entry.  Its size, 0 if that is no routine a template could be
+static int hle_body(const STATE *state, int entry, unsigned char *body)
+{
+    for (int pos = 0; (HLE_MAX_BODY > pos) && (state->memory_size > entry + pos); )
+    {
+        unsigned char insfn = state->memory[entry + pos];
+        int size = hle_instruction(insfn);
+        if ((0 == size) || (HLE_MAX_BODY < pos + size) || (state->memory_size < entry + pos + size))
+            return 0;
+        memcpy(body + pos, state->memory + entry + pos, size);
+        pos += size;
+
+        // The whole body, the interpreter could run all of it?
+        if (0x90 == insfn)
+        {
+            if (state->memory_size - 6 <= entry + pos - 1)
+                return 0;
+            hle_relocate(body, pos, 0U - (unsigned int) entry);
+            return pos;
+        }
+    }
+    return 0;
+}
+
+// Index of entry, or where it would go
+static int hle_index(const HLE *hle, int entry)
+{
+    int low = 0;
+    int high = hle->count;
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+        if (hle->found[mid].entry < entry)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+HLE_FOUND* hle_find(HLE *hle, int entry)
+{
+    // Nothing passed?
+    if (NULL == hle)
+        return NULL;
+
+    int i = hle_index(hle, entry);
+    return ((hle->count > i) && (entry == hle->found[i].entry)) ? hle->found + i : NULL;
+}
+
+// Finds the routines the loaded image calls, forgetting earlier ones.
+// Returns how many
+int hle_scan(HLE *hle, const STATE *state)
+{
+    // Nothing passed?
+    if ((NULL == hle) || (NULL == state))
+        return 0;
+
+    hle_init(hle);
+    if ((WORD_SIZE_64 == state->word_size) || (6 >= state->memory_size))
+        return 0;
+
+    unsigned long long hashes[HLE_TEMPLATE_COUNT];
+    for (int i = 0; HLE_TEMPLATE_COUNT > i; i++)
+        hashes[i] = hle_hash(hle_templates[i].routine.code, hle_templates[i].routine.size);
+
+    // Every byte that could be a call, its destination may be a routine
+    unsigned char body[HLE_MAX_BODY];
+    for (int pos = 0; (state->memory_size - 5 >= pos) && (HLE_MAX > hle->count); pos++)
+    {
+        unsigned int entry = 0;
+        if (0x80 != state->memory[pos])
+            continue;
+        an_bytes_int(state->memory + pos + 1, &entry);
+        if (((unsigned int) (state->memory_size - 6) <= entry) || (NULL != hle_find(hle, (int) entry)))
+            continue;
+
+        int size = hle_body(state, (int) entry, body);
+        unsigned long long hash = hle_hash(body, size);
+        for (int i = 0; (0 < size) && (HLE_TEMPLATE_COUNT > i); i++)
+        {
+            if ((size != hle_templates[i].routine.size) || (hashes[i] != hash)
+                || (0 != memcmp(body, hle_templates[i].routine.code, size)))
+                continue;
+
+            int at = hle_index(hle, (int) entry);
+            memmove(hle->found + at + 1, hle->found + at, (size_t) (hle->count - at) * sizeof(HLE_FOUND));
+            hle->count++;
+            HLE_FOUND *found = hle->found + at;
+            memset(found, 0, sizeof(HLE_FOUND));
+            found->entry = (int) entry;
+            found->size = size;
+            found->routine = i;
+            memcpy(found->code, state->memory + entry, size);
+            break;
+        }
+    }
+
+    return hle->count;
+}
+
+// Copies routine index into memory to run at entry, for building images
+BOOL hle_place(int index, unsigned char *memory, int memory_size, int entry)
+{
+    const HLE_ROUTINE *routine = hle_routine(index);
+
+    // Nothing passed?
+    if ((NULL == routine) || (NULL == memory))
+        return 0;
+
+    // Does not fit?
+    if ((0 > entry) || (memory_size - routine->size < entry))
+        return 0;
+
+    memcpy(memory + entry, routine->code, routine->size);
+    hle_relocate(memory + entry, routine->size, (unsigned int) entry);
+    return 1;
+}
+
+// Whether count words from address are all in memory
+static BOOL hle_loads(const HLE_CALL *call, unsigned int address, unsigned long long count)
+{
+    return (0 == count) || ((unsigned long long) address + 4 * count < (unsigned long long) call->state->memory_size);
+}
+
+// As hle_loads, and clear of the routine's code and its frame
+static BOOL hle_stores(const HLE_CALL *call, unsigned int address, unsigned long long count)
+{
+    unsigned long long end = (unsigned long long) address + 4 * count;
+    return (0 == count)
+           || ((0 != hle_loads(call, address, count))
+               && ((end <= (unsigned int) call->entry) || ((unsigned int) (call->entry + call->size) <= address))
+               && ((end <= call->frame - 4) || (call->frame + 4 <= address)));
+}
+
+// Every routine ends on a count of zero, or its decrement to zero
+static void hle_codes(STATE *state)
+{
+    state->codes.ZF = 1;
+    state->codes.SF = 0;
+    state->codes.OF = 0;
+}
+
+static unsigned long long hle_sum(HLE_CALL *call)
+{
+    REGISTER_NAMES *reg = &call->state->registers.names;
+    unsigned int start = call->args[0];
+    unsigned int count = call->args[1];
+    unsigned long long steps = 5 + 7ULL * count;
+    if ((call->steps < steps) || (0 == hle_loads(call, start, count)))
+        return 0;
+
+    unsigned int sum = 0;
+    unsigned int value = 0;
+    for (unsigned int i = 0; count > i; i++)
+    {
+        an_bytes_int(call->state->memory + start + 4 * i, &value);
+        sum += value;
+    }
+
+    reg->eax = (int) sum;
+    reg->ecx = (int) (start + 4 * count);
+    reg->edx = 0;
+    if (0 != count)
+    {
+        reg->ebx = -1;
+        reg->esi = (int) value;
+    }
+    hle_codes(call->state);
+    return steps;
+}
+
+static unsigned long long hle_copy(HLE_CALL *call)
+{
+    REGISTER_NAMES *reg = &call->state->registers.names;
+    unsigned char *memory = call->state->memory;
+    unsigned int dst = call->args[0];
+    unsigned int src = call->args[1];
+    unsigned int count = call->args[2];
+    unsigned long long steps = 5 + 8ULL * count;
+    if ((call->steps < steps) || (0 == hle_loads(call, src, count)) || (0 == hle_stores(call, dst, count)))
+        return 0;
+
+    if (0 != count)
+    {
+        // Word by word where a word read was written earlier in the copy
+        if ((dst <= src) || ((unsigned long long) src + 4ULL * count <= dst))
+            memmove(memory + dst, memory + src, (size_t) count * 4);
+        else
+        {
+            for (unsigned int i = 0; count > i; i++)
+                memmove(memory + dst + 4 * i, memory + src + 4 * i, 4);
+        }
+
+        unsigned int value = 0;
+        an_bytes_int(memory + dst + 4 * (count - 1), &value);
+        reg->eax = -1;
+        reg->esi = (int) value;
+        call->store.pos = (int) dst;
+        call->store.size = (int) (4 * count);
+    }
+    reg->ebx = (int) (dst + 4 * count);
+    reg->ecx = (int) (src + 4 * count);
+    reg->edx = 0;
+    hle_codes(call->state);
+    return steps;
+}
+
+static unsigned long long hle_fill(HLE_CALL *call)
+{
+    REGISTER_NAMES *reg = &call->state->registers.names;
+    unsigned int dst = call->args[0];
+    unsigned int value = call->args[1];
+    unsigned int count = call->args[2];
+    unsigned long long steps = 5 + 6ULL * count;
+    if ((call->steps < steps) || (0 == hle_stores(call, dst, count)))
+        return 0;
+
+    for (unsigned int i = 0; count > i; i++)
+        an_int_bytes(value, call->state->memory + dst + 4 * i);
+    if (0 != count)
+    {
+        reg->eax = -1;
+        call->store.pos = (int) dst;
+        call->store.size = (int) (4 * count);
+    }
+    reg->ebx = (int) (dst + 4 * count);
+    reg->ecx = (int) value;
+    reg->edx = 0;
+    hle_codes(call->state);
+    return steps;
+}
+
+static unsigned long long hle_length(HLE_CALL *call)
+{
+    REGISTER_NAMES *reg = &call->state->registers.names;
+    unsigned int start = call->args[0];
+    unsigned int count = 0;
+    unsigned int value = 0;
+
+    // Up to the zero word, all of it in memory and in the budget
+    for (;;)
+    {
+        if ((0 == hle_loads(call, start + 4 * count, 1)) || (call->steps < 5 + 8ULL * count))
+            return 0;
+        an_bytes_int(call->state->memory + start + 4 * count, &value);
+        if (0 == value)
+            break;
+        count++;
+    }
+
+    reg->eax = (int) count;
+    reg->ecx = (int) (start + 4 * count);
+    reg->edx = 0;
+    if (0 != count)
+        reg->ebx = 1;
+    hle_codes(call->state);
+    return 5 + 8ULL * count;
+}
+
+static unsigned long long hle_multiply(HLE_CALL *call)
+{
+    REGISTER_NAMES *reg = &call->state->registers.names;
+    unsigned int a = call->args[0];
+    unsigned int b = call->args[1];
+    unsigned long long steps = 5 + 4ULL * b;
+    if (call->steps < steps)
+        return 0;
+
+    reg->eax = (int) (a * b);
+    reg->ecx = (int) a;
+    reg->edx = 0;
+    if (0 != b)
+        reg->ebx = -1;
+    hle_codes(call->state);
+    return steps;
+}
+
+// Called with state on the entry of a routine its call just went to.  Runs
+// it natively up to and including its ret, at most steps of them, and puts
+// what it stored besides the pushed %ebp in store.  Returns the steps it
+// stood for, 0 if the routine is to be interpreted
+unsigned long long hle_run(HLE *hle, STATE *state, unsigned long long steps, HOST_STORE *store)
+{
+    if (NULL != store)
+    {
+        store->pos = -1;
+        store->size = 0;
+    }
+
+    // Nothing passed?
+    if ((NULL == hle) || (NULL == state))
+        return 0;
+
+    // Not a routine found?
+    HLE_FOUND *found = hle_find(hle, state->pc);
+    if (NULL == found)
+        return 0;
+
+    const HLE_TEMPLATE *known = hle_templates + found->routine;
+    unsigned char *memory = state->memory;
+    unsigned int frame = (unsigned int) state->registers.names.esp;
+    unsigned int back = 0;
+
+    // Changed since the scan, or a frame that faults, or too long?  The
+    // pushed %ebp, the arguments and the return address have to be in memory
+    if ((state->memory_size < found->entry + found->size)
+        || (0 != memcmp(memory + found->entry, found->code, found->size)) || (4 > frame)
+        || ((unsigned long long) frame + 4ULL * (known->routine.args + 1) >= (unsigned long long) state->memory_size)
+        || (HLE_FRAME_STEPS > steps))
+    {
+        found->interpreted++;
+        return 0;
+    }
+
+    // Returning past the end, or a push into the code?
+    an_bytes_int(memory + frame, &back);
+    if (((unsigned int) (state->memory_size - 6) <= back)
+        || ((frame - 4 < (unsigned int) (found->entry + found->size)) && ((unsigned int) found->entry < frame + 4)))
+    {
+        found->interpreted++;
+        return 0;
+    }
+
+    // pushl %ebp, the body may read it back
+    unsigned char pushed[4];
+    memcpy(pushed, memory + frame - 4, 4);
+    an_int_bytes((unsigned int) state->registers.names.ebp, memory + frame - 4);
+
+    HLE_CALL call = { state, frame, found->entry, found->size, { 0 }, steps - HLE_FRAME_STEPS, { -1, 0 } };
+    for (int i = 0; known->routine.args > i; i++)
+        an_bytes_int(memory + frame + 4 + 4 * i, call.args + i);
+    unsigned long long body = known->native(&call);
+    if (0 == body)
+    {
+        memcpy(memory + frame - 4, pushed, 4);
+        found->interpreted++;
+        return 0;
+    }
+
+    // popl %ebp gets back what was pushed, nothing stores over the frame
+    state->registers.names.esp = (int) (frame + 4);
+    state->pc = (int) back;
+    state->step += HLE_FRAME_STEPS + body;
+    found->calls++;
+    found->steps += HLE_FRAME_STEPS + body;
+    if (NULL != store)
+        *store = call.store;
+
+    return HLE_FRAME_STEPS + body;
+}
+
+void hle_report(HLE *hle)
+{
+    // Nothing passed?
+    if (NULL == hle)
+        return;
+
+    printf("High level emulation:\n");
+    for (int i = 0; hle->count > i; i++)
+    {
+        HLE_FOUND *found = hle->found + i;
+        printf("0x%04x: %-10s %llu calls for %llu steps, %llu interpreted\n", found->entry,
+               hle_templates[found->routine].routine.name, found->calls, found->steps, found->interpreted);
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef HLE_H
+#define HLE_H
+
+#include "state.h"
+
+// High level emulation of library routines.  hle_scan fingerprints every
+// routine an image calls when it is loaded: the body up to its ret is hashed
+// with jump destinations taken relative to its entry, so a routine hashes the
+// same wherever it was linked, and matched against the templates in hle.c.
+// A call to one found then runs a native version up to and including its
+// ret, with the same memory, registers, condition codes and step count as
+// interpreting it.  Whenever that cannot be exact the routine is interpreted
+// as before: its bytes changed since the scan, an access would fault or reach
+// a device, it would store over its own code or frame, or the step budget
+// ends inside it.  Y86-32 only, and not on probed runs, whose probes see
+// every instruction.  One HLE per machine, the counts are not shared safely.
+
+//// Defines
+
+#define HLE_MAX 64 // Routines found in one image
+#define HLE_MAX_BODY 128 // Bytes of the longest routine
+#define HLE_MAX_ARGS 3
+
+//// Type declarations
+
+// A routine as it is linked at address 0, with a native version
+typedef struct _HLE_ROUTINE
+{
+    const char* name;
+    const unsigned char *code;
+    int size;
+    int args; // Words at 8(%ebp) on
+} HLE_ROUTINE;
+
+typedef struct _HLE_FOUND
+{
+    int entry;
+    int size;
+    int routine; // Index of its HLE_ROUTINE
+    unsigned char code[HLE_MAX_BODY]; // As scanned, checked on every call
+    unsigned long long calls; // Run natively
+    unsigned long long steps; // Steps those calls stood for
+    unsigned long long interpreted; // Calls it could not run
+} HLE_FOUND;
+
+struct _HLE
+{
+    HLE_FOUND found[HLE_MAX]; // Sorted by entry
+    int count;
+};
+
+//// Forward declarations
+
+void hle_init(HLE *hle);
+int hle_scan(HLE *hle, const STATE *state);
+HLE_FOUND* hle_find(HLE *hle, int entry);
+unsigned long long hle_run(HLE *hle, STATE *state, unsigned long long steps, HOST_STORE *store);
+int hle_routine_count(void);
+const HLE_ROUTINE* hle_routine(int index);
+BOOL hle_place(int index, unsigned char *memory, int memory_size, int entry);
+void hle_report(HLE *hle);
+
+#endif
@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hostio.h"
+
+//// Forward declarations
+
+static PROGRAM_STATUS hostio_exit(void *context, STATE *state, HOST_STORE *store);
+static PROGRAM_STATUS hostio_write(void *context, STATE *state, HOST_STORE *store);
+static PROGRAM_STATUS hostio_read(void *context, STATE *state, HOST_STORE *store);
+static PROGRAM_STATUS hostio_time(void *context, STATE *state, HOST_STORE *store);
+
+//// Definitions
+
+BOOL hostio_init(HOSTIO *io, int buffer_size)
+{
+    // Nothing passed?
+    if (NULL == io)
+        return 0;
+
+    memset(io, 0, sizeof(HOSTIO));
+    io->buffer_size = (0 < buffer_size) ? buffer_size : HOSTIO_DEF_BUFFER;
+    io->in_fd = STDIN_FILENO;
+    io->out_fd[0] = STDOUT_FILENO;
+    io->out_fd[1] = STDERR_FILENO;
+
+    // Every buffer in one block
+    io->in = malloc((size_t) io->buffer_size * (HOSTIO_OUTPUTS + 1));
+    if (NULL == io->in)
+        return 0;
+    for (int i = 0; HOSTIO_OUTPUTS > i; i++)
+        io->out[i] = io->in + (size_t) io->buffer_size * (i + 1);
+
+    host_add(&io->host, HOSTIO_EXIT, hostio_exit, io);
+    host_add(&io->host, HOSTIO_WRITE, hostio_write, io);
+    host_add(&io->host, HOSTIO_READ, hostio_read, io);
+    host_add(&io->host, HOSTIO_TIME, hostio_time, io);
+
+    return 1;
+}
+
+// All of it, unless the host descriptor fails
+static BOOL hostio_write_all(HOSTIO *io, int fd, const unsigned char *data, int size)
+{
+    while (0 < size)
+    {
+        ssize_t done = write(fd, data, size);
+        io->syscalls++;
+        if (0 > done)
+        {
+            if (EINTR == errno)
+                continue;
+            io->failed = 1;
+            return 0;
+        }
+        data += done;
+        size -= (int) done;
+    }
+
+    return 1;
+}
+
+BOOL hostio_flush(HOSTIO *io)
+{
+    // Nothing passed?
+    if ((NULL == io) || (NULL == io->in))
+        return 0;
+
+    BOOL ok = 1;
+    for (int i = 0; HOSTIO_OUTPUTS > i; i++)
+    {
+        ok = hostio_write_all(io, io->out_fd[i], io->out[i], io->out_used[i]) && ok;
+        io->out_used[i] = 0;
+    }
+
+    return ok;
+}
+
+void hostio_free(HOSTIO *io)
+{
+    // Nothing passed?
+    if (NULL == io)
+        return;
+
+    free(io->in);
+    io->in = NULL;
+    for (int i = 0; HOSTIO_OUTPUTS > i; i++)
+        io->out[i] = NULL;
+}
+
+// Guest range edx to edx + ebx, or 0 if it is not all in memory
+static BOOL hostio_range(const STATE *state, unsigned int *pos, unsigned int *size)
+{
+    *pos = (unsigned int) state->registers.names.edx;
+    *size = (unsigned int) state->registers.names.ebx;
+    return ((unsigned int) state->memory_size >= *size) && (state->memory_size - *size >= *pos);
+}
+
+static PROGRAM_STATUS hostio_exit(void *context, STATE *state, HOST_STORE *store)
+{
+    HOSTIO *io = context;
+    io->calls++;
+    io->exited = 1;
+    io->exit_code = state->registers.names.ecx;
+    return HLT;
+}
+
+static PROGRAM_STATUS hostio_write(void *context, STATE *state, HOST_STORE *store)
+{
+    HOSTIO *io = context;
+    io->calls++;
+
+    unsigned int pos = 0;
+    unsigned int size = 0;
+    if (0 == hostio_range(state, &pos, &size))
+        return ADR;
+
+    // Not stdout or stderr?
+    int out = state->registers.names.ecx - 1;
+    if ((0 > out) || (HOSTIO_OUTPUTS <= out))
+    {
+        state->registers.names.eax = -1;
+        return AOK;
+    }
+
+    // Make room, anything as large as the buffer goes straight out
+    const unsigned char *data = state->memory + pos;
+    if ((unsigned int) (io->buffer_size - io->out_used[out]) < size)
+    {
+        hostio_write_all(io, io->out_fd[out], io->out[out], io->out_used[out]);
+        io->out_used[out] = 0;
+    }
+    if ((unsigned int) io->buffer_size <= size)
+        hostio_write_all(io, io->out_fd[out], data, (int) size);
+    else
+    {
+        memcpy(io->out[out] + io->out_used[out], data, size);
+        io->out_used[out] += (int) size;
+    }
+
+    state->registers.names.eax = (int) size;
+    return AOK;
+}
+
+static PROGRAM_STATUS hostio_read(void *context, STATE *state, HOST_STORE *store)
+{
+    HOSTIO *io = context;
+    io->calls++;
+
+    unsigned int pos = 0;
+    unsigned int size = 0;
+    if (0 == hostio_range(state, &pos, &size))
+        return ADR;
+
+    // Not stdin?
+    if (0 != state->registers.names.ecx)
+    {
+        state->registers.names.eax = -1;
+        return AOK;
+    }
+
+    // Read ahead once the buffer runs dry, a prompt may be waiting in the output
+    if ((io->in_pos == io->in_used) && (0 < size))
+    {
+        hostio_flush(io);
+        ssize_t done;
+        do
+        {
+            done = read(io->in_fd, io->in, io->buffer_size);
+            io->syscalls++;
+        }
+        while ((0 > done) && (EINTR == errno));
+        if (0 > done)
+        {
+            state->registers.names.eax = -1;
+            return AOK;
+        }
+        io->in_pos = 0;
+        io->in_used = (int) done;
+    }
+
+    // Whatever is buffered, up to the size asked for
+    unsigned int count = (unsigned int) (io->in_used - io->in_pos);
+    if (size < count)
+        count = size;
+    memcpy(state->memory + pos, io->in + io->in_pos, count);
+    io->in_pos += (int) count;
+    store->pos = (int) pos;
+    store->size = (int) count;
+
+    state->registers.names.eax = (int) count;
+    return AOK;
+}
+
+static PROGRAM_STATUS hostio_time(void *context, STATE *state, HOST_STORE *store)
+{
+    HOSTIO *io = context;
+    io->calls++;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    state->registers.names.eax = (int) now.tv_sec;
+    state->registers.names.edx = (int) (now.tv_nsec / 1000);
+    return AOK;
+}
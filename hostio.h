@@ -0,0 +1,64 @@
+#ifndef HOSTIO_H
+#define HOSTIO_H
+
+#include "state.h"
+
+// Standard host services for trap.  Guest output is kept in a buffer per
+// descriptor and written with one large write when it fills or on flush, and
+// input is read ahead the same way, so a guest printing a byte at a time does
+// not make a system call each time.
+//
+//   eax  service  arguments                           result
+//   0    exit     ecx code                            stops the run, status HLT
+//   1    write    ecx fd 1 or 2, edx address, ebx n   eax bytes, -1 for a bad fd
+//   2    read     ecx fd 0, edx address, ebx n        eax bytes, 0 at the end, -1 on error
+//   3    time                                         eax seconds, edx microseconds
+//
+// A range outside guest memory stops the run with ADR.
+
+//// Defines
+
+#define HOSTIO_EXIT 0
+#define HOSTIO_WRITE 1
+#define HOSTIO_READ 2
+#define HOSTIO_TIME 3
+
+#define HOSTIO_DEF_BUFFER 65536
+
+// Guest stdout and stderr
+#define HOSTIO_OUTPUTS 2
+
+//// Type declarations
+
+typedef struct _HOSTIO
+{
+    HOST host;
+    int buffer_size;
+
+    // Output, by guest descriptor less one
+    int out_fd[HOSTIO_OUTPUTS];
+    unsigned char *out[HOSTIO_OUTPUTS];
+    int out_used[HOSTIO_OUTPUTS];
+
+    // Input read ahead
+    int in_fd;
+    unsigned char *in;
+    int in_pos;
+    int in_used;
+
+    BOOL exited;
+    int exit_code;
+    BOOL failed; // A host write failed, output was lost
+
+    // Counters
+    unsigned long long calls;
+    unsigned long long syscalls;
+} HOSTIO;
+
+//// Forward declarations
+
+BOOL hostio_init(HOSTIO *io, int buffer_size);
+BOOL hostio_flush(HOSTIO *io);
+void hostio_free(HOSTIO *io);
+
+#endif
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "wire.h"
+
+//// Defines
+
+#define DEF_SOCKET "sim.sock"
+#define DEF_REQUESTS 100000
+#define DEF_BATCH 1
+#define DEF_PROGRAMS 16
+
+// Counting loop, the count is patched in at offset 2, eax ends up as it
+#define LOOP_PROGRAM { 0x30, 0xf2, 0, 0, 0, 0, 0x30, 0xf3, 1, 0, 0, 0, 0x60, 0x30, 0x40, 0x01, 0, 1, 0, 0, \
+                       0x61, 0x32, 0x74, 0x0c, 0, 0, 0, 0x00 }
+
+//// Type declarations
+
+typedef struct _OPTIONS
+{
+    const char* socket;
+    int requests;
+    int batch;
+    int programs;
+} OPTIONS;
+
+//// Forward declarations
+
+BOOL options_parse(OPTIONS *options, int argc, char** argv);
+void options_usage(const char* prog);
+double clock_now(void);
+int compare_double(const void *a, const void *b);
+BOOL check_results(const unsigned char *data, size_t size, int batch, const int *counts, BOOL *missing, int *missing_count);
+
+//// Main function
+
+int main(int argc, char** argv)
+{
+    OPTIONS options = { DEF_SOCKET, DEF_REQUESTS, DEF_BATCH, DEF_PROGRAMS };
+    if (0 == options_parse(&options, argc, argv))
+    {
+        options_usage((0 == argc) ? "loadgen" : argv[0]);
+        return 0;
+    }
+
+    struct sockaddr_un address = { 0 };
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, options.socket, sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((0 > fd) || (0 != connect(fd, (struct sockaddr*) &address, sizeof(address))))
+    {
+        printf("[!] Could not connect to: '%s'\n", options.socket);
+        return 1;
+    }
+
+    // One loop per program, counting to a different number
+    unsigned char program[] = LOOP_PROGRAM;
+    unsigned char put[8 + sizeof(program)];
+    unsigned long long *hashes = malloc(options.programs * sizeof(unsigned long long));
+    int *counts = malloc(options.programs * sizeof(int));
+    int *batch_counts = malloc(options.batch * sizeof(int));
+    BOOL *missing = malloc(options.batch * sizeof(BOOL));
+    int batches = (options.requests + options.batch - 1) / options.batch;
+    double *latencies = malloc(batches * sizeof(double));
+    unsigned char *request = malloc(10 + options.batch * 18);
+    unsigned char *reply = NULL;
+    size_t reply_size = 0;
+    size_t reply_capacity = 0;
+    unsigned char type = 0;
+    if ((NULL == hashes) || (NULL == counts) || (NULL == batch_counts) || (NULL == missing) || (NULL == latencies) || (NULL == request))
+    {
+        printf("[!] Failed to allocate\n");
+        return 1;
+    }
+    for (int i = 0; options.programs > i; i++)
+    {
+        counts[i] = 10 + i;
+        an_int_bytes(counts[i], program + 2);
+        hashes[i] = wire_hash(program, sizeof(program));
+    }
+
+    BOOL ok = 1;
+    int sent = 0;
+    double start = clock_now();
+    for (int b = 0; (batches > b) && (0 != ok); b++)
+    {
+        int batch = (options.requests - sent < options.batch) ? options.requests - sent : options.batch;
+        unsigned char *out = wire_put_varint(request, batch);
+        for (int i = 0; batch > i; i++)
+        {
+            int p = (sent + i) % options.programs;
+            wire_put_long(out, hashes[p]);
+            out = wire_put_varint(out + 8, 0);
+        }
+
+        double begin = clock_now();
+        ok = wire_send(fd, WIRE_RUN, request, out - request) && wire_recv(fd, &type, &reply, &reply_size, &reply_capacity);
+
+        // Programs the server does not have, send them and run again
+        int missing_count = 0;
+        for (int i = 0; batch > i; i++)
+            batch_counts[i] = counts[(sent + i) % options.programs];
+        ok = ok && check_results(reply, reply_size, batch, batch_counts, missing, &missing_count);
+        if ((0 != ok) && (0 != missing_count))
+        {
+            for (int i = 0; (batch > i) && (0 != ok); i++)
+                if (0 != missing[i])
+                {
+                    int p = (sent + i) % options.programs;
+                    an_int_bytes(counts[p], program + 2);
+                    wire_put_long(put, hashes[p]);
+                    memcpy(put + 8, program, sizeof(program));
+                    ok = wire_send(fd, WIRE_PUT, put, sizeof(put)) && wire_recv(fd, &type, &reply, &reply_size, &reply_capacity)
+                         && (1 == reply_size) && (1 == reply[0]);
+                }
+            ok = ok && wire_send(fd, WIRE_RUN, request, out - request) && wire_recv(fd, &type, &reply, &reply_size, &reply_capacity)
+                 && check_results(reply, reply_size, batch, batch_counts, missing, &missing_count) && (0 == missing_count);
+        }
+
+        latencies[b] = clock_now() - begin;
+        sent += batch;
+    }
+    double elapsed = clock_now() - start;
+    close(fd);
+
+    if (0 == ok)
+        printf("[!] Bad reply from the server\n");
+    else
+    {
+        qsort(latencies, batches, sizeof(double), compare_double);
+        printf("%d runs in %d batches of %d, %d programs\n", sent, batches, options.batch, options.programs);
+        printf("%.3f s, %.0f runs/s\n", elapsed, sent / elapsed);
+        printf("Batch latency: p50 %.1f us, p99 %.1f us, max %.1f us\n", latencies[batches / 2] * 1e6,
+               latencies[(int) (batches * 0.99)] * 1e6, latencies[batches - 1] * 1e6);
+    }
+
+    free(hashes);
+    free(counts);
+    free(batch_counts);
+    free(missing);
+    free(latencies);
+    free(request);
+    free(reply);
+    return (0 != ok) ? 0 : 1;
+}
+
+//// Definitions
+
+BOOL options_parse(OPTIONS *options, int argc, char** argv)
+{
+    for (int i = 1; argc > i; i++)
+    {
+        char* arg = argv[i];
+        BOOL has_value = (argc > i + 1);
+
+        if ((0 == strcmp(arg, "--socket")) && has_value)
+            options->socket = argv[++i];
+        else if ((0 == strcmp(arg, "--requests")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &options->requests)) || (1 > options->requests))
+                return 0;
+        }
+        else if ((0 == strcmp(arg, "--batch")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &options->batch)) || (1 > options->batch) || (65536 < options->batch))
+                return 0;
+        }
+        else if ((0 == strcmp(arg, "--programs")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &options->programs)) || (1 > options->programs))
+                return 0;
+        }
+        else
+        {
+            printf("[!] Unknown option: '%s'\n", arg);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void options_usage(const char* prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("Options:\n");
+    printf("  --socket PATH    Server socket, default %s\n", DEF_SOCKET);
+    printf("  --requests N     Runs to send, default %d\n", DEF_REQUESTS);
+    printf("  --batch N        Runs per request, default %d\n", DEF_BATCH);
+    printf("  --programs N     Different programs to cycle through, default %d\n", DEF_PROGRAMS);
+}
+
+double clock_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+int compare_double(const void *a, const void *b)
+{
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+// Every run must halt with eax at its count, or be unknown to the server
+BOOL check_results(const unsigned char *data, size_t size, int batch, const int *counts, BOOL *missing, int *missing_count)
+{
+    const unsigned char *end = data + size;
+    unsigned long long value = 0;
+    data = wire_get_varint(data, end, &value);
+    if ((NULL == data) || (value != (unsigned long long) batch))
+        return 0;
+
+    *missing_count = 0;
+    for (int i = 0; batch > i; i++)
+    {
+        if (end <= data)
+            return 0;
+        unsigned char status = *data++;
+        missing[i] = (WIRE_UNKNOWN == status);
+        if (0 != missing[i])
+        {
+            (*missing_count)++;
+            continue;
+        }
+
+        // Steps and PC, then codes and the register mask
+        unsigned long long mask = 0;
+        data = wire_get_varint(data, end, &value);
+        data = (NULL == data) ? NULL : wire_get_varint(data, end, &value);
+        if ((NULL == data) || (end - data < 1))
+            return 0;
+        data = wire_get_varint(data + 1, end, &mask);
+
+        unsigned long long eax = 0;
+        for (int r = 0; (REGISTER64_COUNT > r) && (NULL != data); r++)
+            if (0 != (mask & (1ULL << r)))
+                data = wire_get_varint(data, end, (0 == r) ? &eax : &value);
+        if ((NULL == data) || (HLT != status) || ((unsigned long long) counts[i] != eax))
+            return 0;
+
+        // Changed words
+        unsigned long long words = 0;
+        data = wire_get_varint(data, end, &words);
+        for (unsigned long long w = 0; (words > w) && (NULL != data); w++)
+        {
+            data = wire_get_varint(data, end, &value);
+            data = (NULL == data) ? NULL : wire_get_varint(data, end, &value);
+        }
+        if (NULL == data)
+            return 0;
+    }
+
+    return (end == data);
+}
@@ -1,98 +1,76 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-#include "helpers.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "state.h"
+#include "hostio.h"
+#include "console.h"
+#include "pipe.h"
+#include "cache.h"
+#include "bpred.h"
+#include "trace.h"
+#include "engine.h"
+#include "dump.h"
+#include "watch.h"
+#include "hle.h"
+#include "breakpoint.h"
 
 //// Defines
 
-// For using registers as indexed array
-#define REGISTER_COUNT 8
-#define REGISTER_NAME_ARRAY { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi" }
-
-// Special value
-#define REGISTER_NONE 0xF
-
-// Status information
-#define STATUS_COUNT 4
-#define STATUS_NAME_ARRAY { "AOK", "HLT", "ADR", "INS" }
-
-// Default size of memory block in bytes
-#define DEF_MEMORY_SIZE 1024
+// Addresses listed in the per PC reports
+#define REPORT_TOP 10
 
 //// Type declarations
 
-typedef struct _REGISTER_NAMES
-{
-    int eax;
-    int ecx;
-    int edx;
-    int ebx;
-    int esp;
-    int ebp;
-    int esi;
-    int edi;
-} REGISTER_NAMES;
-
-typedef int REGISTER_ID;
-
-typedef union _REGISTERS
-{
-    REGISTER_NAMES names;
-    REGISTER_ID ids[REGISTER_COUNT];
-} REGISTERS;
-
-typedef struct _CONDITION_CODES
-{
-    BOOL ZF;
-    BOOL SF;
-    BOOL OF;
-} CONDITION_CODES;
-
-typedef enum _PROGRAM_STATUS
-{
-    AOK = 1,
-    HLT,
-    ADR,
-    INS,
-    _FIRST = AOK,
-    _LAST = INS
-} PROGRAM_STATUS;
-
-typedef unsigned char *MEMORY;
-
-typedef struct _STATE
+typedef struct _OPTIONS
 {
-    REGISTERS registers;
-    CONDITION_CODES codes;
-    PROGRAM_STATUS status;
-    MEMORY memory;
-    int memory_size;
-    int pc;
-    int step;
-} STATE;
+    char* source_file;
+    char* memory_size;
+    BOOL pipe;
+    int pipe_diagram;
+    CACHE_CONFIG icache;
+    CACHE_CONFIG dcache;
+    CACHE_CONFIG cache[CACHE_LEVEL_MAX - 2];
+    int cache_count;
+    char* bpred;
+    int ras_size;
+    char* trace;
+    int trace_interval;
+    BUDGET budget;
+    int block_step_bytes;
+    int io_buffer;
+    char* console;
+    char* backend;
+    int dump;
+    char* dump_file;
+    char* watch[WATCH_MAX];
+    int watch_count;
+    int* breaks;
+    int break_count;
+    char** incbins;
+    int incbin_count;
+    BOOL hle;
+} OPTIONS;
 
 //// Forward declarations
 
-void state_init(STATE *state);
-BOOL state_allocate(STATE *state, int size);
-void state_free(STATE *state);
-BOOL state_compile(STATE *state, const char* filename);
-void state_run(STATE *state, STATE *state_original);
-BOOL state_clone(STATE *state_from, STATE *state_to);
-void state_changes(STATE *state_old, STATE *state_now);
-BOOL state_push(STATE *state, unsigned int val);
-BOOL state_pop(STATE *state, unsigned int *val);
+BOOL options_parse(OPTIONS *options, int argc, char** argv);
+void options_usage(const char* prog);
+BOOL incbin_parse(const char* arg, int *address, const char** path);
+PROGRAM_STATUS main_watch_resume(void *context, STATE *state, const BUDGET *budget, PROBES *probes);
 
 //// Main function
 
 int main(int argc, char** argv)
 {
-    // No source file?
-    if (1 >= argc)
+    // Read arguments
+    OPTIONS options = { 0 };
+    options.trace_interval = TRACE_DEF_INTERVAL;
+    if (0 == options_parse(&options, argc, argv))
     {
-        char* prog = (0 == argc) ? "program" : argv[0];
-        printf("Usage: %s <source-file>\n", prog);
+        options_usage((0 == argc) ? "program" : argv[0]);
         return 0;
     }
 
@@ -100,714 +78,539 @@ int main(int argc, char** argv)
     STATE state = { 0 };
     state_init(&state);
 
-    // Read arguments
-    char* source_file = argv[1];
     int memory_size = DEF_MEMORY_SIZE;
 
     // Supplied memory size?
-    if (3 <= argc)
-        if ((0 == an_parse_int(argv[2], &memory_size)) || (1 > memory_size) || (0 != memory_size % 4))
+    if (NULL != options.memory_size)
+        if ((0 == an_parse_int(options.memory_size, &memory_size)) || (1 > memory_size) || (0 != memory_size % 4))
         {
             memory_size = DEF_MEMORY_SIZE;
-            printf("[!] Invalid memory size: '%s'", argv[2]);
+            printf("[!] Invalid memory size: '%s'", options.memory_size);
             printf(", using memory size of: %d\n", memory_size);
         }
         else
             printf("[-] Setting memory size to: %d\n", memory_size);
-    
+
     // Allocate memory
     if (0 == state_allocate(&state, memory_size))
     {
         printf("[!] Failed to allocate memory\n");
         return 0;
     }
-    
+
     // Try to compile from source file
-    if (0 == state_compile(&state, source_file))
+    if (0 == state_compile(&state, options.source_file))
     {
         printf("[!] Failed to compile\n");
         state_free(&state);
         return 0;
     }
 
+    state.block_step_bytes = options.block_step_bytes;
+
+    // Host services for trap
+    HOSTIO io;
+    if (0 == hostio_init(&io, options.io_buffer))
+    {
+        printf("[!] Failed to allocate host buffers\n");
+        hostio_free(&io);
+        state_free(&state);
+        return 0;
+    }
+    state.host = &io.host;
+
     // Make a copy
     STATE state_original = { 0 };
     if (0 == state_clone(&state, &state_original))
     {
         printf("[!] Could not clone state\n");
         state_free(&state);
+        hostio_free(&io);
         return 0;
     }
 
-    // Run program
-    state_run(&state, &state_original);
+    // Host files over guest memory, mapped into the copy too so neither reads them
+    for (int i = 0; options.incbin_count > i; i++)
+    {
+        int address = 0;
+        const char* path = NULL;
+        incbin_parse(options.incbins[i], &address, &path);
+        if ((0 > state_map_file(&state, address, path)) || (0 > state_map_file(&state_original, address, path)))
+            printf("[!] Could not place '%s' at 0x%x\n", path, address);
+    }
 
-    // Log the changes
-    state_changes(&state_original, &state);
+    // Attach the requested models
+    PROBES probes = { 0 };
+    PIPE pipe = { 0 };
+    if (0 != options.pipe)
+    {
+        if (0 == pipe_init(&pipe, memory_size, options.pipe_diagram))
+        {
+            printf("[!] Failed to allocate pipeline model\n");
+            state_free(&state);
+            state_free(&state_original);
+            hostio_free(&io);
+            return 0;
+        }
+        probes_add(&probes, pipe_retire, &pipe);
+    }
+    CACHE cache = { 0 };
+    BOOL use_cache = (0 != options.icache.size) || (0 != options.dcache.size) || (0 != options.cache_count);
+    if (0 != use_cache)
+    {
+        if (0 == cache_init(&cache, memory_size, (0 != options.icache.size) ? &options.icache : NULL,
+                            (0 != options.dcache.size) ? &options.dcache : NULL, options.cache, options.cache_count))
+        {
+            printf("[!] Failed to allocate cache model\n");
+            cache_free(&cache);
+            pipe_free(&pipe);
+            state_free(&state);
+            state_free(&state_original);
+            hostio_free(&io);
+            return 0;
+        }
+        probes_add(&probes, cache_retire, &cache);
+    }
+    BPRED bpred = { 0 };
+    BOOL use_bpred = (NULL != options.bpred) || (0 != options.ras_size);
+    if (0 != use_bpred)
+    {
+        if (((NULL != options.bpred) && (0 == bpred_parse(&bpred, options.bpred))) || (0 == bpred_init(&bpred, memory_size, options.ras_size)))
+        {
+            printf("[!] Failed to set up branch predictors\n");
+            bpred_free(&bpred);
+            cache_free(&cache);
+            pipe_free(&pipe);
+            state_free(&state);
+            state_free(&state_original);
+            hostio_free(&io);
+            return 0;
+        }
+        probes_add(&probes, bpred_retire, &bpred);
+    }
+    TRACE trace = { 0 };
+    if (NULL != options.trace)
+    {
+        if (0 == trace_open(&trace, options.trace, &state, options.trace_interval))
+        {
+            printf("[!] Could not open trace: '%s'\n", options.trace);
+            trace_close(&trace, NULL);
+            bpred_free(&bpred);
+            cache_free(&cache);
+            pipe_free(&pipe);
+            state_free(&state);
+            state_free(&state_original);
+            hostio_free(&io);
+            return 0;
+        }
+        probes_add(&probes, trace_retire, &trace);
+    }
 
-    // Free memory
-    state_free(&state);
-    state_free(&state_original);
+    // Console device, "-" for stdout
+    CONSOLE console;
+    int console_fd = -1;
+    if (NULL != options.console)
+    {
+        console_fd = (0 == strcmp(options.console, "-")) ? STDOUT_FILENO
+                     : open(options.console, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if ((0 > console_fd) || (0 == console_open(&console, console_fd, 0)))
+        {
+            printf("[!] Could not open console: '%s'\n", options.console);
+            console_fd = -1;
+        }
+        else
+            state.device = &console.device;
+    }
 
-    return 0;
-}
+    // Watchpoints, kept by page protection on the reference executor
+    WATCHES watches;
+    BOOL use_watch = (0 < options.watch_count);
+    if (0 != use_watch)
+    {
+        if ((0 == watch_supported()) || (0 == watch_init(&watches, 0)))
+        {
+            printf("[!] Watchpoints are not supported on this host\n");
+            use_watch = 0;
+        }
+        for (int i = 0; (0 != use_watch) && (options.watch_count > i); i++)
+        {
+            watch_parse(&watches, options.watch[i]);
+            WATCH *watch = watches.watches + watches.count - 1;
+            if (watch->address + watch->size > (unsigned int) memory_size)
+            {
+                printf("[!] Watchpoint past the end of memory: '%s'\n", options.watch[i]);
+                watches.count--;
+            }
+        }
+    }
 
-//// Definitions
+    // Library routines run natively, a watched run sees all their accesses
+    HLE hle;
+    hle_init(&hle);
+    if ((0 != options.hle) && (0 == use_watch))
+    {
+        hle_scan(&hle, &state);
+        state.hle = &hle;
+    }
 
-void state_init(STATE *state)
-{
-    // Nothing passed?
-    if (NULL == state)
-        return;
+    // Breakpoints, patched into the code
+    BREAKPOINTS breakpoints;
+    breakpoint_init(&breakpoints);
+    for (int i = 0; options.break_count > i; i++)
+        if (0 == breakpoint_add(&breakpoints, &state, options.breaks[i]))
+            printf("[!] Could not set a breakpoint at 0x%x\n", options.breaks[i]);
+
+    // Executor, the reference if the chosen one cannot be set up.  A backend
+    // that compiles may run the compiler from here
+    ENGINE engine;
+    ENGINE_OPTIONS engine_options = { { NULL, NULL, NULL }, 1 };
+    if (0 == engine_open(&engine, options.backend, &state, &engine_options))
+    {
+        printf("[!] Could not set up backend '%s', using %s\n", options.backend, ENGINE_DEF_BACKEND);
+        engine_open(&engine, ENGINE_DEF_BACKEND, &state, NULL);
+    }
 
-    state->status = AOK;
-}
+    // Run program, anything printed so far goes before the guest output
+    fflush(stdout);
+    state_restart(&state);
+    BUDGET budget = options.budget;
+    PROGRAM_STATUS status;
+    while (1)
+    {
+        status = (0 != use_watch) ? watch_resume(&watches, &state, &budget, &probes)
+                 : engine_resume(&engine, &state, &budget, &probes);
+
+        // On a breakpoint?  Show it, run the instruction under it and go on
+        if ((BRK != status) || (NULL == breakpoint_find(&breakpoints, state.pc)))
+            break;
+        breakpoint_print_hit(&state);
+        fflush(stdout);
+        status = breakpoint_step(&breakpoints, &state, (0 != use_watch) ? main_watch_resume : NULL, &watches, &probes);
+        engine_flush(&engine);
+        if (AOK != status)
+            break;
+
+        // What is left of the step budget
+        if (0 != options.budget.steps)
+        {
+            if (options.budget.steps <= state.step)
+            {
+                status = state.status = LIM;
+                break;
+            }
+            budget.steps = options.budget.steps - state.step;
+        }
+    }
+    engine_close(&engine);
+    breakpoint_unpatch(&breakpoints, &state);
+    if ((0 <= console_fd) && (0 == console_close(&console)))
+        printf("[!] Failed to write console output\n");
+    if ((0 <= console_fd) && (STDOUT_FILENO != console_fd))
+        close(console_fd);
+    if (0 == hostio_flush(&io))
+        printf("[!] Failed to write guest output\n");
+    if (LIM == status)
+        printf("[!] Stopped at the budget, the program did not finish\n");
+    if (0 != io.exited)
+        printf("[-] Program exited with code %d\n", io.exit_code);
+
+    // Flush the trace
+    BOOL trace_ok = (NULL == options.trace) || (0 != trace_close(&trace, &state));
+
+    // Log the changes, "-" or no file for stdout
+    if ((DUMP_TEXT == options.dump) && (NULL == options.dump_file))
+        state_changes(&state_original, &state);
+    else
+    {
+        DUMP dump;
+        BOOL to_stdout = (NULL == options.dump_file) || (0 == strcmp(options.dump_file, "-"));
+        int dump_fd = (0 != to_stdout) ? STDOUT_FILENO : open(options.dump_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        fflush(stdout);
+        if ((0 > dump_fd) || (0 == dump_open(&dump, dump_fd, options.dump, 0)))
+            printf("[!] Could not open dump: '%s'\n", options.dump_file);
+        else
+        {
+            dump_changes(&dump, &state_original, &state);
+            if (0 == dump_close(&dump))
+                printf("[!] Failed to write dump\n");
+        }
+        if ((0 <= dump_fd) && (0 == to_stdout))
+            close(dump_fd);
+    }
 
-BOOL state_allocate(STATE *state, int memory_size)
-{
-    // Nothing passed?
-    if (NULL == state)
-        return 0;
+    // Model reports
+    if (0 != options.pipe)
+    {
+        printf("\n");
+        pipe_report(&pipe, REPORT_TOP);
+        pipe_free(&pipe);
+    }
+    if (0 != use_cache)
+    {
+        printf("\n");
+        cache_report(&cache, REPORT_TOP);
+        cache_free(&cache);
+    }
+    if (0 != use_bpred)
+    {
+        printf("\n");
+        bpred_report(&bpred, REPORT_TOP);
+        bpred_free(&bpred);
+    }
+    if (NULL != options.trace)
+    {
+        printf("\n");
+        if (0 == trace_ok)
+            printf("[!] Failed to write trace: '%s'\n", options.trace);
+        trace_report(&trace);
+    }
+    if (0 < options.break_count)
+    {
+        printf("\n");
+        breakpoint_report(&breakpoints);
+    }
+    breakpoint_free(&breakpoints, NULL);
+    if (NULL != state.hle)
+    {
+        printf("\n");
+        hle_report(&hle);
+    }
+    if (0 != use_watch)
+    {
+        printf("\n");
+        watch_report(&watches);
+        watch_free(&watches);
+    }
 
-    // Invalid memory size?
-    if (1 > memory_size)
-        return 0;
-    
-    // Free existing
-    state_free(state);
-    
-    // Try to allocate
-    state->memory = malloc(memory_size);
-    if (NULL == state->memory)
-        return 0;
-    
-    // Zero out
-    state->memory_size = memory_size;
-    memset(state->memory, 0, memory_size);
+    // Free memory
+    state_free(&state);
+    state_free(&state_original);
+    hostio_free(&io);
+    free(options.breaks);
+    free(options.incbins);
 
-    return 1;
+    return (0 != io.exited) ? io.exit_code : 0;
 }
 
-void state_free(STATE *state)
-{
-    // Nothing passed?
-    if (NULL == state)
-        return;
-
-    // Nothing allocated?
-    if (0 >= state->memory_size)
-        return;
-    
-    free(state->memory);
-    state->memory_size = 0;
-}
+//// Definitions
 
-BOOL state_compile(STATE *state, const char* filename)
+// Steps over a breakpoint with the watchpoints still on
+PROGRAM_STATUS main_watch_resume(void *context, STATE *state, const BUDGET *budget, PROBES *probes)
 {
-    // Nothing passed?
-    if (NULL == state)
-        return 0;
-
-    // No memory?
-    if (0 >= state->memory_size)
-        return 0;
-
-    // Possibly use something like this:
-    // https://github.com/xsznix/js-y86/blob/master/js/y86.js : evalArgs
-    // https://github.com/xsznix/js-y86/blob/master/js/syntax.js
-
-    printf("[!] TODO: Compile '%s'\n", filename);
-
-    // Manually compiled information from CMU.edu
-    const int program[] = {
-        0x30f40001, 0x000030f5, 0x00010000, 0x80240000,
-        0x00000000, 0x0d000000, 0xc0000000, 0x000b0000,
-        0x00a00000, 0xa05f2045, 0x30f00400, 0x0000a00f,
-        0x30f21400, 0x0000a02f, 0x80420000, 0x002054b0,
-        0x5f90a05f, 0x20455015, 0x08000000, 0x50250c00,
-        0x00006300, 0x62227378, 0x00000050, 0x61000000,
-        0x00606030, 0xf3040000, 0x00603130, 0xf3ffffff,
-        0xff603274, 0x5b000000, 0x2045b05f, 0x90000000,
-    };
-    for (int i = 0; 32 > i; i++)
-        an_int_bytes_big(program[i], state->memory + (i * 4));
-
-    return 1;
+    return watch_resume(context, state, budget, probes);
 }
 
-void state_run(STATE *state, STATE *state_original)
+BOOL options_parse(OPTIONS *options, int argc, char** argv)
 {
-    // Nothing passed?
-    if (NULL == state)
-        return;
-
-    // No memory?
-    if (0 >= state->memory_size)
-        return;
+    int positional = 0;
 
-    // Start at the beginning
-    state->status = AOK;
-    state->pc = 0;
-    state->step = 0;
-
-    // While there is no error
-    while (AOK == state->status)
+    for (int i = 1; argc > i; i++)
     {
-        // Invalid PC address?
-        if ((0 > state->pc) || (state->memory_size - 6 <= state->pc))
+        char* arg = argv[i];
+        BOOL has_value = (argc > i + 1);
+
+        if (0 == strcmp(arg, "--pipe"))
+            options->pipe = 1;
+        else if ((0 == strcmp(arg, "--pipe-diagram")) && has_value)
         {
-            state->status = ADR;
-            return;
+            options->pipe = 1;
+            if ((0 == an_parse_int(argv[++i], &options->pipe_diagram)) || (0 > options->pipe_diagram))
+                return 0;
         }
-
-        // Increase step counter
-        state->step++;
-
-        // Get instruction and function
-        unsigned char insfn = state->memory[state->pc];
-        unsigned char ins = (insfn >> 4) & 0xF;
-        unsigned char fn = insfn & 0xF;
-
-        // Get arguments ready
-        unsigned char rArB = state->memory[state->pc + 1];
-        unsigned char rA = (rArB >> 4) & 0xF;
-        unsigned char rB = rArB & 0xF;
-        unsigned int dest = 0;
-        an_bytes_int(state->memory + state->pc + 1, &dest);
-        unsigned int val = 0;
-        an_bytes_int(state->memory + state->pc + 2, &val);
-
-        // Temp variables
-        int pos;
-        BOOL condition;
-        unsigned int temp;
-
-        // PC step size, default is 6
-        int pc_step = 6;
-
-        // Handle instruction
-        switch(ins)
+        else if ((0 == strcmp(arg, "--icache")) && has_value)
         {
-            case 0: // halt
-                // Invalid condition?
-                if (0 != fn)
-                {
-                    state->status = INS;
-                    return;
-                }
-
-                state->status = HLT;
-                return;
-
-            case 1: // nop
-                // Invalid condition?
-                if (0 != fn)
-                {
-                    state->status = INS;
-                    return;
-                }
-
-                pc_step = 1;
-                break;
-
-            case 2: // rrmovl or cmovXX
-                // Invalid registers?
-                if ((0 > rA) || (REGISTER_COUNT <= rA) || (0 > rB) || (REGISTER_COUNT <= rB))
-                {
-                    state->status = INS;
-                    return;
-                }
-
-                // Check condition based on flags
-                // https://en.wikibooks.org/wiki/X86_Assembly/Control_Flow#Jump_Instructions
-                switch (fn)
-                {
-                    case 0: // rrmovel
-                        condition = 1;
-                        break;
-                    case 1: // cmovle
-                        condition = (0 != state->codes.ZF) || (state->codes.SF != state->codes.OF);
-                        break;
-                    case 2: // cmovl
-                        condition = (state->codes.SF != state->codes.OF);
-                        break;
-                    case 3: // cmove
-                        condition = (0 != state->codes.ZF);
-                        break;
-                    case 4: // cmovne
-                        condition = (0 == state->codes.ZF);
-                        break;
-                    case 5: // cmovge
-                        condition = (0 != state->codes.ZF) || (state->codes.SF == state->codes.OF);
-                        break;
-                    case 6: // cmovg
-                        condition = (0 == state->codes.ZF) && (state->codes.SF == state->codes.OF);
-                        break;
-                    default:
-                        state->status = INS;
-                        return;
-                }
-
-                // Perform move?
-                if (0 != condition)
-                    state->registers.ids[rB] = state->registers.ids[rA];
-
-                pc_step = 2;
-                break;
-
-            case 3: // irmovl
-                // Invalid condition?
-                if (0 != fn)
-                {
-                    state->status = INS;
-                    return;
-                }
-
-                // Invalid registers?
-                if ((REGISTER_NONE != rA) || (0 > rB) || (REGISTER_COUNT <= rB))
-                {
-                    state->status = INS;
-                    return;
-                }
-
-                // Perform move
-                state->registers.ids[rB] = val;
-
-                pc_step = 6;
-                break;
-
-            case 4: // rmmovl
-                // Invalid condition?
-                if (0 != fn)
-                {
-                    state->status = INS;
-                    return;
-                }
-
-                // Invalid registers?
-                if ((0 > rA) || (REGISTER_COUNT <= rA) || (0 > rB) || (REGISTER_COUNT <= rB))
-                {
-                    state->status = INS;
-                    return;
-                }
-
-                // Memory position
-                pos = state->registers.ids[rB] + val;
-
-                // Invalid position?
-                if ((0 > pos) || (state->memory_size - 4 <= pos))
-                {
-                    state->status = ADR;
-                    return;
-                }
-
-                // Perform move
-                an_int_bytes(state->registers.ids[rA], state->memory + pos);
-
-                pc_step = 6;
-                break;
-
-            case 5: // mrmovl
-                // Invalid condition?
-                if (0 != fn)
-                {
-                    state->status = INS;
-                    return;
-                }
-
-                // Invalid registers?
-                if ((0 > rA) || (REGISTER_COUNT <= rA) || (0 > rB) || (REGISTER_COUNT <= rB))
-                {
-                    state->status = INS;
-                    return;
-                }
-
-                // Memory position
-                pos = state->registers.ids[rB] + val;
-
-                // Invalid position?
-                if ((0 > pos) || (state->memory_size - 4 <= pos))
-                {
-                    state->status = ADR;
-                    return;
-                }
-
-                // Perform move
-                an_bytes_int(state->memory + pos, state->registers.ids + rA);
-
-                pc_step = 6;
-                break;
-
-            case 6: // OPl
-                // Invalid registers?
-                if ((0 > rA) || (REGISTER_COUNT <= rA) || (0 > rB) || (REGISTER_COUNT <= rB))
-                {
-                    state->status = INS;
-                    return;
-                }
-
-                // Perform operation
-                switch(fn)
-                {
-                    case 0: // addl
-                        temp = state->registers.ids[rB] + state->registers.ids[rA];
-                        state->codes.ZF = (0 == temp);
-                        state->codes.SF = an_sign(temp);
-                        state->codes.OF = ((1 == an_sign(state->registers.ids[rB])) && (0 == an_sign(temp)));
-                        state->registers.ids[rB] = temp;
-                        break;
-                    case 1: // subl
-                        temp = state->registers.ids[rB] - state->registers.ids[rA];
-                        state->codes.ZF = (0 == temp);
-                        state->codes.SF = an_sign(temp);
-                        state->codes.OF = ((0 == an_sign(state->registers.ids[rB])) && (1 == an_sign(temp)));
-                        state->registers.ids[rB] = temp;
-                        break;
-                    case 2: // andl
-                        temp = state->registers.ids[rB] & state->registers.ids[rA];
-                        state->codes.ZF = (0 == temp);
-                        state->codes.SF = an_sign(temp);
-                        state->codes.OF = 0;
-                        state->registers.ids[rB] = temp;
-                        break;
-                    case 3: // xorl
-                        temp = state->registers.ids[rB] ^ state->registers.ids[rA];
-                        state->codes.ZF = (0 == temp);
-                        state->codes.SF = an_sign(temp);
-                        state->codes.OF = 0;
-                        state->registers.ids[rB] = temp;
-                        break;
-                    default:
-                        state->status = INS;
-                        return;
-                }
-
-                pc_step = 2;
-                break;
-
-            case 7: // jXX
-                // Check condition based on flags
-                // https://en.wikibooks.org/wiki/X86_Assembly/Control_Flow#Jump_Instructions
-                switch (fn)
-                {
-                    case 0: // jmp
-                        condition = 1;
-                        break;
-                    case 1: // jle
-                        condition = (0 != state->codes.ZF) || (state->codes.SF != state->codes.OF);
-                        break;
-                    case 2: // jl
-                        condition = (state->codes.SF != state->codes.OF);
-                        break;
-                    case 3: // je
-                        condition = (0 != state->codes.ZF);
-                        break;
-                    case 4: // jne
-                        condition = (0 == state->codes.ZF);
-                        break;
-                    case 5: // jge
-                        condition = (0 != state->codes.ZF) || (state->codes.SF == state->codes.OF);
-                        break;
-                    case 6: // jg
-                        condition = (0 == state->codes.ZF) && (state->codes.SF == state->codes.OF);
-                        break;
-                    default:
-                        state->status = INS;
-                        return;
-                }
-
-                // Invalid address?
-                if ((0 > dest) || (state->memory_size - 6 <= dest))
-                {
-                    state->status = ADR;
-                    return;
-                }
-
-                // Perform move?
-                if (0 != condition)
-                {
-                    state->pc = dest;
-                    pc_step = 0;
-                }
-                else
-                    pc_step = 5;
-
-                break;
-
-            case 8: // call
-                // Invalid condition?
-                if (0 != fn)
-                {
-                    state->status = INS;
-                    return;
-                }
-
-                // Invalid address?
-                if ((0 > dest) || (state->memory_size - 6 <= dest))
-                {
-                    state->status = ADR;
-                    return;
-                }
-
-                // Try to push address to return to
-                if (0 == state_push(state, state->pc + 5))
-                {
-                    state->status = ADR;
-                    return;
-                }
-
-                // Move
-                state->pc = dest;
-
-                pc_step = 0;
-                break;
-
-            case 9: // ret
-                // Invalid condition?
-                if (0 != fn)
-                {
-                    state->status = INS;
-                    return;
-                }
-
-                // Try to pop address to return to
-                if (0 == state_pop(state, &pos))
-                {
-                    state->status = ADR;
-                    return;
-                }
-
-                // Invalid address?
-                if ((0 > pos) || (state->memory_size - 6 <= pos))
-                {
-                    state->status = ADR;
-                    return;
-                }
-
-                // Move
-                state->pc = pos;
-
-                pc_step = 0;
-                break;
-
-            case 10: // pushl
-                // Invalid condition?
-                if (0 != fn)
-                {
-                    state->status = INS;
-                    return;
-                }
-
-                // Invalid register?
-                if ((0 > rA) || (REGISTER_COUNT <= rA) || (REGISTER_NONE != rB))
-                {
-                    state->status = INS;
-                    return;
-                }
-
-                // Try to push value
-                if (0 == state_push(state, state->registers.ids[rA]))
-                {
-                    state->status = ADR;
-                    return;
-                }
-
-                pc_step = 2;
-                break;
-
-            case 11: // popl
-                // Invalid condition?
-                if (0 != fn)
-                {
-                    state->status = INS;
-                    return;
-                }
-
-                // Invalid register?
-                if ((0 > rA) || (REGISTER_COUNT <= rA) || (REGISTER_NONE != rB))
-                {
-                    state->status = INS;
-                    return;
-                }
-
-                // Try to pop value
-                if (0 == state_pop(state, state->registers.ids + rA))
-                {
-                    state->status = ADR;
-                    return;
-                }
-
-                pc_step = 2;
-                break;
-
-            case 12: // iOPl
-                // Invalid registers?
-                if ((REGISTER_NONE != rA) || (0 > rB) || (REGISTER_COUNT <= rB))
-                {
-                    state->status = INS;
-                    return;
-                }
-
-                // Perform operation
-                switch(fn)
-                {
-                    case 0: // addl
-                        temp = state->registers.ids[rB] + val;
-                        state->codes.ZF = (0 == temp);
-                        state->codes.SF = an_sign(temp);
-                        state->codes.OF = ((1 == an_sign(state->registers.ids[rB])) && (0 == an_sign(temp)));
-                        state->registers.ids[rB] = temp;
-                        break;
-                    case 1: // subl
-                        temp = state->registers.ids[rB] - val;
-                        state->codes.ZF = (0 == temp);
-                        state->codes.SF = an_sign(temp);
-                        state->codes.OF = ((0 == an_sign(state->registers.ids[rB])) && (1 == an_sign(temp)));
-                        state->registers.ids[rB] = temp;
-                        break;
-                    case 2: // andl
-                        temp = state->registers.ids[rB] & val;
-                        state->codes.ZF = (0 == temp);
-                        state->codes.SF = an_sign(temp);
-                        state->codes.OF = 0;
-                        state->registers.ids[rB] = temp;
-                        break;
-                    case 3: // xorl
-                        temp = state->registers.ids[rB] ^ val;
-                        state->codes.ZF = (0 == temp);
-                        state->codes.SF = an_sign(temp);
-                        state->codes.OF = 0;
-                        state->registers.ids[rB] = temp;
-                        break;
-                    default:
-                        state->status = INS;
-                        return;
-                }
-
-                pc_step = 6;
-                break;
-            
-            // TODO: Extra functions, such as enter (kinda) and leave
-
-            default:
-                state->status = INS;
-                return;
+            if (0 == cache_parse(argv[++i], &options->icache))
+            {
+                printf("[!] Invalid cache: '%s'\n", argv[i]);
+                return 0;
+            }
         }
-
-        // Increment PC
-        state->pc += pc_step;
-    }
-}
-
-BOOL state_clone(STATE *state_from, STATE *state_to)
-{
-    // Nothing passed?
-    if ((NULL == state_from) || (NULL == state_to))
-        return 0;
-    
-    state_to->registers = state_from->registers;
-    state_to->codes = state_from->codes;
-    state_to->status = state_from->status;
-
-    // Try to copy memory if present
-    if (0 < state_from->memory_size)
-    {
-        state_to->memory = malloc(state_from->memory_size);
-        if (NULL == state_to->memory)
+        else if ((0 == strcmp(arg, "--dcache")) && has_value)
+        {
+            if (0 == cache_parse(argv[++i], &options->dcache))
+            {
+                printf("[!] Invalid cache: '%s'\n", argv[i]);
+                return 0;
+            }
+        }
+        else if ((0 == strcmp(arg, "--cache")) && has_value)
+        {
+            i++;
+            if ((CACHE_LEVEL_MAX - 2 <= options->cache_count) || (0 == cache_parse(argv[i], options->cache + options->cache_count)))
+            {
+                printf("[!] Invalid cache: '%s'\n", argv[i]);
+                return 0;
+            }
+            options->cache_count++;
+        }
+        else if ((0 == strcmp(arg, "--bpred")) && has_value)
+            options->bpred = argv[++i];
+        else if ((0 == strcmp(arg, "--ras")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &options->ras_size)) || (0 > options->ras_size))
+                return 0;
+        }
+        else if ((0 == strcmp(arg, "--trace")) && has_value)
+            options->trace = argv[++i];
+        else if ((0 == strcmp(arg, "--trace-interval")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &options->trace_interval)) || (1 > options->trace_interval))
+                return 0;
+        }
+        else if ((0 == strcmp(arg, "--block-cost")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &options->block_step_bytes)) || (0 > options->block_step_bytes))
+                return 0;
+        }
+        else if ((0 == strcmp(arg, "--io-buffer")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &options->io_buffer)) || (1 > options->io_buffer))
+                return 0;
+        }
+        else if ((0 == strcmp(arg, "--console")) && has_value)
+            options->console = argv[++i];
+        else if ((0 == strcmp(arg, "--backend")) && has_value)
+        {
+            options->backend = argv[++i];
+            if (NULL == engine_find(options->backend))
+            {
+                printf("[!] Unknown backend: '%s'\n", options->backend);
+                return 0;
+            }
+        }
+        else if ((0 == strcmp(arg, "--dump")) && has_value)
+        {
+            options->dump = dump_format(argv[++i]);
+            if (0 > options->dump)
+            {
+                printf("[!] Unknown dump format: '%s'\n", argv[i]);
+                return 0;
+            }
+        }
+        else if ((0 == strcmp(arg, "--dump-file")) && has_value)
+            options->dump_file = argv[++i];
+        else if ((0 == strcmp(arg, "--watch")) && has_value)
+        {
+            // Checked here, kept for after the memory size is known
+            WATCHES check = { 0 };
+            if ((WATCH_MAX <= options->watch_count) || (0 == watch_parse(&check, argv[++i])))
+            {
+                printf("[!] Invalid watchpoint: '%s'\n", argv[i]);
+                return 0;
+            }
+            options->watch[options->watch_count++] = argv[i];
+        }
+        else if ((0 == strcmp(arg, "--break")) && has_value)
+        {
+            // Room for as many as there are arguments
+            if (NULL == options->breaks)
+                options->breaks = calloc((size_t) argc, sizeof(int));
+            if ((NULL == options->breaks) || (0 == an_parse_int(argv[++i], options->breaks + options->break_count))
+                || (0 > options->breaks[options->break_count]))
+            {
+                printf("[!] Invalid breakpoint: '%s'\n", argv[i]);
+                return 0;
+            }
+            options->break_count++;
+        }
+        else if ((0 == strcmp(arg, "--incbin")) && has_value)
+        {
+            // Room for as many as there are arguments
+            int address = 0;
+            const char* path = NULL;
+            if (NULL == options->incbins)
+                options->incbins = calloc((size_t) argc, sizeof(char*));
+            if ((NULL == options->incbins) || (0 == incbin_parse(argv[++i], &address, &path)))
+            {
+                printf("[!] Invalid file placement: '%s'\n", argv[i]);
+                return 0;
+            }
+            options->incbins[options->incbin_count++] = argv[i];
+        }
+        else if (0 == strcmp(arg, "--hle"))
+            options->hle = 1;
+        else if ((0 == strcmp(arg, "--max-steps")) && has_value)
+        {
+            char* end = NULL;
+            i++;
+            options->budget.steps = strtoull(argv[i], &end, 0);
+            if (('-' == argv[i][0]) || ('\0' != *end) || (0 == options->budget.steps))
+                return 0;
+        }
+        else if ((0 == strcmp(arg, "--max-seconds")) && has_value)
+        {
+            char* end = NULL;
+            i++;
+            options->budget.seconds = strtod(argv[i], &end);
+            if (('\0' != *end) || (0 >= options->budget.seconds))
+                return 0;
+        }
+        else if (('-' == arg[0]) && ('-' == arg[1]))
+        {
+            printf("[!] Unknown option: '%s'\n", arg);
             return 0;
-        memcpy(state_to->memory, state_from->memory, state_from->memory_size);
-    }
-
-    state_to->memory_size = state_from->memory_size;
-    state_to->pc = state_from->pc;
-    state_to->step = state_from->step;
-
-    return 1;
-}
-
-void state_changes(STATE *state_old, STATE *state_now)
-{
-    // Nothing passed?
-    if ((NULL == state_old) || (NULL == state_now))
-        return;
-
-    printf("Stopped in %d steps at PC = 0x%x.", state_now->step, state_now->pc);
-    
-    const char* st_names[STATUS_COUNT] = STATUS_NAME_ARRAY;
-    BOOL st_valid = (_FIRST > state_now->status) || (_LAST < state_now->status);
-    const char* st_str = st_valid ? "???" : st_names[state_now->status - _FIRST];
-    printf("  Status '%s', CC Z=%d S=%d O=%d\n", st_str, state_now->codes.ZF, state_now->codes.SF, state_now->codes.OF);
-
-    const char* reg_names[REGISTER_COUNT] = REGISTER_NAME_ARRAY;
-    printf("Changes to registers:\n");
-    for (int i = 0; REGISTER_COUNT > i; i++)
-        if (state_old->registers.ids[i] != state_now->registers.ids[i])
-            printf("%%%3s:   0x%08x      0x%08x\n", reg_names[i], state_old->registers.ids[i], state_now->registers.ids[i]);
-    printf("\n");
-
-    printf("Changes to memory:\n");
-    for (int i = 0; state_now->memory_size / 4 > i; i++)
-    {
-        BOOL had_diff = 0;
-        for (int j = i * 4; (i + 1) * 4 > j; j++)
-            had_diff = had_diff || (state_old->memory[j] != state_now->memory[j]);
-        if (0 != had_diff)
+        }
+        else if (0 == positional)
         {
-            printf("0x%04x: 0x", i * 4);
-            for (int j = (i + 1) * 4 - 1; i * 4 <= j; j--)
-                printf("%02x", state_old->memory[j]);
-            printf("      0x");
-            for (int j = (i + 1) * 4 - 1; i * 4 <= j; j--)
-                printf("%02x", state_now->memory[j]);
-            printf("\n");
+            options->source_file = arg;
+            positional++;
         }
+        else if (1 == positional)
+        {
+            options->memory_size = arg;
+            positional++;
+        }
+        else
+            return 0;
     }
+
+    // No source file?
+    return (NULL != options->source_file);
 }
 
-BOOL state_push(STATE *state, unsigned int val)
+void options_usage(const char* prog)
 {
-    // Nothing passed?
-    if (NULL == state)
-        return 0;
-    
-    // No memory?
-    if (0 >= state->memory_size)
-        return 0;
-    
-    // esp is valid position?
-    int esp = state->registers.names.esp;
-    if ((4 > esp) || (state->memory_size <= esp))
-        return 0;
-    
-    // Subtract 4
-    state->registers.names.esp -= 4;
-
-    // Set value
-    an_int_bytes(val, state->memory + state->registers.names.esp);
-    
-    return 1;
+    printf("Usage: %s <source-file> [memory-size] [options]\n", prog);
+    printf("Options:\n");
+    printf("  --pipe               Report PIPE cycles, CPI and bubbles\n");
+    printf("  --pipe-diagram N     Also print stages of the first N instructions\n");
+    printf("  --icache S:W:L[:P]   L1 instruction cache of S bytes, W ways, L byte lines\n");
+    printf("  --dcache S:W:L[:P]   L1 data cache, P is lru (default), fifo or random\n");
+    printf("  --cache S:W:L[:P]    Next shared level, repeat for more levels\n");
+    printf("  --bpred K[:B],...    Compare jXX predictors, K is always, btfnt, bimodal or\n");
+    printf("                       gshare, B is the table size in index bits\n");
+    printf("  --ras N              Predict ret with an N entry return address stack\n");
+    printf("  --trace FILE         Write every retired instruction to a binary trace\n");
+    printf("  --trace-interval N   Records between keyframes in the trace\n");
+    printf("  --block-cost N       Block instructions take a step more per N bytes\n");
+    printf("  --io-buffer N        Bytes buffered per guest stream before a write, default %d\n", HOSTIO_DEF_BUFFER);
+    printf("  --console FILE       Bytes stored at 0x%08x go to FILE, - for stdout\n", CONSOLE_BASE);
+    printf("  --max-steps N        Stop after about N instructions, status LIM\n");
+    printf("  --max-seconds S      Stop after about S seconds, status LIM\n");
+    printf("  --backend NAME       Executor, default %s:\n", ENGINE_DEF_BACKEND);
+    for (int i = 0; engine_count() > i; i++)
+        printf("                         %-10s %s\n", engine_backend(i)->name, engine_backend(i)->description);
+    printf("  --dump FORMAT        Report changes as text (default), json lines or binary\n");
+    printf("  --dump-file FILE     Write the report to FILE, - for stdout\n");
+    printf("  --break A            Show the machine each time the instruction at A is reached\n");
+    printf("  --hle                Run recognised library routines natively\n");
+    printf("  --watch A[:S][:rwc]  Report reads, writes or changes of S bytes at A, default\n");
+    printf("                       4 bytes written, repeat for up to %d\n", WATCH_MAX);
+    printf("  --incbin A:FILE      Place FILE at A, mapped copy on write from a page boundary\n");
 }
 
-BOOL state_pop(STATE *state, unsigned int *val)
+// A:FILE, A as --break takes it
+BOOL incbin_parse(const char* arg, int *address, const char** path)
 {
-    // Nothing passed?
-    if (NULL == state)
-        return 0;
-    
-    // No memory?
-    if (0 >= state->memory_size)
-        return 0;
-    
-    // esp is valid position?
-    int esp = state->registers.names.esp;
-    if ((0 > esp) || (state->memory_size - 4 <= esp))
+    char text[32];
+    const char* colon = strchr(arg, ':');
+
+    // No address, or no file?
+    if ((NULL == colon) || (arg == colon) || ('\0' == colon[1]) || (sizeof(text) <= (size_t) (colon - arg)))
         return 0;
 
-    // Get value
-    an_bytes_int(state->memory + state->registers.names.esp, val);
-    
-    // Add 4
-    state->registers.names.esp += 4;
-    
-    return 1;
+    memcpy(text, arg, (size_t) (colon - arg));
+    text[colon - arg] = '\0';
+    *path = colon + 1;
+    return (0 != an_parse_int(text, address)) && (0 <= *address);
 }
@@ -0,0 +1,425 @@
+#include "optimizer.hpp"
+#include "assembler.hpp"
+
+#include <algorithm>
+#include <map>
+#include <regex>
+
+namespace {
+
+const char* FLAG_READERS[12] = { "jle", "jl", "je", "jne", "jge", "jg",
+                                 "cmovle", "cmovl", "cmove", "cmovne",
+                                 "cmovge", "cmovg" };
+
+// What an instruction does with the condition codes
+enum FlagUse { FLAGS_NONE, FLAGS_READ, FLAGS_WRITE, FLAGS_UNKNOWN };
+
+FlagUse flag_use(const SourceLine& line) {
+  const std::string& command = line.command;
+  for (int i = 0; i < 12; i++)
+    if (command == FLAG_READERS[i])
+      return FLAGS_READ;
+  if (operation_code(command) >= 0 || command == "bcmp"
+      || (command.size() > 1 && command.at(0) == 'i'
+          && operation_code(command.substr(1)) >= 0))
+    return FLAGS_WRITE;
+  if (command == "nop" || command == "rrmovl" || command == "irmovl"
+      || command == "rmmovl" || command == "mrmovl" || command == "pushl"
+      || command == "popl" || command == "bcopy" || command == "bfill"
+      || command == "xadd")
+    return FLAGS_NONE;
+
+  // Control leaves, the flags are printed at a halt, a directive, or cas,
+  // which only writes ZF
+  return FLAGS_UNKNOWN;
+}
+
+// Are the flags written again on every path from line `from` before a read?
+// Only follows straight line code, labels are fine since this path runs on
+bool flags_dead(const std::vector<SourceLine>& lines, size_t from) {
+  for (size_t i = from; i < lines.size(); i++) {
+    if (lines[i].command.empty())
+      continue;
+    FlagUse use = flag_use(lines[i]);
+    if (use == FLAGS_WRITE)
+      return true;
+    if (use != FLAGS_NONE)
+      return false;
+  }
+  return false;
+}
+
+// Local @labels belong to the last global label before them
+std::string full_label(const std::string& label, const std::string& last) {
+  return (!label.empty() && label.at(0) == '@') ? last + label : label;
+}
+
+// Next line with an instruction or directive, or lines.size()
+size_t next_command(const std::vector<SourceLine>& lines, size_t from,
+                    bool* crossed_label) {
+  size_t i = from;
+  while (i < lines.size() && lines[i].command.empty()) {
+    if (!lines[i].label.empty() && crossed_label != nullptr)
+      *crossed_label = true;
+    i++;
+  }
+  return i;
+}
+
+std::string trim(const std::string& text) {
+  size_t start = text.find_first_not_of(" \t\n\r");
+  if (start == std::string::npos)
+    return "";
+  size_t end = text.find_last_not_of(" \t\n\r");
+  return text.substr(start, end - start + 1);
+}
+
+void change(std::vector<std::string>& source, std::vector<SourceLine>& lines,
+            const std::vector<int>& origin, std::vector<std::string>& report,
+            size_t i, const std::string& replacement) {
+  report.push_back("Line " + std::to_string(origin[i]) + ": "
+                   + trim(source[i]) + " -> "
+                   + (replacement.empty() ? "removed" : replacement));
+  source[i] = replacement.empty() ? "" : "\t" + replacement;
+  lines[i] = split_line(source[i]);
+}
+
+// A function marked .inline that is safe to copy into its callers
+struct InlineFunction {
+  std::vector<SourceLine> body; // Without the frame and the ret
+  std::vector<std::string> labels; // Scope resolved, renamed at each site
+  int sites;
+};
+
+// Memory operand such as "8(%ebp)"
+const std::regex MEMORY_OPERAND("(-?\\w*)\\(\\s*%(\\w+)\\s*\\)");
+
+bool is_jump(const std::string& command) {
+  if (command == "jmp")
+    return true;
+  for (int i = 0; i < 6; i++)
+    if (command == FLAG_READERS[i])
+      return true;
+  return false;
+}
+
+// Moves D(%base) operands on to D - shift(%esp), false if the instruction
+// uses base or %esp any other way
+bool rebase_operands(std::string& args, const std::string& base, int shift) {
+  std::string result("");
+  std::string rest = args;
+  std::smatch match;
+  while (std::regex_search(rest, match, MEMORY_OPERAND)) {
+    std::string before = match.prefix().str();
+    if (before.find("%" + base) != std::string::npos
+        || before.find("%esp") != std::string::npos)
+      return false;
+    std::string reg = to_lower(match[2].str());
+    if (reg == base) {
+      size_t end = 0;
+      std::string text = match[1].str();
+      int offset = text.empty() ? 0 : std::stoi(text, &end, 0);
+      if ((!text.empty() && end != text.size()) || offset < shift)
+        return false;
+      result += before + std::to_string(offset - shift) + "(%esp)";
+    } else if (reg == "esp") {
+      return false;
+    } else {
+      result += before + match[0].str();
+    }
+    rest = match.suffix().str();
+  }
+  if (rest.find("%" + base) != std::string::npos
+      || rest.find("%esp") != std::string::npos)
+    return false;
+  args = result + rest;
+  return true;
+}
+
+bool is_instruction(const SourceLine& line, const char* command,
+                    const char* args) {
+  if (line.command != command)
+    return false;
+  std::string compact("");
+  for (size_t i = 0; i < line.args.size(); i++)
+    if (line.args[i] != ' ' && line.args[i] != '\t')
+      compact.push_back(line.args[i]);
+  return to_lower(compact) == args;
+}
+
+// The body of the function at `start`, or why it can not be inlined
+std::string make_inline(const std::vector<SourceLine>& lines, size_t start,
+                        InlineFunction& function) {
+  // Commands up to the only ret
+  std::vector<size_t> commands;
+  size_t end = start + 1;
+  for (; end < lines.size(); end++) {
+    const SourceLine& line = lines[end];
+    if (line.command.empty())
+      continue;
+    if (line.command.at(0) == '.')
+      return "directive inside";
+    if (line.command == "call")
+      return "not a leaf";
+    commands.push_back(end);
+    if (line.command == "ret")
+      break;
+  }
+  if (end == lines.size())
+    return "no ret";
+
+  // pushl %ebp, rrmovl %esp,%ebp ... rrmovl %ebp,%esp, popl %ebp, ret
+  size_t count = commands.size();
+  bool framed = count >= 5
+                && is_instruction(lines[commands[0]], "pushl", "%ebp")
+                && is_instruction(lines[commands[1]], "rrmovl", "%esp,%ebp")
+                && is_instruction(lines[commands[count - 3]], "rrmovl",
+                                  "%ebp,%esp")
+                && is_instruction(lines[commands[count - 2]], "popl", "%ebp");
+  size_t first = framed ? commands[1] + 1 : start + 1;
+  size_t last = framed ? commands[count - 3] : commands[count - 1];
+  std::string base = framed ? "ebp" : "esp";
+  int shift = framed ? 8 : 4;
+
+  // Labels first, jumps must stay inside.  The entry is not copied
+  std::string scope = lines[start].label;
+  for (size_t i = first; i < end; i++)
+    if (!lines[i].label.empty()) {
+      if (lines[i].label.at(0) != '@')
+        scope = lines[i].label;
+      function.labels.push_back(full_label(lines[i].label, scope));
+    }
+
+  scope = lines[start].label;
+  for (size_t i = first; i < end; i++) {
+    SourceLine line = lines[i];
+    if (i >= last && !line.command.empty())
+      continue;
+    if (!line.label.empty()) {
+      if (line.label.at(0) != '@')
+        scope = line.label;
+      line.label = full_label(line.label, scope);
+    } else if (!line.command.empty()) {
+      if (line.command == "pushl" || line.command == "popl"
+          || line.command == "ret")
+        return "uses the stack";
+      if (is_jump(line.command)) {
+        line.args = full_label(trim(line.args), scope);
+        if (std::find(function.labels.begin(), function.labels.end(),
+                      line.args) == function.labels.end())
+          return "jumps out";
+      } else if (!rebase_operands(line.args, base, shift)) {
+        return "uses %" + base + " or %esp";
+      }
+    }
+    function.body.push_back(line);
+  }
+
+  return "";
+}
+
+// One sweep over the source, returns the number of changes
+int peephole_pass(std::vector<std::string>& source,
+                  std::vector<SourceLine>& lines,
+                  const std::vector<int>& origin,
+                  std::vector<std::string>& report) {
+  int changes = 0;
+  std::string last_label("");
+
+  for (size_t i = 0; i < lines.size(); i++) {
+    const SourceLine& line = lines[i];
+    if (!line.label.empty() && line.label.at(0) != '@')
+      last_label = line.label;
+    if (line.command.empty())
+      continue;
+
+    try {
+      if (line.command == "irmovl" && line.args.find('$') != std::string::npos) {
+        std::string args = line.args;
+        unsigned int value = parse_immediate(args);
+        std::vector<int> regs = parse_registers(args, 1);
+        if (value == 0 && flags_dead(lines, i + 1)) {
+          std::string reg = std::string("%") + REGISTER_CODES[regs[0]];
+          change(source, lines, origin, report, i,
+                 "xorl " + reg + ", " + reg);
+          changes++;
+        }
+      } else if (line.command == "rrmovl"
+                 || line.command.compare(0, 4, "cmov") == 0) {
+        std::vector<int> regs = parse_registers(line.args, 2);
+        if (regs[0] == regs[1]) {
+          change(source, lines, origin, report, i, "");
+          changes++;
+        }
+      } else if (line.command == "jmp") {
+        // Only labels between the jump and its target?
+        std::string target = full_label(trim(line.args), last_label);
+        std::string scope = last_label;
+        for (size_t j = i + 1; j < lines.size() && lines[j].command.empty(); j++) {
+          if (lines[j].label.empty())
+            continue;
+          if (lines[j].label.at(0) != '@')
+            scope = lines[j].label;
+          if (full_label(lines[j].label, scope) == target) {
+            change(source, lines, origin, report, i, "");
+            changes++;
+            break;
+          }
+        }
+      } else if (line.command == "pushl") {
+        bool crossed = false;
+        size_t j = next_command(lines, i + 1, &crossed);
+        if (!crossed && j < lines.size() && lines[j].command == "popl") {
+          int from = parse_registers(line.args, 1)[0];
+          int to = parse_registers(lines[j].args, 1)[0];
+
+          // popl %esp adds 4 after the load, no move does that
+          if (to == REGISTER_ESP)
+            continue;
+
+          std::string move = "";
+          if (from != to)
+            move = std::string("rrmovl %") + REGISTER_CODES[from] + ", %"
+                   + REGISTER_CODES[to];
+          change(source, lines, origin, report, i, move);
+          change(source, lines, origin, report, j, "");
+          changes++;
+        }
+      }
+    } catch (const std::invalid_argument& e) {
+      // Operands the pass does not understand, compile reports them
+    }
+  }
+
+  return changes;
+}
+
+}
+
+SourceLine split_line(const std::string& text) {
+  SourceLine result;
+  std::string line = text;
+
+  // Remove comments
+  size_t index = line.find_first_of(";#");
+  if (index != std::string::npos)
+    line.erase(index);
+  line = trim(line);
+  if (line.empty())
+    return result;
+
+  // Label?
+  if (line.at(line.size() - 1) == ':') {
+    result.label = line.substr(0, line.size() - 1);
+    return result;
+  }
+
+  // Split into command and optional args
+  index = line.find_first_of(" \t");
+  result.command = to_lower(line.substr(0, index));
+  if (index != std::string::npos)
+    result.args = trim(line.substr(index + 1));
+  return result;
+}
+
+int peephole(std::vector<std::string>& source, const std::vector<int>& origin,
+             std::vector<std::string>& report) {
+  std::vector<SourceLine> lines;
+  lines.reserve(source.size());
+  for (size_t i = 0; i < source.size(); i++)
+    lines.push_back(split_line(source[i]));
+
+  // One change can expose another, such as a push and pop around a jump
+  int total = 0;
+  int changes = 0;
+  do {
+    changes = peephole_pass(source, lines, origin, report);
+    total += changes;
+  } while (changes > 0);
+
+  return total;
+}
+
+int inline_functions(std::vector<std::string>& source, std::vector<int>& origin,
+                     std::vector<std::string>& report) {
+  std::vector<SourceLine> lines;
+  lines.reserve(source.size());
+  for (size_t i = 0; i < source.size(); i++)
+    lines.push_back(split_line(source[i]));
+
+  // Functions marked by .inline on a line before their label
+  std::map<std::string, InlineFunction> functions;
+  for (size_t i = 0; i < lines.size(); i++) {
+    if (lines[i].command != ".inline")
+      continue;
+    size_t start = next_command(lines, i + 1, nullptr);
+    size_t label = i + 1;
+    while (label < start && lines[label].label.empty())
+      label++;
+    if (label == start || lines[label].label.at(0) == '@') {
+      report.push_back("Line " + std::to_string(origin[i])
+                       + ": .inline -> not before a function label");
+      continue;
+    }
+
+    InlineFunction function;
+    std::string problem = make_inline(lines, label, function);
+    if (!problem.empty()) {
+      report.push_back("Line " + std::to_string(origin[label]) + ": "
+                       + lines[label].label + " -> not inlined, " + problem);
+      continue;
+    }
+    function.sites = 0;
+    functions[lines[label].label] = function;
+  }
+  if (functions.empty())
+    return 0;
+
+  // Each call becomes a copy of the body with its own @labels
+  std::vector<std::string> out;
+  std::vector<int> out_origin;
+  int total = 0;
+  for (size_t i = 0; i < lines.size(); i++) {
+    std::map<std::string, InlineFunction>::iterator found = functions.end();
+    if (lines[i].command == "call")
+      found = functions.find(trim(lines[i].args));
+    if (found == functions.end()) {
+      out.push_back(source[i]);
+      out_origin.push_back(origin[i]);
+      continue;
+    }
+
+    InlineFunction& function = found->second;
+    std::string suffix = "_" + std::to_string(++function.sites);
+    std::map<std::string, std::string> names;
+    for (size_t l = 0; l < function.labels.size(); l++) {
+      std::string name = function.labels[l];
+      if (name.compare(0, found->first.size() + 1, found->first + "@") != 0)
+        name = found->first + "@" + name;
+      std::replace(name.begin(), name.end(), '@', '_');
+      names[function.labels[l]] = "@" + name + suffix;
+    }
+
+    for (size_t b = 0; b < function.body.size(); b++) {
+      const SourceLine& line = function.body[b];
+      if (!line.label.empty())
+        out.push_back(names[line.label] + ":");
+      else if (is_jump(line.command))
+        out.push_back("\t" + line.command + " " + names[line.args]);
+      else if (!line.command.empty())
+        out.push_back("\t" + line.command
+                      + (line.args.empty() ? "" : " " + line.args));
+      else
+        continue;
+      out_origin.push_back(origin[i]);
+    }
+
+    report.push_back("Line " + std::to_string(origin[i]) + ": call "
+                     + found->first + " -> inlined");
+    total++;
+  }
+
+  source.swap(out);
+  origin.swap(out_origin);
+  return total;
+}
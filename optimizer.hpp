@@ -0,0 +1,42 @@
+#ifndef OPTIMIZER_HPP
+#define OPTIMIZER_HPP
+
+#include <string>
+#include <vector>
+
+// Source to source passes run by State::compile before encoding.  origin
+// holds the original line number of every line, so errors still point at the
+// source, and removed lines are left blank.  Each change is described in
+// report.
+
+// One source line split into its parts, comments dropped
+struct SourceLine {
+  std::string label; // Without the colon, empty if none
+  std::string command; // Lower case, a directive keeps its '.'
+  std::string args;
+};
+
+SourceLine split_line(const std::string& line);
+
+// Copies the body of leaf functions marked with .inline into their callers,
+// returns the number of calls replaced.  A function is only inlined if it
+// ends in its only ret, makes no calls, does not push, pop or write %esp, and
+// with a pushl %ebp / rrmovl %esp,%ebp frame only uses %ebp to reach its
+// arguments.  Those become offsets from %esp, since no return address or
+// saved %ebp is pushed, and its labels become @labels of the caller.  Lines
+// added for a call keep the line number of the call in origin.  Memory below
+// %esp no longer holds those two words after the call, the rest of the state
+// is the same.
+int inline_functions(std::vector<std::string>& source, std::vector<int>& origin,
+                     std::vector<std::string>& report);
+
+// Rewrites wasteful instruction patterns, returns the number of changes:
+//   irmovl $0, %r       -> xorl %r, %r, when the flags are written before read
+//   rrmovl %r, %r       -> removed, also cmovXX
+//   jmp L  / L:         -> removed
+//   pushl %r / popl %s  -> rrmovl %r, %s, or removed if r is s, unless s is
+//                          %esp, which popl leaves 4 past the loaded word
+int peephole(std::vector<std::string>& source, const std::vector<int>& origin,
+             std::vector<std::string>& report);
+
+#endif
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipe.h"
+
+//// Definitions
+
+BOOL pipe_init(PIPE *pipe, int memory_size, int diagram)
+{
+    // Nothing passed?
+    if (NULL == pipe)
+        return 0;
+
+    // Invalid memory size?
+    if (1 > memory_size)
+        return 0;
+
+    memset(pipe, 0, sizeof(PIPE));
+    pipe->memory_size = memory_size;
+    pipe->diagram = diagram;
+    for (int i = 0; PIPE_DEPTH > i; i++)
+    {
+        pipe->slots[i].dst_e = REGISTER_NONE;
+        pipe->slots[i].dst_m = REGISTER_NONE;
+    }
+
+    return 1;
+}
+
+void pipe_free(PIPE *pipe)
+{
+    // Nothing passed?
+    if (NULL == pipe)
+        return;
+
+    free(pipe->pcs);
+    pipe->pcs = NULL;
+    pipe->pc_count = 0;
+    pipe->pc_capacity = 0;
+    pipe->memory_size = 0;
+}
+
+// Counters of the address, added the first time it has bubbles.  NULL if
+// there is no memory for it, then only the totals have them
+static PIPE_PC* pipe_pc(PIPE *pipe, int pc)
+{
+    int low = 0;
+    int high = pipe->pc_count;
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+        if (pipe->pcs[mid].pc < pc)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if ((pipe->pc_count > low) && (pc == pipe->pcs[low].pc))
+        return pipe->pcs + low;
+
+    // Room for one more?
+    if (pipe->pc_capacity == pipe->pc_count)
+    {
+        int capacity = (0 == pipe->pc_capacity) ? 64 : pipe->pc_capacity * 2;
+        PIPE_PC *grown = realloc(pipe->pcs, (size_t) capacity * sizeof(PIPE_PC));
+        if (NULL == grown)
+            return NULL;
+        pipe->pcs = grown;
+        pipe->pc_capacity = capacity;
+    }
+
+    memmove(pipe->pcs + low + 1, pipe->pcs + low, (size_t) (pipe->pc_count - low) * sizeof(PIPE_PC));
+    pipe->pc_count++;
+    memset(pipe->pcs + low, 0, sizeof(PIPE_PC));
+    pipe->pcs[low].pc = pc;
+    return pipe->pcs + low;
+}
+
+// Find where an operand comes from when its reader is in decode
+static void pipe_forward(PIPE *pipe, int src, unsigned long long decode)
+{
+    // Not read?
+    if (REGISTER_NONE == src)
+        return;
+
+    // Most recent producer wins
+    for (int i = 0; PIPE_DEPTH > i; i++)
+    {
+        PIPE_SLOT *slot = pipe->slots + i;
+        unsigned long long stage = decode - slot->decode + 1;
+
+        // Already in the register file?
+        if ((pipe->instructions <= (unsigned long long) i) || (4 < stage))
+            return;
+
+        switch (stage)
+        {
+            case 2: // Execute, loads are stalled until memory
+                if (src == slot->dst_e)
+                {
+                    pipe->forwards[PIPE_E_VALE]++;
+                    return;
+                }
+                break;
+            case 3: // Memory
+                if (src == slot->dst_m)
+                {
+                    pipe->forwards[PIPE_M_VALM]++;
+                    return;
+                }
+                if (src == slot->dst_e)
+                {
+                    pipe->forwards[PIPE_M_REG_VALE]++;
+                    return;
+                }
+                break;
+            case 4: // Write-back
+                if (src == slot->dst_m)
+                {
+                    pipe->forwards[PIPE_W_VALM]++;
+                    return;
+                }
+                if (src == slot->dst_e)
+                {
+                    pipe->forwards[PIPE_W_VALE]++;
+                    return;
+                }
+                break;
+        }
+    }
+}
+
+void pipe_retire(void *context, const STATE *state, const RETIRED *retired)
+{
+    PIPE *pipe = context;
+    unsigned char ins = (retired->insfn >> 4) & 0xF;
+    unsigned char fn = retired->insfn & 0xF;
+    int rA = (retired->rArB >> 4) & 0xF;
+    int rB = retired->rArB & 0xF;
+
+    // Registers read in decode and written in write-back
+    int src_a = REGISTER_NONE;
+    int src_b = REGISTER_NONE;
+    int dst_e = REGISTER_NONE;
+    int dst_m = REGISTER_NONE;
+    switch (ins)
+    {
+        case 2: // rrmovl or cmovXX
+            src_a = rA;
+            dst_e = (0 != retired->condition) ? rB : REGISTER_NONE;
+            break;
+        case 3: // irmovl
+            dst_e = rB;
+            break;
+        case 4: // rmmovl
+            src_a = rA;
+            src_b = rB;
+            break;
+        case 5: // mrmovl
+            src_b = rB;
+            dst_m = rA;
+            break;
+        case 6: // OPl
+            src_a = rA;
+            src_b = rB;
+            dst_e = rB;
+            break;
+        case 8: // call
+            src_b = REGISTER_ESP;
+            dst_e = REGISTER_ESP;
+            break;
+        case 9: // ret
+            src_a = REGISTER_ESP;
+            src_b = REGISTER_ESP;
+            dst_e = REGISTER_ESP;
+            break;
+        case 10: // pushl
+            src_a = rA;
+            src_b = REGISTER_ESP;
+            dst_e = REGISTER_ESP;
+            break;
+        case 11: // popl
+            src_a = REGISTER_ESP;
+            src_b = REGISTER_ESP;
+            dst_e = REGISTER_ESP;
+            dst_m = rA;
+            break;
+        case 12: // iOPl
+            src_b = rB;
+            dst_e = rB;
+            break;
+        case 13: // bcopy, bfill or bcmp, the count register is not modelled
+            src_a = rA;
+            src_b = rB;
+            break;
+        case 14: // trap, like a load into eax, the argument registers are not modelled
+            src_a = REGISTER_EAX;
+            dst_m = REGISTER_EAX;
+            break;
+        case 15: // cas or xadd, a load into eax or rA, eax as an operand is not modelled
+            src_a = rA;
+            src_b = rB;
+            dst_m = (0 == fn) ? REGISTER_EAX : rA;
+            break;
+    }
+
+    unsigned long long fetch = pipe->next_fetch;
+    unsigned long long decode = fetch + 1;
+    int bubbles[PIPE_CAUSE_COUNT] = { 0 };
+
+    // Load/use, the loaded value is not ready until the memory stage
+    PIPE_SLOT *last = pipe->slots;
+    if ((0 < pipe->instructions) && (REGISTER_NONE != last->dst_m) && ((src_a == last->dst_m) || (src_b == last->dst_m)))
+        bubbles[PIPE_LOAD_USE] = 1;
+    decode += bubbles[PIPE_LOAD_USE];
+
+    pipe_forward(pipe, src_a, decode);
+    pipe_forward(pipe, src_b, decode);
+
+    // Predicted taken, a fall through cancels two fetched instructions
+    if ((7 == ins) && (0 != fn) && (0 == retired->condition))
+        bubbles[PIPE_MISPREDICT] = 2;
+
+    // Return address is known once ret reaches write-back
+    if (9 == ins)
+        bubbles[PIPE_RETURN] = 3;
+
+    // Account bubbles by cause and address
+    int total = 0;
+    for (int i = 0; PIPE_CAUSE_COUNT > i; i++)
+    {
+        pipe->bubbles[i] += bubbles[i];
+        total += bubbles[i];
+    }
+    PIPE_PC *at = NULL;
+    if ((0 != total) && (0 <= retired->pc) && (pipe->memory_size > retired->pc))
+        at = pipe_pc(pipe, retired->pc);
+    for (int i = 0; (NULL != at) && (PIPE_CAUSE_COUNT > i); i++)
+        at->bubbles[i] += bubbles[i];
+
+    // Stage diagram
+    if (0 < pipe->diagram)
+    {
+        const char* ins_names[INSTRUCTION_COUNT] = INSTRUCTION_NAME_ARRAY;
+        printf("0x%04x %-6s  F %4llu  D %4llu  E %4llu  M %4llu  W %4llu", retired->pc,
+               (INSTRUCTION_COUNT > ins) ? ins_names[ins] : "???",
+               fetch, decode, decode + 1, decode + 2, decode + 3);
+        if (0 != bubbles[PIPE_LOAD_USE])
+            printf("  (load/use)");
+        printf("\n");
+        pipe->diagram--;
+    }
+
+    // Shift the pipeline
+    memmove(pipe->slots + 1, pipe->slots, (PIPE_DEPTH - 1) * sizeof(PIPE_SLOT));
+    last->decode = decode;
+    last->dst_e = dst_e;
+    last->dst_m = dst_m;
+
+    pipe->instructions++;
+    pipe->next_fetch = fetch + 1 + total;
+    pipe->cycles = decode + 4;
+}
+
+void pipe_report(PIPE *pipe, int top)
+{
+    // Nothing passed?
+    if (NULL == pipe)
+        return;
+
+    unsigned long long total = 0;
+    for (int i = 0; PIPE_CAUSE_COUNT > i; i++)
+        total += pipe->bubbles[i];
+    double cpi = (0 == pipe->instructions) ? 0 : (double) (pipe->instructions + total) / pipe->instructions;
+
+    printf("Pipeline:\n");
+    printf("%llu instructions in %llu cycles, CPI %.3f\n", pipe->instructions, pipe->cycles, cpi);
+
+    const char* cause_names[PIPE_CAUSE_COUNT] = PIPE_CAUSE_NAME_ARRAY;
+    printf("Bubbles:");
+    for (int i = 0; PIPE_CAUSE_COUNT > i; i++)
+        printf("  %s %llu", cause_names[i], pipe->bubbles[i]);
+    printf("\n");
+
+    const char* forward_names[PIPE_FORWARD_COUNT] = PIPE_FORWARD_NAME_ARRAY;
+    printf("Forwarded:");
+    for (int i = 0; PIPE_FORWARD_COUNT > i; i++)
+        printf("  %s %llu", forward_names[i], pipe->forwards[i]);
+    printf("\n");
+
+    // Worst addresses first, reported ones are cleared from the search
+    printf("Bubbles by PC:\n");
+    BOOL *shown = calloc(pipe->pc_count + 1, sizeof(BOOL));
+    if (NULL == shown)
+        return;
+    for (int n = 0; top > n; n++)
+    {
+        int worst = -1;
+        unsigned long long worst_total = 0;
+        for (int p = 0; pipe->pc_count > p; p++)
+        {
+            unsigned long long sum = 0;
+            for (int i = 0; PIPE_CAUSE_COUNT > i; i++)
+                sum += pipe->pcs[p].bubbles[i];
+            if ((0 == shown[p]) && (worst_total < sum))
+            {
+                worst = p;
+                worst_total = sum;
+            }
+        }
+
+        // Nothing left?
+        if (0 > worst)
+            break;
+
+        shown[worst] = 1;
+        printf("0x%04x:", pipe->pcs[worst].pc);
+        for (int i = 0; PIPE_CAUSE_COUNT > i; i++)
+            printf("  %s %llu", cause_names[i], pipe->pcs[worst].bubbles[i]);
+        printf("\n");
+    }
+    free(shown);
+}
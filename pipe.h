@@ -0,0 +1,78 @@
+#ifndef PIPE_H
+#define PIPE_H
+
+#include "state.h"
+
+//// Defines
+
+// Bubble causes
+#define PIPE_CAUSE_COUNT 3
+#define PIPE_CAUSE_NAME_ARRAY { "load/use", "mispredict", "ret" }
+
+// Forwarding sources, as named in the PIPE control logic
+#define PIPE_FORWARD_COUNT 5
+#define PIPE_FORWARD_NAME_ARRAY { "e_valE", "m_valM", "M_valE", "W_valM", "W_valE" }
+
+// Instructions in flight after the one being decoded
+#define PIPE_DEPTH 3
+
+//// Type declarations
+
+typedef enum _PIPE_CAUSE
+{
+    PIPE_LOAD_USE,
+    PIPE_MISPREDICT,
+    PIPE_RETURN
+} PIPE_CAUSE;
+
+typedef enum _PIPE_FORWARD
+{
+    PIPE_E_VALE, // ALU result of the instruction in execute
+    PIPE_M_VALM, // Value read by the instruction in memory
+    PIPE_M_REG_VALE, // ALU result in the M pipeline register
+    PIPE_W_VALM, // Loaded value in the W pipeline register
+    PIPE_W_VALE // ALU result in the W pipeline register
+} PIPE_FORWARD;
+
+// An older instruction that may still need to forward its results
+typedef struct _PIPE_SLOT
+{
+    unsigned long long decode; // Cycle it left decode
+    int dst_e;
+    int dst_m;
+} PIPE_SLOT;
+
+// Bubbles caused by the instruction at one address
+typedef struct _PIPE_PC
+{
+    int pc;
+    unsigned long long bubbles[PIPE_CAUSE_COUNT];
+} PIPE_PC;
+
+// Timing model of the five stage PIPE processor, driven by retired
+// instructions.  Forwarding is complete, jXX is predicted taken, and ret
+// stalls fetch until it reaches write-back.
+typedef struct _PIPE
+{
+    unsigned long long instructions;
+    unsigned long long cycles;
+    unsigned long long bubbles[PIPE_CAUSE_COUNT];
+    unsigned long long forwards[PIPE_FORWARD_COUNT];
+    PIPE_PC *pcs; // Only addresses with bubbles, sorted
+    int pc_count;
+    int pc_capacity;
+    int memory_size;
+
+    unsigned long long next_fetch; // Earliest fetch of the next instruction
+    PIPE_SLOT slots[PIPE_DEPTH]; // Most recent first
+    int diagram; // Rows of the stage diagram left to print
+} PIPE;
+
+//// Forward declarations
+
+BOOL pipe_init(PIPE *pipe, int memory_size, int diagram);
+void pipe_free(PIPE *pipe);
+void pipe_retire(void *context, const STATE *state, const RETIRED *retired);
+void pipe_report(PIPE *pipe, int top);
+
+#endif
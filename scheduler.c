@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "scheduler.h"
+
+//// Definitions
+
+BOOL sched_init(SCHED *sched, int workers, unsigned long long quantum, SCHED_POLICY policy, SCHED_DONE done, void *context)
+{
+    // Nothing passed?
+    if (NULL == sched)
+        return 0;
+
+    // Invalid sizes?
+    if ((1 > workers) || (SCHED_WORKER_MAX < workers))
+        return 0;
+
+    memset(sched, 0, sizeof(SCHED));
+    sched->worker_count = workers;
+    sched->quantum = (0 == quantum) ? SCHED_DEF_QUANTUM : quantum;
+    sched->policy = policy;
+    sched->done = done;
+    sched->context = context;
+    atomic_init(&sched->live, 0);
+
+    for (int i = 0; workers > i; i++)
+    {
+        sched->workers[i].sched = sched;
+        pthread_mutex_init(&sched->workers[i].lock, NULL);
+        atomic_init(&sched->workers[i].count, 0);
+    }
+
+    return 1;
+}
+
+void sched_free(SCHED *sched)
+{
+    // Nothing passed?
+    if (NULL == sched)
+        return;
+
+    for (int i = 0; sched->worker_count > i; i++)
+        pthread_mutex_destroy(&sched->workers[i].lock);
+    memset(sched, 0, sizeof(SCHED));
+}
+
+// Queue the guest on the worker, the worker's lock must be held
+static void sched_push(SCHED_WORKER *worker, GUEST *guest)
+{
+    int level = (SCHED_PRIORITY == worker->sched->policy) ? guest->priority : 0;
+    SCHED_QUEUE *queue = worker->queues + level;
+    guest->next = NULL;
+    if (NULL == queue->tail)
+        queue->head = guest;
+    else
+        queue->tail->next = guest;
+    queue->tail = guest;
+    worker->count++;
+}
+
+// Next guest of the worker by priority, the worker's lock must be held
+static GUEST* sched_pop(SCHED_WORKER *worker)
+{
+    for (int level = 0; SCHED_PRIORITIES > level; level++)
+    {
+        SCHED_QUEUE *queue = worker->queues + level;
+        GUEST *guest = queue->head;
+        if (NULL == guest)
+            continue;
+
+        queue->head = guest->next;
+        if (NULL == queue->head)
+            queue->tail = NULL;
+        worker->count--;
+        return guest;
+    }
+    return NULL;
+}
+
+BOOL sched_add(SCHED *sched, GUEST *guest)
+{
+    // Nothing passed?
+    if ((NULL == sched) || (NULL == guest) || (NULL == guest->sim))
+        return 0;
+
+    // Invalid priority?
+    if ((0 > guest->priority) || (SCHED_PRIORITIES <= guest->priority))
+        return 0;
+
+    // Spread over the workers, stealing evens it out later
+    SCHED_WORKER *worker = sched->workers + sched->next_worker;
+    sched->next_worker = (sched->next_worker + 1) % sched->worker_count;
+
+    pthread_mutex_lock(&worker->lock);
+    sched_push(worker, guest);
+    pthread_mutex_unlock(&worker->lock);
+    atomic_fetch_add(&sched->live, 1);
+
+    return 1;
+}
+
+// Takes a guest from the busiest other worker
+static GUEST* sched_steal(SCHED_WORKER *thief)
+{
+    SCHED *sched = thief->sched;
+    SCHED_WORKER *victim = NULL;
+    int most = 0;
+    for (int i = 0; sched->worker_count > i; i++)
+    {
+        SCHED_WORKER *worker = sched->workers + i;
+        int count = atomic_load_explicit(&worker->count, memory_order_relaxed); // Stale only picks a worse victim
+        if ((thief != worker) && (most < count))
+        {
+            victim = worker;
+            most = count;
+        }
+    }
+
+    // Nothing to take?
+    if (NULL == victim)
+        return NULL;
+
+    pthread_mutex_lock(&victim->lock);
+    GUEST *guest = sched_pop(victim);
+    pthread_mutex_unlock(&victim->lock);
+    if (NULL != guest)
+        thief->steals++;
+    return guest;
+}
+
+static void* sched_worker(void *context)
+{
+    SCHED_WORKER *worker = context;
+    SCHED *sched = worker->sched;
+    BUDGET budget = { sched->quantum, 0, 0 };
+
+    while (0 < atomic_load(&sched->live))
+    {
+        pthread_mutex_lock(&worker->lock);
+        GUEST *guest = sched_pop(worker);
+        pthread_mutex_unlock(&worker->lock);
+
+        // Nothing here, help out or wait for the rest to finish
+        if (NULL == guest)
+            guest = sched_steal(worker);
+        if (NULL == guest)
+        {
+            sched_yield();
+            continue;
+        }
+
+        const STATE *state = sim_state(guest->sim);
+        unsigned long long before = state->step;
+        PROGRAM_STATUS status = sim_run_budget(guest->sim, &budget);
+        worker->steps += state->step - before;
+        worker->quanta++;
+        guest->quanta++;
+
+        // Used up its quantum, back of the queue
+        if (LIM == status)
+        {
+            pthread_mutex_lock(&worker->lock);
+            sched_push(worker, guest);
+            pthread_mutex_unlock(&worker->lock);
+            continue;
+        }
+
+        if (NULL != sched->done)
+            sched->done(sched->context, guest);
+        atomic_fetch_sub(&sched->live, 1);
+    }
+
+    return NULL;
+}
+
+BOOL sched_run(SCHED *sched)
+{
+    // Nothing passed?
+    if (NULL == sched)
+        return 0;
+
+    // The calling thread is the first worker
+    int started = 1;
+    BOOL ok = 1;
+    for (; sched->worker_count > started; started++)
+        if (0 != pthread_create(&sched->workers[started].thread, NULL, sched_worker, sched->workers + started))
+        {
+            ok = 0;
+            break;
+        }
+    sched_worker(sched->workers);
+    for (int i = 1; started > i; i++)
+        pthread_join(sched->workers[i].thread, NULL);
+
+    return ok;
+}
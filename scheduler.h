@@ -0,0 +1,82 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "sim.h"
+
+//// Defines
+
+// Priority levels, 0 runs first
+#define SCHED_PRIORITIES 4
+
+// Most worker threads
+#define SCHED_WORKER_MAX 64
+
+// Steps a guest runs before the next one gets a turn, when none is given
+#define SCHED_DEF_QUANTUM 10000
+
+//// Type declarations
+
+typedef enum _SCHED_POLICY
+{
+    SCHED_ROUND_ROBIN, // Every guest in turn, priorities ignored
+    SCHED_PRIORITY // Lowest level with a runnable guest first, round robin within it
+} SCHED_POLICY;
+
+// One guest program, owned by the caller.  The machine already holds all of
+// its state, so switching guests is only taking the next one off a queue.
+typedef struct _GUEST
+{
+    SIM *sim;
+    int priority;
+    void *user;
+    unsigned long long quanta; // Turns it was given
+    struct _GUEST *next;
+} GUEST;
+
+typedef struct _SCHED_QUEUE
+{
+    GUEST *head;
+    GUEST *tail;
+} SCHED_QUEUE;
+
+typedef struct _SCHED SCHED;
+
+// Runs its own queues, steals from the others when they are empty
+typedef struct _SCHED_WORKER
+{
+    pthread_mutex_t lock;
+    SCHED_QUEUE queues[SCHED_PRIORITIES];
+    atomic_int count; // Read by thieves without the lock
+    SCHED *sched;
+    pthread_t thread;
+    unsigned long long quanta;
+    unsigned long long steps;
+    unsigned long long steals;
+} SCHED_WORKER;
+
+// Called on the worker thread once a guest stops for good
+typedef void (*SCHED_DONE)(void *context, GUEST *guest);
+
+struct _SCHED
+{
+    SCHED_WORKER workers[SCHED_WORKER_MAX];
+    int worker_count;
+    int next_worker; // Where the next added guest goes
+    unsigned long long quantum;
+    SCHED_POLICY policy;
+    atomic_int live; // Guests not done yet
+    SCHED_DONE done;
+    void *context;
+};
+
+//// Forward declarations
+
+BOOL sched_init(SCHED *sched, int workers, unsigned long long quantum, SCHED_POLICY policy, SCHED_DONE done, void *context);
+void sched_free(SCHED *sched);
+BOOL sched_add(SCHED *sched, GUEST *guest);
+BOOL sched_run(SCHED *sched);
+
+#endif
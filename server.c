@@ -0,0 +1,628 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "sim.h"
+#include "wire.h"
+
+//// Defines
+
+#define DEF_SOCKET "sim.sock"
+#define DEF_CACHE 256
+#define DEF_POOL 16
+#define DEF_MAX_STEPS 10000000ULL
+
+// Most clients connected at once
+#define CLIENT_MAX 64
+
+//// Type declarations
+
+// A cached image, zero padded to the memory size, without a Y86-64 header
+typedef struct _PROGRAM
+{
+    unsigned long long hash;
+    unsigned char *image;
+    int word_size;
+    int next; // Next in the hash bucket, -1 at the end
+    int newer; // Toward the most recently used, -1 at the end
+    int older; // Toward the least recently used, -1 at the end
+} PROGRAM;
+
+// Images by content hash, least recently used evicted first
+typedef struct _PROGRAMS
+{
+    PROGRAM *entries;
+    int capacity;
+    int count;
+    int *buckets;
+    int bucket_mask;
+    int newest;
+    int oldest;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+} PROGRAMS;
+
+// Machines ready to run, each remembers the image it holds so running the
+// same program again only needs a reset
+typedef struct _POOL
+{
+    SIM **sims;
+    unsigned long long *hashes;
+    BOOL *loaded;
+    unsigned long long *last_used;
+    int size;
+    unsigned long long clock;
+    unsigned long long reloads;
+} POOL;
+
+// A connection, with the frame it is part way through sending
+typedef struct _CLIENT
+{
+    int fd;
+    unsigned char *in; // Header and payload
+    size_t in_size;
+    size_t in_capacity;
+} CLIENT;
+
+typedef struct _SERVER
+{
+    int memory_size;
+    unsigned long long max_steps;
+    PROGRAMS programs;
+    POOL pool;
+    unsigned char *out;
+    size_t out_capacity;
+    unsigned long long requests;
+    unsigned long long runs;
+} SERVER;
+
+typedef struct _OPTIONS
+{
+    const char* socket;
+    int memory_size;
+    int cache;
+    int pool;
+    unsigned long long max_steps;
+} OPTIONS;
+
+//// Forward declarations
+
+BOOL options_parse(OPTIONS *options, int argc, char** argv);
+void options_usage(const char* prog);
+BOOL programs_init(PROGRAMS *programs, int capacity, int memory_size);
+void programs_free(PROGRAMS *programs);
+int programs_find(PROGRAMS *programs, unsigned long long hash);
+int programs_put(PROGRAMS *programs, unsigned long long hash, const unsigned char *image, int size, int memory_size);
+BOOL pool_init(POOL *pool, int size, int memory_size);
+void pool_free(POOL *pool);
+SIM* pool_take(POOL *pool, const PROGRAM *program, int memory_size);
+BOOL server_reserve(SERVER *server, size_t size);
+BOOL server_put(SERVER *server, const unsigned char *data, size_t size, size_t *reply);
+BOOL server_run(SERVER *server, const unsigned char *data, size_t size, size_t *reply);
+BOOL server_client(SERVER *server, CLIENT *client);
+
+//// Main function
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_signal(int signal)
+{
+    stopping = 1;
+}
+
+int main(int argc, char** argv)
+{
+    OPTIONS options = { DEF_SOCKET, DEF_MEMORY_SIZE, DEF_CACHE, DEF_POOL, DEF_MAX_STEPS };
+    if (0 == options_parse(&options, argc, argv))
+    {
+        options_usage((0 == argc) ? "server" : argv[0]);
+        return 0;
+    }
+
+    SERVER server = { 0 };
+    server.memory_size = options.memory_size;
+    server.max_steps = options.max_steps;
+    if ((0 == programs_init(&server.programs, options.cache, options.memory_size))
+        || (0 == pool_init(&server.pool, options.pool, options.memory_size)))
+    {
+        printf("[!] Failed to allocate the cache and pool\n");
+        programs_free(&server.programs);
+        pool_free(&server.pool);
+        return 1;
+    }
+
+    // Listen
+    struct sockaddr_un address = { 0 };
+    address.sun_family = AF_UNIX;
+    if (sizeof(address.sun_path) <= strlen(options.socket))
+    {
+        printf("[!] Socket path too long: '%s'\n", options.socket);
+        return 1;
+    }
+    strcpy(address.sun_path, options.socket);
+    unlink(options.socket);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((0 > listener) || (0 != bind(listener, (struct sockaddr*) &address, sizeof(address)))
+        || (0 != listen(listener, CLIENT_MAX)))
+    {
+        printf("[!] Could not listen on: '%s'\n", options.socket);
+        return 1;
+    }
+
+    // Stop cleanly, and keep going when a client goes away mid reply
+    struct sigaction action = { 0 };
+    action.sa_handler = on_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("[-] Listening on '%s', memory %d, cache %d, pool %d\n", options.socket, options.memory_size, options.cache, options.pool);
+    fflush(stdout);
+
+    // Clients share the index of their descriptor, 0 is the listener
+    struct pollfd fds[CLIENT_MAX + 1];
+    CLIENT clients[CLIENT_MAX + 1];
+    int count = 1;
+    fds[0].fd = listener;
+    fds[0].events = POLLIN;
+    while (0 == stopping)
+    {
+        if (0 > poll(fds, count, -1))
+        {
+            if (EINTR == errno)
+                continue;
+            break;
+        }
+
+        // Requests, a closed client is swapped with the last one
+        for (int i = count - 1; 1 <= i; i--)
+            if ((0 != fds[i].revents) && (0 == server_client(&server, clients + i)))
+            {
+                close(fds[i].fd);
+                free(clients[i].in);
+                fds[i] = fds[--count];
+                clients[i] = clients[count];
+            }
+
+        // New clients
+        if (0 != (fds[0].revents & POLLIN))
+        {
+            // Never wait on one client, its frames are read as they come
+            int client = accept(listener, NULL, NULL);
+            if ((0 <= client) && (CLIENT_MAX + 1 > count) && (0 == fcntl(client, F_SETFL, O_NONBLOCK)))
+            {
+                fds[count].fd = client;
+                fds[count].events = POLLIN;
+                fds[count].revents = 0;
+                memset(clients + count, 0, sizeof(CLIENT));
+                clients[count].fd = client;
+                count++;
+            }
+            else if (0 <= client)
+                close(client);
+        }
+    }
+
+    for (int i = 0; count > i; i++)
+    {
+        close(fds[i].fd);
+        if (0 < i)
+            free(clients[i].in);
+    }
+    unlink(options.socket);
+
+    printf("[-] Served %llu requests, %llu runs\n", server.requests, server.runs);
+    printf("Cache: %llu hits, %llu misses, %llu evicted, %llu machines loaded\n",
+           server.programs.hits, server.programs.misses, server.programs.evictions, server.pool.reloads);
+
+    programs_free(&server.programs);
+    pool_free(&server.pool);
+    free(server.out);
+    return 0;
+}
+
+//// Definitions
+
+BOOL options_parse(OPTIONS *options, int argc, char** argv)
+{
+    for (int i = 1; argc > i; i++)
+    {
+        char* arg = argv[i];
+        BOOL has_value = (argc > i + 1);
+
+        if ((0 == strcmp(arg, "--socket")) && has_value)
+            options->socket = argv[++i];
+        else if ((0 == strcmp(arg, "--memory")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &options->memory_size)) || (8 > options->memory_size) || (0 != options->memory_size % 4))
+                return 0;
+        }
+        else if ((0 == strcmp(arg, "--cache")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &options->cache)) || (1 > options->cache))
+                return 0;
+        }
+        else if ((0 == strcmp(arg, "--pool")) && has_value)
+        {
+            if ((0 == an_parse_int(argv[++i], &options->pool)) || (1 > options->pool))
+                return 0;
+        }
+        else if ((0 == strcmp(arg, "--max-steps")) && has_value)
+        {
+            char* end = NULL;
+            i++;
+            options->max_steps = strtoull(argv[i], &end, 0);
+            if (('-' == argv[i][0]) || ('\0' != *end) || (0 == options->max_steps))
+                return 0;
+        }
+        else
+        {
+            printf("[!] Unknown option: '%s'\n", arg);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void options_usage(const char* prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("Options:\n");
+    printf("  --socket PATH    Unix socket to listen on, default %s\n", DEF_SOCKET);
+    printf("  --memory N       Memory size of every machine, default %d\n", DEF_MEMORY_SIZE);
+    printf("  --cache N        Programs kept by content hash, default %d\n", DEF_CACHE);
+    printf("  --pool N         Machines kept ready to run, default %d\n", DEF_POOL);
+    printf("  --max-steps N    Most steps of one run, default %llu\n", DEF_MAX_STEPS);
+}
+
+BOOL programs_init(PROGRAMS *programs, int capacity, int memory_size)
+{
+    memset(programs, 0, sizeof(PROGRAMS));
+
+    // Twice as many buckets as entries, rounded up to a power of 2
+    int buckets = 1;
+    while (capacity * 2 > buckets)
+        buckets *= 2;
+
+    programs->entries = calloc(capacity, sizeof(PROGRAM));
+    programs->buckets = malloc(buckets * sizeof(int));
+    if ((NULL == programs->entries) || (NULL == programs->buckets))
+        return 0;
+
+    for (int i = 0; capacity > i; i++)
+    {
+        programs->entries[i].image = malloc(memory_size);
+        if (NULL == programs->entries[i].image)
+            return 0;
+    }
+    memset(programs->buckets, 0xFF, buckets * sizeof(int));
+    programs->capacity = capacity;
+    programs->bucket_mask = buckets - 1;
+    programs->newest = -1;
+    programs->oldest = -1;
+
+    return 1;
+}
+
+void programs_free(PROGRAMS *programs)
+{
+    if (NULL != programs->entries)
+        for (int i = 0; programs->capacity > i; i++)
+            free(programs->entries[i].image);
+    free(programs->entries);
+    free(programs->buckets);
+    memset(programs, 0, sizeof(PROGRAMS));
+}
+
+static void programs_unlink(PROGRAMS *programs, int index)
+{
+    PROGRAM *program = programs->entries + index;
+    if (0 <= program->newer)
+        programs->entries[program->newer].older = program->older;
+    else
+        programs->newest = program->older;
+    if (0 <= program->older)
+        programs->entries[program->older].newer = program->newer;
+    else
+        programs->oldest = program->newer;
+}
+
+static void programs_make_newest(PROGRAMS *programs, int index)
+{
+    PROGRAM *program = programs->entries + index;
+    program->newer = -1;
+    program->older = programs->newest;
+    if (0 <= programs->newest)
+        programs->entries[programs->newest].newer = index;
+    programs->newest = index;
+    if (0 > programs->oldest)
+        programs->oldest = index;
+}
+
+int programs_find(PROGRAMS *programs, unsigned long long hash)
+{
+    int index = programs->buckets[hash & programs->bucket_mask];
+    while ((0 <= index) && (hash != programs->entries[index].hash))
+        index = programs->entries[index].next;
+
+    // Not cached?
+    if (0 > index)
+    {
+        programs->misses++;
+        return -1;
+    }
+
+    programs->hits++;
+    if (programs->newest != index)
+    {
+        programs_unlink(programs, index);
+        programs_make_newest(programs, index);
+    }
+    return index;
+}
+
+int programs_put(PROGRAMS *programs, unsigned long long hash, const unsigned char *image, int size, int memory_size)
+{
+    // Already there?
+    int index = programs->buckets[hash & programs->bucket_mask];
+    while ((0 <= index) && (hash != programs->entries[index].hash))
+        index = programs->entries[index].next;
+    if (0 <= index)
+        return index;
+
+    // Room left, or evict the least recently used
+    if (programs->capacity > programs->count)
+        index = programs->count++;
+    else
+    {
+        index = programs->oldest;
+        programs_unlink(programs, index);
+        int *link = programs->buckets + (programs->entries[index].hash & programs->bucket_mask);
+        while (index != *link)
+            link = &programs->entries[*link].next;
+        *link = programs->entries[index].next;
+        programs->evictions++;
+    }
+
+    // Y86-64 header?  Kept as the word size, so the image lines up with memory
+    PROGRAM *program = programs->entries + index;
+    program->word_size = WORD_SIZE_32;
+    if ((WORD64_MAGIC_SIZE <= size) && (0 == memcmp(image, WORD64_MAGIC, WORD64_MAGIC_SIZE)))
+    {
+        program->word_size = WORD_SIZE_64;
+        image += WORD64_MAGIC_SIZE;
+        size -= WORD64_MAGIC_SIZE;
+    }
+    program->hash = hash;
+    memcpy(program->image, image, size);
+    memset(program->image + size, 0, memory_size - size);
+    program->next = programs->buckets[hash & programs->bucket_mask];
+    programs->buckets[hash & programs->bucket_mask] = index;
+    programs_make_newest(programs, index);
+
+    return index;
+}
+
+BOOL pool_init(POOL *pool, int size, int memory_size)
+{
+    memset(pool, 0, sizeof(POOL));
+    pool->sims = calloc(size, sizeof(SIM*));
+    pool->hashes = calloc(size, sizeof(unsigned long long));
+    pool->loaded = calloc(size, sizeof(BOOL));
+    pool->last_used = calloc(size, sizeof(unsigned long long));
+    if ((NULL == pool->sims) || (NULL == pool->hashes) || (NULL == pool->loaded) || (NULL == pool->last_used))
+        return 0;
+    pool->size = size;
+
+    for (int i = 0; size > i; i++)
+    {
+        pool->sims[i] = sim_create(memory_size, NULL);
+        if (NULL == pool->sims[i])
+            return 0;
+    }
+
+    return 1;
+}
+
+void pool_free(POOL *pool)
+{
+    if (NULL != pool->sims)
+        for (int i = 0; pool->size > i; i++)
+            sim_destroy(pool->sims[i]);
+    free(pool->sims);
+    free(pool->hashes);
+    free(pool->loaded);
+    free(pool->last_used);
+    memset(pool, 0, sizeof(POOL));
+}
+
+// A machine reset to the program, loaded only if none holds it already
+SIM* pool_take(POOL *pool, const PROGRAM *program, int memory_size)
+{
+    int pick = 0;
+    for (int i = 0; pool->size > i; i++)
+    {
+        if ((0 != pool->loaded[i]) && (program->hash == pool->hashes[i]))
+        {
+            pick = i;
+            break;
+        }
+        if (pool->last_used[pick] > pool->last_used[i])
+            pick = i;
+    }
+
+    SIM *sim = pool->sims[pick];
+    if ((0 != pool->loaded[pick]) && (program->hash == pool->hashes[pick]))
+        sim_reset(sim);
+    else
+    {
+        sim_word_size(sim, program->word_size);
+        sim_load(sim, program->image, memory_size);
+        pool->hashes[pick] = program->hash;
+        pool->loaded[pick] = 1;
+        pool->reloads++;
+    }
+    pool->last_used[pick] = ++pool->clock;
+
+    return sim;
+}
+
+BOOL server_reserve(SERVER *server, size_t size)
+{
+    // Big enough?
+    if (server->out_capacity >= size)
+        return 1;
+
+    size_t capacity = (0 == server->out_capacity) ? 4096 : server->out_capacity;
+    while (capacity < size)
+        capacity *= 2;
+    unsigned char *grown = realloc(server->out, capacity);
+    if (NULL == grown)
+        return 0;
+    server->out = grown;
+    server->out_capacity = capacity;
+    return 1;
+}
+
+BOOL server_put(SERVER *server, const unsigned char *data, size_t size, size_t *reply)
+{
+    // No hash, or does not fit?
+    if ((8 > size) || (0 == server_reserve(server, 1)))
+        return 0;
+    size_t header = ((8 + WORD64_MAGIC_SIZE <= size) && (0 == memcmp(data + 8, WORD64_MAGIC, WORD64_MAGIC_SIZE))) ? WORD64_MAGIC_SIZE : 0;
+    if ((size_t) server->memory_size < size - 8 - header)
+        return 0;
+
+    // Hash must match the content
+    unsigned long long hash = wire_get_long(data);
+    BOOL ok = (hash == wire_hash(data + 8, size - 8));
+    if (0 != ok)
+        programs_put(&server->programs, hash, data + 8, (int) (size - 8), server->memory_size);
+
+    server->out[0] = ok;
+    *reply = 1;
+    return 1;
+}
+
+// Status, counters, registers, then the memory words that changed
+static unsigned char* server_result(unsigned char *out, const STATE *state, const unsigned char *image)
+{
+    *out++ = (unsigned char) state->status;
+    out = wire_put_varint(out, state->step);
+    out = wire_put_varint(out, (unsigned int) state->pc);
+    *out++ = (unsigned char) (state->codes.ZF | (state->codes.SF << 1) | (state->codes.OF << 2));
+
+    // Registers of the word size the image ran with
+    BOOL wide = (WORD_SIZE_64 == state->word_size);
+    int count = (0 != wide) ? REGISTER64_COUNT : REGISTER_COUNT;
+    unsigned long long values[REGISTER64_COUNT];
+    unsigned int mask = 0;
+    for (int i = 0; count > i; i++)
+    {
+        values[i] = (0 != wide) ? (unsigned long long) state->registers64.ids[i] : (unsigned int) state->registers.ids[i];
+        if (0 != values[i])
+            mask |= 1u << i;
+    }
+    out = wire_put_varint(out, mask);
+    for (int i = 0; count > i; i++)
+        if (0 != values[i])
+            out = wire_put_varint(out, values[i]);
+
+    int words = state->memory_size / 4;
+    int changed = 0;
+    for (int i = 0; words > i; i++)
+        changed += (0 != memcmp(state->memory + i * 4, image + i * 4, 4));
+    out = wire_put_varint(out, changed);
+
+    int last = 0;
+    for (int i = 0; (words > i) && (0 < changed); i++)
+        if (0 != memcmp(state->memory + i * 4, image + i * 4, 4))
+        {
+            unsigned int value = 0;
+            an_bytes_int(state->memory + i * 4, &value);
+            out = wire_put_varint(out, i - last);
+            out = wire_put_varint(out, value);
+            last = i;
+            changed--;
+        }
+
+    return out;
+}
+
+BOOL server_run(SERVER *server, const unsigned char *data, size_t size, size_t *reply)
+{
+    const unsigned char *end = data + size;
+    unsigned long long count = 0;
+    data = wire_get_varint(data, end, &count);
+    if ((NULL == data) || ((size_t) (end - data) / 9 < count) || (0 == server_reserve(server, 10)))
+        return 0;
+
+    size_t used = wire_put_varint(server->out, count) - server->out;
+    size_t result_max = WIRE_RESULT_MAX + (size_t) server->memory_size / 4 * 10;
+    for (unsigned long long i = 0; count > i; i++)
+    {
+        // Hash and budget
+        if (end - data < 9)
+            return 0;
+        unsigned long long hash = wire_get_long(data);
+        unsigned long long steps = 0;
+        data = wire_get_varint(data + 8, end, &steps);
+        if ((NULL == data) || (0 == server_reserve(server, used + result_max)))
+            return 0;
+
+        // Not cached?
+        int index = programs_find(&server->programs, hash);
+        if (0 > index)
+        {
+            server->out[used++] = WIRE_UNKNOWN;
+            continue;
+        }
+
+        const PROGRAM *program = server->programs.entries + index;
+        SIM *sim = pool_take(&server->pool, program, server->memory_size);
+        BUDGET budget = { server->max_steps, 0, 0 };
+        if ((0 != steps) && (server->max_steps > steps))
+            budget.steps = steps;
+        sim_run_budget(sim, &budget);
+        used = server_result(server->out + used, sim_state(sim), program->image) - server->out;
+        server->runs++;
+    }
+
+    *reply = used;
+    return 1;
+}
+
+// Reads what the client sent and answers once a frame is whole, 0 to drop
+// the client.  One frame per call, so every client gets a turn
+BOOL server_client(SERVER *server, CLIENT *client)
+{
+    int got = wire_recv_some(client->fd, &client->in, &client->in_size, &client->in_capacity);
+    if (WIRE_CLOSED == got)
+        return 0;
+    if (WIRE_PARTIAL == got)
+        return 1;
+
+    unsigned char type = client->in[4];
+    const unsigned char *data = client->in + WIRE_HEADER_SIZE;
+    size_t size = client->in_size - WIRE_HEADER_SIZE;
+    client->in_size = 0;
+
+    size_t reply = 0;
+    BOOL ok = 0;
+    if (WIRE_PUT == type)
+        ok = server_put(server, data, size, &reply);
+    else if (WIRE_RUN == type)
+        ok = server_run(server, data, size, &reply);
+
+    server->requests++;
+    return (0 != ok) && (0 != wire_send(client->fd, type, server->out, reply));
+}
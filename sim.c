@@ -0,0 +1,277 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "engine.h"
+
+//// Type declarations
+
+struct _SIM
+{
+    STATE state;
+    unsigned char *image; // Memory as loaded, restored by sim_reset
+    PROBES probes;
+    SIM_ALLOCATOR allocator;
+    BOOL compile; // Backends may run the compiler
+    int word_size; // Of images without a header
+    ENGINE engine;
+};
+
+//// Definitions
+
+static void* sim_default_alloc(void *context, size_t size)
+{
+    return malloc(size);
+}
+
+static void sim_default_free(void *context, void *pointer)
+{
+    free(pointer);
+}
+
+SIM* sim_create(int memory_size, const SIM_ALLOCATOR *allocator)
+{
+    // Invalid memory size?
+    if ((1 > memory_size) || (0 != memory_size % 4))
+        return NULL;
+
+    // Half an allocator?
+    SIM_ALLOCATOR use = { sim_default_alloc, sim_default_free, NULL };
+    if (NULL != allocator)
+    {
+        if ((NULL == allocator->alloc) || (NULL == allocator->free))
+            return NULL;
+        use = *allocator;
+    }
+
+    SIM *sim = use.alloc(use.context, sizeof(SIM));
+    if (NULL == sim)
+        return NULL;
+    memset(sim, 0, sizeof(SIM));
+    sim->allocator = use;
+    sim->word_size = WORD_SIZE_32;
+
+    // Machine and image in one block
+    sim->state.memory = use.alloc(use.context, (size_t) memory_size * 2);
+    if (NULL == sim->state.memory)
+    {
+        use.free(use.context, sim);
+        return NULL;
+    }
+    memset(sim->state.memory, 0, (size_t) memory_size * 2);
+    sim->image = sim->state.memory + memory_size;
+    sim->state.memory_size = memory_size;
+    state_init(&sim->state);
+    ENGINE_OPTIONS options = { use, 0 };
+    engine_open(&sim->engine, ENGINE_DEF_BACKEND, &sim->state, &options);
+
+    return sim;
+}
+
+void sim_destroy(SIM *sim)
+{
+    // Nothing passed?
+    if (NULL == sim)
+        return;
+
+    engine_close(&sim->engine);
+    SIM_ALLOCATOR allocator = sim->allocator;
+    allocator.free(allocator.context, sim->state.memory);
+    allocator.free(allocator.context, sim);
+}
+
+BOOL sim_load(SIM *sim, const unsigned char *image, int size)
+{
+    // Nothing passed?
+    if ((NULL == sim) || ((NULL == image) && (0 != size)))
+        return 0;
+
+    // Y86-64 image?  The header is not part of memory
+    int word_size = sim->word_size;
+    if ((WORD64_MAGIC_SIZE <= size) && (0 == memcmp(image, WORD64_MAGIC, WORD64_MAGIC_SIZE)))
+    {
+        word_size = WORD_SIZE_64;
+        image += WORD64_MAGIC_SIZE;
+        size -= WORD64_MAGIC_SIZE;
+    }
+
+    // Does not fit?
+    if ((0 > size) || (sim->state.memory_size < size))
+        return 0;
+
+    memset(sim->image, 0, sim->state.memory_size);
+    if (0 < size)
+        memcpy(sim->image, image, size);
+    sim->state.word_size = word_size;
+    sim_reset(sim);
+
+    return 1;
+}
+
+void sim_reset(SIM *sim)
+{
+    // Nothing passed?
+    if (NULL == sim)
+        return;
+
+    memcpy(sim->state.memory, sim->image, sim->state.memory_size);
+    engine_flush(&sim->engine);
+    memset(&sim->state.registers, 0, sizeof(REGISTERS));
+    memset(&sim->state.registers64, 0, sizeof(REGISTERS64));
+    memset(&sim->state.codes, 0, sizeof(CONDITION_CODES));
+    state_restart(&sim->state);
+}
+
+// WORD_SIZE_32 or WORD_SIZE_64 for images without a header, the next
+// sim_load picks Y86-64 anyway when it finds one
+BOOL sim_word_size(SIM *sim, int bytes)
+{
+    // Nothing passed?
+    if (NULL == sim)
+        return 0;
+
+    // Unknown size?
+    if ((WORD_SIZE_32 != bytes) && (WORD_SIZE_64 != bytes))
+        return 0;
+
+    sim->word_size = bytes;
+    sim->state.word_size = bytes;
+    return 1;
+}
+
+// Executor by name, see engine.h, the current one is kept if it is unknown
+BOOL sim_backend(SIM *sim, const char *name)
+{
+    // Nothing passed?
+    if (NULL == sim)
+        return 0;
+
+    ENGINE engine;
+    ENGINE_OPTIONS options = { sim->allocator, sim->compile };
+    if (0 == engine_open(&engine, name, &sim->state, &options))
+        return 0;
+
+    engine_close(&sim->engine);
+    sim->engine = engine;
+    return 1;
+}
+
+// Lets the next sim_backend run the system compiler and write its cache,
+// off by default so a backend that compiles only loads cached code
+void sim_compile(SIM *sim, BOOL allow)
+{
+    // Nothing passed?
+    if (NULL == sim)
+        return;
+
+    sim->compile = (0 != allow);
+}
+
+// Block instructions take a step more per step_bytes bytes, 0 for one step
+void sim_block_cost(SIM *sim, int step_bytes)
+{
+    // Nothing passed?
+    if ((NULL == sim) || (0 > step_bytes))
+        return;
+
+    sim->state.block_step_bytes = step_bytes;
+}
+
+// Services for trap, such as a HOSTIO's host, NULL so traps fault
+void sim_host(SIM *sim, HOST *host)
+{
+    // Nothing passed?
+    if (NULL == sim)
+        return;
+
+    sim->state.host = host;
+}
+
+// Memory mapped device such as a CONSOLE's, NULL for none
+void sim_device(SIM *sim, DEVICE *device)
+{
+    // Nothing passed?
+    if (NULL == sim)
+        return;
+
+    sim->state.device = device;
+}
+
+// Routines to run natively, such as an HLE scanned from the loaded image,
+// NULL to interpret every one
+void sim_hle(SIM *sim, HLE *hle)
+{
+    // Nothing passed?
+    if (NULL == sim)
+        return;
+
+    sim->state.hle = hle;
+}
+
+BOOL sim_probe(SIM *sim, PROBE_RETIRE retire, void *context)
+{
+    // Nothing passed?
+    if (NULL == sim)
+        return 0;
+
+    return probes_add(&sim->probes, retire, context);
+}
+
+// Runs until the program stops or exactly steps more, 0 for no limit
+PROGRAM_STATUS sim_run(SIM *sim, unsigned long long steps)
+{
+    BUDGET budget = { steps, 0, (0 != steps) };
+    return sim_run_budget(sim, &budget);
+}
+
+PROGRAM_STATUS sim_run_budget(SIM *sim, const BUDGET *budget)
+{
+    // Nothing passed?
+    if (NULL == sim)
+        return INS;
+
+    return engine_resume(&sim->engine, &sim->state, budget, &sim->probes);
+}
+
+PROGRAM_STATUS sim_step(SIM *sim)
+{
+    return sim_run(sim, 1);
+}
+
+const STATE* sim_state(const SIM *sim)
+{
+    // Nothing passed?
+    if (NULL == sim)
+        return NULL;
+
+    return &sim->state;
+}
+
+BOOL sim_read(const SIM *sim, int address, unsigned int *value)
+{
+    // Nothing passed?
+    if ((NULL == sim) || (NULL == value))
+        return 0;
+
+    // Invalid address?
+    if ((0 > address) || (sim->state.memory_size - 4 < address))
+        return 0;
+
+    an_bytes_int(sim->state.memory + address, value);
+    return 1;
+}
+
+BOOL sim_write(SIM *sim, int address, unsigned int value)
+{
+    // Nothing passed?
+    if (NULL == sim)
+        return 0;
+
+    // Invalid address?
+    if ((0 > address) || (sim->state.memory_size - 4 < address))
+        return 0;
+
+    an_int_bytes(value, sim->state.memory + address);
+    engine_flush(&sim->engine);
+    return 1;
+}
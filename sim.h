@@ -0,0 +1,41 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stddef.h>
+
+#include "engine.h"
+
+// Embeddable simulator.  A SIM owns one machine and the image it was loaded
+// with, there is no global state and nothing is printed, so a host can keep
+// any number of them and run short jobs without starting a process each.
+
+//// Type declarations
+
+// Memory for a SIM, its machine and its backend, malloc and free when none
+// is given
+typedef ENGINE_ALLOCATOR SIM_ALLOCATOR;
+
+typedef struct _SIM SIM;
+
+//// Forward declarations
+
+SIM* sim_create(int memory_size, const SIM_ALLOCATOR *allocator);
+void sim_destroy(SIM *sim);
+BOOL sim_load(SIM *sim, const unsigned char *image, int size);
+void sim_reset(SIM *sim);
+BOOL sim_word_size(SIM *sim, int bytes);
+BOOL sim_backend(SIM *sim, const char *name);
+void sim_compile(SIM *sim, BOOL allow);
+void sim_block_cost(SIM *sim, int step_bytes);
+void sim_host(SIM *sim, HOST *host);
+void sim_device(SIM *sim, DEVICE *device);
+void sim_hle(SIM *sim, HLE *hle);
+BOOL sim_probe(SIM *sim, PROBE_RETIRE retire, void *context);
+PROGRAM_STATUS sim_run(SIM *sim, unsigned long long steps);
+PROGRAM_STATUS sim_run_budget(SIM *sim, const BUDGET *budget);
+PROGRAM_STATUS sim_step(SIM *sim);
+const STATE* sim_state(const SIM *sim);
+BOOL sim_read(const SIM *sim, int address, unsigned int *value);
+BOOL sim_write(SIM *sim, int address, unsigned int value);
+
+#endif
@@ -0,0 +1,492 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "state.h"
+#include "dump.h"
+#include "hle.h"
+
+//// Definitions
+
+void state_init(STATE *state)
+{
+    // Nothing passed?
+    if (NULL == state)
+        return;
+
+    state->status = AOK;
+}
+
+// Zeroed whole pages, untouched ones cost nothing until used
+static MEMORY state_pages(int size)
+{
+    void *memory = mmap(NULL, (size_t) size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (MAP_FAILED == memory) ? NULL : memory;
+}
+
+BOOL state_allocate(STATE *state, int memory_size)
+{
+    // Nothing passed?
+    if (NULL == state)
+        return 0;
+
+    // Invalid memory size?
+    if (1 > memory_size)
+        return 0;
+    
+    // Free existing
+    state_free(state);
+    
+    // Try to allocate, already zero
+    state->memory = state_pages(memory_size);
+    if (NULL == state->memory)
+        return 0;
+    
+    state->memory_size = memory_size;
+    state->memory_pages = 1;
+
+    return 1;
+}
+
+void state_free(STATE *state)
+{
+    // Nothing passed?
+    if (NULL == state)
+        return;
+
+    // Nothing allocated?
+    if (0 >= state->memory_size)
+        return;
+    
+    // Files mapped over it go with it
+    if (0 != state->memory_pages)
+        munmap(state->memory, (size_t) state->memory_size);
+    else
+        free(state->memory);
+    state->memory_size = 0;
+    state->memory_pages = 0;
+}
+
+BOOL state_compile(STATE *state, const char* filename)
+{
+    // Nothing passed?
+    if (NULL == state)
+        return 0;
+
+    // No memory?
+    if (0 >= state->memory_size)
+        return 0;
+
+    // Possibly use something like this:
+    // https://github.com/xsznix/js-y86/blob/master/js/y86.js : evalArgs
+    // https://github.com/xsznix/js-y86/blob/master/js/syntax.js
+
+    printf("[!] TODO: Compile '%s'\n", filename);
+
+    // Manually compiled information from CMU.edu
+    const int program[] = {
+        0x30f40001, 0x000030f5, 0x00010000, 0x80240000,
+        0x00000000, 0x0d000000, 0xc0000000, 0x000b0000,
+        0x00a00000, 0xa05f2045, 0x30f00400, 0x0000a00f,
+        0x30f21400, 0x0000a02f, 0x80420000, 0x002054b0,
+        0x5f90a05f, 0x20455015, 0x08000000, 0x50250c00,
+        0x00006300, 0x62227378, 0x00000050, 0x61000000,
+        0x00606030, 0xf3040000, 0x00603130, 0xf3ffffff,
+        0xff603274, 0x5b000000, 0x2045b05f, 0x90000000,
+    };
+    for (int i = 0; 32 > i; i++)
+        an_int_bytes_big(program[i], state->memory + (i * 4));
+
+    return 1;
+}
+
+// Places a host file at address.  On memory from state_allocate the whole
+// pages of it are mapped copy on write when address is on a page, so nothing
+// is read until the guest touches it, the rest is read in.  Returns the bytes
+// placed, -1 if the file cannot be read or does not fit
+int state_map_file(STATE *state, int address, const char *path)
+{
+    // Nothing passed?
+    if ((NULL == state) || (NULL == path))
+        return -1;
+
+    int fd = open(path, O_RDONLY);
+    if (0 > fd)
+        return -1;
+
+    // Does not fit?
+    struct stat info;
+    if ((0 != fstat(fd, &info)) || (0 > address) || (state->memory_size < address)
+        || ((off_t) (state->memory_size - address) < info.st_size))
+    {
+        close(fd);
+        return -1;
+    }
+
+    int size = (int) info.st_size;
+    int mapped = 0;
+    long page = sysconf(_SC_PAGESIZE);
+    if ((0 != state->memory_pages) && (0 < page) && (0 == address % page))
+    {
+        mapped = size - size % (int) page;
+        if ((0 < mapped) && (MAP_FAILED == mmap(state->memory + address, (size_t) mapped, PROT_READ | PROT_WRITE,
+                                                MAP_PRIVATE | MAP_FIXED, fd, 0)))
+            mapped = 0;
+    }
+
+    // Part of a page, or memory that cannot take a mapping
+    for (int pos = mapped; size > pos; )
+    {
+        ssize_t got = pread(fd, state->memory + address + pos, (size_t) (size - pos), pos);
+        if ((0 > got) && (EINTR == errno))
+            continue;
+        if (0 >= got)
+        {
+            close(fd);
+            return -1;
+        }
+        pos += (int) got;
+    }
+
+    close(fd);
+    return size;
+}
+
+//// Executor variants
+
+static void probes_retire(PROBES *probes, const STATE *state, const RETIRED *retired)
+{
+    for (int i = 0; probes->count > i; i++)
+        probes->retire[i](probes->context[i], state, retired);
+}
+
+static double limit_clock(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+void limit_start(LIMIT *limit, const STATE *state, const BUDGET *budget)
+{
+    limit->steps = ~0ULL;
+    limit->deadline = 0;
+    if (NULL != budget)
+    {
+        if ((0 != budget->steps) && (~0ULL - state->step > budget->steps))
+            limit->steps = state->step + budget->steps;
+        if (0 < budget->seconds)
+            limit->deadline = limit_clock() + budget->seconds;
+    }
+
+    // Only a timed run needs checks before the step limit
+    limit->check_at = limit->steps;
+    if ((0 != limit->deadline) && (limit->steps - state->step > BUDGET_CLOCK_STEPS))
+        limit->check_at = state->step + BUDGET_CLOCK_STEPS;
+}
+
+// Called once check_at is reached, moves it along if the budget is not spent
+BOOL limit_reached(LIMIT *limit, const STATE *state)
+{
+    if (limit->steps <= state->step)
+        return 1;
+    if ((0 != limit->deadline) && (limit->deadline <= limit_clock()))
+        return 1;
+
+    limit->check_at = limit->steps;
+    if (limit->steps - state->step > BUDGET_CLOCK_STEPS)
+        limit->check_at = state->step + BUDGET_CLOCK_STEPS;
+    return 0;
+}
+
+// Device registers, once an access has missed memory
+static BOOL state_device_store(STATE *state, int pos, unsigned int value)
+{
+    DEVICE *device = state->device;
+    unsigned int offset = (unsigned int) pos - ((NULL != device) ? device->base : 0);
+    return (NULL != device) && (device->size > offset) && (NULL != device->store)
+           && (0 != device->store(device->context, offset, value));
+}
+
+static BOOL state_device_load(STATE *state, int pos, unsigned int *value)
+{
+    DEVICE *device = state->device;
+    unsigned int offset = (unsigned int) pos - ((NULL != device) ? device->base : 0);
+    return (NULL != device) && (device->size > offset) && (NULL != device->load)
+           && (0 != device->load(device->context, offset, value));
+}
+
+// Each word size gets its own helpers and executor variants, so the loop
+// never looks at the word size
+
+// Y86-32
+#define WORD unsigned int
+#define SWORD int
+#define WORD_BYTES WORD_SIZE_32
+#define WORD_REGISTERS registers.ids
+#define WORD_REGISTER_COUNT REGISTER_COUNT
+#define WORD_LOAD an_bytes_int
+#define WORD_STORE an_int_bytes
+#define WORD_OPERATE state_operate_32
+#define WORD_PUSH state_push_32
+#define WORD_POP state_pop_32
+#include "state_word.h"
+
+#define STATE_RUN_NAME state_execute
+#include "state_run.h"
+#undef STATE_RUN_NAME
+
+#define STATE_RUN_NAME state_execute_probed
+#define STATE_RUN_PROBES
+#include "state_run.h"
+#undef STATE_RUN_PROBES
+#undef STATE_RUN_NAME
+
+#define STATE_RUN_NAME state_execute_exact
+#define STATE_RUN_PROBES
+#define STATE_RUN_EXACT
+#include "state_run.h"
+#undef STATE_RUN_EXACT
+#undef STATE_RUN_PROBES
+#undef STATE_RUN_NAME
+
+#undef WORD
+#undef SWORD
+#undef WORD_BYTES
+#undef WORD_REGISTERS
+#undef WORD_REGISTER_COUNT
+#undef WORD_LOAD
+#undef WORD_STORE
+#undef WORD_OPERATE
+#undef WORD_PUSH
+#undef WORD_POP
+
+// Y86-64
+#define WORD unsigned long long
+#define SWORD long long
+#define WORD_BYTES WORD_SIZE_64
+#define WORD_REGISTERS registers64.ids
+#define WORD_REGISTER_COUNT REGISTER64_COUNT
+#define WORD_LOAD an_bytes_long
+#define WORD_STORE an_long_bytes
+#define WORD_OPERATE state_operate_64
+#define WORD_PUSH state_push_64
+#define WORD_POP state_pop_64
+#include "state_word.h"
+
+#define STATE_RUN_NAME state_execute_64
+#include "state_run.h"
+#undef STATE_RUN_NAME
+
+#define STATE_RUN_NAME state_execute_probed_64
+#define STATE_RUN_PROBES
+#include "state_run.h"
+#undef STATE_RUN_PROBES
+#undef STATE_RUN_NAME
+
+#define STATE_RUN_NAME state_execute_exact_64
+#define STATE_RUN_PROBES
+#define STATE_RUN_EXACT
+#include "state_run.h"
+#undef STATE_RUN_EXACT
+#undef STATE_RUN_PROBES
+#undef STATE_RUN_NAME
+
+#undef WORD
+#undef SWORD
+#undef WORD_BYTES
+#undef WORD_REGISTERS
+#undef WORD_REGISTER_COUNT
+#undef WORD_LOAD
+#undef WORD_STORE
+#undef WORD_OPERATE
+#undef WORD_PUSH
+#undef WORD_POP
+
+// OPl and iOPl for other executors, b = b op a
+BOOL state_operate(STATE *state, int fn, unsigned int a, unsigned int *b)
+{
+    return state_operate_32(state, fn, a, b);
+}
+
+void state_run(STATE *state, STATE *state_original)
+{
+    state_restart(state);
+    state_resume(state, NULL, NULL);
+}
+
+void state_run_probed(STATE *state, STATE *state_original, PROBES *probes)
+{
+    state_restart(state);
+    state_resume(state, NULL, probes);
+}
+
+void state_restart(STATE *state)
+{
+    // Nothing passed?
+    if (NULL == state)
+        return;
+
+    // Start at the beginning
+    state->status = AOK;
+    state->pc = 0;
+    state->step = 0;
+}
+
+PROGRAM_STATUS state_resume(STATE *state, const BUDGET *budget, PROBES *probes)
+{
+    // Nothing passed?
+    if (NULL == state)
+        return INS;
+
+    // Stopped for good?
+    if (LIM == state->status)
+        state->status = AOK;
+    if (AOK != state->status)
+        return state->status;
+
+    LIMIT limit;
+    limit_start(&limit, state, budget);
+
+    // Exact stop, with or without probes?
+    PROBES none = { 0 };
+    if (WORD_SIZE_64 == state->word_size)
+    {
+        if ((NULL != budget) && (0 != budget->exact))
+            state_execute_exact_64(state, (NULL == probes) ? &none : probes, &limit);
+        else if ((NULL == probes) || (0 >= probes->count))
+            state_execute_64(state, NULL, &limit);
+        else
+            state_execute_probed_64(state, probes, &limit);
+    }
+    else if ((NULL != budget) && (0 != budget->exact))
+        state_execute_exact(state, (NULL == probes) ? &none : probes, &limit);
+    else if ((NULL == probes) || (0 >= probes->count))
+        state_execute(state, NULL, &limit);
+    else
+        state_execute_probed(state, probes, &limit);
+
+    return state->status;
+}
+
+BOOL probes_add(PROBES *probes, PROBE_RETIRE retire, void *context)
+{
+    // Nothing passed?
+    if ((NULL == probes) || (NULL == retire))
+        return 0;
+
+    // No room?
+    if (PROBE_MAX <= probes->count)
+        return 0;
+
+    probes->retire[probes->count] = retire;
+    probes->context[probes->count] = context;
+    probes->count++;
+
+    return 1;
+}
+
+BOOL host_add(HOST *host, int number, HOST_SERVICE service, void *context)
+{
+    // Nothing passed?
+    if ((NULL == host) || (NULL == service))
+        return 0;
+
+    // No such number?
+    if ((0 > number) || (HOST_SERVICE_MAX <= number))
+        return 0;
+
+    host->service[number] = service;
+    host->context[number] = context;
+
+    return 1;
+}
+
+BOOL state_clone(STATE *state_from, STATE *state_to)
+{
+    // Nothing passed?
+    if ((NULL == state_from) || (NULL == state_to))
+        return 0;
+    
+    state_to->registers = state_from->registers;
+    state_to->registers64 = state_from->registers64;
+    state_to->word_size = state_from->word_size;
+    state_to->codes = state_from->codes;
+    state_to->status = state_from->status;
+
+    // Try to copy memory if present, pages of zeros are left untouched
+    if (0 < state_from->memory_size)
+    {
+        state_to->memory = state_pages(state_from->memory_size);
+        if (NULL == state_to->memory)
+            return 0;
+        state_to->memory_pages = 1;
+
+        int page = (int) sysconf(_SC_PAGESIZE);
+        page = (0 < page) ? page : 4096;
+        for (int pos = 0; state_from->memory_size > pos; pos += page)
+        {
+            const unsigned char *from = state_from->memory + pos;
+            int size = (state_from->memory_size - pos < page) ? state_from->memory_size - pos : page;
+            if ((0 != from[0]) || (0 != memcmp(from, from + 1, (size_t) (size - 1))))
+                memcpy(state_to->memory + pos, from, (size_t) size);
+        }
+    }
+
+    state_to->memory_size = state_from->memory_size;
+    state_to->pc = state_from->pc;
+    state_to->step = state_from->step;
+    state_to->block_step_bytes = state_from->block_step_bytes;
+    state_to->host = state_from->host;
+    state_to->device = state_from->device;
+    state_to->hle = state_from->hle;
+
+    return 1;
+}
+
+void state_changes(STATE *state_old, STATE *state_now)
+{
+    // Nothing passed?
+    if ((NULL == state_old) || (NULL == state_now))
+        return;
+
+    // What printf holds goes first, then the whole report in one write
+    DUMP dump;
+    fflush(stdout);
+    if (0 == dump_open(&dump, STDOUT_FILENO, DUMP_TEXT, 0))
+        return;
+    dump_changes(&dump, state_old, state_now);
+    dump_close(&dump);
+}
+
+BOOL state_push(STATE *state, unsigned int val)
+{
+    // Nothing passed?
+    if (NULL == state)
+        return 0;
+    
+    // No memory?
+    if (0 >= state->memory_size)
+        return 0;
+    
+    return state_push_32(state, val);
+}
+
+BOOL state_pop(STATE *state, unsigned int *val)
+{
+    // Nothing passed?
+    if (NULL == state)
+        return 0;
+    
+    // No memory?
+    if (0 >= state->memory_size)
+        return 0;
+
+    return state_pop_32(state, val);
+}
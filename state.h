@@ -0,0 +1,268 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include "helpers.h"
+
+//// Defines
+
+// For using registers as indexed array
+#define REGISTER_COUNT 8
+#define REGISTER_NAME_ARRAY { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi" }
+
+// Y86-64 registers, the same numbers with r8 to r14 added
+#define REGISTER64_COUNT 15
+#define REGISTER64_NAME_ARRAY { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", \
+                                "r8", "r9", "r10", "r11", "r12", "r13", "r14" }
+
+// Special value
+#define REGISTER_NONE 0xF
+
+// Stack pointer index, used implicitly by call, ret, pushl and popl
+#define REGISTER_ESP 4
+
+// Instruction names and sizes in bytes by icode
+#define INSTRUCTION_COUNT 16
+#define INSTRUCTION_NAME_ARRAY { "halt", "nop", "rrmovl", "irmovl", "rmmovl", "mrmovl", "OPl", "jXX", "call", "ret", "pushl", "popl", "iOPl", "block", "trap", "atomic" }
+#define INSTRUCTION_SIZE_ARRAY { 1, 1, 2, 6, 6, 6, 2, 5, 5, 1, 2, 2, 6, 3, 1, 6 }
+
+// OPl and iOPl functions, rB = rB op rA.  Division faults INS on zero, shift
+// counts are taken modulo 32, OF is set by addl, subl, mull and divl only
+#define OPERATION_COUNT 11
+#define OPERATION_NAME_ARRAY { "addl", "subl", "andl", "xorl", "mull", "divl", "modl", "shll", "sarl", "shrl", "orl" }
+
+// Block instructions, icode 0xD: function, rA rB, rC 0xF.  Count bytes in rC
+//   bcopy rA, rB, rC  copy from address rA to address rB, ranges may overlap
+//   bfill rA, rB, rC  fill from address rB with the low byte of rA
+//   bcmp rA, rB, rC   compare at rA with rB, ZF if equal, SF if rA is lower
+#define BLOCK_COUNT 3
+#define BLOCK_NAME_ARRAY { "bcopy", "bfill", "bcmp" }
+
+// Atomic instructions, icode 0xF: function, rA rB, displacement like rmmovl.
+// The word must be aligned, they are sequentially consistent between harts
+//   cas rA, D(rB)   store rA if the word holds eax and set ZF, else load it into eax
+//   xadd rA, D(rB)  add rA to the word, rA gets the old value, flags unchanged
+#define ATOMIC_COUNT 2
+#define ATOMIC_NAME_ARRAY { "cas", "xadd" }
+
+// Host services, called by trap (icode 0xE) with the number in eax
+#define REGISTER_EAX 0
+#define HOST_SERVICE_MAX 16
+
+// trap with this function is a breakpoint, the run stops on it with BRK
+// before it counts as a step
+#define BREAKPOINT_FN 0xF
+#define BREAKPOINT_OPCODE 0xEF
+
+// Word sizes in bytes, immediates, addresses and registers are this wide.
+// The encoding is otherwise the same, so an instruction with an immediate or
+// displacement is 10 bytes in Y86-64, and a jump or call 9
+#define WORD_SIZE_32 4
+#define WORD_SIZE_64 8
+
+// Image header selecting Y86-64, stripped when loaded.  Images without one
+// are Y86-32
+#define WORD64_MAGIC "Y86-64\0\0"
+#define WORD64_MAGIC_SIZE 8
+
+// Status information
+#define STATUS_COUNT 6
+#define STATUS_NAME_ARRAY { "AOK", "HLT", "ADR", "INS", "LIM", "BRK" }
+
+// Default size of memory block in bytes
+#define DEF_MEMORY_SIZE 1024
+
+// Steps between wall clock reads of a timed run
+#define BUDGET_CLOCK_STEPS 65536
+
+//// Type declarations
+
+typedef struct _REGISTER_NAMES
+{
+    int eax;
+    int ecx;
+    int edx;
+    int ebx;
+    int esp;
+    int ebp;
+    int esi;
+    int edi;
+} REGISTER_NAMES;
+
+typedef int REGISTER_ID;
+
+typedef union _REGISTERS
+{
+    REGISTER_NAMES names;
+    REGISTER_ID ids[REGISTER_COUNT];
+} REGISTERS;
+
+typedef struct _REGISTER64_NAMES
+{
+    long long rax;
+    long long rcx;
+    long long rdx;
+    long long rbx;
+    long long rsp;
+    long long rbp;
+    long long rsi;
+    long long rdi;
+    long long r8;
+    long long r9;
+    long long r10;
+    long long r11;
+    long long r12;
+    long long r13;
+    long long r14;
+} REGISTER64_NAMES;
+
+typedef long long REGISTER64_ID;
+
+typedef union _REGISTERS64
+{
+    REGISTER64_NAMES names;
+    REGISTER64_ID ids[REGISTER64_COUNT];
+} REGISTERS64;
+
+typedef struct _CONDITION_CODES
+{
+    BOOL ZF;
+    BOOL SF;
+    BOOL OF;
+} CONDITION_CODES;
+
+typedef enum _PROGRAM_STATUS
+{
+    AOK = 1,
+    HLT,
+    ADR,
+    INS,
+    LIM, // Budget spent, the run can be resumed
+    BRK, // On a breakpoint, resumed by running the instruction it replaced
+    _FIRST = AOK,
+    _LAST = BRK
+} PROGRAM_STATUS;
+
+typedef unsigned char *MEMORY;
+
+typedef struct _HOST HOST;
+typedef struct _DEVICE DEVICE;
+typedef struct _HLE HLE;
+
+typedef struct _STATE
+{
+    REGISTERS registers;
+    REGISTERS64 registers64; // Used instead of registers by Y86-64
+    int word_size; // WORD_SIZE_64 for Y86-64, Y86-32 otherwise
+    CONDITION_CODES codes;
+    PROGRAM_STATUS status;
+    MEMORY memory;
+    int memory_size;
+    BOOL memory_pages; // memory is whole pages from state_allocate, files can be mapped over it
+    int pc;
+    unsigned long long step;
+    int block_step_bytes; // Block instructions cost a step more per this many bytes, 0 for one step
+    HOST *host; // Services for trap, NULL to fault
+    DEVICE *device; // Registers outside memory for rmmovl and mrmovl, NULL for none
+    HLE *hle; // Routines run natively when called, NULL to interpret all
+} STATE;
+
+// Guest memory a host service wrote, so probes can see it
+typedef struct _HOST_STORE
+{
+    int pos; // -1 if none
+    int size;
+} HOST_STORE;
+
+// Arguments are in ecx, edx and ebx, results go in the registers.  Returns AOK
+// to go on, HLT to stop the run after the trap, or a fault
+typedef PROGRAM_STATUS (*HOST_SERVICE)(void *context, STATE *state, HOST_STORE *store);
+
+struct _HOST
+{
+    HOST_SERVICE service[HOST_SERVICE_MAX];
+    void *context[HOST_SERVICE_MAX];
+};
+
+// Limits on one run, zero for no limit.  Budgets are checked when a basic
+// block ends, so a run can go over by the rest of a block, unless exact asks
+// for the step budget to be checked before every instruction.
+typedef struct _BUDGET
+{
+    unsigned long long steps; // Instructions
+    double seconds; // Wall clock time
+    BOOL exact; // Stop on the step itself, slower
+} BUDGET;
+
+// Budget of one run as absolute limits, for executors
+typedef struct _LIMIT
+{
+    unsigned long long steps; // Step to stop at
+    double deadline; // Clock to stop at, 0 if untimed
+    unsigned long long check_at; // Step of the next check
+} LIMIT;
+
+// Everything a probe needs to know about one retired instruction
+typedef struct _RETIRED
+{
+    int pc; // Address of the instruction
+    int next_pc; // Address of the next instruction
+    int size; // Length of the instruction in bytes
+    unsigned char insfn; // Instruction and function byte
+    unsigned char rArB; // Register byte, REGISTER_NONE for unused halves
+    BOOL condition; // Jump taken or conditional move performed
+    int mem_pos; // Address of the memory access, -1 if none
+    BOOL mem_write; // Access was a store
+    int mem_size; // Bytes accessed at mem_pos
+    int read_pos; // Second range read by block copy and compare, -1 if none
+} RETIRED;
+
+// Called after every retired instruction of a probed run
+typedef void (*PROBE_RETIRE)(void *context, const STATE *state, const RETIRED *retired);
+
+// Most probes that can watch one run
+#define PROBE_MAX 8
+
+typedef struct _PROBES
+{
+    int count;
+    PROBE_RETIRE retire[PROBE_MAX];
+    void *context[PROBE_MAX];
+} PROBES;
+
+// Memory mapped device.  Its registers are at addresses past the end of
+// memory, so rmmovl and mrmovl only look for it once the range check fails.
+// Offsets are from base, an access fails with ADR when these return 0
+typedef BOOL (*DEVICE_STORE)(void *context, unsigned int offset, unsigned int value);
+typedef BOOL (*DEVICE_LOAD)(void *context, unsigned int offset, unsigned int *value);
+
+struct _DEVICE
+{
+    unsigned int base;
+    unsigned int size;
+    DEVICE_STORE store;
+    DEVICE_LOAD load;
+    void *context;
+};
+
+//// Forward declarations
+
+void state_init(STATE *state);
+BOOL state_allocate(STATE *state, int size);
+void state_free(STATE *state);
+BOOL state_compile(STATE *state, const char* filename);
+int state_map_file(STATE *state, int address, const char *path);
+void state_run(STATE *state, STATE *state_original);
+void state_run_probed(STATE *state, STATE *state_original, PROBES *probes);
+void state_restart(STATE *state);
+PROGRAM_STATUS state_resume(STATE *state, const BUDGET *budget, PROBES *probes);
+void limit_start(LIMIT *limit, const STATE *state, const BUDGET *budget);
+BOOL limit_reached(LIMIT *limit, const STATE *state);
+BOOL state_operate(STATE *state, int fn, unsigned int a, unsigned int *b);
+BOOL probes_add(PROBES *probes, PROBE_RETIRE retire, void *context);
+BOOL host_add(HOST *host, int number, HOST_SERVICE service, void *context);
+BOOL state_clone(STATE *state_from, STATE *state_to);
+void state_changes(STATE *state_old, STATE *state_now);
+BOOL state_push(STATE *state, unsigned int val);
+BOOL state_pop(STATE *state, unsigned int *val);
+
+#endif
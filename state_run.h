@@ -0,0 +1,618 @@
+// Executor body, included by state.c once per variant.  Define
+// STATE_RUN_NAME, STATE_RUN_PROBES for the variant that reports every retired
+// instruction, and STATE_RUN_EXACT for the one that stops on an exact step,
+// before including.  The plain variant compiles to the same loop as if the
+// probes did not exist.
+//
+// The word size is a template parameter too, state.c defines WORD, SWORD,
+// WORD_BYTES, WORD_REGISTERS and WORD_REGISTER_COUNT, and WORD_LOAD,
+// WORD_STORE, WORD_OPERATE, WORD_PUSH and WORD_POP for Y86-32 or Y86-64.
+// Only immediates, addresses and registers change width, the encoding is
+// the same apart from their size.
+
+#ifdef STATE_RUN_PROBES
+#define PROBE(...) __VA_ARGS__
+#else
+#define PROBE(...)
+#endif
+
+#ifdef STATE_RUN_EXACT
+#define EXACT(...) __VA_ARGS__
+#else
+#define EXACT(...)
+#endif
+
+// Register by number in the register file of this word size
+#define REG(r) (state->WORD_REGISTERS[r])
+
+// Longest instruction, one with an immediate or displacement
+#define WORD_INSTRUCTION (2 + WORD_BYTES)
+
+// A taken jump, call or ret ends a basic block, the only place the budget is
+// checked.  The loop stops after the instruction is reported.
+#define BLOCK_END() \
+    if ((limit->check_at <= state->step) && (0 != limit_reached(limit, state))) \
+        state->status = LIM
+
+static void STATE_RUN_NAME(STATE *state, PROBES *probes, LIMIT *limit)
+{
+    // Nothing passed?
+    if (NULL == state)
+        return;
+
+    // No memory?
+    if (0 >= state->memory_size)
+        return;
+
+    // While there is no error
+    while (AOK == state->status)
+    {
+        // Step budget spent?
+        EXACT(if (limit->steps <= state->step) { state->status = LIM; return; })
+
+        // Invalid PC address?
+        if ((0 > state->pc) || (state->memory_size - WORD_INSTRUCTION <= state->pc))
+        {
+            state->status = ADR;
+            return;
+        }
+
+        // Increase step counter
+        state->step++;
+
+        // Get instruction and function
+        unsigned char insfn = state->memory[state->pc];
+        unsigned char ins = (insfn >> 4) & 0xF;
+        unsigned char fn = insfn & 0xF;
+
+        // Get arguments ready
+        unsigned char rArB = state->memory[state->pc + 1];
+        unsigned char rA = (rArB >> 4) & 0xF;
+        unsigned char rB = rArB & 0xF;
+        WORD dest = 0;
+        WORD_LOAD(state->memory + state->pc + 1, &dest);
+        WORD val = 0;
+        WORD_LOAD(state->memory + state->pc + 2, &val);
+
+        // What the probes get to see
+        PROBE(RETIRED retired = { state->pc, 0, 0, insfn, rArB, 0, -1, 0, WORD_BYTES, -1 };)
+
+        // Temp variables
+        int pos;
+        WORD address;
+        BOOL condition;
+        WORD temp;
+        unsigned char rC;
+        WORD count;
+#if 4 == WORD_BYTES
+        HOST_STORE store;
+        PROGRAM_STATUS status;
+#endif
+
+        // PC step size, default is the longest
+        int pc_step = WORD_INSTRUCTION;
+
+        // Handle instruction
+        switch(ins)
+        {
+            case 0: // halt
+                // Invalid condition?
+                if (0 != fn)
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                state->status = HLT;
+                PROBE(retired.size = 1; retired.next_pc = state->pc;)
+                PROBE(probes_retire(probes, state, &retired);)
+                return;
+
+            case 1: // nop
+                // Invalid condition?
+                if (0 != fn)
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                pc_step = 1;
+                break;
+
+            case 2: // rrmovl or cmovXX
+                // Invalid registers?
+                if ((0 > rA) || (WORD_REGISTER_COUNT <= rA) || (0 > rB) || (WORD_REGISTER_COUNT <= rB))
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Check condition based on flags
+                // https://en.wikibooks.org/wiki/X86_Assembly/Control_Flow#Jump_Instructions
+                switch (fn)
+                {
+                    case 0: // rrmovel
+                        condition = 1;
+                        break;
+                    case 1: // cmovle
+                        condition = (0 != state->codes.ZF) || (state->codes.SF != state->codes.OF);
+                        break;
+                    case 2: // cmovl
+                        condition = (state->codes.SF != state->codes.OF);
+                        break;
+                    case 3: // cmove
+                        condition = (0 != state->codes.ZF);
+                        break;
+                    case 4: // cmovne
+                        condition = (0 == state->codes.ZF);
+                        break;
+                    case 5: // cmovge
+                        condition = (0 != state->codes.ZF) || (state->codes.SF == state->codes.OF);
+                        break;
+                    case 6: // cmovg
+                        condition = (0 == state->codes.ZF) && (state->codes.SF == state->codes.OF);
+                        break;
+                    default:
+                        state->status = INS;
+                        return;
+                }
+
+                // Perform move?
+                if (0 != condition)
+                    REG(rB) = REG(rA);
+                PROBE(retired.condition = condition;)
+
+                pc_step = 2;
+                break;
+
+            case 3: // irmovl
+                // Invalid condition?
+                if (0 != fn)
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Invalid registers?
+                if ((REGISTER_NONE != rA) || (0 > rB) || (WORD_REGISTER_COUNT <= rB))
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Perform move
+                REG(rB) = val;
+
+                pc_step = WORD_INSTRUCTION;
+                break;
+
+            case 4: // rmmovl
+                // Invalid condition?
+                if (0 != fn)
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Invalid registers?
+                if ((0 > rA) || (WORD_REGISTER_COUNT <= rA) || (0 > rB) || (WORD_REGISTER_COUNT <= rB))
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Memory position, negative ones wrap to past the end
+                address = (WORD) REG(rB) + val;
+
+                // Invalid position, unless it is a device register
+                if ((WORD) (state->memory_size - WORD_BYTES) <= address)
+                {
+                    if ((address != (unsigned int) address)
+                        || (0 == state_device_store(state, (int) address, (unsigned int) REG(rA))))
+                    {
+                        state->status = ADR;
+                        return;
+                    }
+                }
+                else
+                {
+                    // Perform move
+                    WORD_STORE(REG(rA), state->memory + address);
+                    PROBE(retired.mem_pos = (int) address; retired.mem_write = 1;)
+                }
+
+                pc_step = WORD_INSTRUCTION;
+                break;
+
+            case 5: // mrmovl
+                // Invalid condition?
+                if (0 != fn)
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Invalid registers?
+                if ((0 > rA) || (WORD_REGISTER_COUNT <= rA) || (0 > rB) || (WORD_REGISTER_COUNT <= rB))
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Memory position, negative ones wrap to past the end
+                address = (WORD) REG(rB) + val;
+
+                // Invalid position, unless it is a device register
+                if ((WORD) (state->memory_size - WORD_BYTES) <= address)
+                {
+                    unsigned int device_value = 0;
+                    if ((address != (unsigned int) address)
+                        || (0 == state_device_load(state, (int) address, &device_value)))
+                    {
+                        state->status = ADR;
+                        return;
+                    }
+                    REG(rA) = device_value;
+                }
+                else
+                {
+                    // Perform move
+                    WORD_LOAD(state->memory + address, (WORD*) &REG(rA));
+                    PROBE(retired.mem_pos = (int) address;)
+                }
+
+                pc_step = WORD_INSTRUCTION;
+                break;
+
+            case 6: // OPl
+                // Invalid registers?
+                if ((0 > rA) || (WORD_REGISTER_COUNT <= rA) || (0 > rB) || (WORD_REGISTER_COUNT <= rB))
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Perform operation, unknown or dividing by zero?
+                if (0 == WORD_OPERATE(state, fn, REG(rA), (WORD*) &REG(rB)))
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                pc_step = 2;
+                break;
+
+            case 7: // jXX
+                // Check condition based on flags
+                // https://en.wikibooks.org/wiki/X86_Assembly/Control_Flow#Jump_Instructions
+                switch (fn)
+                {
+                    case 0: // jmp
+                        condition = 1;
+                        break;
+                    case 1: // jle
+                        condition = (0 != state->codes.ZF) || (state->codes.SF != state->codes.OF);
+                        break;
+                    case 2: // jl
+                        condition = (state->codes.SF != state->codes.OF);
+                        break;
+                    case 3: // je
+                        condition = (0 != state->codes.ZF);
+                        break;
+                    case 4: // jne
+                        condition = (0 == state->codes.ZF);
+                        break;
+                    case 5: // jge
+                        condition = (0 != state->codes.ZF) || (state->codes.SF == state->codes.OF);
+                        break;
+                    case 6: // jg
+                        condition = (0 == state->codes.ZF) && (state->codes.SF == state->codes.OF);
+                        break;
+                    default:
+                        state->status = INS;
+                        return;
+                }
+
+                // Invalid address?
+                if ((0 > dest) || (state->memory_size - WORD_INSTRUCTION <= dest))
+                {
+                    state->status = ADR;
+                    return;
+                }
+
+                // Perform move?
+                if (0 != condition)
+                {
+                    state->pc = dest;
+                    pc_step = 0;
+                    BLOCK_END();
+                }
+                else
+                    pc_step = 1 + WORD_BYTES;
+                PROBE(retired.size = 1 + WORD_BYTES; retired.condition = condition;)
+
+                break;
+
+            case 8: // call
+                // Invalid condition?
+                if (0 != fn)
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Invalid address?
+                if ((0 > dest) || (state->memory_size - WORD_INSTRUCTION <= dest))
+                {
+                    state->status = ADR;
+                    return;
+                }
+
+                // Try to push address to return to
+                if (0 == WORD_PUSH(state, state->pc + 1 + WORD_BYTES))
+                {
+                    state->status = ADR;
+                    return;
+                }
+                PROBE(retired.size = 1 + WORD_BYTES; retired.mem_pos = (int) REG(REGISTER_ESP); retired.mem_write = 1;)
+
+                // Move
+                state->pc = dest;
+
+#if 4 == WORD_BYTES
+                // Recognised routine, and no probe to see its steps?  It runs natively up to its ret
+                if ((NULL != state->hle) PROBE(&& (0 == probes->count)))
+                    hle_run(state->hle, state, (limit->steps > state->step) ? limit->steps - state->step : 0, &store);
+#endif
+
+                pc_step = 0;
+                BLOCK_END();
+                break;
+
+            case 9: // ret
+                // Invalid condition?
+                if (0 != fn)
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Try to pop address to return to
+                if (0 == WORD_POP(state, &address))
+                {
+                    state->status = ADR;
+                    return;
+                }
+                PROBE(retired.size = 1; retired.mem_pos = (int) REG(REGISTER_ESP) - WORD_BYTES;)
+
+                // Invalid address?
+                if ((WORD) (state->memory_size - WORD_INSTRUCTION) <= address)
+                {
+                    state->status = ADR;
+                    return;
+                }
+
+                // Move
+                state->pc = (int) address;
+
+                pc_step = 0;
+                BLOCK_END();
+                break;
+
+            case 10: // pushl
+                // Invalid condition?
+                if (0 != fn)
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Invalid register?
+                if ((0 > rA) || (WORD_REGISTER_COUNT <= rA) || (REGISTER_NONE != rB))
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Try to push value
+                if (0 == WORD_PUSH(state, REG(rA)))
+                {
+                    state->status = ADR;
+                    return;
+                }
+                PROBE(retired.mem_pos = (int) REG(REGISTER_ESP); retired.mem_write = 1;)
+
+                pc_step = 2;
+                break;
+
+            case 11: // popl
+                // Invalid condition?
+                if (0 != fn)
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Invalid register?
+                if ((0 > rA) || (WORD_REGISTER_COUNT <= rA) || (REGISTER_NONE != rB))
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Try to pop value
+                if (0 == WORD_POP(state, (WORD*) &REG(rA)))
+                {
+                    state->status = ADR;
+                    return;
+                }
+                PROBE(retired.mem_pos = (int) REG(REGISTER_ESP) - WORD_BYTES;)
+
+                pc_step = 2;
+                break;
+
+            case 12: // iOPl
+                // Invalid registers?
+                if ((REGISTER_NONE != rA) || (0 > rB) || (WORD_REGISTER_COUNT <= rB))
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Perform operation, unknown or dividing by zero?
+                if (0 == WORD_OPERATE(state, fn, val, (WORD*) &REG(rB)))
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                pc_step = WORD_INSTRUCTION;
+                break;
+
+            case 13: // bcopy, bfill or bcmp
+                // Invalid function or registers?
+                rC = (state->memory[state->pc + 2] >> 4) & 0xF;
+                if ((BLOCK_COUNT <= fn) || (WORD_REGISTER_COUNT <= rA) || (WORD_REGISTER_COUNT <= rB) || (WORD_REGISTER_COUNT <= rC)
+                    || (REGISTER_NONE != (state->memory[state->pc + 2] & 0xF)))
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Invalid ranges?  rA is the fill byte, not an address, for bfill
+                count = REG(rC);
+                dest = REG(rB);
+                temp = REG(rA);
+                if (((WORD) state->memory_size < count) || (state->memory_size - count < dest)
+                    || ((1 != fn) && (state->memory_size - count < temp)))
+                {
+                    state->status = ADR;
+                    return;
+                }
+
+                // Perform operation
+                switch (fn)
+                {
+                    case 0: // bcopy
+                        memmove(state->memory + dest, state->memory + temp, count);
+                        PROBE(retired.mem_pos = dest; retired.mem_write = 1; retired.read_pos = temp;)
+                        break;
+                    case 1: // bfill
+                        memset(state->memory + dest, temp & 0xFF, count);
+                        PROBE(retired.mem_pos = dest; retired.mem_write = 1;)
+                        break;
+                    case 2: // bcmp
+                        pos = memcmp(state->memory + temp, state->memory + dest, count);
+                        state->codes.ZF = (0 == pos);
+                        state->codes.SF = (0 > pos);
+                        state->codes.OF = 0;
+                        PROBE(retired.mem_pos = temp; retired.read_pos = dest;)
+                        break;
+                    default:
+                        state->status = INS;
+                        return;
+                }
+                PROBE(retired.mem_size = (int) count;)
+
+                // Charge for the bytes
+                if (0 < state->block_step_bytes)
+                    state->step += count / (WORD) state->block_step_bytes;
+
+                pc_step = 3;
+                break;
+
+            case 14: // trap, services only know the 32 bit registers
+                // Breakpoint?  Stopped on, it does not count as a step
+                if (BREAKPOINT_FN == fn)
+                {
+                    state->step--;
+                    state->status = BRK;
+                    return;
+                }
+
+#if 4 == WORD_BYTES
+                // Invalid function or no such service?
+                temp = REG(REGISTER_EAX);
+                if ((0 != fn) || (NULL == state->host) || (HOST_SERVICE_MAX <= temp) || (NULL == state->host->service[temp]))
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Service failed?  An exit still retires
+                store.pos = -1;
+                store.size = 0;
+                status = state->host->service[temp](state->host->context[temp], state, &store);
+                if ((AOK != status) && (HLT != status))
+                {
+                    state->status = status;
+                    return;
+                }
+                state->status = status;
+                PROBE(if ((0 <= store.pos) && (0 < store.size)) { retired.mem_pos = store.pos; retired.mem_write = 1; retired.mem_size = store.size; })
+
+                pc_step = 1;
+                break;
+#else
+                state->status = INS;
+                return;
+#endif
+
+            case 15: // cas or xadd
+                // Invalid function or registers?
+                if ((ATOMIC_COUNT <= fn) || (WORD_REGISTER_COUNT <= rA) || (WORD_REGISTER_COUNT <= rB))
+                {
+                    state->status = INS;
+                    return;
+                }
+
+                // Memory position, only aligned words of memory, no devices
+                address = (WORD) REG(rB) + val;
+                if (((WORD) (state->memory_size - WORD_BYTES) <= address) || (0 != address % WORD_BYTES))
+                {
+                    state->status = ADR;
+                    return;
+                }
+
+                // Host atomics on the word itself, guest and host are both little endian
+                if (0 == fn)
+                {
+                    temp = REG(REGISTER_EAX);
+                    condition = __atomic_compare_exchange_n((WORD*) (state->memory + address), &temp, (WORD) REG(rA),
+                                                            0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+                    REG(REGISTER_EAX) = temp;
+                    state->codes.ZF = condition;
+                    PROBE(retired.condition = condition; retired.mem_write = condition;)
+                }
+                else
+                {
+                    REG(rA) = __atomic_fetch_add((WORD*) (state->memory + address), (WORD) REG(rA), __ATOMIC_SEQ_CST);
+                    PROBE(retired.mem_write = 1;)
+                }
+                PROBE(retired.mem_pos = (int) address;)
+
+                pc_step = WORD_INSTRUCTION;
+                break;
+
+            // TODO: Extra functions, such as enter (kinda) and leave
+
+            default:
+                state->status = INS;
+                return;
+        }
+
+        // Increment PC
+        state->pc += pc_step;
+
+        // Report to the probes
+        PROBE(if (0 == retired.size) retired.size = pc_step;)
+        PROBE(retired.next_pc = state->pc;)
+        PROBE(probes_retire(probes, state, &retired);)
+    }
+}
+
+#undef PROBE
+#undef EXACT
+#undef BLOCK_END
+#undef REG
+#undef WORD_INSTRUCTION
@@ -0,0 +1,104 @@
+// Word sized helpers of the executor, included by state.c once per word size
+// with the same defines as state_run.h, before the variants that call them.
+
+// Top bit of a word
+#define WORD_SIGN(v) ((BOOL) (((v) >> (WORD_BYTES * 8 - 1)) & 1))
+
+// OPl and iOPl, b = b op a.  Unknown functions and division by zero fail
+static inline BOOL WORD_OPERATE(STATE *state, int fn, WORD a, WORD *b)
+{
+    WORD value = *b;
+    WORD temp = 0;
+    SWORD product = 0;
+    BOOL overflow = 0;
+    switch (fn)
+    {
+        case 0: // addl
+            temp = value + a;
+            overflow = ((1 == WORD_SIGN(value)) && (0 == WORD_SIGN(temp)));
+            break;
+        case 1: // subl
+            temp = value - a;
+            overflow = ((0 == WORD_SIGN(value)) && (1 == WORD_SIGN(temp)));
+            break;
+        case 2: // andl
+            temp = value & a;
+            break;
+        case 3: // xorl
+            temp = value ^ a;
+            break;
+        case 4: // mull, overflow if the signed product does not fit
+            overflow = __builtin_mul_overflow((SWORD) value, (SWORD) a, &product);
+            temp = (WORD) product;
+            break;
+        case 5: // divl, rounds toward zero
+        case 6: // modl, takes the sign of b
+            if (0 == a)
+                return 0;
+
+            // Only the most negative value over -1 does not fit
+            if (((WORD) 1 << (WORD_BYTES * 8 - 1) == value) && ((WORD) -1 == a))
+            {
+                temp = (5 == fn) ? value : 0;
+                overflow = (5 == fn);
+            }
+            else
+                temp = (WORD) ((5 == fn) ? (SWORD) value / (SWORD) a : (SWORD) value % (SWORD) a);
+            break;
+        case 7: // shll, the count is taken modulo the word bits
+            temp = value << (a & (WORD_BYTES * 8 - 1));
+            break;
+        case 8: // sarl
+            temp = (WORD) ((SWORD) value >> (a & (WORD_BYTES * 8 - 1)));
+            break;
+        case 9: // shrl
+            temp = value >> (a & (WORD_BYTES * 8 - 1));
+            break;
+        case 10: // orl
+            temp = value | a;
+            break;
+        default:
+            return 0;
+    }
+
+    state->codes.ZF = (0 == temp);
+    state->codes.SF = WORD_SIGN(temp);
+    state->codes.OF = overflow;
+    *b = temp;
+    return 1;
+}
+
+static inline BOOL WORD_PUSH(STATE *state, WORD val)
+{
+    // esp is valid position?
+    SWORD esp = (SWORD) state->WORD_REGISTERS[REGISTER_ESP];
+    if ((WORD_BYTES > esp) || (state->memory_size <= esp))
+        return 0;
+
+    // Subtract a word
+    esp -= WORD_BYTES;
+    state->WORD_REGISTERS[REGISTER_ESP] = esp;
+
+    // Set value
+    WORD_STORE(val, state->memory + esp);
+
+    return 1;
+}
+
+static inline BOOL WORD_POP(STATE *state, WORD *val)
+{
+    // esp is valid position?
+    SWORD esp = (SWORD) state->WORD_REGISTERS[REGISTER_ESP];
+    if ((0 > esp) || (state->memory_size - WORD_BYTES <= esp))
+        return 0;
+
+    // Get value
+    WORD_LOAD(state->memory + esp, val);
+
+    // Add a word
+    state->WORD_REGISTERS[REGISTER_ESP] += WORD_BYTES;
+
+    return 1;
+}
+
+#undef WORD_SIGN
@@ -0,0 +1,662 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "trace.h"
+
+//// Definitions
+
+unsigned char* trace_varint(unsigned char *out, unsigned int value)
+{
+    while (0x80 <= value)
+    {
+        *out++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+unsigned int trace_zigzag(int value)
+{
+    return ((unsigned int) value << 1) ^ (unsigned int) (value >> 31);
+}
+
+static unsigned char trace_codes(const CONDITION_CODES *codes)
+{
+    return (0 != codes->ZF) | ((0 != codes->SF) << 1) | ((0 != codes->OF) << 2);
+}
+
+// Start a chunk from the current machine state
+static void trace_keyframe(TRACE *trace, TRACE_SLOT *slot, const STATE *state)
+{
+    unsigned char *out = slot->data;
+
+    an_int_bytes(state->pc, out);
+    an_int_bytes((unsigned int) state->step, out + 4);
+    an_int_bytes((unsigned int) ((unsigned long long) state->step >> 32), out + 8);
+    for (int i = 0; REGISTER_COUNT > i; i++)
+        an_int_bytes(state->registers.ids[i], out + 12 + i * 4);
+    out[TRACE_KEYFRAME_SIZE - 1] = trace_codes(&state->codes);
+    memcpy(out + TRACE_KEYFRAME_SIZE, state->memory, trace->memory_size);
+
+    slot->size = TRACE_KEYFRAME_SIZE + trace->memory_size;
+    slot->records = 0;
+    slot->first_step = state->step;
+    slot->status = AOK;
+
+    // Deltas restart at every keyframe
+    trace->registers = state->registers;
+    trace->codes = state->codes;
+    trace->expected_pc = state->pc;
+    trace->last_mem = 0;
+}
+
+// Wait for a free slot, the writer is behind if the ring is full
+static TRACE_SLOT* trace_acquire(TRACE *trace)
+{
+    unsigned int head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    while (TRACE_SLOTS <= head - atomic_load_explicit(&trace->tail, memory_order_acquire))
+        sched_yield();
+    return trace->slots + head % TRACE_SLOTS;
+}
+
+static void trace_publish(TRACE *trace)
+{
+    atomic_fetch_add_explicit(&trace->head, 1, memory_order_release);
+    trace->open = NULL;
+}
+
+static BOOL trace_write(TRACE *trace, const unsigned char *data, size_t size)
+{
+    if (size != fwrite(data, 1, size, trace->file))
+        return 0;
+    trace->file_bytes += size;
+    return 1;
+}
+
+// Compress and write one chunk
+static BOOL trace_write_chunk(TRACE *trace, TRACE_SLOT *slot)
+{
+    uLongf compressed_size = trace->compressed_capacity;
+    if (Z_OK != compress2(trace->compressed, &compressed_size, slot->data, slot->size, Z_BEST_SPEED))
+        return 0;
+
+    unsigned char header[TRACE_CHUNK_HEADER_SIZE];
+    an_int_bytes(TRACE_CHUNK_MAGIC, header);
+    an_int_bytes((unsigned int) slot->size, header + 4);
+    an_int_bytes((unsigned int) compressed_size, header + 8);
+    an_int_bytes(slot->records, header + 12);
+    an_int_bytes((unsigned int) slot->first_step, header + 16);
+    an_int_bytes((unsigned int) (slot->first_step >> 32), header + 20);
+    an_int_bytes((unsigned int) slot->status, header + 24);
+
+    trace->raw_bytes += slot->size;
+    return trace_write(trace, header, sizeof(header)) && trace_write(trace, trace->compressed, compressed_size);
+}
+
+static void* trace_writer(void *context)
+{
+    TRACE *trace = context;
+    struct timespec nap = { 0, 50000 };
+
+    while (1)
+    {
+        unsigned int tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+
+        // Nothing published?
+        if (tail == atomic_load_explicit(&trace->head, memory_order_acquire))
+        {
+            // Run finished and everything is written?
+            if ((0 != atomic_load_explicit(&trace->done, memory_order_acquire))
+                && (tail == atomic_load_explicit(&trace->head, memory_order_acquire)))
+                break;
+            nanosleep(&nap, NULL);
+            continue;
+        }
+
+        if (0 == trace_write_chunk(trace, trace->slots + tail % TRACE_SLOTS))
+            atomic_store(&trace->failed, 1);
+        atomic_store_explicit(&trace->tail, tail + 1, memory_order_release);
+    }
+
+    return NULL;
+}
+
+BOOL trace_open(TRACE *trace, const char* filename, const STATE *state, int interval)
+{
+    // Nothing passed?
+    if ((NULL == trace) || (NULL == filename) || (NULL == state))
+        return 0;
+
+    // No memory or invalid interval?
+    if ((0 >= state->memory_size) || (1 > interval))
+        return 0;
+
+    // Records only know the Y86-32 registers
+    if (WORD_SIZE_64 == state->word_size)
+        return 0;
+
+    memset(trace, 0, sizeof(TRACE));
+    trace->memory_size = state->memory_size;
+    trace->interval = interval;
+    trace->capacity = TRACE_KEYFRAME_SIZE + (size_t) state->memory_size + (size_t) interval * TRACE_RECORD_MAX;
+
+    // Buffers
+    for (int i = 0; TRACE_SLOTS > i; i++)
+    {
+        trace->slots[i].data = malloc(trace->capacity);
+        if (NULL == trace->slots[i].data)
+            return 0;
+    }
+    trace->compressed_capacity = compressBound(trace->capacity);
+    trace->compressed = malloc(trace->compressed_capacity);
+    if (NULL == trace->compressed)
+        return 0;
+
+    trace->file = fopen(filename, "wb");
+    if (NULL == trace->file)
+        return 0;
+
+    // File header
+    unsigned char header[TRACE_HEADER_SIZE];
+    an_int_bytes(TRACE_MAGIC, header);
+    an_int_bytes(TRACE_VERSION, header + 4);
+    an_int_bytes(state->memory_size, header + 8);
+    an_int_bytes(interval, header + 12);
+    if (0 == trace_write(trace, header, sizeof(header)))
+        return 0;
+
+    // First chunk starts before the first instruction
+    trace->open = trace_acquire(trace);
+    trace_keyframe(trace, trace->open, state);
+
+    if (0 != pthread_create(&trace->thread, NULL, trace_writer, trace))
+        return 0;
+    trace->started = 1;
+
+    return 1;
+}
+
+void trace_retire(void *context, const STATE *state, const RETIRED *retired)
+{
+    static const int sizes[INSTRUCTION_COUNT] = INSTRUCTION_SIZE_ARRAY;
+    TRACE *trace = context;
+    TRACE_SLOT *slot = trace->open;
+    unsigned char *start = slot->data + slot->size;
+    unsigned char *out = start + 2;
+    unsigned char kind = 0;
+    int writes = 0;
+
+    start[1] = retired->insfn;
+
+    // Not where the last instruction falls through to?
+    if (trace->expected_pc != retired->pc)
+    {
+        kind |= TRACE_JUMP;
+        out = trace_varint(out, trace_zigzag(retired->pc - trace->expected_pc));
+    }
+
+    // Registers that changed
+    for (int i = 0; REGISTER_COUNT > i; i++)
+        if (trace->registers.ids[i] != state->registers.ids[i])
+        {
+            *out++ = i;
+            out = trace_varint(out, trace_zigzag((int) ((unsigned int) state->registers.ids[i] - (unsigned int) trace->registers.ids[i])));
+            trace->registers.ids[i] = state->registers.ids[i];
+            writes++;
+        }
+
+    // Block instruction, the next keyframe has the bytes it stored
+    BOOL block = (0 <= retired->mem_pos) && (4 != retired->mem_size);
+    BOOL block_store = (0 != block) && (0 != retired->mem_write);
+    if (0 != block)
+    {
+        unsigned long long extra = state->step - (slot->first_step + slot->records + 1);
+        kind |= TRACE_BLOCK;
+        out = trace_varint(out, trace_zigzag(retired->mem_pos - trace->last_mem));
+        out = trace_varint(out, ((unsigned int) retired->mem_size << 1) | block_store);
+        out = trace_varint(out, (unsigned int) extra);
+        trace->last_mem = retired->mem_pos;
+    }
+
+    // Stored word
+    else if ((0 <= retired->mem_pos) && (0 != retired->mem_write))
+    {
+        unsigned int value = 0;
+        an_bytes_int(state->memory + retired->mem_pos, &value);
+        kind |= TRACE_MEM;
+        out = trace_varint(out, trace_zigzag(retired->mem_pos - trace->last_mem));
+        out = trace_varint(out, value);
+        trace->last_mem = retired->mem_pos;
+    }
+
+    // Condition codes
+    unsigned char codes = trace_codes(&state->codes);
+    if (trace_codes(&trace->codes) != codes)
+    {
+        kind |= TRACE_CC;
+        *out++ = codes;
+        trace->codes = state->codes;
+    }
+
+    start[0] = kind | (writes << TRACE_REG_SHIFT);
+    slot->size = out - slot->data;
+    slot->records++;
+    trace->records++;
+
+    unsigned char ins = (retired->insfn >> 4) & 0xF;
+    trace->expected_pc = retired->pc + ((INSTRUCTION_COUNT > ins) ? sizes[ins] : retired->size);
+
+    // Chunk full, or memory changed more than the records hold?
+    if ((trace->interval <= (int) slot->records) || (0 != block_store))
+    {
+        trace_publish(trace);
+        trace->open = trace_acquire(trace);
+        trace_keyframe(trace, trace->open, state);
+    }
+}
+
+BOOL trace_close(TRACE *trace, const STATE *state)
+{
+    // Nothing passed?
+    if (NULL == trace)
+        return 0;
+
+    // Last chunk carries the final status
+    if ((NULL != trace->open) && (NULL != state))
+    {
+        trace->open->status = state->status;
+        trace_publish(trace);
+    }
+
+    if (0 != trace->started)
+    {
+        atomic_store_explicit(&trace->done, 1, memory_order_release);
+        pthread_join(trace->thread, NULL);
+        trace->started = 0;
+    }
+
+    BOOL ok = (0 == atomic_load(&trace->failed));
+    if (NULL != trace->file)
+    {
+        ok = (0 == fclose(trace->file)) && ok;
+        trace->file = NULL;
+    }
+
+    for (int i = 0; TRACE_SLOTS > i; i++)
+    {
+        free(trace->slots[i].data);
+        trace->slots[i].data = NULL;
+    }
+    free(trace->compressed);
+    trace->compressed = NULL;
+
+    return ok;
+}
+
+void trace_report(TRACE *trace)
+{
+    // Nothing passed?
+    if (NULL == trace)
+        return;
+
+    printf("Trace:\n");
+    printf("%llu records, %llu bytes encoded, %llu bytes written", trace->records, trace->raw_bytes, trace->file_bytes);
+    if (0 != trace->records)
+        printf(", %.2f bytes per record", (double) trace->file_bytes / trace->records);
+    printf("\n");
+}
+
+static const unsigned char* trace_read_varint(const unsigned char *in, const unsigned char *end, unsigned int *value)
+{
+    *value = 0;
+    for (int shift = 0; (end > in) && (35 > shift); shift += 7)
+    {
+        unsigned char byte = *in++;
+        *value |= (unsigned int) (byte & 0x7F) << shift;
+        if (0 == (byte & 0x80))
+            return in;
+    }
+
+    // Truncated
+    return NULL;
+}
+
+static int trace_unzigzag(unsigned int value)
+{
+    return (int) ((value >> 1) ^ (0u - (value & 1)));
+}
+
+static unsigned long long trace_bytes_long(const unsigned char *in)
+{
+    unsigned int low = 0;
+    unsigned int high = 0;
+    an_bytes_int(in, &low);
+    an_bytes_int(in + 4, &high);
+    return ((unsigned long long) high << 32) | low;
+}
+
+BOOL trace_map(TRACE_FILE *file, const char* filename)
+{
+    // Nothing passed?
+    if ((NULL == file) || (NULL == filename))
+        return 0;
+
+    memset(file, 0, sizeof(TRACE_FILE));
+
+    int fd = open(filename, O_RDONLY);
+    if (0 > fd)
+        return 0;
+
+    struct stat info;
+    if ((0 != fstat(fd, &info)) || (TRACE_HEADER_SIZE > info.st_size))
+    {
+        close(fd);
+        return 0;
+    }
+
+    void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == data)
+        return 0;
+    file->data = data;
+    file->size = info.st_size;
+
+    // File header
+    unsigned int magic = 0;
+    unsigned int version = 0;
+    unsigned int memory_size = 0;
+    unsigned int interval = 0;
+    an_bytes_int(file->data, &magic);
+    an_bytes_int(file->data + 4, &version);
+    an_bytes_int(file->data + 8, &memory_size);
+    an_bytes_int(file->data + 12, &interval);
+    if ((TRACE_MAGIC != magic) || (1 > version) || (TRACE_VERSION < version) || (0 == memory_size) || (0x7FFFFFFF < memory_size))
+    {
+        trace_unmap(file);
+        return 0;
+    }
+    file->memory_size = memory_size;
+    file->interval = interval;
+
+    // Walk the chunk headers to build the index
+    int capacity = 0;
+    size_t offset = TRACE_HEADER_SIZE;
+    while (file->size >= offset + TRACE_CHUNK_HEADER_SIZE)
+    {
+        const unsigned char *header = file->data + offset;
+        an_bytes_int(header, &magic);
+        if (TRACE_CHUNK_MAGIC != magic)
+            break;
+
+        if (capacity <= file->chunk_count)
+        {
+            capacity = (0 == capacity) ? 64 : capacity * 2;
+            TRACE_CHUNK *chunks = realloc(file->chunks, capacity * sizeof(TRACE_CHUNK));
+            if (NULL == chunks)
+            {
+                trace_unmap(file);
+                return 0;
+            }
+            file->chunks = chunks;
+        }
+
+        TRACE_CHUNK *chunk = file->chunks + file->chunk_count;
+        unsigned int status = 0;
+        an_bytes_int(header + 4, &chunk->raw_size);
+        an_bytes_int(header + 8, &chunk->compressed_size);
+        an_bytes_int(header + 12, &chunk->records);
+        chunk->first_step = trace_bytes_long(header + 16);
+        an_bytes_int(header + 24, &status);
+        chunk->status = status;
+        chunk->offset = offset + TRACE_CHUNK_HEADER_SIZE;
+
+        // Truncated chunk, the writer did not finish
+        if (file->size < chunk->offset + chunk->compressed_size)
+            break;
+
+        file->records += chunk->records;
+        file->chunk_count++;
+        offset = chunk->offset + chunk->compressed_size;
+    }
+
+    return 1;
+}
+
+void trace_unmap(TRACE_FILE *file)
+{
+    // Nothing passed?
+    if (NULL == file)
+        return;
+
+    if (NULL != file->data)
+        munmap(file->data, file->size);
+    free(file->chunks);
+    memset(file, 0, sizeof(TRACE_FILE));
+}
+
+int trace_find(const TRACE_FILE *file, unsigned long long step)
+{
+    // Nothing passed?
+    if ((NULL == file) || (0 == file->chunk_count))
+        return -1;
+
+    // Last chunk whose keyframe is at or before the step
+    int low = 0;
+    int high = file->chunk_count - 1;
+    while (low < high)
+    {
+        int mid = (low + high + 1) / 2;
+        if (file->chunks[mid].first_step <= step)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+
+    // Before the trace?  Chunks run up to the next keyframe, the last one to
+    // wherever its records end
+    if (file->chunks[low].first_step > step)
+        return -1;
+
+    return low;
+}
+
+BOOL trace_cursor_open(TRACE_CURSOR *cursor, const TRACE_FILE *file, int chunk)
+{
+    // Nothing passed?
+    if ((NULL == cursor) || (NULL == file) || (0 > chunk) || (file->chunk_count <= chunk))
+        return 0;
+
+    memset(cursor, 0, sizeof(TRACE_CURSOR));
+    const TRACE_CHUNK *info = file->chunks + chunk;
+
+    // Keyframe must be there
+    if (TRACE_KEYFRAME_SIZE + (unsigned int) file->memory_size > info->raw_size)
+        return 0;
+
+    cursor->raw = malloc(info->raw_size);
+    if (NULL == cursor->raw)
+        return 0;
+
+    uLongf raw_size = info->raw_size;
+    if ((Z_OK != uncompress(cursor->raw, &raw_size, file->data + info->offset, info->compressed_size))
+        || (info->raw_size != raw_size))
+    {
+        trace_cursor_close(cursor);
+        return 0;
+    }
+
+    // Machine at the keyframe
+    state_init(&cursor->state);
+    if (0 == state_allocate(&cursor->state, file->memory_size))
+    {
+        trace_cursor_close(cursor);
+        return 0;
+    }
+    const unsigned char *in = cursor->raw;
+    unsigned int value = 0;
+    an_bytes_int(in, &value);
+    cursor->state.pc = value;
+    cursor->step = trace_bytes_long(in + 4);
+    cursor->state.step = cursor->step;
+    for (int i = 0; REGISTER_COUNT > i; i++)
+    {
+        an_bytes_int(in + 12 + i * 4, &value);
+        cursor->state.registers.ids[i] = value;
+    }
+    unsigned char codes = in[TRACE_KEYFRAME_SIZE - 1];
+    cursor->state.codes.ZF = (codes >> 0) & 1;
+    cursor->state.codes.SF = (codes >> 1) & 1;
+    cursor->state.codes.OF = (codes >> 2) & 1;
+    memcpy(cursor->state.memory, in + TRACE_KEYFRAME_SIZE, file->memory_size);
+
+    cursor->next = in + TRACE_KEYFRAME_SIZE + file->memory_size;
+    cursor->end = cursor->raw + raw_size;
+    cursor->remaining = info->records;
+    cursor->mem_pos = -1;
+
+    // Status is only known for the end of the chunk
+    cursor->status = info->status;
+    if (0 == cursor->remaining)
+        cursor->state.status = cursor->status;
+    cursor->pc = cursor->state.pc;
+
+    return 1;
+}
+
+BOOL trace_cursor_next(TRACE_CURSOR *cursor)
+{
+    static const int sizes[INSTRUCTION_COUNT] = INSTRUCTION_SIZE_ARRAY;
+
+    // Nothing passed or nothing left?
+    if ((NULL == cursor) || (0 == cursor->remaining) || (cursor->end < cursor->next + 2))
+        return 0;
+
+    const unsigned char *in = cursor->next;
+    const unsigned char *end = cursor->end;
+    unsigned char kind = *in++;
+    unsigned int value = 0;
+    STATE *state = &cursor->state;
+
+    cursor->insfn = *in++;
+    cursor->mem_pos = -1;
+    cursor->reg_writes = 0;
+
+    // Jumped?
+    if (0 != (kind & TRACE_JUMP))
+    {
+        if (NULL == (in = trace_read_varint(in, end, &value)))
+            return 0;
+        state->pc += trace_unzigzag(value);
+    }
+    cursor->pc = state->pc;
+
+    // Registers
+    int writes = kind >> TRACE_REG_SHIFT;
+    for (int i = 0; writes > i; i++)
+    {
+        if (end <= in)
+            return 0;
+        unsigned char reg = *in++;
+        if ((REGISTER_COUNT <= reg) || (NULL == (in = trace_read_varint(in, end, &value))))
+            return 0;
+        state->registers.ids[reg] = (unsigned int) state->registers.ids[reg] + (unsigned int) trace_unzigzag(value);
+        cursor->reg_writes |= 1 << reg;
+    }
+
+    // Store
+    if (0 != (kind & TRACE_MEM))
+    {
+        if (NULL == (in = trace_read_varint(in, end, &value)))
+            return 0;
+        int pos = cursor->mem_last + trace_unzigzag(value);
+        if ((NULL == (in = trace_read_varint(in, end, &cursor->mem_value))) || (0 > pos) || (state->memory_size - 4 < pos))
+            return 0;
+        an_int_bytes(cursor->mem_value, state->memory + pos);
+        cursor->mem_pos = pos;
+        cursor->mem_size = 4;
+        cursor->mem_last = pos;
+    }
+
+    // Block instruction, only the range it stored to is known
+    unsigned int extra = 0;
+    if (0 != (kind & TRACE_BLOCK))
+    {
+        unsigned int size = 0;
+        if (NULL == (in = trace_read_varint(in, end, &value)))
+            return 0;
+        int pos = cursor->mem_last + trace_unzigzag(value);
+        if ((NULL == (in = trace_read_varint(in, end, &size))) || (NULL == (in = trace_read_varint(in, end, &extra)))
+            || (0 > pos) || ((unsigned int) (state->memory_size - pos) < (size >> 1)))
+            return 0;
+        if (0 != (size & 1))
+        {
+            cursor->mem_pos = pos;
+            cursor->mem_size = size >> 1;
+            cursor->mem_value = 0;
+        }
+        cursor->mem_last = pos;
+    }
+
+    // Condition codes
+    if (0 != (kind & TRACE_CC))
+    {
+        if (end <= in)
+            return 0;
+        unsigned char codes = *in++;
+        state->codes.ZF = (codes >> 0) & 1;
+        state->codes.SF = (codes >> 1) & 1;
+        state->codes.OF = (codes >> 2) & 1;
+    }
+
+    // Fall through address, corrected by the next record if it jumped
+    unsigned char ins = (cursor->insfn >> 4) & 0xF;
+    state->pc += (INSTRUCTION_COUNT > ins) ? sizes[ins] : 0;
+    cursor->step += 1 + extra;
+    state->step = cursor->step;
+    cursor->remaining--;
+    cursor->next = in;
+    if (0 == cursor->remaining)
+        state->status = cursor->status;
+
+    // Halt leaves the PC on itself
+    if (0 == ins)
+        state->pc = cursor->pc;
+
+    return 1;
+}
+
+int trace_cursor_peek_pc(const TRACE_CURSOR *cursor)
+{
+    // Nothing passed?
+    if (NULL == cursor)
+        return -1;
+
+    // No next record?
+    if ((0 == cursor->remaining) || (cursor->end < cursor->next + 2))
+        return cursor->state.pc;
+
+    unsigned int value = 0;
+    if ((0 == (cursor->next[0] & TRACE_JUMP)) || (NULL == trace_read_varint(cursor->next + 2, cursor->end, &value)))
+        return cursor->state.pc;
+
+    return cursor->state.pc + trace_unzigzag(value);
+}
+
+void trace_cursor_close(TRACE_CURSOR *cursor)
+{
+    // Nothing passed?
+    if (NULL == cursor)
+        return;
+
+    free(cursor->raw);
+    state_free(&cursor->state);
+    memset(cursor, 0, sizeof(TRACE_CURSOR));
+}
@@ -0,0 +1,144 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "state.h"
+
+//// Defines
+
+// File layout, all integers little endian:
+//   file header  "Y86T", version, memory size, keyframe interval
+//   chunks       header, then the zlib compressed keyframe and records
+// Every chunk starts from a keyframe of the whole machine, so chunks can be
+// decoded on their own.  A block store ends its chunk, the bytes it wrote are
+// in the next keyframe, and a block instruction may take more than one step.
+#define TRACE_MAGIC 0x54363859
+#define TRACE_CHUNK_MAGIC 0x43363859
+#define TRACE_VERSION 2
+#define TRACE_HEADER_SIZE 16
+#define TRACE_CHUNK_HEADER_SIZE 28
+
+// Keyframe: pc, step, registers, condition codes, then memory
+#define TRACE_KEYFRAME_SIZE (4 + 8 + 4 * REGISTER_COUNT + 1)
+
+// Record: kind byte, instruction byte, then the parts the kind names
+#define TRACE_JUMP 0x01 // Zigzag PC delta from the fall through address
+#define TRACE_MEM 0x02 // Zigzag address delta from the last store, value
+#define TRACE_CC 0x04 // Condition codes byte
+#define TRACE_BLOCK 0x08 // Zigzag address delta from the last store, byte count
+                         // shifted left with bit 0 set for a store, extra steps
+#define TRACE_REG_SHIFT 4 // Count of register id, zigzag delta pairs
+#define TRACE_RECORD_MAX (2 + 5 + REGISTER_COUNT * 6 + 15 + 1)
+
+// Records between keyframes when none is given
+#define TRACE_DEF_INTERVAL 16384
+
+// Chunks in flight between the run and the writer thread
+#define TRACE_SLOTS 8
+
+//// Type declarations
+
+typedef struct _TRACE_SLOT
+{
+    unsigned char *data; // Keyframe then records
+    size_t size;
+    unsigned int records;
+    unsigned long long first_step;
+    int status;
+} TRACE_SLOT;
+
+// Binary trace of every retired instruction.  The run encodes records into
+// a ring of chunk slots, a writer thread compresses and writes full slots.
+typedef struct _TRACE
+{
+    FILE *file;
+    int memory_size;
+    int interval;
+    size_t capacity;
+    TRACE_SLOT slots[TRACE_SLOTS];
+    atomic_uint head; // Slots published by the run
+    atomic_uint tail; // Slots written by the writer
+    atomic_int done;
+    atomic_int failed;
+    pthread_t thread;
+    BOOL started;
+
+    // Run side
+    TRACE_SLOT *open;
+    REGISTERS registers;
+    CONDITION_CODES codes;
+    int expected_pc;
+    int last_mem;
+    unsigned long long records;
+
+    // Writer side
+    unsigned char *compressed;
+    size_t compressed_capacity;
+    unsigned long long raw_bytes;
+    unsigned long long file_bytes;
+} TRACE;
+
+// Where a chunk is in a mapped trace, the sparse seek index
+typedef struct _TRACE_CHUNK
+{
+    size_t offset; // Of the compressed data
+    unsigned int raw_size;
+    unsigned int compressed_size;
+    unsigned int records;
+    unsigned long long first_step; // Steps retired before the keyframe
+    int status; // Status after the last record
+} TRACE_CHUNK;
+
+// A trace file mapped read only
+typedef struct _TRACE_FILE
+{
+    unsigned char *data;
+    size_t size;
+    int memory_size;
+    int interval;
+    TRACE_CHUNK *chunks;
+    int chunk_count;
+    unsigned long long records;
+} TRACE_FILE;
+
+// Replays one chunk, state holds the machine after the last record
+typedef struct _TRACE_CURSOR
+{
+    unsigned char *raw;
+    const unsigned char *next;
+    const unsigned char *end;
+    unsigned int remaining;
+    unsigned long long step; // Steps retired so far
+    int status; // Status after the last record
+    STATE state;
+
+    // Last record
+    int pc;
+    unsigned char insfn;
+    int mem_pos; // -1 if there was no store
+    int mem_size; // Bytes stored, 4 unless a block
+    int mem_last; // Base of the next store delta
+    unsigned int mem_value; // Stored word, unless a block
+    unsigned char reg_writes; // Bit per register written
+} TRACE_CURSOR;
+
+//// Forward declarations
+
+BOOL trace_open(TRACE *trace, const char* filename, const STATE *state, int interval);
+void trace_retire(void *context, const STATE *state, const RETIRED *retired);
+BOOL trace_close(TRACE *trace, const STATE *state);
+void trace_report(TRACE *trace);
+unsigned char* trace_varint(unsigned char *out, unsigned int value);
+unsigned int trace_zigzag(int value);
+BOOL trace_map(TRACE_FILE *file, const char* filename);
+void trace_unmap(TRACE_FILE *file);
+int trace_find(const TRACE_FILE *file, unsigned long long step);
+BOOL trace_cursor_open(TRACE_CURSOR *cursor, const TRACE_FILE *file, int chunk);
+BOOL trace_cursor_next(TRACE_CURSOR *cursor);
+int trace_cursor_peek_pc(const TRACE_CURSOR *cursor);
+void trace_cursor_close(TRACE_CURSOR *cursor);
+
+#endif
@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "trace.h"
+
+//// Defines
+
+// Most worker threads
+#define THREAD_MAX 256
+
+//// Type declarations
+
+typedef enum _QUERY
+{
+    QUERY_INFO,
+    QUERY_WRITES,
+    QUERY_REG,
+    QUERY_MIX,
+    QUERY_STATE
+} QUERY;
+
+typedef struct _HIT
+{
+    unsigned long long step;
+    int pc;
+    unsigned int value;
+    int pos; // Block stores only
+    int size;
+} HIT;
+
+// What one chunk contributed
+typedef struct _RESULT
+{
+    HIT *hits;
+    int count;
+    int capacity;
+    unsigned long long mix[INSTRUCTION_COUNT + 1];
+    BOOL failed;
+} RESULT;
+
+// Chunks first to last, shared by the workers
+typedef struct _JOB
+{
+    const TRACE_FILE *file;
+    QUERY query;
+    int address;
+    int reg;
+    unsigned long long from;
+    unsigned long long to;
+    int first;
+    int last;
+    atomic_int next;
+    RESULT *results;
+} JOB;
+
+//// Forward declarations
+
+int usage(const char* prog);
+BOOL parse_step(const char* in, unsigned long long *out);
+HIT* result_add(RESULT *result, unsigned long long step, int pc, unsigned int value);
+void job_chunk(JOB *job, int chunk);
+void* job_worker(void *context);
+BOOL run_job(JOB *job, int threads);
+int query_state(const TRACE_FILE *file, unsigned long long step);
+void query_info(const TRACE_FILE *file);
+
+//// Main function
+
+int main(int argc, char** argv)
+{
+    int threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int arg = 1;
+
+    // Options first
+    if ((argc > arg + 1) && (0 == strcmp(argv[arg], "--threads")))
+    {
+        if ((0 == an_parse_int(argv[arg + 1], &threads)) || (1 > threads) || (THREAD_MAX < threads))
+            return usage(argv[0]);
+        arg += 2;
+    }
+    if (1 > threads)
+        threads = 1;
+
+    // No trace or query?
+    if (argc < arg + 2)
+        return usage(argv[0]);
+
+    TRACE_FILE file = { 0 };
+    if (0 == trace_map(&file, argv[arg]))
+    {
+        printf("[!] Could not read trace: '%s'\n", argv[arg]);
+        return 1;
+    }
+
+    const char* query = argv[arg + 1];
+    char** params = argv + arg + 2;
+    int param_count = argc - arg - 2;
+    int ret = 0;
+
+    JOB job = { 0 };
+    job.file = &file;
+    job.to = ~0ULL;
+    int window = 0;
+
+    if ((0 == strcmp(query, "info")) && (0 == param_count))
+        query_info(&file);
+    else if ((0 == strcmp(query, "state")) && (1 == param_count))
+    {
+        unsigned long long step = 0;
+        ret = (0 == parse_step(params[0], &step)) ? usage(argv[0]) : query_state(&file, step);
+    }
+    else if ((0 == strcmp(query, "writes")) && (1 <= param_count) && (0 != an_parse_int(params[0], &job.address)))
+    {
+        job.query = QUERY_WRITES;
+        window = 1;
+    }
+    else if ((0 == strcmp(query, "reg")) && (1 <= param_count))
+    {
+        const char* reg_names[REGISTER_COUNT] = REGISTER_NAME_ARRAY;
+        const char* name = ('%' == params[0][0]) ? params[0] + 1 : params[0];
+        job.query = QUERY_REG;
+        job.reg = 0;
+        while ((REGISTER_COUNT > job.reg) && (0 != strcmp(name, reg_names[job.reg])))
+            job.reg++;
+        window = (REGISTER_COUNT > job.reg);
+        if (0 == window)
+            ret = usage(argv[0]);
+    }
+    else if (0 == strcmp(query, "mix"))
+    {
+        job.query = QUERY_MIX;
+        window = 2;
+    }
+    else
+        ret = usage(argv[0]);
+
+    // Queries over a window of steps, split across the workers
+    if (0 != window)
+    {
+        int from_param = (2 == window) ? 0 : 1;
+        if (((param_count > from_param) && (0 == parse_step(params[from_param], &job.from)))
+            || ((param_count > from_param + 1) && (0 == parse_step(params[from_param + 1], &job.to)))
+            || (param_count > from_param + 2))
+            ret = usage(argv[0]);
+        else if (0 == run_job(&job, threads))
+        {
+            printf("[!] Failed to decode trace\n");
+            ret = 1;
+        }
+    }
+
+    trace_unmap(&file);
+    return ret;
+}
+
+//// Definitions
+
+int usage(const char* prog)
+{
+    printf("Usage: %s [--threads N] <trace-file> <query>\n", prog);
+    printf("Queries:\n");
+    printf("  info                      Chunks, records and compression\n");
+    printf("  writes ADDR [FROM [TO]]   Steps that stored to the word at ADDR\n");
+    printf("  reg NAME [FROM [TO]]      Values written to a register\n");
+    printf("  mix [FROM [TO]]           Instruction mix over a window of steps\n");
+    printf("  state STEP                Machine state after STEP instructions\n");
+    return 1;
+}
+
+BOOL parse_step(const char* in, unsigned long long *out)
+{
+    char* end = NULL;
+    *out = strtoull(in, &end, 0);
+    return ('\0' != in[0]) && ('-' != in[0]) && ('\0' == *end);
+}
+
+HIT* result_add(RESULT *result, unsigned long long step, int pc, unsigned int value)
+{
+    if (result->capacity <= result->count)
+    {
+        int capacity = (0 == result->capacity) ? 256 : result->capacity * 2;
+        HIT *hits = realloc(result->hits, capacity * sizeof(HIT));
+        if (NULL == hits)
+            return NULL;
+        result->hits = hits;
+        result->capacity = capacity;
+    }
+
+    HIT *hit = result->hits + result->count++;
+    hit->step = step;
+    hit->pc = pc;
+    hit->value = value;
+    hit->pos = -1;
+    hit->size = 4;
+    return hit;
+}
+
+void job_chunk(JOB *job, int chunk)
+{
+    RESULT *result = job->results + chunk;
+    TRACE_CURSOR cursor;
+    if (0 == trace_cursor_open(&cursor, job->file, chunk))
+    {
+        result->failed = 1;
+        return;
+    }
+
+    while (0 != trace_cursor_next(&cursor))
+    {
+        // Outside the window?
+        if (job->from > cursor.step)
+            continue;
+        if (job->to < cursor.step)
+            break;
+
+        unsigned char ins = (cursor.insfn >> 4) & 0xF;
+        BOOL ok = 1;
+        HIT *hit = NULL;
+        switch (job->query)
+        {
+            case QUERY_WRITES:
+                if ((0 <= cursor.mem_pos) && (job->address + 4 > cursor.mem_pos) && (cursor.mem_pos + cursor.mem_size > job->address))
+                {
+                    hit = result_add(result, cursor.step, cursor.pc, cursor.mem_value);
+                    ok = (NULL != hit);
+                    if ((0 != ok) && (4 != cursor.mem_size))
+                    {
+                        hit->pos = cursor.mem_pos;
+                        hit->size = cursor.mem_size;
+                    }
+                }
+                break;
+            case QUERY_REG:
+                if (0 != (cursor.reg_writes & (1 << job->reg)))
+                    ok = (NULL != result_add(result, cursor.step, cursor.pc, cursor.state.registers.ids[job->reg]));
+                break;
+            case QUERY_MIX:
+                result->mix[(INSTRUCTION_COUNT > ins) ? ins : INSTRUCTION_COUNT]++;
+                break;
+            default:
+                break;
+        }
+
+        if (0 == ok)
+        {
+            result->failed = 1;
+            break;
+        }
+    }
+
+    // Stopped early on a corrupt record?
+    if ((0 != cursor.remaining) && (job->to >= cursor.step))
+        result->failed = 1;
+
+    trace_cursor_close(&cursor);
+}
+
+void* job_worker(void *context)
+{
+    JOB *job = context;
+
+    // Claim chunks until none are left
+    while (1)
+    {
+        int chunk = atomic_fetch_add(&job->next, 1);
+        if (job->last < chunk)
+            break;
+        job_chunk(job, chunk);
+    }
+
+    return NULL;
+}
+
+BOOL run_job(JOB *job, int threads)
+{
+    const TRACE_FILE *file = job->file;
+
+    // Empty trace?
+    if (0 == file->chunk_count)
+        return 1;
+
+    // Only the chunks overlapping the window
+    job->first = (0 == job->from) ? 0 : trace_find(file, job->from - 1);
+    job->last = trace_find(file, job->to);
+    if (0 > job->first)
+        job->first = (file->chunks[0].first_step >= job->from) ? 0 : file->chunk_count;
+    if (0 > job->last)
+        job->last = file->chunk_count - 1;
+    atomic_store(&job->next, job->first);
+
+    job->results = calloc(file->chunk_count, sizeof(RESULT));
+    if (NULL == job->results)
+        return 0;
+
+    // Workers, the calling thread is one of them
+    pthread_t workers[THREAD_MAX];
+    int started = 0;
+    if (threads > job->last - job->first + 1)
+        threads = job->last - job->first + 1;
+    for (int i = 1; threads > i; i++)
+        if (0 == pthread_create(workers + started, NULL, job_worker, job))
+            started++;
+    job_worker(job);
+    for (int i = 0; started > i; i++)
+        pthread_join(workers[i], NULL);
+
+    // Merge in chunk order
+    const char* reg_names[REGISTER_COUNT] = REGISTER_NAME_ARRAY;
+    const char* ins_names[INSTRUCTION_COUNT] = INSTRUCTION_NAME_ARRAY;
+    unsigned long long mix[INSTRUCTION_COUNT + 1] = { 0 };
+    unsigned long long total = 0;
+    BOOL ok = 1;
+    for (int i = job->first; job->last >= i; i++)
+    {
+        RESULT *result = job->results + i;
+        ok = ok && (0 == result->failed);
+        for (int j = 0; result->count > j; j++)
+        {
+            HIT *hit = result->hits + j;
+            if ((QUERY_WRITES == job->query) && (0 <= hit->pos))
+                printf("step %llu  PC 0x%04x  wrote %d bytes at 0x%04x\n", hit->step, hit->pc, hit->size, hit->pos);
+            else if (QUERY_WRITES == job->query)
+                printf("step %llu  PC 0x%04x  wrote 0x%08x\n", hit->step, hit->pc, hit->value);
+            else
+                printf("step %llu  PC 0x%04x  %%%s = 0x%08x\n", hit->step, hit->pc, reg_names[job->reg], hit->value);
+        }
+        for (int j = 0; INSTRUCTION_COUNT >= j; j++)
+        {
+            mix[j] += result->mix[j];
+            total += result->mix[j];
+        }
+        free(result->hits);
+    }
+
+    if (QUERY_MIX == job->query)
+        for (int j = 0; INSTRUCTION_COUNT >= j; j++)
+            if (0 != mix[j])
+                printf("%-7s %12llu  %6.2f%%\n", (INSTRUCTION_COUNT > j) ? ins_names[j] : "???", mix[j], 100.0 * mix[j] / total);
+
+    free(job->results);
+    job->results = NULL;
+    return ok;
+}
+
+int query_state(const TRACE_FILE *file, unsigned long long step)
+{
+    int chunk = trace_find(file, step);
+    if (0 > chunk)
+    {
+        printf("[!] Step %llu is not in the trace\n", step);
+        return 1;
+    }
+
+    // Initial machine to diff against
+    TRACE_CURSOR initial;
+    TRACE_CURSOR cursor;
+    if (0 == trace_cursor_open(&initial, file, 0))
+    {
+        printf("[!] Failed to decode trace\n");
+        return 1;
+    }
+    if (0 == trace_cursor_open(&cursor, file, chunk))
+    {
+        printf("[!] Failed to decode trace\n");
+        trace_cursor_close(&initial);
+        return 1;
+    }
+
+    // Replay from the keyframe only
+    while ((step > cursor.step) && (0 != trace_cursor_next(&cursor)))
+        ;
+    BOOL ok = (step == cursor.step);
+    if (0 != ok)
+    {
+        cursor.state.pc = trace_cursor_peek_pc(&cursor);
+        state_changes(&initial.state, &cursor.state);
+    }
+    else if (step < cursor.step)
+        printf("[!] Step %llu is inside a block instruction, it ends at step %llu\n", step, cursor.step);
+    else if ((step > cursor.step) && (0 == cursor.remaining))
+        printf("[!] Step %llu is not in the trace\n", step);
+    else
+        printf("[!] Failed to decode trace\n");
+
+    trace_cursor_close(&cursor);
+    trace_cursor_close(&initial);
+    return (0 != ok) ? 0 : 1;
+}
+
+void query_info(const TRACE_FILE *file)
+{
+    unsigned long long raw = 0;
+    unsigned long long compressed = 0;
+    for (int i = 0; file->chunk_count > i; i++)
+    {
+        raw += file->chunks[i].raw_size;
+        compressed += file->chunks[i].compressed_size;
+    }
+
+    const char* st_names[STATUS_COUNT] = STATUS_NAME_ARRAY;
+    int status = (0 < file->chunk_count) ? file->chunks[file->chunk_count - 1].status : AOK;
+    BOOL st_valid = (_FIRST <= status) && (_LAST >= status);
+
+    printf("Memory size:  %d\n", file->memory_size);
+    printf("Interval:     %d\n", file->interval);
+    printf("Chunks:       %d\n", file->chunk_count);
+    printf("Records:      %llu\n", file->records);
+    printf("Final status: %s\n", st_valid ? st_names[status - _FIRST] : "???");
+    printf("Bytes:        %llu encoded, %llu compressed, %zu in file\n", raw, compressed, file->size);
+}
@@ -0,0 +1,389 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+
+#include "watch.h"
+
+//// Defines
+
+// Hosts where the trap flag can single step the faulting access
+#if defined(__linux__) && defined(__x86_64__)
+#define WATCH_HOST 1
+#else
+#define WATCH_HOST 0
+#endif
+
+// x86 trap flag, and the write bit of the page fault error code
+#define WATCH_TRAP_FLAG 0x100
+#define WATCH_FAULT_WRITE 0x2
+
+//// Definitions
+
+// The run the handlers serve
+static WATCHES *volatile watch_active = NULL;
+static struct sigaction watch_old_segv;
+static struct sigaction watch_old_trap;
+
+// 0 capacity for the default
+BOOL watch_init(WATCHES *watches, int hit_capacity)
+{
+    // Nothing passed?
+    if (NULL == watches)
+        return 0;
+
+    memset(watches, 0, sizeof(WATCHES));
+    if (0 >= hit_capacity)
+        hit_capacity = WATCH_DEF_HITS;
+    watches->hits = malloc((size_t) hit_capacity * sizeof(WATCH_HIT));
+    if (NULL == watches->hits)
+        return 0;
+    watches->hit_capacity = hit_capacity;
+
+    return 1;
+}
+
+void watch_free(WATCHES *watches)
+{
+    // Nothing passed?
+    if (NULL == watches)
+        return;
+
+    free(watches->hits);
+    watches->hits = NULL;
+    watches->hit_capacity = 0;
+    watches->hit_count = 0;
+}
+
+BOOL watch_add(WATCHES *watches, unsigned int address, unsigned int size, int kinds)
+{
+    // Nothing passed?
+    if (NULL == watches)
+        return 0;
+
+    // Full, empty, too wide or wrapping?
+    if ((WATCH_MAX <= watches->count) || (0 == size) || (WATCH_MAX_SIZE < size) || (address + size < address))
+        return 0;
+
+    // No kind, or an unknown one?
+    if ((0 == kinds) || (0 != (kinds & ~(WATCH_READ | WATCH_WRITE | WATCH_CHANGE))))
+        return 0;
+
+    WATCH *watch = watches->watches + watches->count++;
+    memset(watch, 0, sizeof(WATCH));
+    watch->address = address;
+    watch->size = size;
+    watch->kinds = kinds;
+    return 1;
+}
+
+// address[:size][:kinds], kinds any of r, w and c, by default a written word
+BOOL watch_parse(WATCHES *watches, const char* spec)
+{
+    // Nothing passed?
+    if ((NULL == watches) || (NULL == spec))
+        return 0;
+
+    char part[32];
+    int address = 0;
+    int size = 4;
+    int kinds = 0;
+    int count = 0;
+    const char* start = spec;
+    while (1)
+    {
+        const char* end = strchr(start, ':');
+        size_t len = (NULL == end) ? strlen(start) : (size_t) (end - start);
+        if ((sizeof(part) <= len) || (0 == len))
+            return 0;
+        memcpy(part, start, len);
+        part[len] = '\0';
+
+        if (0 == count)
+        {
+            if (0 == an_parse_int(part, &address))
+                return 0;
+        }
+        else if ((1 == count) && (0 != an_parse_int(part, &size)))
+        {
+            // Size given
+        }
+        else if (0 == kinds)
+        {
+            for (size_t i = 0; len > i; i++)
+            {
+                switch (part[i])
+                {
+                    case 'r':
+                        kinds |= WATCH_READ;
+                        break;
+                    case 'w':
+                        kinds |= WATCH_WRITE;
+                        break;
+                    case 'c':
+                        kinds |= WATCH_CHANGE;
+                        break;
+                    default:
+                        return 0;
+                }
+            }
+        }
+        else
+            return 0;
+        count++;
+
+        if (NULL == end)
+            break;
+        start = end + 1;
+    }
+
+    if ((0 > address) || (0 >= size))
+        return 0;
+
+    return watch_add(watches, (unsigned int) address, (unsigned int) size, (0 == kinds) ? WATCH_WRITE : kinds);
+}
+
+BOOL watch_supported(void)
+{
+    return WATCH_HOST;
+}
+
+#if WATCH_HOST
+
+// In the memory of the run?
+static inline BOOL watch_fits(const WATCHES *watches, const WATCH *watch)
+{
+    return (watch->address + watch->size <= (unsigned int) watches->state->memory_size);
+}
+
+// No access if a read is watched on the page, else read only
+static int watch_page_protection(const WATCHES *watches, size_t page)
+{
+    int protection = PROT_READ;
+    for (int i = 0; watches->count > i; i++)
+    {
+        const WATCH *watch = watches->watches + i;
+        if ((0 != watch_fits(watches, watch)) && (0 != (watch->kinds & WATCH_READ))
+            && (page < watch->address + watch->size) && (page + watches->page > watch->address))
+            protection = PROT_NONE;
+    }
+    return protection;
+}
+
+// Every page holding a watched range, opened or protected
+static void watch_protect(WATCHES *watches, BOOL open)
+{
+    for (int i = 0; watches->count > i; i++)
+    {
+        const WATCH *watch = watches->watches + i;
+        if (0 == watch_fits(watches, watch))
+            continue;
+
+        size_t first = watch->address / watches->page * watches->page;
+        size_t last = (watch->address + watch->size - 1) / watches->page * watches->page;
+        for (size_t page = first; last >= page; page += watches->page)
+            mprotect(watches->mirror + page, watches->page,
+                     (0 != open) ? (PROT_READ | PROT_WRITE) : watch_page_protection(watches, page));
+    }
+}
+
+// Up to a word of the range from offset, little endian
+static unsigned int watch_word(const unsigned char *bytes, unsigned int offset, unsigned int size)
+{
+    unsigned int value = 0;
+    for (unsigned int i = 0; (4 > i) && (size > offset + i); i++)
+        value |= (unsigned int) bytes[offset + i] << (i * 8);
+    return value;
+}
+
+// Records a hit on the word of the range around offset
+static void watch_hit(WATCHES *watches, int index, int kind, long long offset)
+{
+    WATCH *watch = watches->watches + index;
+    unsigned int word = (unsigned int) offset & ~3U;
+    unsigned int new_value = watch_word(watches->mirror + watch->address, word, watch->size);
+
+    // The same instruction again, a byte at a time?  One hit, with the value after it
+    for (int i = watches->hit_count - 1; (0 <= i) && (watches->hits[i].step == watches->state->step); i--)
+    {
+        WATCH_HIT *hit = watches->hits + i;
+        if ((index == hit->watch) && (kind == hit->kind) && (watch->address + word == hit->address))
+        {
+            hit->new_value = new_value;
+            return;
+        }
+    }
+
+    // Kept full?
+    if (watches->hit_capacity <= watches->hit_count)
+    {
+        watches->missed++;
+        return;
+    }
+
+    WATCH_HIT *hit = watches->hits + watches->hit_count++;
+    hit->watch = index;
+    hit->kind = kind;
+    hit->step = watches->state->step;
+    hit->pc = watches->state->pc;
+    hit->address = watch->address + word;
+    hit->old_value = watch_word(watch->shadow, word, watch->size);
+    hit->new_value = new_value;
+}
+
+// An access to a watched page.  Open them all and step over it
+static void watch_segv(int signal, siginfo_t *info, void *context)
+{
+    WATCHES *watches = watch_active;
+    unsigned char *fault = info->si_addr;
+    ucontext_t *uc = context;
+
+    // Not a watched page?  Back to the old handler, the access faults again for real
+    if ((NULL == watches) || (0 != watches->pending) || (watches->mirror > fault)
+        || (watches->mirror + watches->mapped <= fault))
+    {
+        sigaction(SIGSEGV, &watch_old_segv, NULL);
+        return;
+    }
+
+    watches->fault = fault;
+    watches->fault_write = (0 != (uc->uc_mcontext.gregs[REG_ERR] & WATCH_FAULT_WRITE));
+    watches->pending = 1;
+    watches->faults++;
+    watch_protect(watches, 1);
+    uc->uc_mcontext.gregs[REG_EFL] |= WATCH_TRAP_FLAG;
+}
+
+// The access is done.  Compare, report and protect again
+static void watch_trap(int signal, siginfo_t *info, void *context)
+{
+    WATCHES *watches = watch_active;
+    ucontext_t *uc = context;
+
+    // Not a step of ours?
+    if ((NULL == watches) || (0 == watches->pending))
+    {
+        sigaction(SIGTRAP, &watch_old_trap, NULL);
+        raise(SIGTRAP);
+        return;
+    }
+
+    uc->uc_mcontext.gregs[REG_EFL] &= ~WATCH_TRAP_FLAG;
+    watches->pending = 0;
+
+    long long fault = watches->fault - watches->mirror;
+    for (int i = 0; watches->count > i; i++)
+    {
+        WATCH *watch = watches->watches + i;
+        if (0 == watch_fits(watches, watch))
+            continue;
+
+        const unsigned char *now = watches->mirror + watch->address;
+        long long offset = fault - watch->address;
+        BOOL inside = (0 <= offset) && (watch->size > offset);
+        long long changed = -1;
+        for (unsigned int j = 0; (watch->size > j) && (0 > changed); j++)
+            if (watch->shadow[j] != now[j])
+                changed = j;
+
+        if ((0 != (watch->kinds & WATCH_READ)) && (0 != inside) && (0 == watches->fault_write))
+            watch_hit(watches, i, WATCH_READ, offset);
+        if ((0 != (watch->kinds & WATCH_WRITE)) && ((0 <= changed) || ((0 != inside) && (0 != watches->fault_write))))
+            watch_hit(watches, i, WATCH_WRITE, (0 <= changed) ? changed : offset);
+        if ((0 != (watch->kinds & WATCH_CHANGE)) && (0 <= changed))
+            watch_hit(watches, i, WATCH_CHANGE, changed);
+
+        memcpy(watch->shadow, now, watch->size);
+    }
+
+    watch_protect(watches, 0);
+}
+
+#endif
+
+// Runs state_resume with the watched pages protected.  Without watchpoints,
+// or where they are not supported, it is a plain run
+PROGRAM_STATUS watch_resume(WATCHES *watches, STATE *state, const BUDGET *budget, PROBES *probes)
+{
+    // Nothing passed?
+    if ((NULL == watches) || (NULL == state))
+        return INS;
+
+#if WATCH_HOST
+    // Nothing to watch, or a run already watched?
+    if ((0 >= watches->count) || (NULL != watch_active) || (0 >= state->memory_size))
+        return state_resume(state, budget, probes);
+
+    // Pages of its own, so nothing else shares a protected page
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t mapped = ((size_t) state->memory_size + page - 1) / page * page;
+    unsigned char *mirror = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == mirror)
+        return state_resume(state, budget, probes);
+    memcpy(mirror, state->memory, (size_t) state->memory_size);
+
+    watches->state = state;
+    watches->home = state->memory;
+    watches->mirror = mirror;
+    watches->mapped = mapped;
+    watches->page = page;
+    watches->pending = 0;
+    state->memory = mirror;
+    for (int i = 0; watches->count > i; i++)
+        if (0 != watch_fits(watches, watches->watches + i))
+            memcpy(watches->watches[i].shadow, mirror + watches->watches[i].address, watches->watches[i].size);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_SIGINFO;
+    action.sa_sigaction = watch_segv;
+    sigaction(SIGSEGV, &action, &watch_old_segv);
+    action.sa_sigaction = watch_trap;
+    sigaction(SIGTRAP, &action, &watch_old_trap);
+
+    watch_active = watches;
+    watch_protect(watches, 0);
+    PROGRAM_STATUS status = state_resume(state, budget, probes);
+    watch_protect(watches, 1);
+    watch_active = NULL;
+
+    sigaction(SIGSEGV, &watch_old_segv, NULL);
+    sigaction(SIGTRAP, &watch_old_trap, NULL);
+
+    // Back to the state's own memory
+    memcpy(watches->home, mirror, (size_t) state->memory_size);
+    state->memory = watches->home;
+    munmap(mirror, mapped);
+    watches->mirror = NULL;
+    watches->home = NULL;
+    watches->state = NULL;
+    return status;
+#else
+    return state_resume(state, budget, probes);
+#endif
+}
+
+void watch_report(WATCHES *watches)
+{
+    // Nothing passed?
+    if (NULL == watches)
+        return;
+
+    const char* kind_names[] = { "", "read", "write", "", "change" };
+    printf("Watchpoints:\n");
+    printf("%d hits, %llu faults on watched pages", watches->hit_count, watches->faults);
+    if (0 != watches->missed)
+        printf(", %llu more hits not kept", watches->missed);
+    printf("\n");
+    for (int i = 0; watches->hit_count > i; i++)
+    {
+        const WATCH_HIT *hit = watches->hits + i;
+        printf("Step %6llu  PC = 0x%04x  %-6s 0x%04x: 0x%08x      0x%08x\n", hit->step, hit->pc, kind_names[hit->kind],
+               hit->address, hit->old_value, hit->new_value);
+    }
+}
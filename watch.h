@@ -0,0 +1,85 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stddef.h>
+
+#include "state.h"
+
+// Data watchpoints on guest memory, checked by the host MMU rather than by
+// the executor.  For a watched run the guest memory is moved onto pages of
+// its own, and the pages holding a watched range are protected: no access
+// for read watches, read only otherwise.  An access to such a page faults,
+// the handler opens the watched pages and single steps the host instruction,
+// and the trap after it compares the watched bytes, reports any hit and
+// protects the pages again.  Unwatched pages and runs without watchpoints
+// run exactly as before.
+//
+// Needs Linux on x86-64 for the trap flag.  One watched run at a time per
+// process, on the reference executor, and not for harts on threads.  A host
+// fault gives the first byte an access touches, so reads and writes of the
+// same value are seen when they start inside the range; watch whole words.
+
+//// Defines
+
+#define WATCH_READ 1
+#define WATCH_WRITE 2
+#define WATCH_CHANGE 4
+
+#define WATCH_MAX 16
+#define WATCH_MAX_SIZE 64
+#define WATCH_DEF_HITS 1024
+
+//// Type declarations
+
+typedef struct _WATCH
+{
+    unsigned int address;
+    unsigned int size; // Bytes, at most WATCH_MAX_SIZE
+    int kinds; // WATCH_READ, WATCH_WRITE and WATCH_CHANGE
+    unsigned char shadow[WATCH_MAX_SIZE]; // The bytes as last seen
+} WATCH;
+
+typedef struct _WATCH_HIT
+{
+    int watch;
+    int kind; // One of WATCH_READ, WATCH_WRITE and WATCH_CHANGE
+    unsigned long long step; // Of the instruction, counting from 1
+    int pc;
+    unsigned int address; // Word reported, in the range
+    unsigned int old_value;
+    unsigned int new_value;
+} WATCH_HIT;
+
+typedef struct _WATCHES
+{
+    WATCH watches[WATCH_MAX];
+    int count;
+
+    WATCH_HIT *hits;
+    int hit_capacity;
+    int hit_count;
+    unsigned long long missed; // Hits past the capacity
+    unsigned long long faults; // Host accesses to watched pages
+
+    // While a watched run is on
+    STATE *state;
+    unsigned char *home; // The state's own memory
+    unsigned char *mirror; // Page aligned copy the run uses
+    size_t mapped;
+    size_t page;
+    unsigned char *fault; // Host address of the access being stepped
+    BOOL fault_write;
+    BOOL pending;
+} WATCHES;
+
+//// Forward declarations
+
+BOOL watch_init(WATCHES *watches, int hit_capacity);
+void watch_free(WATCHES *watches);
+BOOL watch_add(WATCHES *watches, unsigned int address, unsigned int size, int kinds);
+BOOL watch_parse(WATCHES *watches, const char* spec);
+BOOL watch_supported(void);
+PROGRAM_STATUS watch_resume(WATCHES *watches, STATE *state, const BUDGET *budget, PROBES *probes);
+void watch_report(WATCHES *watches);
+
+#endif
@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/uio.h>
+
+#include "wire.h"
+
+//// Definitions
+
+// FNV-1a, 64 bits
+unsigned long long wire_hash(const unsigned char *data, size_t size)
+{
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; size > i; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+unsigned char* wire_put_varint(unsigned char *out, unsigned long long value)
+{
+    while (0x80 <= value)
+    {
+        *out++ = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (unsigned char) value;
+    return out;
+}
+
+const unsigned char* wire_get_varint(const unsigned char *in, const unsigned char *end, unsigned long long *value)
+{
+    *value = 0;
+    for (int shift = 0; 64 > shift; shift += 7)
+    {
+        // Ran out?
+        if (end <= in)
+            return NULL;
+
+        unsigned char byte = *in++;
+        *value |= (unsigned long long) (byte & 0x7F) << shift;
+        if (0 == (byte & 0x80))
+            return in;
+    }
+    return NULL;
+}
+
+void wire_put_long(unsigned char *out, unsigned long long value)
+{
+    an_int_bytes((unsigned int) value, out);
+    an_int_bytes((unsigned int) (value >> 32), out + 4);
+}
+
+unsigned long long wire_get_long(const unsigned char *in)
+{
+    unsigned int low = 0;
+    unsigned int high = 0;
+    an_bytes_int(in, &low);
+    an_bytes_int(in + 4, &high);
+    return ((unsigned long long) high << 32) | low;
+}
+
+static BOOL wire_read_all(int fd, unsigned char *data, size_t size)
+{
+    while (0 < size)
+    {
+        ssize_t got = read(fd, data, size);
+        if ((0 > got) && (EINTR == errno))
+            continue;
+        if (0 >= got)
+            return 0;
+        data += got;
+        size -= got;
+    }
+    return 1;
+}
+
+BOOL wire_send(int fd, unsigned char type, const unsigned char *data, size_t size)
+{
+    // Too big?
+    if (WIRE_FRAME_MAX < size)
+        return 0;
+
+    unsigned char header[WIRE_HEADER_SIZE];
+    an_int_bytes((unsigned int) size, header);
+    header[4] = type;
+
+    // Header and payload in one call
+    struct iovec parts[2] = { { header, WIRE_HEADER_SIZE }, { (void*) data, size } };
+    int count = (0 == size) ? 1 : 2;
+    size_t left = WIRE_HEADER_SIZE + size;
+    while (0 < left)
+    {
+        ssize_t sent = writev(fd, parts, count);
+        if ((0 > sent) && (EINTR == errno))
+            continue;
+
+        // Non-blocking socket full, wait until the peer reads
+        if ((0 > sent) && ((EAGAIN == errno) || (EWOULDBLOCK == errno)))
+        {
+            struct pollfd out = { fd, POLLOUT, 0 };
+            if ((0 > poll(&out, 1, -1)) && (EINTR != errno))
+                return 0;
+            continue;
+        }
+        if (0 >= sent)
+            return 0;
+        left -= sent;
+
+        // Skip what went out
+        for (int i = 0; (count > i) && (0 < sent); i++)
+        {
+            size_t part = ((size_t) sent < parts[i].iov_len) ? (size_t) sent : parts[i].iov_len;
+            parts[i].iov_base = (unsigned char*) parts[i].iov_base + part;
+            parts[i].iov_len -= part;
+            sent -= part;
+        }
+    }
+    return 1;
+}
+
+// Reads one whole frame, growing the buffer as needed
+BOOL wire_recv(int fd, unsigned char *type, unsigned char **data, size_t *size, size_t *capacity)
+{
+    unsigned char header[WIRE_HEADER_SIZE];
+    if (0 == wire_read_all(fd, header, WIRE_HEADER_SIZE))
+        return 0;
+
+    unsigned int length = 0;
+    an_bytes_int(header, &length);
+    if (WIRE_FRAME_MAX < length)
+        return 0;
+
+    if (*capacity < length)
+    {
+        unsigned char *grown = realloc(*data, length);
+        if (NULL == grown)
+            return 0;
+        *data = grown;
+        *capacity = length;
+    }
+
+    *type = header[4];
+    *size = length;
+    return wire_read_all(fd, *data, length);
+}
+
+// Reads what has arrived of one frame, header included, without waiting for
+// the rest.  Stops at the end of the frame, so the next one stays queued
+int wire_recv_some(int fd, unsigned char **data, size_t *have, size_t *capacity)
+{
+    while (1)
+    {
+        // Header first, then the payload it announces
+        size_t want = WIRE_HEADER_SIZE;
+        if (WIRE_HEADER_SIZE <= *have)
+        {
+            unsigned int length = 0;
+            an_bytes_int(*data, &length);
+            if (WIRE_FRAME_MAX < length)
+                return WIRE_CLOSED;
+            want += length;
+        }
+        if (want == *have)
+            return WIRE_WHOLE;
+
+        if (*capacity < want)
+        {
+            size_t size = (WIRE_HEADER_SIZE == want) ? 4096 : want;
+            unsigned char *grown = realloc(*data, size);
+            if (NULL == grown)
+                return WIRE_CLOSED;
+            *data = grown;
+            *capacity = size;
+        }
+
+        ssize_t got = read(fd, *data + *have, want - *have);
+        if ((0 > got) && (EINTR == errno))
+            continue;
+        if ((0 > got) && ((EAGAIN == errno) || (EWOULDBLOCK == errno)))
+            return WIRE_PARTIAL;
+        if (0 >= got)
+            return WIRE_CLOSED;
+        *have += got;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stddef.h>
+
+#include "state.h"
+
+//// Defines
+
+// Frames on the server socket, both ways: payload size (4 bytes), type byte,
+// payload.  Integers are little endian, varints are 7 bits per byte.
+//   WIRE_PUT  request  hash (8), image bytes
+//             reply    1 if the image was cached
+//   WIRE_RUN  request  count, then count of: hash (8), step budget
+//             reply    count, then count of results
+// A result is the status byte, steps, PC, condition codes byte, a varint mask
+// of the registers that are not zero and their values, then the count of
+// memory words that differ from the image and, for each, the word index delta
+// from the previous one and its value.  A Y86-64 run has 15 registers of 64
+// bits, memory words are 4 bytes either way.  Status WIRE_UNKNOWN means the hash is not
+// cached, PUT the image and run again.
+#define WIRE_PUT 1
+#define WIRE_RUN 2
+#define WIRE_HEADER_SIZE 5
+#define WIRE_FRAME_MAX (16 << 20)
+#define WIRE_UNKNOWN 0
+
+// What wire_recv_some got
+#define WIRE_CLOSED -1
+#define WIRE_PARTIAL 0
+#define WIRE_WHOLE 1
+
+// Longest result: status, steps, PC, codes, mask, registers, word count
+#define WIRE_RESULT_MAX (1 + 10 + 5 + 1 + 3 + REGISTER64_COUNT * 10 + 5)
+
+//// Forward declarations
+
+unsigned long long wire_hash(const unsigned char *data, size_t size);
+unsigned char* wire_put_varint(unsigned char *out, unsigned long long value);
+const unsigned char* wire_get_varint(const unsigned char *in, const unsigned char *end, unsigned long long *value);
+void wire_put_long(unsigned char *out, unsigned long long value);
+unsigned long long wire_get_long(const unsigned char *in);
+BOOL wire_send(int fd, unsigned char type, const unsigned char *data, size_t size);
+BOOL wire_recv(int fd, unsigned char *type, unsigned char **data, size_t *size, size_t *capacity);
+int wire_recv_some(int fd, unsigned char **data, size_t *have, size_t *capacity);
+
+#endif